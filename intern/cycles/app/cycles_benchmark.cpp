@@ -0,0 +1,442 @@
+/*
+ * Copyright 2011-2015 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Benchmark
+ *
+ * Renders XML scenes with every requested CPU kernel variant, and reports the
+ * time spent loading the scene, synchronizing it to the device, building
+ * BVHs and path tracing. Scenes are rendered with a fixed seed and sample
+ * count so results of different builds can be compared.
+ *
+ * When several integrators are given, each scene is also compared against
+ * the image of the first integrator, to check they converge to the same
+ * result. */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "buffers.h"
+#include "camera.h"
+#include "device.h"
+#include "integrator.h"
+#include "mesh.h"
+#include "scene.h"
+#include "session.h"
+
+#include "util_args.h"
+#include "util_foreach.h"
+#include "util_function.h"
+#include "util_optimization.h"
+#include "util_path.h"
+#include "util_string.h"
+#include "util_system.h"
+#include "util_time.h"
+
+#include "cycles_xml.h"
+
+CCL_NAMESPACE_BEGIN
+
+struct BenchmarkResult {
+	string scene;
+	string kernel;
+	string integrator;
+	int width, height;
+	int samples;
+
+	double load_time;
+	double sync_time;
+	double bvh_time;
+	double render_time;
+	double samples_per_second;
+	size_t mem_peak;
+
+	/* difference against the first integrator, negative if not compared */
+	double rms_difference;
+	double max_difference;
+};
+
+struct Options {
+	vector<string> filepaths;
+	vector<string> kernels;
+	vector<string> integrators;
+	string output_path;
+	int seed;
+	bool quiet;
+	SceneParams scene_params;
+	SessionParams session_params;
+} options;
+
+static int files_parse(int argc, const char *argv[])
+{
+	for(int i = 0; i < argc; i++)
+		options.filepaths.push_back(argv[i]);
+
+	return 0;
+}
+
+static bool benchmark_kernel_compiled(const string& kernel)
+{
+	if(kernel == "none")
+		return true;
+#ifdef WITH_CYCLES_OPTIMIZED_KERNEL_SSE2
+	if(kernel == "sse2")
+		return true;
+#endif
+#ifdef WITH_CYCLES_OPTIMIZED_KERNEL_SSE3
+	if(kernel == "sse3")
+		return true;
+#endif
+#ifdef WITH_CYCLES_OPTIMIZED_KERNEL_SSE41
+	if(kernel == "sse41")
+		return true;
+#endif
+#ifdef WITH_CYCLES_OPTIMIZED_KERNEL_AVX
+	if(kernel == "avx")
+		return true;
+#endif
+#ifdef WITH_CYCLES_OPTIMIZED_KERNEL_AVX2
+	if(kernel == "avx2")
+		return true;
+#endif
+	return false;
+}
+
+static bool benchmark_kernel_supported(const string& kernel)
+{
+	/* the kernel is only used if the CPU supports it, and no better
+	 * variant is used instead, see CPUDevice::thread_path_trace */
+	system_cpu_limit_instruction_set("");
+
+	if(kernel == "none")
+		return true;
+	else if(kernel == "sse2")
+		return system_cpu_support_sse2();
+	else if(kernel == "sse3")
+		return system_cpu_support_sse3();
+	else if(kernel == "sse41")
+		return system_cpu_support_sse41();
+	else if(kernel == "avx")
+		return system_cpu_support_avx();
+	else if(kernel == "avx2")
+		return system_cpu_support_avx2();
+
+	return false;
+}
+
+static void benchmark_write_render_tile(RenderTile& rtile, vector<float> *pixels, int width)
+{
+	RenderBuffers *buffers = rtile.buffers;
+	vector<float> tile_pixels(rtile.w*rtile.h*4);
+
+	if(!buffers->copy_from_device())
+		return;
+	if(!buffers->get_pass_rect(PASS_COMBINED, 1.0f, rtile.sample, 4, &tile_pixels[0]))
+		return;
+
+	for(int y = 0; y < rtile.h; y++)
+		memcpy(&(*pixels)[((rtile.y + y)*width + rtile.x)*4], &tile_pixels[y*rtile.w*4], sizeof(float)*rtile.w*4);
+}
+
+static void benchmark_compare(const vector<float>& a, const vector<float>& b, BenchmarkResult& result)
+{
+	double sum = 0.0, max = 0.0;
+
+	for(size_t i = 0; i < a.size(); i++) {
+		if(i % 4 == 3)
+			continue;
+
+		double diff = (double)fabsf(a[i] - b[i]);
+		sum += diff*diff;
+		max = (diff > max)? diff: max;
+	}
+
+	result.rms_difference = sqrt(sum/(a.size()/4*3));
+	result.max_difference = max;
+}
+
+static bool benchmark_run(const string& filepath, const string& kernel, const string& integrator,
+                          BenchmarkResult& result, vector<float> *pixels)
+{
+	system_cpu_limit_instruction_set(kernel);
+
+	options.session_params.wavefront = (integrator == "wavefront");
+
+	Session *session = new Session(options.session_params);
+	Scene *scene = new Scene(options.scene_params, options.session_params.device);
+	session->scene = scene;
+
+	/* read scene */
+	double time_start = time_dt();
+
+	xml_read_file(scene, filepath.c_str());
+
+	scene->integrator->seed = options.seed;
+	scene->integrator->tag_update(scene);
+	scene->camera->compute_auto_viewplane();
+
+	result.load_time = time_dt() - time_start;
+
+	result.scene = path_filename(filepath);
+	result.kernel = kernel;
+	result.integrator = integrator;
+	result.width = scene->camera->width;
+	result.height = scene->camera->height;
+	result.samples = options.session_params.samples;
+	result.rms_difference = -1.0;
+	result.max_difference = -1.0;
+
+	if(pixels) {
+		/* tiles are copied out as they finish, for comparing integrators */
+		pixels->clear();
+		pixels->resize(result.width*result.height*4, 0.0f);
+		session->write_render_tile_cb = function_bind(&benchmark_write_render_tile, _1, pixels, result.width);
+	}
+
+	BufferParams buffer_params;
+	buffer_params.width = result.width;
+	buffer_params.height = result.height;
+	buffer_params.full_width = result.width;
+	buffer_params.full_height = result.height;
+
+	session->reset(buffer_params, options.session_params.samples);
+	session->load_kernels();
+
+	/* synchronize scene to the device here rather than in the session
+	 * thread, so it is not counted as render time */
+	time_start = time_dt();
+
+	{
+		thread_scoped_lock scene_lock(scene->mutex);
+		scene->device_update(session->device, session->progress);
+	}
+
+	result.sync_time = time_dt() - time_start;
+	result.bvh_time = scene->mesh_manager->bvh_time;
+
+	/* render */
+	time_start = time_dt();
+
+	session->start();
+	session->wait();
+
+	result.render_time = time_dt() - time_start;
+	result.samples_per_second = (result.render_time > 0.0)?
+		((double)result.width*result.height*result.samples)/result.render_time: 0.0;
+	result.mem_peak = session->stats.mem_peak;
+
+	bool success = !session->progress.get_cancel();
+
+	if(!success) {
+		fprintf(stderr, "%s with %s kernel and %s integrator failed: %s\n", result.scene.c_str(),
+		        kernel.c_str(), integrator.c_str(), session->progress.get_cancel_message().c_str());
+	}
+
+	/* also frees the scene */
+	delete session;
+
+	system_cpu_limit_instruction_set("");
+
+	return success;
+}
+
+static string benchmark_json_string(const string& str)
+{
+	string result = "\"";
+
+	for(size_t i = 0; i < str.size(); i++) {
+		unsigned char c = str[i];
+
+		if(c == '"' || c == '\\')
+			result += string("\\") + (char)c;
+		else if(c < 0x20)
+			result += string_printf("\\u%04x", c);
+		else
+			result += (char)c;
+	}
+
+	return result + "\"";
+}
+
+static void benchmark_write_json(FILE *f, const vector<BenchmarkResult>& results)
+{
+	fprintf(f, "{\n");
+	fprintf(f, "  \"cpu\": %s,\n", benchmark_json_string(system_cpu_brand_string()).c_str());
+	fprintf(f, "  \"threads\": %d,\n", (options.session_params.threads)?
+		options.session_params.threads: system_cpu_thread_count());
+	fprintf(f, "  \"samples\": %d,\n", options.session_params.samples);
+	fprintf(f, "  \"seed\": %d,\n", options.seed);
+	fprintf(f, "  \"results\": [");
+
+	for(size_t i = 0; i < results.size(); i++) {
+		const BenchmarkResult& r = results[i];
+
+		fprintf(f, "%s\n    {", (i == 0)? "": ",");
+		fprintf(f, "\"scene\": %s, ", benchmark_json_string(r.scene).c_str());
+		fprintf(f, "\"kernel\": %s, ", benchmark_json_string(r.kernel).c_str());
+		fprintf(f, "\"integrator\": %s, ", benchmark_json_string(r.integrator).c_str());
+		fprintf(f, "\"width\": %d, \"height\": %d, ", r.width, r.height);
+		fprintf(f, "\"load_time\": %f, ", r.load_time);
+		fprintf(f, "\"sync_time\": %f, ", r.sync_time);
+		fprintf(f, "\"bvh_time\": %f, ", r.bvh_time);
+		fprintf(f, "\"render_time\": %f, ", r.render_time);
+		fprintf(f, "\"samples_per_second\": %f, ", r.samples_per_second);
+		if(r.rms_difference >= 0.0) {
+			fprintf(f, "\"rms_difference\": %g, ", r.rms_difference);
+			fprintf(f, "\"max_difference\": %g, ", r.max_difference);
+		}
+		fprintf(f, "\"mem_peak\": %llu}", (unsigned long long)r.mem_peak);
+	}
+
+	fprintf(f, "%s]\n}\n", (results.size())? "\n  ": "");
+}
+
+static void options_parse(int argc, const char **argv)
+{
+	options.seed = 0;
+	options.quiet = false;
+	options.session_params.samples = 16;
+
+	string kernels = "sse2,sse41,avx,avx2";
+	string integrators = "megakernel";
+
+	ArgParse ap;
+	bool help = false;
+
+	ap.options ("Usage: cycles_benchmark [options] file.xml ...",
+		"%*", files_parse, "",
+		"--kernels %s", &kernels, "Comma separated CPU kernels to benchmark: none, sse2, sse3, sse41, avx, avx2",
+		"--integrators %s", &integrators, "Comma separated integrators to benchmark: megakernel, wavefront (default megakernel)",
+		"--samples %d", &options.session_params.samples, "Number of samples to render (default 16)",
+		"--seed %d", &options.seed, "Integrator seed, the same for all scenes (default 0)",
+		"--threads %d", &options.session_params.threads, "CPU Rendering Threads",
+		"--output %s", &options.output_path, "File path to write results as JSON, instead of standard output",
+		"--quiet", &options.quiet, "Don't print a summary of each render",
+		"--help", &help, "Print help message",
+		NULL);
+
+	if(ap.parse(argc, argv) < 0) {
+		fprintf(stderr, "%s\n", ap.geterror().c_str());
+		ap.usage();
+		exit(EXIT_FAILURE);
+	}
+	else if(help || options.filepaths.empty()) {
+		ap.usage();
+		exit(EXIT_SUCCESS);
+	}
+
+	string_split(options.kernels, kernels, ",");
+	string_split(options.integrators, integrators, ",");
+
+	foreach(const string& integrator, options.integrators) {
+		if(integrator != "megakernel" && integrator != "wavefront") {
+			fprintf(stderr, "Unknown integrator: %s\n", integrator.c_str());
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(options.session_params.samples <= 0) {
+		fprintf(stderr, "Invalid number of samples: %d\n", options.session_params.samples);
+		exit(EXIT_FAILURE);
+	}
+
+	/* CPU device, rendering in the background */
+	vector<DeviceInfo>& devices = Device::available_devices();
+
+	foreach(DeviceInfo& device, devices) {
+		if(device.type == DEVICE_CPU) {
+			options.session_params.device = device;
+			break;
+		}
+	}
+
+	options.session_params.background = true;
+	options.session_params.tile_size = make_int2(32, 32);
+	options.scene_params.shadingsystem = SHADINGSYSTEM_SVM;
+}
+
+CCL_NAMESPACE_END
+
+using namespace ccl;
+
+int main(int argc, const char **argv)
+{
+	path_init();
+	options_parse(argc, argv);
+
+	vector<BenchmarkResult> results;
+	bool success = true;
+
+	foreach(const string& kernel, options.kernels) {
+		if(!benchmark_kernel_compiled(kernel)) {
+			fprintf(stderr, "Skipping %s kernel, not compiled in.\n", kernel.c_str());
+			continue;
+		}
+		else if(!benchmark_kernel_supported(kernel)) {
+			fprintf(stderr, "Skipping %s kernel, not supported by this CPU.\n", kernel.c_str());
+			continue;
+		}
+
+		foreach(const string& filepath, options.filepaths) {
+			bool compare = (options.integrators.size() > 1);
+			vector<float> reference, pixels;
+
+			for(size_t i = 0; i < options.integrators.size(); i++) {
+				const string& integrator = options.integrators[i];
+				BenchmarkResult result;
+
+				if(!benchmark_run(filepath, kernel, integrator, result, (compare)? &pixels: NULL)) {
+					success = false;
+					continue;
+				}
+
+				if(compare) {
+					if(i == 0)
+						reference.swap(pixels);
+					else if(reference.size() == pixels.size())
+						benchmark_compare(reference, pixels, result);
+				}
+
+				if(!options.quiet) {
+					fprintf(stderr, "%-24s %-6s %-10s sync %7.3fs  bvh %7.3fs  render %8.3fs  %12.0f samples/s",
+					        result.scene.c_str(), result.kernel.c_str(), result.integrator.c_str(),
+					        result.sync_time, result.bvh_time, result.render_time, result.samples_per_second);
+					if(result.rms_difference >= 0.0)
+						fprintf(stderr, "  rms diff %.2e  max diff %.2e", result.rms_difference, result.max_difference);
+					fprintf(stderr, "\n");
+				}
+
+				results.push_back(result);
+			}
+		}
+	}
+
+	if(options.output_path != "") {
+		FILE *f = fopen(options.output_path.c_str(), "w");
+
+		if(!f) {
+			fprintf(stderr, "Failed to write results to %s\n", options.output_path.c_str());
+			return EXIT_FAILURE;
+		}
+
+		benchmark_write_json(f, results);
+		fclose(f);
+	}
+	else
+		benchmark_write_json(stdout, results);
+
+	return (success)? EXIT_SUCCESS: EXIT_FAILURE;
+}
+
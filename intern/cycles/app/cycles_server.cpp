@@ -36,6 +36,8 @@ int main(int argc, const char **argv)
 	string devicename = "cpu";
 	bool list = false;
 	int threads = 0;
+	int port = 5120;
+	int cache_size = 2048;
 
 	vector<DeviceType>& types = Device::available_types();
 
@@ -53,6 +55,8 @@ int main(int argc, const char **argv)
 		"--device %s", &devicename, ("Devices to use: " + devicelist).c_str(),
 		"--list-devices", &list, "List information about all available devices",
 		"--threads %d", &threads, "Number of threads to use for CPU device",
+		"--port %d", &port, "Port to listen on, use different ports to run multiple servers on one machine",
+		"--cache-size %d", &cache_size, "Megabytes of scene data to keep in memory for later renders",
 		NULL);
 
 	if(ap.parse(argc, argv) < 0) {
@@ -91,8 +95,8 @@ int main(int argc, const char **argv)
 	while(1) {
 		Stats stats;
 		Device *device = Device::create(device_info, stats, true);
-		printf("Cycles Server with device: %s\n", device->info.description.c_str());
-		device->server_run();
+		printf("Cycles Server with device: %s, port %d\n", device->info.description.c_str(), port);
+		device->server_run(port, (size_t)cache_size*1024*1024);
 		delete device;
 	}
 
@@ -344,6 +344,11 @@ static void options_parse(int argc, const char **argv)
 		"--samples %d", &options.session_params.samples, "Number of samples to render",
 		"--output %s", &options.session_params.output_path, "File path to write output image",
 		"--threads %d", &options.session_params.threads, "CPU Rendering Threads",
+		"--wavefront", &options.session_params.wavefront, "Trace tiles as sorted streams of paths (CPU only)",
+		"--profile", &options.session_params.profile, "Print time spent per event, shader and object after rendering (CPU only)",
+		"--profile-json %s", &options.session_params.profile_path, "File path to write profiling results as JSON",
+		"--texture-cache-size %d", &options.scene_params.texture_cache_size, "Megabytes of image textures to keep in memory, reading the rest from disk on demand (CPU with SVM only)",
+		"--compact-images", &options.scene_params.use_compact_images, "Keep greyscale and half float images in compact storage (CPU only)",
 		"--width  %d", &options.width, "Window width in pixel",
 		"--height %d", &options.height, "Window height in pixel",
 		"--list-devices", &list, "List information about all available devices",
@@ -377,6 +382,10 @@ static void options_parse(int argc, const char **argv)
 	else if(ssname == "svm")
 		options.scene_params.shadingsystem = SHADINGSYSTEM_SVM;
 
+	/* writing profiling results implies profiling */
+	if(options.session_params.profile_path != "")
+		options.session_params.profile = true;
+
 #ifndef WITH_CYCLES_STANDALONE_GUI
 	options.session_params.background = true;
 #endif
@@ -443,6 +452,19 @@ int main(int argc, const char **argv)
 #endif
 		session_init();
 		options.session->wait();
+
+		if(options.session_params.profile)
+			printf("\n%s", options.session->profiling_summary().c_str());
+
+		if(options.session->stats.image_cache_tile_lookups) {
+			Stats& stats = options.session->stats;
+
+			printf("\nImage cache: %llu tiles loaded, %.1f%% hit rate, %.2f MB read\n",
+			       (unsigned long long)stats.image_cache_tiles_loaded,
+			       (double)stats.image_cache_hit_rate() * 100.0,
+			       (double)stats.image_cache_bytes_read / (1024.0 * 1024.0));
+		}
+
 		session_exit();
 #ifdef WITH_CYCLES_STANDALONE_GUI
 	}
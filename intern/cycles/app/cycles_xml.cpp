@@ -307,6 +307,7 @@ static void xml_read_integrator(const XMLReadState& state, pugi::xml_node node)
 	xml_read_bool(&integrator->caustics_reflective, node, "caustics_reflective");
 	xml_read_bool(&integrator->caustics_refractive, node, "caustics_refractive");
 	xml_read_float(&integrator->filter_glossy, node, "filter_glossy");
+	xml_read_bool(&integrator->use_light_tree, node, "use_light_tree");
 	
 	xml_read_int(&integrator->seed, node, "seed");
 	xml_read_float(&integrator->sample_clamp_direct, node, "sample_clamp_direct");
@@ -822,7 +823,7 @@ static void xml_read_background(const XMLReadState& state, pugi::xml_node node)
 
 /* Mesh */
 
-static Mesh *xml_add_mesh(Scene *scene, const Transform& tfm)
+static Mesh *xml_add_mesh(Scene *scene, const Transform& tfm, pugi::xml_node node)
 {
 	/* create mesh */
 	Mesh *mesh = new Mesh();
@@ -832,6 +833,7 @@ static Mesh *xml_add_mesh(Scene *scene, const Transform& tfm)
 	Object *object = new Object();
 	object->mesh = mesh;
 	object->tfm = tfm;
+	xml_read_ustring(&object->name, node, "name");
 	scene->objects.push_back(object);
 
 	return mesh;
@@ -840,7 +842,7 @@ static Mesh *xml_add_mesh(Scene *scene, const Transform& tfm)
 static void xml_read_mesh(const XMLReadState& state, pugi::xml_node node)
 {
 	/* add mesh */
-	Mesh *mesh = xml_add_mesh(state.scene, state.tfm);
+	Mesh *mesh = xml_add_mesh(state.scene, state.tfm, node);
 	mesh->used_shaders.push_back(state.shader);
 
 	/* read state */
@@ -971,7 +973,7 @@ static void xml_read_patch(const XMLReadState& state, pugi::xml_node node)
 
 	if(patch) {
 		/* add mesh */
-		Mesh *mesh = xml_add_mesh(state.scene, transform_identity());
+		Mesh *mesh = xml_add_mesh(state.scene, transform_identity(), node);
 
 		mesh->used_shaders.push_back(state.shader);
 
@@ -989,6 +991,76 @@ static void xml_read_patch(const XMLReadState& state, pugi::xml_node node)
 	}
 }
 
+/* Curves */
+
+static void xml_read_curves(const XMLReadState& state, pugi::xml_node node)
+{
+	/* add mesh */
+	Mesh *mesh = xml_add_mesh(state.scene, state.tfm, node);
+	mesh->used_shaders.push_back(state.shader);
+
+	/* read keys and curves, radius is either per key or one for all keys */
+	vector<float3> P;
+	vector<float> radius;
+	vector<int> nkeys;
+
+	xml_read_float3_array(P, node, "P");
+	xml_read_float_array(radius, node, "radius");
+	xml_read_int_array(nkeys, node, "nkeys");
+
+	if(radius.size() != 1 && radius.size() != P.size()) {
+		fprintf(stderr, "Curves need one radius, or one radius per key.\n");
+		return;
+	}
+
+	for(size_t i = 0; i < P.size(); i++)
+		mesh->add_curve_key(P[i], (radius.size() == 1)? radius[0]: radius[i]);
+
+	int key_offset = 0;
+
+	for(size_t i = 0; i < nkeys.size(); i++) {
+		if(key_offset + nkeys[i] > (int)P.size()) {
+			fprintf(stderr, "Curves use more keys than given.\n");
+			break;
+		}
+
+		mesh->add_curve(key_offset, nkeys[i], state.shader);
+		key_offset += nkeys[i];
+	}
+}
+
+/* Instance */
+
+static void xml_read_instance(const XMLReadState& state, pugi::xml_node node)
+{
+	/* instance the mesh of a previously read named mesh, curves or patch */
+	ustring name;
+
+	if(!xml_read_ustring(&name, node, "object")) {
+		fprintf(stderr, "Instance without object name.\n");
+		return;
+	}
+
+	Mesh *mesh = NULL;
+
+	foreach(Object *ob, state.scene->objects) {
+		if(ob->name == name) {
+			mesh = ob->mesh;
+			break;
+		}
+	}
+
+	if(!mesh) {
+		fprintf(stderr, "Unknown object \"%s\".\n", name.c_str());
+		return;
+	}
+
+	Object *object = new Object();
+	object->mesh = mesh;
+	object->tfm = state.tfm;
+	state.scene->objects.push_back(object);
+}
+
 /* Light */
 
 static void xml_read_light(const XMLReadState& state, pugi::xml_node node)
@@ -1120,6 +1192,12 @@ static void xml_read_scene(const XMLReadState& state, pugi::xml_node scene_node)
 		else if(string_iequals(node.name(), "patch")) {
 			xml_read_patch(state, node);
 		}
+		else if(string_iequals(node.name(), "curves")) {
+			xml_read_curves(state, node);
+		}
+		else if(string_iequals(node.name(), "instance")) {
+			xml_read_instance(state, node);
+		}
 		else if(string_iequals(node.name(), "light")) {
 			xml_read_light(state, node);
 		}
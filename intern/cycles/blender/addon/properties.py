@@ -245,6 +245,33 @@ class CyclesRenderSettings(bpy.types.PropertyGroup):
                 default='SOBOL',
                 )
 
+        cls.use_light_tree = BoolProperty(
+                name="Light Tree",
+                description="Pick lamps proportional to their estimated contribution at each shading point, "
+                            "instead of uniformly (faster convergence in scenes with many lamps)",
+                default=False,
+                )
+
+        cls.use_adaptive_sampling = BoolProperty(
+                name="Adaptive Sampling",
+                description="Stop sampling pixels once their noise level is below the threshold (final render only)",
+                default=False,
+                )
+        cls.adaptive_threshold = FloatProperty(
+                name="Adaptive Threshold",
+                description="Standard error of the mean pixel luminance relative to that mean, below which "
+                            "a pixel is considered converged",
+                min=0.0, max=1.0,
+                default=0.01,
+                precision=4,
+                )
+        cls.adaptive_min_samples = IntProperty(
+                name="Adaptive Min Samples",
+                description="Minimum number of samples to render before a pixel can be considered converged",
+                min=1, max=10000,
+                default=16,
+                )
+
         cls.use_layer_samples = EnumProperty(
                 name="Layer Samples",
                 description="How to use per render layer sample settings",
@@ -456,11 +483,51 @@ class CyclesRenderSettings(bpy.types.PropertyGroup):
                 description="Use BVH spatial splits: longer builder time, faster render",
                 default=False,
                 )
+        cls.debug_use_bvh_refit = BoolProperty(
+                name="Refit BVH",
+                description="Refit the BVH of meshes that only deformed since the previous update "
+                            "instead of rebuilding it, for animations with Persistent Images",
+                default=False,
+                )
+        cls.debug_bvh_refit_threshold = FloatProperty(
+                name="Refit Threshold",
+                description="Rebuild a refit BVH once its cost grew this many times compared to a new build "
+                            "(0 never rebuilds)",
+                min=0.0, max=100.0,
+                default=1.5,
+                )
+        cls.debug_use_wavefront = BoolProperty(
+                name="Wavefront",
+                description="Trace the paths of a tile in streams sorted by ray direction and shader on the CPU, "
+                            "instead of one path at a time",
+                default=False,
+                )
+        cls.debug_use_profiler = BoolProperty(
+                name="Profiler",
+                description="Sample where CPU render time is spent per event, shader and object, "
+                            "and write a summary to the log after rendering",
+                default=False,
+                )
         cls.use_cache = BoolProperty(
                 name="Cache BVH",
                 description="Cache last built BVH to disk for faster re-render if no geometry changed",
                 default=False,
                 )
+        cls.debug_use_compact_images = BoolProperty(
+                name="Compact Images",
+                description="Store single channel images with one byte or float channel instead of four, "
+                            "and half float images as four half floats instead of four floats (CPU only)",
+                default=False,
+                )
+        cls.texture_cache_size = IntProperty(
+                name="Texture Cache",
+                description="Read image textures from disk on demand in tiles, keeping at most this "
+                            "many megabytes in memory, always at full resolution without mipmapping "
+                            "(0 loads all images fully, CPU with SVM only)",
+                min=0, max=65536,
+                default=0,
+                subtype='UNSIGNED',
+                )
         cls.tile_order = EnumProperty(
                 name="Tile Order",
                 description="Tile order for rendering",
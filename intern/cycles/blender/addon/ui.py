@@ -128,6 +128,7 @@ class CyclesRender_PT_sampling(CyclesButtonsPanel, Panel):
         sub.prop(cscene, "seed")
         sub.prop(cscene, "sample_clamp_direct")
         sub.prop(cscene, "sample_clamp_indirect")
+        sub.prop(cscene, "use_light_tree")
 
         if cscene.progressive == 'PATH':
             col = split.column()
@@ -157,6 +158,13 @@ class CyclesRender_PT_sampling(CyclesButtonsPanel, Panel):
         if use_cpu(context) or cscene.feature_set == 'EXPERIMENTAL':
             layout.row().prop(cscene, "sampling_pattern", text="Pattern")
 
+        row = layout.row(align=True)
+        row.prop(cscene, "use_adaptive_sampling")
+        sub = row.row(align=True)
+        sub.active = cscene.use_adaptive_sampling
+        sub.prop(cscene, "adaptive_threshold", text="Threshold")
+        sub.prop(cscene, "adaptive_min_samples", text="Min Samples")
+
         for rl in scene.render.layers:
             if rl.samples > 0:
                 layout.separator()
@@ -298,6 +306,7 @@ class CyclesRender_PT_performance(CyclesButtonsPanel, Panel):
         sub.prop(rd, "tile_y", text="Y")
 
         sub.prop(cscene, "use_progressive_refine")
+        sub.prop(cscene, "debug_use_profiler")
 
         subsub = sub.column(align=True)
         subsub.enabled = not rd.use_border
@@ -315,11 +324,16 @@ class CyclesRender_PT_performance(CyclesButtonsPanel, Panel):
         col.label(text="Final Render:")
         col.prop(cscene, "use_cache")
         col.prop(rd, "use_persistent_data", text="Persistent Images")
+        col.prop(cscene, "texture_cache_size")
 
         col.separator()
 
         col.label(text="Acceleration structure:")
         col.prop(cscene, "debug_use_spatial_splits")
+        col.prop(cscene, "debug_use_bvh_refit")
+        sub = col.column()
+        sub.active = cscene.debug_use_bvh_refit
+        sub.prop(cscene, "debug_bvh_refit_threshold")
 
 
 class CyclesRender_PT_layer_options(CyclesButtonsPanel, Panel):
@@ -27,6 +27,9 @@
 #include "subd_split.h"
 
 #include "util_foreach.h"
+#include "util_logging.h"
+#include "util_task.h"
+#include "util_time.h"
 
 #include "mikktspace.h"
 
@@ -455,7 +458,7 @@ static void create_mesh(Scene *scene, Mesh *mesh, BL::Mesh b_mesh, const vector<
 	}
 }
 
-static void create_subd_mesh(Scene *scene, Mesh *mesh, BL::Mesh b_mesh, PointerRNA *cmesh, const vector<uint>& used_shaders)
+static void create_subd_mesh(Scene *scene, Mesh *mesh, BL::Mesh b_mesh, float dicing_rate, const vector<uint>& used_shaders)
 {
 	/* create subd mesh */
 	SubdMesh sdmesh;
@@ -488,7 +491,7 @@ static void create_subd_mesh(Scene *scene, Mesh *mesh, BL::Mesh b_mesh, PointerR
 	                 mesh->need_attribute(scene, ATTR_STD_PTEX_UV);
 
 	SubdParams sdparams(mesh, used_shaders[0], true, need_ptex);
-	sdparams.dicing_rate = RNA_float_get(cmesh, "dicing_rate");
+	sdparams.dicing_rate = dicing_rate;
 	//scene->camera->update();
 	//sdparams.camera = scene->camera;
 
@@ -499,6 +502,35 @@ static void create_subd_mesh(Scene *scene, Mesh *mesh, BL::Mesh b_mesh, PointerR
 
 /* Sync */
 
+struct BlenderSync::MeshSyncData {
+	MeshSyncData(Mesh *mesh_, BL::Object b_ob_)
+	: mesh(mesh_), b_ob(b_ob_), b_mesh(PointerRNA_NULL),
+	  use_surfaces(false), use_hair(false), use_subdivision(false), dicing_rate(1.0f),
+	  derived_time(0.0), convert_time(0.0), hair_time(0.0) {}
+
+	Mesh *mesh;
+	BL::Object b_ob;
+	BL::Mesh b_mesh;
+
+	bool use_surfaces;
+	bool use_hair;
+	bool use_subdivision;
+	float dicing_rate;
+
+	/* to detect if the BVH needs to be rebuilt */
+	vector<Mesh::Triangle> oldtriangle;
+	vector<float4> oldcurve_keys;
+
+	double derived_time;
+	double convert_time;
+	double hair_time;
+};
+
+/* queued meshes are converted once either limit is reached, bounding the
+ * memory used by derived meshes during sync */
+#define MESH_SYNC_BATCH_MESHES 256
+#define MESH_SYNC_BATCH_VERTS (1 << 21)
+
 Mesh *BlenderSync::sync_mesh(BL::Object b_ob, bool object_updated, bool hide_tris)
 {
 	/* test if we can instance or if the object is modified */
@@ -558,11 +590,13 @@ Mesh *BlenderSync::sync_mesh(BL::Object b_ob, bool object_updated, bool hide_tri
 	/* create derived mesh */
 	PointerRNA cmesh = RNA_pointer_get(&b_ob_data.ptr, "cycles");
 
-	vector<Mesh::Triangle> oldtriangle = mesh->triangles;
+	MeshSyncData *data = new MeshSyncData(mesh, b_ob);
+
+	data->oldtriangle = mesh->triangles;
 	
 	/* compares curve_keys rather than strands in order to handle quick hair
 	 * adjustments in dynamic BVH - other methods could probably do this better*/
-	vector<float4> oldcurve_keys = mesh->curve_keys;
+	data->oldcurve_keys = mesh->curve_keys;
 
 	mesh->clear();
 	mesh->used_shaders = used_shaders;
@@ -578,24 +612,21 @@ Mesh *BlenderSync::sync_mesh(BL::Object b_ob, bool object_updated, bool hide_tri
 		if(preview && b_ob.type() != BL::Object::type_MESH)
 			b_ob.update_from_editmode();
 
-		bool need_undeformed = mesh->need_attribute(scene, ATTR_STD_GENERATED);
-		BL::Mesh b_mesh = object_to_mesh(b_data, b_ob, b_scene, true, !preview, need_undeformed);
+		double time_start = time_dt();
 
-		if(b_mesh) {
-			if(render_layer.use_surfaces && !hide_tris) {
-				if(cmesh.data && experimental && RNA_boolean_get(&cmesh, "use_subdivision"))
-					create_subd_mesh(scene, mesh, b_mesh, &cmesh, used_shaders);
-				else
-					create_mesh(scene, mesh, b_mesh, used_shaders);
+		bool need_undeformed = mesh->need_attribute(scene, ATTR_STD_GENERATED);
+		data->b_mesh = object_to_mesh(b_data, b_ob, b_scene, true, !preview, need_undeformed);
 
-				create_mesh_volume_attributes(scene, b_ob, mesh, b_scene.frame_current());
-			}
+		data->derived_time = time_dt() - time_start;
 
-			if(render_layer.use_hair)
-				sync_curves(mesh, b_mesh, b_ob, false);
+		if(data->b_mesh) {
+			data->use_surfaces = render_layer.use_surfaces && !hide_tris;
+			data->use_hair = render_layer.use_hair;
 
-			/* free derived mesh */
-			b_data.meshes.remove(b_mesh);
+			if(cmesh.data && experimental && RNA_boolean_get(&cmesh, "use_subdivision")) {
+				data->use_subdivision = true;
+				data->dicing_rate = RNA_float_get(&cmesh, "dicing_rate");
+			}
 		}
 		mesh->geometry_synced = true;
 	}
@@ -612,26 +643,137 @@ Mesh *BlenderSync::sync_mesh(BL::Object b_ob, bool object_updated, bool hide_tri
 			mesh->displacement_method = Mesh::DISPLACE_BOTH;
 	}
 
-	/* tag update */
-	bool rebuild = false;
+	/* the geometry is converted later in sync_mesh_finish, but the object
+	 * sync needs to know already that the mesh was updated */
+	mesh->tag_update(scene, false);
 
-	if(oldtriangle.size() != mesh->triangles.size())
-		rebuild = true;
-	else if(oldtriangle.size()) {
-		if(memcmp(&oldtriangle[0], &mesh->triangles[0], sizeof(Mesh::Triangle)*oldtriangle.size()) != 0)
-			rebuild = true;
+	mesh_sync_queue.push_back(data);
+
+	/* convert in batches, so only a bounded number of derived meshes is
+	 * alive at the same time */
+	if(data->b_mesh)
+		mesh_sync_queue_verts += data->b_mesh.vertices.length();
+
+	if(mesh_sync_queue.size() >= MESH_SYNC_BATCH_MESHES || mesh_sync_queue_verts >= MESH_SYNC_BATCH_VERTS)
+		sync_mesh_finish();
+
+	return mesh;
+}
+
+void BlenderSync::sync_mesh_data(MeshSyncData *data)
+{
+	/* runs in a task, must only read from the derived mesh which is not
+	 * shared with anything else, and write to the cycles mesh */
+	double time_start = time_dt();
+
+	if(data->use_surfaces) {
+		if(data->use_subdivision)
+			create_subd_mesh(scene, data->mesh, data->b_mesh, data->dicing_rate, data->mesh->used_shaders);
+		else
+			create_mesh(scene, data->mesh, data->b_mesh, data->mesh->used_shaders);
+	}
+
+	data->convert_time = time_dt() - time_start;
+
+	thread_scoped_lock lock(mesh_sync_done_mutex);
+	mesh_sync_done.push_back(data);
+	mesh_sync_done_cond.notify_one();
+}
+
+void BlenderSync::sync_mesh_finish()
+{
+	if(mesh_sync_queue.empty())
+		return;
+
+	progress.set_sync_status("Synchronizing mesh data");
+
+	double time_start = time_dt();
+
+	/* convert geometry in parallel. creating and freeing derived meshes and
+	 * particle hair modify blender data, so those are done on this thread,
+	 * for each mesh as soon as its conversion is done */
+	TaskPool pool;
+
+	BLI_begin_threaded_malloc();
+
+	foreach(MeshSyncData *data, mesh_sync_queue) {
+		if(data->b_mesh) {
+			pool.push(function_bind(&BlenderSync::sync_mesh_data, this, data));
+		}
+		else {
+			thread_scoped_lock lock(mesh_sync_done_mutex);
+			mesh_sync_done.push_back(data);
+		}
 	}
 
-	if(oldcurve_keys.size() != mesh->curve_keys.size())
-		rebuild = true;
-	else if(oldcurve_keys.size()) {
-		if(memcmp(&oldcurve_keys[0], &mesh->curve_keys[0], sizeof(float4)*oldcurve_keys.size()) != 0)
+	for(size_t i = 0; i < mesh_sync_queue.size(); i++) {
+		MeshSyncData *data;
+
+		{
+			thread_scoped_lock lock(mesh_sync_done_mutex);
+
+			while(mesh_sync_done.empty())
+				mesh_sync_done_cond.wait(lock);
+
+			data = mesh_sync_done.back();
+			mesh_sync_done.pop_back();
+		}
+
+		Mesh *mesh = data->mesh;
+		BL::Mesh b_mesh = data->b_mesh;
+
+		if(b_mesh) {
+			double hair_start = time_dt();
+
+			if(data->use_surfaces)
+				create_mesh_volume_attributes(scene, data->b_ob, mesh, b_scene.frame_current());
+
+			if(data->use_hair)
+				sync_curves(mesh, b_mesh, data->b_ob, false);
+
+			/* free derived mesh */
+			b_data.meshes.remove(b_mesh);
+
+			data->hair_time = time_dt() - hair_start;
+		}
+
+		/* tag update */
+		bool rebuild = false;
+
+		if(data->oldtriangle.size() != mesh->triangles.size())
 			rebuild = true;
+		else if(data->oldtriangle.size()) {
+			if(memcmp(&data->oldtriangle[0], &mesh->triangles[0], sizeof(Mesh::Triangle)*data->oldtriangle.size()) != 0)
+				rebuild = true;
+		}
+
+		if(data->oldcurve_keys.size() != mesh->curve_keys.size())
+			rebuild = true;
+		else if(data->oldcurve_keys.size()) {
+			if(memcmp(&data->oldcurve_keys[0], &mesh->curve_keys[0], sizeof(float4)*data->oldcurve_keys.size()) != 0)
+				rebuild = true;
+		}
+
+		mesh->tag_update(scene, rebuild);
+
+		VLOG(1) << "Synced mesh " << mesh->name.c_str()
+		        << " of object " << data->b_ob.name().c_str()
+		        << ": derived mesh " << data->derived_time
+		        << "s, conversion " << data->convert_time
+		        << "s, volume and hair " << data->hair_time << "s.";
+
+		delete data;
 	}
-	
-	mesh->tag_update(scene, rebuild);
 
-	return mesh;
+	pool.wait_work();
+
+	BLI_end_threaded_malloc();
+
+	VLOG(1) << "Synced " << mesh_sync_queue.size() << " meshes in "
+	        << time_dt() - time_start << "s.";
+
+	mesh_sync_queue.clear();
+	mesh_sync_queue_verts = 0;
 }
 
 void BlenderSync::sync_mesh_motion(BL::Object b_ob, Object *object, float motion_time)
@@ -522,6 +522,9 @@ void BlenderSync::sync_objects(BL::SpaceView3D b_v3d, float motion_time)
 		}
 	}
 
+	/* convert mesh geometry, also when canceled to free derived meshes */
+	sync_mesh_finish();
+
 	progress.set_sync_status("");
 
 	if(!cancel && !motion) {
@@ -435,6 +435,11 @@ void BlenderSession::render()
 		Pass::add(PASS_BVH_TRAVERSAL_STEPS, passes);
 #endif
 
+		/* internal pass used to stop sampling converged pixels */
+		PointerRNA cscene = RNA_pointer_get(&b_scene.ptr, "cycles");
+		if(get_boolean(cscene, "use_adaptive_sampling"))
+			Pass::add(PASS_ADAPTIVE_SAMPLING, passes);
+
 		if(session_params.device.advanced_shading) {
 
 			/* loop over passes */
@@ -851,6 +856,13 @@ void BlenderSession::update_status_progress()
 	
 	timestatus += string_printf("Mem:%.2fM, Peak:%.2fM", (double)mem_used, (double)mem_peak);
 
+	if(session->stats.image_cache_tile_lookups) {
+		timestatus += string_printf(", Tiles:%llu (%.1f%% hits, %.2fM read)",
+		                            (unsigned long long)session->stats.image_cache_tiles_loaded,
+		                            (double)session->stats.image_cache_hit_rate() * 100.0,
+		                            (double)session->stats.image_cache_bytes_read / 1024.0 / 1024.0);
+	}
+
 	if(status.size() > 0)
 		status = " | " + status;
 	if(substatus.size() > 0)
@@ -48,6 +48,7 @@ BlenderSync::BlenderSync(BL::RenderEngine b_engine_, BL::BlendData b_data_, BL::
   mesh_map(&scene_->meshes),
   light_map(&scene_->lights),
   particle_system_map(&scene_->particle_systems),
+  mesh_sync_queue_verts(0),
   world_map(NULL),
   world_recalc(false),
   experimental(false),
@@ -207,6 +208,13 @@ void BlenderSync::sync_integrator()
 	integrator->sample_all_lights_direct = get_boolean(cscene, "sample_all_lights_direct");
 	integrator->sample_all_lights_indirect = get_boolean(cscene, "sample_all_lights_indirect");
 
+	integrator->adaptive_threshold = get_float(cscene, "adaptive_threshold");
+	integrator->adaptive_min_samples = get_int(cscene, "adaptive_min_samples");
+
+	integrator->use_light_tree = get_boolean(cscene, "use_light_tree");
+	if(integrator->use_light_tree != previntegrator.use_light_tree)
+		scene->light_manager->tag_update(scene);
+
 	int diffuse_samples = get_int(cscene, "diffuse_samples");
 	int glossy_samples = get_int(cscene, "glossy_samples");
 	int transmission_samples = get_int(cscene, "transmission_samples");
@@ -372,12 +380,17 @@ SceneParams BlenderSync::get_scene_params(BL::Scene b_scene, bool background)
 
 	params.use_bvh_spatial_split = RNA_boolean_get(&cscene, "debug_use_spatial_splits");
 	params.use_bvh_cache = (background)? RNA_boolean_get(&cscene, "use_cache"): false;
+	params.use_bvh_refit = RNA_boolean_get(&cscene, "debug_use_bvh_refit");
+	params.bvh_refit_threshold = RNA_float_get(&cscene, "debug_bvh_refit_threshold");
 
 	if(background && params.shadingsystem != SHADINGSYSTEM_OSL)
 		params.persistent_data = r.use_persistent_data();
 	else
 		params.persistent_data = false;
 
+	params.texture_cache_size = get_int(cscene, "texture_cache_size");
+	params.use_compact_images = get_boolean(cscene, "debug_use_compact_images");
+
 	return params;
 }
 
@@ -404,10 +417,15 @@ SessionParams BlenderSync::get_session_params(BL::RenderEngine b_engine, BL::Use
 	params.device = devices[0];
 
 	if(RNA_enum_get(&cscene, "device") == 2) {
-		/* find network device */
+		/* find network device, several servers listed explicitly are combined
+		 * into a multi device which is preferred */
 		foreach(DeviceInfo& info, devices)
 			if(info.type == DEVICE_NETWORK)
 				params.device = info;
+
+		foreach(DeviceInfo& info, devices)
+			if(info.type == DEVICE_MULTI && info.id.compare(0, 13, "NETWORK_MULTI") == 0)
+				params.device = info;
 	}
 	else if(RNA_enum_get(&cscene, "device") == 1) {
 		/* find GPU device with given id */
@@ -494,6 +512,8 @@ SessionParams BlenderSync::get_session_params(BL::RenderEngine b_engine, BL::Use
 	params.text_timeout = get_float(cscene, "debug_text_timeout");
 
 	params.progressive_refine = get_boolean(cscene, "use_progressive_refine");
+	params.wavefront = get_boolean(cscene, "debug_use_wavefront");
+	params.profile = get_boolean(cscene, "debug_use_profiler");
 
 	if(background) {
 		if(params.progressive_refine)
@@ -29,6 +29,7 @@
 
 #include "util_map.h"
 #include "util_set.h"
+#include "util_thread.h"
 #include "util_transform.h"
 #include "util_vector.h"
 
@@ -81,6 +82,7 @@ private:
 
 	void sync_nodes(Shader *shader, BL::ShaderNodeTree b_ntree);
 	Mesh *sync_mesh(BL::Object b_ob, bool object_updated, bool hide_tris);
+	void sync_mesh_finish();
 	void sync_curves(Mesh *mesh, BL::Mesh b_mesh, BL::Object b_ob, bool motion, int time_index = 0);
 	Object *sync_object(BL::Object b_parent, int persistent_id[OBJECT_PERSISTENT_ID_SIZE], BL::DupliObject b_dupli_ob,
 	                                 Transform& tfm, uint layer_flag, float motion_time, bool hide_tris);
@@ -89,6 +91,11 @@ private:
 	void sync_mesh_motion(BL::Object b_ob, Object *object, float motion_time);
 	void sync_camera_motion(BL::Object b_ob, float motion_time);
 
+	/* mesh geometry conversion from sync_mesh, done in parallel by
+	 * sync_mesh_finish after all objects were synced */
+	struct MeshSyncData;
+	void sync_mesh_data(MeshSyncData *data);
+
 	/* particles */
 	bool sync_dupli_particle(BL::Object b_ob, BL::DupliObject b_dup, Object *object);
 
@@ -110,6 +117,11 @@ private:
 	id_map<ParticleSystemKey, ParticleSystem> particle_system_map;
 	set<Mesh*> mesh_synced;
 	set<Mesh*> mesh_motion_synced;
+	vector<MeshSyncData*> mesh_sync_queue;
+	size_t mesh_sync_queue_verts;
+	vector<MeshSyncData*> mesh_sync_done;
+	thread_mutex mesh_sync_done_mutex;
+	thread_condition_variable mesh_sync_done_cond;
 	std::set<float> motion_times;
 	void *world_map;
 	bool world_recalc;
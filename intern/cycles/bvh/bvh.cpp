@@ -59,6 +59,10 @@ struct BVHStackEntry
 BVH::BVH(const BVHParams& params_, const vector<Object*>& objects_)
 : params(params_), objects(objects_)
 {
+	build_area_cost = 0.0f;
+	area_cost = 0.0f;
+	top_level_prims = 0;
+	node_area_sum = 0.0f;
 }
 
 BVH *BVH::create(const BVHParams& params, const vector<Object*>& objects)
@@ -217,6 +221,7 @@ void BVH::build(Progress& progress)
 
 	/* pack triangles */
 	progress.set_substatus("Packing BVH triangles and strands");
+	top_level_prims = 0;
 	pack_primitives();
 
 	if(progress.get_cancel()) {
@@ -227,7 +232,12 @@ void BVH::build(Progress& progress)
 	/* pack nodes */
 	progress.set_substatus("Packing BVH nodes");
 	array<int> tmp_prim_object = pack.prim_object;
+	node_area_sum = 0.0f;
 	pack_nodes(tmp_prim_object, root);
+
+	float root_area = root->m_bounds.safe_area();
+	build_area_cost = (root_area > 0.0f)? node_area_sum/root_area: 0.0f;
+	area_cost = build_area_cost;
 	
 	/* free build nodes */
 	root->deleteSubtree();
@@ -250,12 +260,100 @@ void BVH::build(Progress& progress)
 void BVH::refit(Progress& progress)
 {
 	progress.set_substatus("Packing BVH primitives");
-	pack_primitives();
+
+	if(params.top_level) {
+		/* primitives of merged instance BVH's are updated when those are
+		 * refit, and merged again by rebuilding the top level */
+		for(size_t i = 0; i < top_level_prims; i++)
+			pack_primitive(i);
+	}
+	else
+		pack_primitives();
 
 	if(progress.get_cancel()) return;
 
 	progress.set_substatus("Refitting BVH nodes");
-	refit_nodes();
+
+	BoundBox bbox = BoundBox::empty;
+
+	node_area_sum = 0.0f;
+	refit_nodes(bbox);
+
+	float root_area = bbox.safe_area();
+	area_cost = (root_area > 0.0f)? node_area_sum/root_area: 0.0f;
+}
+
+void BVH::refit_primitives(int start, int end, BoundBox& bbox, uint& visibility)
+{
+	if(start < 0) {
+		/* object instance leaf */
+		start = ~start;
+		end = start + 1;
+	}
+
+	for(int prim = start; prim < end; prim++) {
+		int pidx = pack.prim_index[prim];
+		int tob = pack.prim_object[prim];
+		Object *ob = objects[tob];
+
+		if(pidx == -1) {
+			/* object instance */
+			bbox.grow(ob->bounds);
+		}
+		else {
+			/* primitives */
+			const Mesh *mesh = ob->mesh;
+
+			if(pack.prim_type[prim] & PRIMITIVE_ALL_CURVE) {
+				/* curves */
+				int str_offset = (params.top_level)? mesh->curve_offset: 0;
+				const Mesh::Curve& curve = mesh->curves[pidx - str_offset];
+				int k = PRIMITIVE_UNPACK_SEGMENT(pack.prim_type[prim]);
+
+				curve.bounds_grow(k, &mesh->curve_keys[0], bbox);
+
+				visibility |= PATH_RAY_CURVE;
+
+				/* motion curves */
+				if(mesh->use_motion_blur) {
+					Attribute *attr = mesh->curve_attributes.find(ATTR_STD_MOTION_VERTEX_POSITION);
+
+					if(attr) {
+						size_t mesh_size = mesh->curve_keys.size();
+						size_t steps = mesh->motion_steps - 1;
+						float4 *key_steps = attr->data_float4();
+
+						for (size_t i = 0; i < steps; i++)
+							curve.bounds_grow(k, key_steps + i*mesh_size, bbox);
+					}
+				}
+			}
+			else {
+				/* triangles */
+				int tri_offset = (params.top_level)? mesh->tri_offset: 0;
+				const Mesh::Triangle& triangle = mesh->triangles[pidx - tri_offset];
+				const float3 *vpos = &mesh->verts[0];
+
+				triangle.bounds_grow(vpos, bbox);
+
+				/* motion triangles */
+				if(mesh->use_motion_blur) {
+					Attribute *attr = mesh->attributes.find(ATTR_STD_MOTION_VERTEX_POSITION);
+
+					if(attr) {
+						size_t mesh_size = mesh->verts.size();
+						size_t steps = mesh->motion_steps - 1;
+						float3 *vert_steps = attr->data_float3();
+
+						for (size_t i = 0; i < steps; i++)
+							triangle.bounds_grow(vert_steps + i*mesh_size, bbox);
+					}
+				}
+			}
+		}
+
+		visibility |= ob->visibility;
+	}
 }
 
 /* Triangles */
@@ -269,6 +367,10 @@ void BVH::pack_triangle(int idx, float4 woop[3])
 		return;
 
 	int tidx = pack.prim_index[idx];
+
+	if(top_level_prims)
+		tidx -= mesh->tri_offset;
+
 	const int *vidx = mesh->triangles[tidx].v;
 	const float3* vpos = &mesh->verts[0];
 	float3 v0 = vpos[vidx[0]];
@@ -307,6 +409,10 @@ void BVH::pack_curve_segment(int idx, float4 woop[3])
 	int tob = pack.prim_object[idx];
 	const Mesh *mesh = objects[tob]->mesh;
 	int tidx = pack.prim_index[idx];
+
+	if(top_level_prims)
+		tidx -= mesh->curve_offset;
+
 	int segment = PRIMITIVE_UNPACK_SEGMENT(pack.prim_type[idx]);
 	int k0 = mesh->curves[tidx].first_key + segment;
 	int k1 = mesh->curves[tidx].first_key + segment + 1;
@@ -347,28 +453,34 @@ void BVH::pack_primitives()
 	pack.prim_visibility.clear();
 	pack.prim_visibility.resize(tidx_size);
 
-	for(unsigned int i = 0; i < tidx_size; i++) {
-		if(pack.prim_index[i] != -1) {
-			float4 woop[3];
+	for(unsigned int i = 0; i < tidx_size; i++)
+		pack_primitive(i);
+}
 
-			if(pack.prim_type[i] & PRIMITIVE_ALL_CURVE)
-				pack_curve_segment(i, woop);
-			else
-				pack_triangle(i, woop);
-			
-			memcpy(&pack.tri_woop[i * nsize], woop, sizeof(float4)*3);
+void BVH::pack_primitive(int idx)
+{
+	int nsize = TRI_NODE_SIZE;
 
-			int tob = pack.prim_object[i];
-			Object *ob = objects[tob];
-			pack.prim_visibility[i] = ob->visibility;
+	if(pack.prim_index[idx] != -1) {
+		float4 woop[3];
 
-			if(pack.prim_type[i] & PRIMITIVE_ALL_CURVE)
-				pack.prim_visibility[i] |= PATH_RAY_CURVE;
-		}
-		else {
-			memset(&pack.tri_woop[i * nsize], 0, sizeof(float4)*3);
-			pack.prim_visibility[i] = 0;
-		}
+		if(pack.prim_type[idx] & PRIMITIVE_ALL_CURVE)
+			pack_curve_segment(idx, woop);
+		else
+			pack_triangle(idx, woop);
+		
+		memcpy(&pack.tri_woop[idx * nsize], woop, sizeof(float4)*3);
+
+		int tob = pack.prim_object[idx];
+		Object *ob = objects[tob];
+		pack.prim_visibility[idx] = ob->visibility;
+
+		if(pack.prim_type[idx] & PRIMITIVE_ALL_CURVE)
+			pack.prim_visibility[idx] |= PATH_RAY_CURVE;
+	}
+	else {
+		memset(&pack.tri_woop[idx * nsize], 0, sizeof(float4)*3);
+		pack.prim_visibility[idx] = 0;
 	}
 }
 
@@ -394,6 +506,7 @@ void BVH::pack_instances(size_t nodes_size)
 
 	/* track offsets of instanced BVH data in global array */
 	size_t prim_offset = pack.prim_index.size();
+	top_level_prims = prim_offset;
 	size_t nodes_offset = nodes_size;
 
 	/* clear array that gives the node indexes for instanced objects */
@@ -578,6 +691,8 @@ void RegularBVH::pack_node(int idx, const BoundBox& b0, const BoundBox& b1, int
 	};
 
 	memcpy(&pack.nodes[idx * BVH_NODE_SIZE], data, sizeof(int4)*BVH_NODE_SIZE);
+
+	node_area_sum += b0.safe_area() + b1.safe_area();
 }
 
 void RegularBVH::pack_nodes(const array<int>& prims, const BVHNode *root)
@@ -625,11 +740,8 @@ void RegularBVH::pack_nodes(const array<int>& prims, const BVHNode *root)
 	pack.root_index = (pack.is_leaf[0])? -1: 0;
 }
 
-void RegularBVH::refit_nodes()
+void RegularBVH::refit_nodes(BoundBox& bbox)
 {
-	assert(!params.top_level);
-
-	BoundBox bbox = BoundBox::empty;
 	uint visibility = 0;
 	refit_node(0, (pack.is_leaf[0])? true: false, bbox, visibility);
 }
@@ -643,69 +755,7 @@ void RegularBVH::refit_node(int idx, bool leaf, BoundBox& bbox, uint& visibility
 
 	if(leaf) {
 		/* refit leaf node */
-		for(int prim = c0; prim < c1; prim++) {
-			int pidx = pack.prim_index[prim];
-			int tob = pack.prim_object[prim];
-			Object *ob = objects[tob];
-
-			if(pidx == -1) {
-				/* object instance */
-				bbox.grow(ob->bounds);
-			}
-			else {
-				/* primitives */
-				const Mesh *mesh = ob->mesh;
-
-				if(pack.prim_type[prim] & PRIMITIVE_ALL_CURVE) {
-					/* curves */
-					int str_offset = (params.top_level)? mesh->curve_offset: 0;
-					const Mesh::Curve& curve = mesh->curves[pidx - str_offset];
-					int k = PRIMITIVE_UNPACK_SEGMENT(pack.prim_type[prim]);
-
-					curve.bounds_grow(k, &mesh->curve_keys[0], bbox);
-
-					visibility |= PATH_RAY_CURVE;
-
-					/* motion curves */
-					if(mesh->use_motion_blur) {
-						Attribute *attr = mesh->curve_attributes.find(ATTR_STD_MOTION_VERTEX_POSITION);
-
-						if(attr) {
-							size_t mesh_size = mesh->curve_keys.size();
-							size_t steps = mesh->motion_steps - 1;
-							float4 *key_steps = attr->data_float4();
-
-							for (size_t i = 0; i < steps; i++)
-								curve.bounds_grow(k, key_steps + i*mesh_size, bbox);
-						}
-					}
-				}
-				else {
-					/* triangles */
-					int tri_offset = (params.top_level)? mesh->tri_offset: 0;
-					const Mesh::Triangle& triangle = mesh->triangles[pidx - tri_offset];
-					const float3 *vpos = &mesh->verts[0];
-
-					triangle.bounds_grow(vpos, bbox);
-
-					/* motion triangles */
-					if(mesh->use_motion_blur) {
-						Attribute *attr = mesh->attributes.find(ATTR_STD_MOTION_VERTEX_POSITION);
-
-						if(attr) {
-							size_t mesh_size = mesh->verts.size();
-							size_t steps = mesh->motion_steps - 1;
-							float3 *vert_steps = attr->data_float3();
-
-							for (size_t i = 0; i < steps; i++)
-								triangle.bounds_grow(vert_steps + i*mesh_size, bbox);
-						}
-					}
-				}
-			}
-
-			visibility |= ob->visibility;
-		}
+		refit_primitives(c0, c1, bbox, visibility);
 
 		pack_node(idx, bbox, bbox, c0, c1, visibility, visibility);
 	}
@@ -772,6 +822,8 @@ void QBVH::pack_inner(const BVHStackEntry& e, const BVHStackEntry *en, int num)
 
 		data[6][i] = __int_as_float(en[i].encodeIdx());
 		data[7][i] = 0.0f;
+
+		node_area_sum += en[i].node->m_bounds.safe_area();
 	}
 
 	for(int i = num; i < 4; i++) {
@@ -863,9 +915,50 @@ void QBVH::pack_nodes(const array<int>& prims, const BVHNode *root)
 	pack.root_index = (pack.is_leaf[0])? -1: 0;
 }
 
-void QBVH::refit_nodes()
+void QBVH::refit_nodes(BoundBox& bbox)
 {
-	assert(0); /* todo */
+	uint visibility = 0;
+	refit_node(0, (pack.is_leaf[0])? true: false, bbox, visibility);
+}
+
+void QBVH::refit_node(int idx, bool leaf, BoundBox& bbox, uint& visibility)
+{
+	float4 *data = (float4*)&pack.nodes[idx*BVH_QNODE_SIZE];
+
+	if(leaf) {
+		/* refit leaf node, its bounds are stored in the parent */
+		int c0 = __float_as_int(data[6].x);
+		int c1 = __float_as_int(data[6].y);
+
+		refit_primitives(c0, c1, bbox, visibility);
+	}
+	else {
+		/* refit inner node, set child bounds. unused child slots have index
+		 * 0, which is the root and never a child */
+		for(int i = 0; i < 4; i++) {
+			int c = __float_as_int(data[6][i]);
+
+			if(c == 0)
+				continue;
+
+			BoundBox cbbox = BoundBox::empty;
+			uint cvisibility = 0;
+
+			refit_node((c < 0)? -c-1: c, (c < 0), cbbox, cvisibility);
+
+			data[0][i] = cbbox.min.x;
+			data[1][i] = cbbox.max.x;
+			data[2][i] = cbbox.min.y;
+			data[3][i] = cbbox.max.y;
+			data[4][i] = cbbox.min.z;
+			data[5][i] = cbbox.max.z;
+
+			node_area_sum += cbbox.safe_area();
+
+			bbox.grow(cbbox);
+			visibility |= cvisibility;
+		}
+	}
 }
 
 CCL_NAMESPACE_END
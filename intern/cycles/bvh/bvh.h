@@ -88,12 +88,20 @@ public:
 	vector<Object*> objects;
 	string cache_filename;
 
+	/* summed surface area of all node bounds relative to the root bounds, as
+	 * built and after the last refit. refitting moves primitives away from the
+	 * layout the tree was built for, which shows as a growing cost */
+	float build_area_cost;
+	float area_cost;
+
 	static BVH *create(const BVHParams& params, const vector<Object*>& objects);
 	virtual ~BVH() {}
 
 	void build(Progress& progress);
 	void refit(Progress& progress);
 
+	float refit_degradation() { return (build_area_cost > 0.0f)? area_cost/build_area_cost: 1.0f; }
+
 	void clear_cache_except();
 
 protected:
@@ -105,15 +113,26 @@ protected:
 
 	/* triangles and strands*/
 	void pack_primitives();
+	void pack_primitive(int idx);
 	void pack_triangle(int idx, float4 woop[3]);
 	void pack_curve_segment(int idx, float4 woop[3]);
 
 	/* merge instance BVH's */
 	void pack_instances(size_t nodes_size);
 
+	/* number of primitives in the top level BVH itself, set once instance
+	 * BVH's are merged in after them. primitive indexes are global from then on */
+	size_t top_level_prims;
+
+	/* summed node area while packing or refitting, for the area costs */
+	float node_area_sum;
+
+	/* refit */
+	void refit_primitives(int start, int end, BoundBox& bbox, uint& visibility);
+
 	/* for subclasses to implement */
 	virtual void pack_nodes(const array<int>& prims, const BVHNode *root) = 0;
-	virtual void refit_nodes() = 0;
+	virtual void refit_nodes(BoundBox& bbox) = 0;
 };
 
 /* Regular BVH
@@ -133,7 +152,7 @@ protected:
 	void pack_node(int idx, const BoundBox& b0, const BoundBox& b1, int c0, int c1, uint visibility0, uint visibility1);
 
 	/* refit */
-	void refit_nodes();
+	void refit_nodes(BoundBox& bbox);
 	void refit_node(int idx, bool leaf, BoundBox& bbox, uint& visibility);
 };
 
@@ -153,7 +172,8 @@ protected:
 	void pack_inner(const BVHStackEntry& e, const BVHStackEntry *en, int num);
 
 	/* refit */
-	void refit_nodes();
+	void refit_nodes(BoundBox& bbox);
+	void refit_node(int idx, bool leaf, BoundBox& bbox, uint& visibility);
 };
 
 CCL_NAMESPACE_END
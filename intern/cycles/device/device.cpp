@@ -154,9 +154,12 @@ Device *Device::create(DeviceInfo& info, Stats &stats, bool background)
 			break;
 #endif
 #ifdef WITH_NETWORK
-		case DEVICE_NETWORK:
-			device = device_network_create(info, stats, "127.0.0.1");
+		case DEVICE_NETWORK: {
+			/* explicitly listed servers store their address in the id */
+			string address = (info.id.compare(0, 8, "NETWORK_") == 0)? info.id.substr(8): "127.0.0.1";
+			device = device_network_create(info, stats, address.c_str());
 			break;
+		}
 #endif
 #ifdef WITH_OPENCL
 		case DEVICE_OPENCL:
@@ -252,16 +255,16 @@ vector<DeviceInfo>& Device::available_devices()
 			device_opencl_info(devices);
 #endif
 
+#ifdef WITH_NETWORK
+		device_network_info(devices);
+#endif
+
 #ifdef WITH_MULTI
 		device_multi_info(devices);
 #endif
 
 		device_cpu_info(devices);
 
-#ifdef WITH_NETWORK
-		device_network_info(devices);
-#endif
-
 		devices_init = true;
 	}
 
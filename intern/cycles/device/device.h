@@ -31,6 +31,7 @@
 
 CCL_NAMESPACE_BEGIN
 
+class KernelImageCache;
 class Progress;
 class RenderTile;
 
@@ -118,6 +119,9 @@ public:
 	/* open shading language, only for CPU device */
 	virtual void *osl_memory() { return NULL; }
 
+	/* on demand image textures, only for CPU device */
+	virtual void image_cache_set(KernelImageCache * /*image_cache*/) {}
+
 	/* load/compile kernels, must be called before adding tasks */ 
 	virtual bool load_kernels(bool experimental) { return true; }
 
@@ -133,8 +137,9 @@ public:
 		const DeviceDrawParams &draw_params);
 
 #ifdef WITH_NETWORK
-	/* networking */
-	void server_run();
+	/* networking, cache_limit is the number of bytes of scene data kept
+	 * in memory for later connections */
+	void server_run(int port, size_t cache_limit);
 #endif
 
 	/* multi device */
@@ -61,6 +61,12 @@ public:
 #ifdef WITH_OSL
 		kernel_globals.osl = &osl_globals;
 #endif
+		kernel_globals.image_cache = NULL;
+
+		/* compact image storage is only set for some slots, lookups test it first */
+		memset(kernel_globals.texture_byte1_images, 0, sizeof(kernel_globals.texture_byte1_images));
+		memset(kernel_globals.texture_half4_images, 0, sizeof(kernel_globals.texture_half4_images));
+		memset(kernel_globals.texture_float1_images, 0, sizeof(kernel_globals.texture_float1_images));
 
 		/* do now to avoid thread issues */
 		system_cpu_support_sse2();
@@ -137,6 +143,11 @@ public:
 #endif
 	}
 
+	void image_cache_set(KernelImageCache *image_cache)
+	{
+		kernel_globals.image_cache = image_cache;
+	}
+
 	void thread_run(DeviceTask *task)
 	{
 		if(task->type == DeviceTask::PATH_TRACE)
@@ -168,38 +179,57 @@ public:
 #ifdef WITH_OSL
 		OSLShader::thread_init(&kg, &kernel_globals, &osl_globals);
 #endif
+		stats.profiler.add_state(&kg.profiler);
 
 		RenderTile tile;
 
 		void(*path_trace_kernel)(KernelGlobals*, float*, unsigned int*, int, int, int, int, int);
+		void(*path_trace_wavefront_kernel)(KernelGlobals*, WavefrontState*, float*, unsigned int*, int, int, int, int, int, int, int);
 
 #ifdef WITH_CYCLES_OPTIMIZED_KERNEL_AVX2
-		if(system_cpu_support_avx2())
+		if(system_cpu_support_avx2()) {
 			path_trace_kernel = kernel_cpu_avx2_path_trace;
+			path_trace_wavefront_kernel = kernel_cpu_avx2_path_trace_wavefront;
+		}
 		else
 #endif
 #ifdef WITH_CYCLES_OPTIMIZED_KERNEL_AVX
-		if(system_cpu_support_avx())
+		if(system_cpu_support_avx()) {
 			path_trace_kernel = kernel_cpu_avx_path_trace;
+			path_trace_wavefront_kernel = kernel_cpu_avx_path_trace_wavefront;
+		}
 		else
 #endif
 #ifdef WITH_CYCLES_OPTIMIZED_KERNEL_SSE41
-		if(system_cpu_support_sse41())
+		if(system_cpu_support_sse41()) {
 			path_trace_kernel = kernel_cpu_sse41_path_trace;
+			path_trace_wavefront_kernel = kernel_cpu_sse41_path_trace_wavefront;
+		}
 		else
 #endif
 #ifdef WITH_CYCLES_OPTIMIZED_KERNEL_SSE3
-		if(system_cpu_support_sse3())
+		if(system_cpu_support_sse3()) {
 			path_trace_kernel = kernel_cpu_sse3_path_trace;
+			path_trace_wavefront_kernel = kernel_cpu_sse3_path_trace_wavefront;
+		}
 		else
 #endif
 #ifdef WITH_CYCLES_OPTIMIZED_KERNEL_SSE2
-		if(system_cpu_support_sse2())
+		if(system_cpu_support_sse2()) {
 			path_trace_kernel = kernel_cpu_sse2_path_trace;
+			path_trace_wavefront_kernel = kernel_cpu_sse2_path_trace_wavefront;
+		}
 		else
 #endif
+		{
 			path_trace_kernel = kernel_cpu_path_trace;
-		
+			path_trace_wavefront_kernel = kernel_cpu_path_trace_wavefront;
+		}
+
+		WavefrontState *wavefront_state = NULL;
+		if(task.integrator_wavefront)
+			wavefront_state = kernel_wavefront_state_create();
+
 		while(task.acquire_tile(this, tile)) {
 			float *render_buffer = (float*)tile.buffer;
 			uint *rng_state = (uint*)tile.rng_state;
@@ -212,10 +242,16 @@ public:
 							break;
 					}
 
-					for(int y = tile.y; y < tile.y + tile.h; y++) {
-						for(int x = tile.x; x < tile.x + tile.w; x++) {
-							path_trace_kernel(&kg, render_buffer, rng_state,
-								sample, x, y, tile.offset, tile.stride);
+					if(task.integrator_wavefront) {
+						path_trace_wavefront_kernel(&kg, wavefront_state, render_buffer, rng_state,
+							sample, tile.x, tile.y, tile.w, tile.h, tile.offset, tile.stride);
+					}
+					else {
+						for(int y = tile.y; y < tile.y + tile.h; y++) {
+							for(int x = tile.x; x < tile.x + tile.w; x++) {
+								path_trace_kernel(&kg, render_buffer, rng_state,
+									sample, x, y, tile.offset, tile.stride);
+							}
 						}
 					}
 
@@ -233,6 +269,11 @@ public:
 			}
 		}
 
+		if(wavefront_state)
+			kernel_wavefront_state_free(wavefront_state);
+
+		stats.profiler.remove_state(&kg.profiler);
+
 #ifdef WITH_OSL
 		OSLShader::thread_free(&kg);
 #endif
@@ -321,6 +362,7 @@ public:
 #ifdef WITH_OSL
 		OSLShader::thread_init(&kg, &kernel_globals, &osl_globals);
 #endif
+		stats.profiler.add_state(&kg.profiler);
 		void(*shader_kernel)(KernelGlobals*, uint4*, float4*, int, int, int, int);
 
 #ifdef WITH_CYCLES_OPTIMIZED_KERNEL_AVX2
@@ -362,6 +404,8 @@ public:
 
 		}
 
+		stats.profiler.remove_state(&kg.profiler);
+
 #ifdef WITH_OSL
 		OSLShader::thread_free(&kg);
 #endif
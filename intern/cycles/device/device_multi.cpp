@@ -26,6 +26,7 @@
 #include "util_foreach.h"
 #include "util_list.h"
 #include "util_map.h"
+#include "util_thread.h"
 #include "util_time.h"
 
 CCL_NAMESPACE_BEGIN
@@ -55,6 +56,12 @@ public:
 		}
 
 #ifdef WITH_NETWORK
+		/* servers listed explicitly replace discovery, discovery reports other
+		 * addresses for the same servers and would connect to them twice */
+		foreach(DeviceInfo& subinfo, info.multi_devices)
+			if(subinfo.type == DEVICE_NETWORK)
+				return;
+
 		/* try to add network devices */
 		ServerDiscovery discovery(true);
 		time_sleep(1.0);
@@ -62,7 +69,12 @@ public:
 		vector<string> servers = discovery.get_server_list();
 
 		foreach(string& server, servers) {
-			device = device_network_create(info, stats, server.c_str());
+			DeviceInfo server_info;
+			server_info.type = DEVICE_NETWORK;
+			server_info.description = "Network Device " + server;
+			server_info.id = "NETWORK_" + server;
+
+			device = device_network_create(server_info, stats, server.c_str());
 			if(device)
 				devices.push_back(SubDevice(device));
 		}
@@ -152,9 +164,12 @@ public:
 	void mem_free(device_memory& mem)
 	{
 		device_ptr tmp = mem.device_pointer;
+		size_t device_size = mem.device_size;
 
 		foreach(SubDevice& sub, devices) {
+			/* each sub device frees its own allocation of the same size */
 			mem.device_pointer = sub.ptr_map[tmp];
+			mem.device_size = device_size;
 			sub.device->mem_free(mem);
 			sub.ptr_map.erase(sub.ptr_map.find(tmp));
 		}
@@ -182,9 +197,11 @@ public:
 	void tex_free(device_memory& mem)
 	{
 		device_ptr tmp = mem.device_pointer;
+		size_t device_size = mem.device_size;
 
 		foreach(SubDevice& sub, devices) {
 			mem.device_pointer = sub.ptr_map[tmp];
+			mem.device_size = device_size;
 			sub.device->tex_free(mem);
 			sub.ptr_map.erase(sub.ptr_map.find(tmp));
 		}
@@ -317,8 +334,23 @@ public:
 
 	void task_wait()
 	{
+		/* network devices answer tile requests from their server while
+		 * waiting, so they have to wait at the same time for all servers
+		 * to keep working */
+		list<thread*> threads;
+
+		foreach(SubDevice& sub, devices)
+			if(sub.device->info.type == DEVICE_NETWORK)
+				threads.push_back(new thread(function_bind(&Device::task_wait, sub.device)));
+
 		foreach(SubDevice& sub, devices)
-			sub.device->task_wait();
+			if(sub.device->info.type != DEVICE_NETWORK)
+				sub.device->task_wait();
+
+		foreach(thread *t, threads) {
+			t->join();
+			delete t;
+		}
 	}
 
 	void task_cancel()
@@ -446,6 +478,9 @@ void device_multi_info(vector<DeviceInfo>& devices)
 		device_multi_add(devices, DEVICE_OPENCL, false, false, "OPENCL_MULTI_%d", num++);
 	if(!device_multi_add(devices, DEVICE_OPENCL, true, true, "OPENCL_MULTI_%d", num++))
 		device_multi_add(devices, DEVICE_OPENCL, true, false, "OPENCL_MULTI_%d", num++);
+
+	/* explicitly listed network servers render together */
+	device_multi_add(devices, DEVICE_NETWORK, false, true, "NETWORK_MULTI_%d", 0);
 }
 
 CCL_NAMESPACE_END
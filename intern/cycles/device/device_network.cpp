@@ -19,13 +19,13 @@
 #include "device_network.h"
 
 #include "util_foreach.h"
+#include "util_time.h"
 
 #if defined(WITH_NETWORK)
 
 CCL_NAMESPACE_BEGIN
 
 typedef map<device_ptr, device_ptr> PtrMap;
-typedef vector<uint8_t> DataVector;
 typedef map<device_ptr, DataVector> DataMap;
 
 /* tile list */
@@ -50,15 +50,26 @@ public:
 
 	thread_mutex rpc_lock;
 
-	NetworkDevice(DeviceInfo& info, Stats &stats, const char *address)
-	: Device(info, stats, true), socket(io_service)
+	/* transfer and utilisation statistics, reported after each render task */
+	string address;
+	size_t bytes_sent, bytes_sent_uncompressed;
+	size_t bytes_received, bytes_received_uncompressed;
+	int num_textures, num_textures_cached;
+
+	NetworkDevice(DeviceInfo& info, Stats &stats, const char *address_)
+	: Device(info, stats, true), socket(io_service), address(address_)
 	{
 		error_func = NetworkError();
+
+		string host;
+		int port;
+		network_parse_address(address, host, port);
+
 		stringstream portstr;
-		portstr << SERVER_PORT;
+		portstr << port;
 
 		tcp::resolver resolver(io_service);
-		tcp::resolver::query query(address, portstr.str());
+		tcp::resolver::query query(host, portstr.str());
 		tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
 		tcp::resolver::iterator end;
 
@@ -71,8 +82,11 @@ public:
 
 		if(error)
 			error_func.network_error(error.message());
+		else
+			socket.set_option(tcp::no_delay(true));
 
 		mem_counter = 0;
+		stats_reset();
 	}
 
 	~NetworkDevice()
@@ -86,6 +100,7 @@ public:
 		thread_scoped_lock lock(rpc_lock);
 
 		mem.device_pointer = ++mem_counter;
+		mem.device_size = mem.memory_size();
 
 		RPCSend snd(socket, &error_func, "mem_alloc");
 
@@ -102,14 +117,18 @@ public:
 
 		snd.add(mem);
 		snd.write();
-		snd.write_buffer((void*)mem.data_pointer, mem.memory_size());
+
+		bytes_sent += snd.write_buffer_compressed((void*)mem.data_pointer, mem.memory_size());
+		bytes_sent_uncompressed += mem.memory_size();
 	}
 
 	void mem_copy_from(device_memory& mem, int y, int w, int h, int elem)
 	{
 		thread_scoped_lock lock(rpc_lock);
 
-		size_t data_size = mem.memory_size();
+		/* only the requested rows are sent back */
+		size_t offset, size;
+		network_mem_rows(mem, y, w, h, elem, offset, size);
 
 		RPCSend snd(socket, &error_func, "mem_copy_from");
 
@@ -121,7 +140,8 @@ public:
 		snd.write();
 
 		RPCReceive rcv(socket, &error_func);
-		rcv.read_buffer((void*)mem.data_pointer, data_size);
+		bytes_received += rcv.read_buffer_compressed((uint8_t*)mem.data_pointer + offset, size);
+		bytes_received_uncompressed += size;
 	}
 
 	void mem_zero(device_memory& mem)
@@ -145,6 +165,7 @@ public:
 			snd.write();
 
 			mem.device_pointer = 0;
+			mem.device_size = 0;
 		}
 	}
 
@@ -167,17 +188,32 @@ public:
 		thread_scoped_lock lock(rpc_lock);
 
 		mem.device_pointer = ++mem_counter;
+		mem.device_size = mem.memory_size();
 
 		RPCSend snd(socket, &error_func, "tex_alloc");
 
 		string name_string(name);
+		string hash = network_data_hash((void*)mem.data_pointer, mem.memory_size());
 
 		snd.add(name_string);
 		snd.add(mem);
 		snd.add(interpolation);
 		snd.add(periodic);
+		snd.add(hash);
 		snd.write();
-		snd.write_buffer((void*)mem.data_pointer, mem.memory_size());
+
+		/* server tells if it still has the data from an earlier render */
+		bool cached;
+		RPCReceive rcv(socket, &error_func);
+		rcv.read(cached);
+
+		if(!cached)
+			bytes_sent += snd.write_buffer_compressed((void*)mem.data_pointer, mem.memory_size());
+
+		bytes_sent_uncompressed += mem.memory_size();
+		num_textures++;
+		if(cached)
+			num_textures_cached++;
 	}
 
 	void tex_free(device_memory& mem)
@@ -191,6 +227,7 @@ public:
 			snd.write();
 
 			mem.device_pointer = 0;
+			mem.device_size = 0;
 		}
 	}
 
@@ -233,6 +270,7 @@ public:
 		lock.unlock();
 
 		TileList the_tiles;
+		int num_tiles = 0;
 
 		/* todo: run this threaded for connecting to multiple clients */
 		for(;;) {
@@ -277,6 +315,7 @@ public:
 				assert(tile.buffers != NULL);
 
 				the_task.release_tile(tile);
+				num_tiles++;
 
 				lock.lock();
 				RPCSend snd(socket, &error_func, "release_tile");
@@ -284,7 +323,16 @@ public:
 				lock.unlock();
 			}
 			else if(rcv.name == "task_wait_done") {
+				double busy_time, wall_time;
+				int num_threads;
+
+				rcv.read(busy_time);
+				rcv.read(wall_time);
+				rcv.read(num_threads);
 				lock.unlock();
+
+				if(the_task.type == DeviceTask::PATH_TRACE)
+					stats_print(num_tiles, busy_time, wall_time, num_threads);
 				break;
 			}
 			else
@@ -306,6 +354,30 @@ public:
 
 private:
 	NetworkError error_func;
+
+	void stats_reset()
+	{
+		bytes_sent = bytes_sent_uncompressed = 0;
+		bytes_received = bytes_received_uncompressed = 0;
+		num_textures = num_textures_cached = 0;
+	}
+
+	void stats_print(int num_tiles, double busy_time, double wall_time, int num_threads)
+	{
+		/* fraction of the time the server threads spent rendering tiles,
+		 * rather than waiting for tiles or results to be transferred */
+		double utilisation = (wall_time > 0.0 && num_threads > 0)? busy_time/(wall_time*num_threads): 0.0;
+
+		printf("Network server %s: %d tiles, %.1f%% utilisation of %d threads, "
+		       "sent %.2f MB (%.2f MB uncompressed, %d of %d textures cached), "
+		       "received %.2f MB (%.2f MB uncompressed)\n",
+		       address.c_str(), num_tiles, utilisation*100.0, num_threads,
+		       bytes_sent/(1024.0*1024.0), bytes_sent_uncompressed/(1024.0*1024.0),
+		       num_textures_cached, num_textures,
+		       bytes_received/(1024.0*1024.0), bytes_received_uncompressed/(1024.0*1024.0));
+
+		stats_reset();
+	}
 };
 
 Device *device_network_create(DeviceInfo& info, Stats &stats, const char *address)
@@ -324,9 +396,109 @@ void device_network_info(vector<DeviceInfo>& devices)
 	info.advanced_shading = true; /* todo: get this info from device */
 	info.pack_images = false;
 
+	/* servers can be listed explicitly as "host:port" separated by spaces or
+	 * commas, each becomes a device so they can be combined in a multi device */
+	const char *servers_env = getenv("CYCLES_NETWORK_SERVERS");
+
+	if(servers_env) {
+		vector<string> servers;
+		string_split(servers, servers_env, ", ");
+
+		foreach(string& server, servers) {
+			DeviceInfo server_info = info;
+
+			server_info.description = "Network Device " + server;
+			server_info.id = "NETWORK_" + server;
+			server_info.num = devices.size();
+
+			devices.push_back(server_info);
+		}
+
+		if(servers.size())
+			return;
+	}
+
 	devices.push_back(info);
 }
 
+/* Scene data kept by a server across connections, keyed by a hash of the
+ * contents, so rendering the same or a slightly changed scene again only
+ * transfers the data that changed. Entries no longer used by a connection
+ * stay around until the cache is over its size limit, then the least
+ * recently used are freed first. */
+
+class NetworkDataCache {
+public:
+	NetworkDataCache(size_t limit_)
+	: limit(limit_), size(0), counter(0) {}
+
+	/* returns NULL if not cached, otherwise adds a user */
+	DataVector *acquire(const string& hash)
+	{
+		map<string, Entry>::iterator it = entries.find(hash);
+
+		if(it == entries.end())
+			return NULL;
+
+		it->second.users++;
+		it->second.last_used = ++counter;
+
+		return &it->second.data;
+	}
+
+	/* new entry with one user, to be filled by the caller */
+	DataVector *insert(const string& hash, size_t data_size)
+	{
+		Entry& entry = entries[hash];
+
+		entry.data.resize(data_size);
+		entry.users = 1;
+		entry.last_used = ++counter;
+		size += data_size;
+
+		return &entry.data;
+	}
+
+	void release(const string& hash)
+	{
+		map<string, Entry>::iterator it = entries.find(hash);
+
+		if(it != entries.end()) {
+			it->second.users--;
+			trim();
+		}
+	}
+
+protected:
+	struct Entry {
+		DataVector data;
+		int users;
+		uint64_t last_used;
+	};
+
+	void trim()
+	{
+		while(size > limit) {
+			map<string, Entry>::iterator it, oldest = entries.end();
+
+			for(it = entries.begin(); it != entries.end(); it++)
+				if(it->second.users == 0 && (oldest == entries.end() || it->second.last_used < oldest->second.last_used))
+					oldest = it;
+
+			if(oldest == entries.end())
+				break;
+
+			size -= oldest->second.data.size();
+			entries.erase(oldest);
+		}
+	}
+
+	map<string, Entry> entries;
+	size_t limit;
+	size_t size;
+	uint64_t counter;
+};
+
 class DeviceServer {
 public:
 	thread_mutex rpc_lock;
@@ -337,12 +509,20 @@ public:
 
 	bool have_error() { return error_func.have_error(); }
 
-	DeviceServer(Device *device_, tcp::socket& socket_)
-	: device(device_), socket(socket_), stop(false), blocked_waiting(false)
+	DeviceServer(Device *device_, tcp::socket& socket_, NetworkDataCache& cache_)
+	: device(device_), socket(socket_), cache(cache_), stop(false), blocked_waiting(false),
+	  task_start_time(0.0), task_busy_time(0.0), task_num_threads(0)
 	{
 		error_func = NetworkError();
 	}
 
+	~DeviceServer()
+	{
+		/* textures of this connection remain cached for the next one */
+		for(map<device_ptr, string>::iterator it = tex_hash.begin(); it != tex_hash.end(); it++)
+			cache.release(it->second);
+	}
+
 	void listen()
 	{
 		/* receive remote function calls */
@@ -401,9 +581,10 @@ protected:
 		mapins = ptr_map.insert(PtrMap::value_type(client_pointer, real_pointer));
 		assert(mapins.second);
 
-		/* insert reverse mapping from real our device pointer to client pointer */
-		mapins = ptr_imap.insert(PtrMap::value_type(real_pointer, client_pointer));
-		assert(mapins.second);
+		/* insert reverse mapping from real our device pointer to client pointer,
+		 * textures sharing cached data can have the same real pointer, they
+		 * never need the reverse mapping */
+		ptr_imap.insert(PtrMap::value_type(real_pointer, client_pointer));
 	}
 
 	device_ptr device_ptr_from_client_pointer(device_ptr client_pointer)
@@ -425,13 +606,13 @@ protected:
 
 		/* erase the reverse mapping */
 		PtrMap::iterator irev = ptr_imap.find(result);
-		assert(irev != ptr_imap.end());
-		ptr_imap.erase(irev);
+		if(irev != ptr_imap.end() && irev->second == client_pointer)
+			ptr_imap.erase(irev);
 
-		/* erase the data vector */
+		/* erase the data vector, textures are in the cache instead */
 		DataMap::iterator idata = mem_data.find(client_pointer);
-		assert(idata != mem_data.end());
-		mem_data.erase(idata);
+		if(idata != mem_data.end())
+			mem_data.erase(idata);
 
 		return result;
 	}
@@ -486,7 +667,7 @@ protected:
 			mem.data_pointer = (device_ptr)&data_v[0];
 
 			/* copy data from network into memory buffer */
-			rcv.read_buffer((uint8_t*)mem.data_pointer, data_size);
+			rcv.read_buffer_compressed((uint8_t*)mem.data_pointer, data_size);
 
 			/* translate the client pointer to a real device pointer */
 			mem.device_pointer = device_ptr_from_client_pointer(client_pointer);
@@ -513,11 +694,12 @@ protected:
 
 			device->mem_copy_from(mem, y, w, h, elem);
 
-			size_t data_size = mem.memory_size();
+			size_t offset, size;
+			network_mem_rows(mem, y, w, h, elem, offset, size);
 
 			RPCSend snd(socket, &error_func, "mem_copy_from");
 			snd.write();
-			snd.write_buffer((uint8_t*)mem.data_pointer, data_size);
+			snd.write_buffer_compressed((uint8_t*)mem.data_pointer + offset, size);
 			lock.unlock();
 		}
 		else if(rcv.name == "mem_zero") {
@@ -566,30 +748,42 @@ protected:
 			string name;
 			InterpolationType interpolation;
 			bool periodic;
+			string hash;
 			device_ptr client_pointer;
 
 			rcv.read(name);
 			rcv.read(mem);
 			rcv.read(interpolation);
 			rcv.read(periodic);
-			lock.unlock();
+			rcv.read(hash);
 
 			client_pointer = mem.device_pointer;
 
 			size_t data_size = mem.memory_size();
 
-			DataVector &data_v = data_vector_insert(client_pointer, data_size);
+			/* only receive the data if it's not cached from an earlier render */
+			DataVector *data_v = cache.acquire(hash);
+			bool cached = (data_v != NULL);
+
+			RPCSend snd(socket, &error_func, "tex_alloc");
+			snd.add(cached);
+			snd.write();
+			lock.unlock();
+
+			if(!cached) {
+				data_v = cache.insert(hash, data_size);
+				rcv.read_buffer_compressed(data_size? &(*data_v)[0]: NULL, data_size);
+			}
 
 			if(data_size)
-				mem.data_pointer = (device_ptr)&(data_v[0]);
+				mem.data_pointer = (device_ptr)&(*data_v)[0];
 			else
 				mem.data_pointer = 0;
 
-			rcv.read_buffer((uint8_t*)mem.data_pointer, data_size);
-
 			device->tex_alloc(name.c_str(), mem, interpolation, periodic);
 
 			pointer_mapping_insert(client_pointer, mem.device_pointer);
+			tex_hash[client_pointer] = hash;
 		}
 		else if(rcv.name == "tex_free") {
 			network_device_memory mem;
@@ -603,6 +797,12 @@ protected:
 			mem.device_pointer = device_ptr_from_client_pointer_erase(client_pointer);
 
 			device->tex_free(mem);
+
+			map<device_ptr, string>::iterator it = tex_hash.find(client_pointer);
+			if(it != tex_hash.end()) {
+				cache.release(it->second);
+				tex_hash.erase(it);
+			}
 		}
 		else if(rcv.name == "load_kernels") {
 			bool experimental;
@@ -643,6 +843,10 @@ protected:
 			task.update_tile_sample = function_bind(&DeviceServer::task_update_tile_sample, this, _1);
 			task.get_cancel = function_bind(&DeviceServer::task_get_cancel, this);
 
+			task_start_time = time_dt();
+			task_busy_time = 0.0;
+			task_num_threads = device->get_split_task_count(task);
+
 			device->task_add(task);
 		}
 		else if(rcv.name == "task_wait") {
@@ -652,8 +856,13 @@ protected:
 			device->task_wait();
 			blocked_waiting = false;
 
+			double task_wall_time = time_dt() - task_start_time;
+
 			lock.lock();
 			RPCSend snd(socket, &error_func, "task_wait_done");
+			snd.add(task_busy_time);
+			snd.add(task_wall_time);
+			snd.add(task_num_threads);
 			snd.write();
 			lock.unlock();
 		}
@@ -712,6 +921,8 @@ protected:
 					if(tile.buffer) tile.buffer = ptr_map[tile.buffer];
 					if(tile.rng_state) tile.rng_state = ptr_map[tile.rng_state];
 
+					tile_start_time[pair<int, int>(tile.x, tile.y)] = time_dt();
+
 					result = true;
 					break;
 				}
@@ -741,6 +952,12 @@ protected:
 	{
 		thread_scoped_lock acquire_lock(acquire_mutex);
 
+		map<pair<int, int>, double>::iterator it = tile_start_time.find(pair<int, int>(tile.x, tile.y));
+		if(it != tile_start_time.end()) {
+			task_busy_time += time_dt() - it->second;
+			tile_start_time.erase(it);
+		}
+
 		if(tile.buffer) tile.buffer = ptr_imap[tile.buffer];
 		if(tile.rng_state) tile.rng_state = ptr_imap[tile.rng_state];
 
@@ -788,6 +1005,10 @@ protected:
 	PtrMap ptr_imap;
 	DataMap mem_data;
 
+	/* textures are stored in the cache, shared with other connections */
+	NetworkDataCache& cache;
+	map<device_ptr, string> tex_hash;
+
 	struct AcquireEntry {
 		string name;
 		RenderTile tile;
@@ -798,6 +1019,12 @@ protected:
 
 	bool stop;
 	bool blocked_waiting;
+
+	/* time spent rendering tiles, for utilisation statistics */
+	double task_start_time;
+	double task_busy_time;
+	int task_num_threads;
+	map<pair<int, int>, double> tile_start_time;
 private:
 	NetworkError error_func;
 
@@ -805,24 +1032,31 @@ private:
 
 };
 
-void Device::server_run()
+void Device::server_run(int port, size_t cache_limit)
 {
 	try {
 		/* starts thread that responds to discovery requests */
-		ServerDiscovery discovery;
+		ServerDiscovery discovery(false, port);
+
+		/* scene data cache, kept across connections */
+		NetworkDataCache cache(cache_limit);
 
 		for(;;) {
 			/* accept connection */
 			boost::asio::io_service io_service;
-			tcp::acceptor acceptor(io_service, tcp::endpoint(tcp::v4(), SERVER_PORT));
+			tcp::acceptor acceptor(io_service, tcp::endpoint(tcp::v4(), port));
 
 			tcp::socket socket(io_service);
 			acceptor.accept(socket);
 
+			/* RPCs are small request/reply pairs, don't let them wait for
+			 * delayed acknowledgements */
+			socket.set_option(tcp::no_delay(true));
+
 			string remote_address = socket.remote_endpoint().address().to_string();
 			printf("Connected to remote client at: %s\n", remote_address.c_str());
 
-			DeviceServer server(this, socket);
+			DeviceServer server(this, socket, cache);
 			server.listen();
 
 			printf("Disconnected.\n");
@@ -33,11 +33,14 @@
 #include <sstream>
 #include <deque>
 
+#include <zlib.h>
+
 #include "buffers.h"
 
 #include "util_foreach.h"
 #include "util_list.h"
 #include "util_map.h"
+#include "util_md5.h"
 #include "util_string.h"
 
 CCL_NAMESPACE_BEGIN
@@ -55,6 +58,83 @@ static const int DISCOVER_PORT = 5121;
 static const string DISCOVER_REQUEST_MSG = "REQUEST_RENDER_SERVER_IP";
 static const string DISCOVER_REPLY_MSG = "REPLY_RENDER_SERVER_IP";
 
+/* servers are addressed as "host" or "host:port", multiple servers can run
+ * on the same machine by giving each its own port */
+static inline void network_parse_address(const string& address, string& host, int& port)
+{
+	size_t pos = address.rfind(':');
+
+	if(pos == string::npos) {
+		host = address;
+		port = SERVER_PORT;
+	}
+	else {
+		host = address.substr(0, pos);
+		port = atoi(address.substr(pos + 1).c_str());
+	}
+}
+
+/* Compression and hashing of data buffers
+ *
+ * Scene data and render buffers are compressed with zlib at its fastest
+ * level, which already removes most of the empty passes and repeated data
+ * while keeping up with a local network. Scene data is identified by a hash
+ * of its contents, so servers can keep it cached between renders. */
+
+typedef vector<uint8_t> DataVector;
+
+static inline string network_data_hash(const void *data, size_t size)
+{
+	MD5Hash md5;
+	const uint8_t *bytes = (const uint8_t*)data;
+
+	/* append in chunks, md5 uses int sizes */
+	while(size > 0) {
+		int chunk = (size > (1 << 30))? (1 << 30): (int)size;
+		md5.append(bytes, chunk);
+		bytes += chunk;
+		size -= chunk;
+	}
+
+	return md5.get_hex();
+}
+
+/* byte range of rows y to y + h of a buffer with rows of w elements */
+static inline void network_mem_rows(device_memory& mem, int y, int w, int h, int elem,
+                                    size_t& offset, size_t& size)
+{
+	size_t total = mem.memory_size();
+
+	offset = (size_t)y*w*elem;
+	size = (size_t)w*h*elem;
+
+	if(offset > total)
+		offset = total;
+	if(size > total - offset)
+		size = total - offset;
+}
+
+static inline void network_compress(const void *data, size_t size, DataVector& compressed)
+{
+	uLongf compressed_size = compressBound(size);
+	compressed.resize(compressed_size);
+
+	if(compress2(&compressed[0], &compressed_size, (const Bytef*)data, size, 1) == Z_OK)
+		compressed.resize(compressed_size);
+	else
+		compressed.clear();
+}
+
+static inline bool network_uncompress(const DataVector& compressed, void *data, size_t size)
+{
+	uLongf data_size = size;
+
+	if(uncompress((Bytef*)data, &data_size, &compressed[0], compressed.size()) != Z_OK)
+		return false;
+
+	return data_size == size;
+}
+
 #if 0
 typedef boost::archive::text_oarchive o_archive;
 typedef boost::archive::text_iarchive i_archive;
@@ -118,7 +198,7 @@ public:
 	void add(const device_memory& mem)
 	{
 		archive & mem.data_type & mem.data_elements & mem.data_size;
-		archive & mem.data_width & mem.data_height & mem.data_depth & mem.device_pointer;
+		archive & mem.data_width & mem.data_height & mem.data_depth & mem.device_pointer & mem.device_size;
 	}
 
 	template<typename T> void add(const T& data)
@@ -134,7 +214,7 @@ public:
 		archive & task.offset & task.stride;
 		archive & task.shader_input & task.shader_output & task.shader_eval_type;
 		archive & task.shader_x & task.shader_w;
-		archive & task.need_finish_queue;
+		archive & task.need_finish_queue & task.integrator_wavefront;
 	}
 
 	void add(const RenderTile& tile)
@@ -187,6 +267,28 @@ public:
 			error_func->network_error(error.message());
 	}
 
+	/* compressed buffer, preceded by its compressed size, returns the
+	 * number of bytes sent */
+	size_t write_buffer_compressed(void *buffer, size_t size)
+	{
+		if(size == 0)
+			return 0;
+
+		DataVector compressed;
+		network_compress(buffer, size, compressed);
+
+		if(compressed.empty())
+			error_func->network_error("Network send error: failed to compress buffer");
+
+		uint64_t compressed_size = compressed.size();
+		write_buffer(&compressed_size, sizeof(compressed_size));
+
+		if(compressed_size)
+			write_buffer(&compressed[0], compressed_size);
+
+		return sizeof(compressed_size) + compressed_size;
+	}
+
 protected:
 	string name;
 	tcp::socket& socket;
@@ -261,7 +363,7 @@ public:
 	void read(network_device_memory& mem)
 	{
 		*archive & mem.data_type & mem.data_elements & mem.data_size;
-		*archive & mem.data_width & mem.data_height & mem.data_depth & mem.device_pointer;
+		*archive & mem.data_width & mem.data_height & mem.data_depth & mem.device_pointer & mem.device_size;
 
 		mem.data_pointer = 0;
 	}
@@ -284,6 +386,30 @@ public:
 			cout << "Network receive error: buffer size doesn't match expected size\n";
 	}
 
+	/* counterpart of RPCSend::write_buffer_compressed, returns the number of
+	 * bytes received */
+	size_t read_buffer_compressed(void *buffer, size_t size)
+	{
+		if(size == 0)
+			return 0;
+
+		uint64_t compressed_size = 0;
+		read_buffer(&compressed_size, sizeof(compressed_size));
+
+		if(compressed_size == 0) {
+			error_func->network_error("Network receive error: empty compressed buffer");
+			return sizeof(compressed_size);
+		}
+
+		DataVector compressed(compressed_size);
+		read_buffer(&compressed[0], compressed_size);
+
+		if(!network_uncompress(compressed, buffer, size))
+			error_func->network_error("Network receive error: failed to uncompress buffer");
+
+		return sizeof(compressed_size) + compressed_size;
+	}
+
 	void read(DeviceTask& task)
 	{
 		int type;
@@ -293,7 +419,7 @@ public:
 		*archive & task.offset & task.stride;
 		*archive & task.shader_input & task.shader_output & task.shader_eval_type;
 		*archive & task.shader_x & task.shader_w;
-		*archive & task.need_finish_queue;
+		*archive & task.need_finish_queue & task.integrator_wavefront;
 
 		task.type = (DeviceTask::Type)type;
 	}
@@ -322,8 +448,8 @@ protected:
 
 class ServerDiscovery {
 public:
-	ServerDiscovery(bool discover = false)
-	: listen_socket(io_service), collect_servers(false)
+	ServerDiscovery(bool discover = false, int server_port_ = SERVER_PORT)
+	: listen_socket(io_service), collect_servers(false), server_port(server_port_)
 	{
 		/* setup listen socket */
 		listen_endpoint.address(boost::asio::ip::address_v4::any());
@@ -384,9 +510,13 @@ private:
 
 			/* handle incoming message */
 			if(collect_servers) {
-				if(msg == DISCOVER_REPLY_MSG) {
+				/* reply is followed by the port the server listens on */
+				if(msg.compare(0, DISCOVER_REPLY_MSG.size(), DISCOVER_REPLY_MSG) == 0) {
 					string address = receive_endpoint.address().to_string();
 
+					if(msg.size() > DISCOVER_REPLY_MSG.size())
+						address += ":" + msg.substr(DISCOVER_REPLY_MSG.size() + 1);
+
 					mutex.lock();
 
 					/* add address if it's not already in the list */
@@ -402,7 +532,7 @@ private:
 			else {
 				/* reply to request */
 				if(msg == DISCOVER_REQUEST_MSG)
-					broadcast_message(DISCOVER_REPLY_MSG);
+					broadcast_message(string_printf("%s %d", DISCOVER_REPLY_MSG.c_str(), server_port));
 			}
 		}
 
@@ -462,6 +592,9 @@ private:
 	/* collection of server addresses in list */
 	bool collect_servers;
 	vector<string> servers;
+
+	/* port to report in replies when running as server */
+	int server_port;
 };
 
 CCL_NAMESPACE_END
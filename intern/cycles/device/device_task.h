@@ -65,6 +65,7 @@ public:
 
 	bool need_finish_queue;
 	bool integrator_branched;
+	bool integrator_wavefront;
 protected:
 	double last_update_time;
 };
@@ -23,6 +23,7 @@
 #include "kernel_globals.h"
 #include "kernel_film.h"
 #include "kernel_path.h"
+#include "kernel_path_wavefront.h"
 #include "kernel_bake.h"
 
 CCL_NAMESPACE_BEGIN
@@ -37,6 +38,30 @@ void kernel_const_copy(KernelGlobals *kg, const char *name, void *host, size_t s
 		assert(0);
 }
 
+/* An image slot can be reloaded with a different storage type, clear all
+ * storage for the slot so the lookup picks up the new one. */
+static void kernel_tex_image_clear(KernelGlobals *kg, int id)
+{
+	if(id >= MAX_FLOAT_IMAGES) {
+		kg->texture_byte_images[id - MAX_FLOAT_IMAGES].data = NULL;
+		kg->texture_byte1_images[id - MAX_FLOAT_IMAGES].data = NULL;
+	}
+	else {
+		kg->texture_float_images[id].data = NULL;
+		kg->texture_half4_images[id].data = NULL;
+		kg->texture_float1_images[id].data = NULL;
+	}
+}
+
+template<typename T> static void kernel_tex_image_set(KernelGlobals *kg, int id, texture_image<T> *tex, device_ptr mem, size_t width, size_t height, size_t depth, InterpolationType interpolation)
+{
+	kernel_tex_image_clear(kg, id);
+
+	tex->data = (T*)mem;
+	tex->dimensions_set(width, height, depth);
+	tex->interpolation = interpolation;
+}
+
 void kernel_tex_copy(KernelGlobals *kg, const char *name, device_ptr mem, size_t width, size_t height, size_t depth, InterpolationType interpolation)
 {
 	if(0) {
@@ -50,35 +75,40 @@ void kernel_tex_copy(KernelGlobals *kg, const char *name, device_ptr mem, size_t
 #define KERNEL_IMAGE_TEX(type, ttype, tname)
 #include "kernel_textures.h"
 
+	else if(strstr(name, "__tex_image_half4")) {
+		int id = atoi(name + strlen("__tex_image_half4_"));
+		int array_index = id;
+
+		if (array_index >= 0 && array_index < MAX_FLOAT_IMAGES)
+			kernel_tex_image_set(kg, id, &kg->texture_half4_images[array_index], mem, width, height, depth, interpolation);
+	}
+	else if(strstr(name, "__tex_image_float1")) {
+		int id = atoi(name + strlen("__tex_image_float1_"));
+		int array_index = id;
+
+		if (array_index >= 0 && array_index < MAX_FLOAT_IMAGES)
+			kernel_tex_image_set(kg, id, &kg->texture_float1_images[array_index], mem, width, height, depth, interpolation);
+	}
+	else if(strstr(name, "__tex_image_byte1")) {
+		int id = atoi(name + strlen("__tex_image_byte1_"));
+		int array_index = id - MAX_FLOAT_IMAGES;
+
+		if (array_index >= 0 && array_index < MAX_BYTE_IMAGES)
+			kernel_tex_image_set(kg, id, &kg->texture_byte1_images[array_index], mem, width, height, depth, interpolation);
+	}
 	else if(strstr(name, "__tex_image_float")) {
-		texture_image_float4 *tex = NULL;
 		int id = atoi(name + strlen("__tex_image_float_"));
 		int array_index = id;
 
-		if (array_index >= 0 && array_index < MAX_FLOAT_IMAGES) {
-			tex = &kg->texture_float_images[array_index];
-		}
-
-		if(tex) {
-			tex->data = (float4*)mem;
-			tex->dimensions_set(width, height, depth);
-			tex->interpolation = interpolation;
-		}
+		if (array_index >= 0 && array_index < MAX_FLOAT_IMAGES)
+			kernel_tex_image_set(kg, id, &kg->texture_float_images[array_index], mem, width, height, depth, interpolation);
 	}
 	else if(strstr(name, "__tex_image")) {
-		texture_image_uchar4 *tex = NULL;
 		int id = atoi(name + strlen("__tex_image_"));
 		int array_index = id - MAX_FLOAT_IMAGES;
 
-		if (array_index >= 0 && array_index < MAX_BYTE_IMAGES) {
-			tex = &kg->texture_byte_images[array_index];
-		}
-
-		if(tex) {
-			tex->data = (uchar4*)mem;
-			tex->dimensions_set(width, height, depth);
-			tex->interpolation = interpolation;
-		}
+		if (array_index >= 0 && array_index < MAX_BYTE_IMAGES)
+			kernel_tex_image_set(kg, id, &kg->texture_byte_images[array_index], mem, width, height, depth, interpolation);
 	}
 	else
 		assert(0);
@@ -94,6 +124,24 @@ void kernel_tex_copy(KernelGlobals *kg, const char *name, device_ptr mem, size_t
 	/* do nothing */
 #endif
 
+/* Wavefront State */
+
+WavefrontState *kernel_wavefront_state_create()
+{
+	WavefrontState *state = new WavefrontState();
+
+	state->paths.resize(WAVEFRONT_STREAM_SIZE);
+	state->active.resize(WAVEFRONT_STREAM_SIZE);
+	state->keys.resize(WAVEFRONT_STREAM_SIZE);
+
+	return state;
+}
+
+void kernel_wavefront_state_free(WavefrontState *state)
+{
+	delete state;
+}
+
 /* Path Tracing */
 
 void kernel_cpu_path_trace(KernelGlobals *kg, float *buffer, unsigned int *rng_state, int sample, int x, int y, int offset, int stride)
@@ -106,6 +154,11 @@ void kernel_cpu_path_trace(KernelGlobals *kg, float *buffer, unsigned int *rng_s
 		kernel_path_trace(kg, buffer, rng_state, sample, x, y, offset, stride);
 }
 
+void kernel_cpu_path_trace_wavefront(KernelGlobals *kg, WavefrontState *state, float *buffer, unsigned int *rng_state, int sample, int x, int y, int w, int h, int offset, int stride)
+{
+	kernel_path_trace_wavefront(kg, state, buffer, rng_state, sample, x, y, w, h, offset, stride);
+}
+
 /* Film */
 
 void kernel_cpu_convert_to_byte(KernelGlobals *kg, uchar4 *rgba, float *buffer, float sample_scale, int x, int y, int offset, int stride)
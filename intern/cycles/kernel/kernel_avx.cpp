@@ -38,6 +38,7 @@
 #include "kernel_globals.h"
 #include "kernel_film.h"
 #include "kernel_path.h"
+#include "kernel_path_wavefront.h"
 #include "kernel_bake.h"
 
 CCL_NAMESPACE_BEGIN
@@ -54,6 +55,11 @@ void kernel_cpu_avx_path_trace(KernelGlobals *kg, float *buffer, unsigned int *r
 		kernel_path_trace(kg, buffer, rng_state, sample, x, y, offset, stride);
 }
 
+void kernel_cpu_avx_path_trace_wavefront(KernelGlobals *kg, WavefrontState *state, float *buffer, unsigned int *rng_state, int sample, int x, int y, int w, int h, int offset, int stride)
+{
+	kernel_path_trace_wavefront(kg, state, buffer, rng_state, sample, x, y, w, h, offset, stride);
+}
+
 /* Film */
 
 void kernel_cpu_avx_convert_to_byte(KernelGlobals *kg, uchar4 *rgba, float *buffer, float sample_scale, int x, int y, int offset, int stride)
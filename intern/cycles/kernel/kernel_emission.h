@@ -70,6 +70,8 @@ ccl_device_noinline bool direct_emission(KernelGlobals *kg, ShaderData *sd,
 	if(ls->pdf == 0.0f)
 		return false;
 
+	PROFILING_INIT(kg, PROFILING_DIRECT_LIGHT);
+
 	/* todo: implement */
 	differential3 dD = differential3_zero();
 
@@ -150,6 +152,8 @@ ccl_device_noinline bool direct_emission(KernelGlobals *kg, ShaderData *sd,
 
 ccl_device_noinline float3 indirect_primitive_emission(KernelGlobals *kg, ShaderData *sd, float t, int path_flag, float bsdf_pdf)
 {
+	PROFILING_INIT(kg, PROFILING_INDIRECT_EMISSION);
+
 	/* evaluate emissive closure */
 	float3 L = shader_emissive_eval(kg, sd);
 
@@ -174,6 +178,8 @@ ccl_device_noinline float3 indirect_primitive_emission(KernelGlobals *kg, Shader
 
 ccl_device_noinline bool indirect_lamp_emission(KernelGlobals *kg, PathState *state, Ray *ray, float3 *emission)
 {
+	PROFILING_INIT(kg, PROFILING_INDIRECT_EMISSION);
+
 	bool hit_lamp = false;
 
 	*emission = make_float3(0.0f, 0.0f, 0.0f);
@@ -227,6 +233,8 @@ ccl_device_noinline bool indirect_lamp_emission(KernelGlobals *kg, PathState *st
 ccl_device_noinline float3 indirect_background(KernelGlobals *kg, PathState *state, Ray *ray)
 {
 #ifdef __BACKGROUND__
+	PROFILING_INIT(kg, PROFILING_INDIRECT_EMISSION);
+
 	int shader = kernel_data.background.surface_shader;
 
 	/* use visibility flag to skip lights */
@@ -16,6 +16,11 @@
 
 /* Constant Globals */
 
+#ifdef __KERNEL_CPU__
+#include "kernel_image_cache.h"
+#include "util_profiling.h"
+#endif
+
 CCL_NAMESPACE_BEGIN
 
 /* On the CPU, we pass along the struct KernelGlobals to nearly everywhere in
@@ -38,6 +43,18 @@ typedef struct KernelGlobals {
 	texture_image_uchar4 texture_byte_images[MAX_BYTE_IMAGES];
 	texture_image_float4 texture_float_images[MAX_FLOAT_IMAGES];
 
+	/* compact storage for the same slots, at most one of these and the arrays
+	 * above has data for a given slot */
+	texture_image_uchar texture_byte1_images[MAX_BYTE_IMAGES];
+	texture_image_half4 texture_half4_images[MAX_FLOAT_IMAGES];
+	texture_image_float texture_float1_images[MAX_FLOAT_IMAGES];
+
+	/* optional, images not in the texture arrays above */
+	KernelImageCache *image_cache;
+
+	/* per thread, sampled by the profiler when it is running */
+	ProfilingState profiler;
+
 #define KERNEL_TEX(type, ttype, name) ttype name;
 #define KERNEL_IMAGE_TEX(type, ttype, name)
 #include "kernel_textures.h"
@@ -54,6 +71,53 @@ typedef struct KernelGlobals {
 
 } KernelGlobals;
 
+/* Profiling, see util_profiling.h */
+#define PROFILING_INIT(kg, event) ProfilingHelper profiling_helper(&kg->profiler, event)
+#define PROFILING_EVENT(event) profiling_helper.set_event(event)
+#define PROFILING_SHADER(shader) \
+	if((shader) != SHADER_NONE) { profiling_helper.set_shader((shader) & SHADER_MASK); }
+#define PROFILING_OBJECT(object) \
+	if((object) != OBJECT_NONE) { profiling_helper.set_object(object); }
+
+/* Image texture lookups, picking the storage type the slot was loaded with */
+
+#define KERNEL_TEX_IMAGE_DISPATCH(lookup) \
+	if(id >= MAX_FLOAT_IMAGES) { \
+		id -= MAX_FLOAT_IMAGES; \
+		if(kg->texture_byte1_images[id].data) \
+			return kg->texture_byte1_images[id].lookup; \
+		return kg->texture_byte_images[id].lookup; \
+	} \
+	if(kg->texture_half4_images[id].data) \
+		return kg->texture_half4_images[id].lookup; \
+	if(kg->texture_float1_images[id].data) \
+		return kg->texture_float1_images[id].lookup; \
+	return kg->texture_float_images[id].lookup;
+
+ccl_device_inline float4 kernel_tex_image_interp_cpu(KernelGlobals *kg, int id, float x, float y)
+{
+	KERNEL_TEX_IMAGE_DISPATCH(interp(x, y))
+}
+
+ccl_device_inline float4 kernel_tex_image_interp_3d_cpu(KernelGlobals *kg, int id, float x, float y, float z)
+{
+	KERNEL_TEX_IMAGE_DISPATCH(interp_3d(x, y, z))
+}
+
+ccl_device_inline float4 kernel_tex_image_interp_3d_ex_cpu(KernelGlobals *kg, int id, float x, float y, float z, int interpolation)
+{
+	KERNEL_TEX_IMAGE_DISPATCH(interp_3d_ex(x, y, z, interpolation))
+}
+
+#undef KERNEL_TEX_IMAGE_DISPATCH
+
+#else
+
+#define PROFILING_INIT(kg, event)
+#define PROFILING_EVENT(event)
+#define PROFILING_SHADER(shader)
+#define PROFILING_OBJECT(object)
+
 #endif
 
 /* For CUDA, constant memory textures must be globals, so we can't put them
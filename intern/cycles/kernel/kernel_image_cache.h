@@ -0,0 +1,39 @@
+/*
+ * Copyright 2011-2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#ifndef __KERNEL_IMAGE_CACHE_H__
+#define __KERNEL_IMAGE_CACHE_H__
+
+#include "util_types.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Image textures that are read from disk on demand through a tile cache,
+ * instead of being fully loaded into memory. Only used by the CPU kernel,
+ * implemented by the ImageManager. Lookups are point samples of the full
+ * resolution image, without mip level selection. */
+
+class KernelImageCache {
+public:
+	virtual ~KernelImageCache() {}
+
+	/* returns false when the image in this slot is not handled by the cache */
+	virtual bool lookup(int slot, float x, float y, float4 *result) = 0;
+};
+
+CCL_NAMESPACE_END
+
+#endif /* __KERNEL_IMAGE_CACHE_H__ */
@@ -646,6 +646,126 @@ ccl_device int light_distribution_sample(KernelGlobals *kg, float randt)
 	return clamp(first-1, 0, kernel_data.integrator.num_distribution-1);
 }
 
+#ifdef __LIGHT_TREE__
+
+/* Light Tree
+ *
+ * Estimated contribution of all lamps in a node at shading point P, from the
+ * node energy, bounding box and orientation cone. This is conservative, so
+ * it is only zero when none of the lamps can illuminate P. */
+
+ccl_device float light_tree_node_importance(KernelGlobals *kg, int node, float3 P)
+{
+	float4 data0 = kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 0);
+	float energy = data0.w;
+
+	if(energy == 0.0f)
+		return 0.0f;
+
+	float4 data1 = kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 1);
+	float4 data2 = kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 2);
+	float4 data3 = kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 3);
+
+	float3 bbox_min = float4_to_float3(data0);
+	float3 bbox_max = float4_to_float3(data1);
+	float3 axis = float4_to_float3(data2);
+	float theta_o = data2.w;
+	float theta_e = data3.x;
+
+	float3 centroid = 0.5f*(bbox_min + bbox_max);
+	float radius = 0.5f*len(bbox_max - bbox_min);
+	float3 V = P - centroid;
+	float dist = len(V);
+
+	/* angle between the cone axis and P, minus the spread of the cone and
+	 * the angle subtended by the bounding sphere */
+	float theta = (dist > 0.0f)? safe_acosf(dot(axis, V)/dist): 0.0f;
+	float theta_u = (dist > radius)? safe_asinf(radius/dist): M_PI_F;
+	float theta_p = max(theta - theta_o - theta_u, 0.0f);
+
+	if(theta_p >= theta_e)
+		return 0.0f;
+
+	/* avoid the singularity when P is inside the bounds */
+	float dist_sq = max(dist*dist, max(radius*radius, 1e-8f));
+
+	return energy*cosf(theta_p)/dist_sq;
+}
+
+/* Traverse the tree picking children proportional to their importance.
+ * Returns the lamp and the probability of picking it, or -1 when no lamp
+ * can contribute. randu is rescaled to [0, 1) again for sampling the lamp. */
+
+ccl_device int light_tree_sample(KernelGlobals *kg, float3 P, float *randu, float *pdf)
+{
+	float u = *randu;
+	int node = 0;
+	*pdf = 1.0f;
+
+	for(;;) {
+		float4 data1 = kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 1);
+		int index = __float_as_int(data1.w);
+
+		/* leaf */
+		if(index < 0) {
+			*randu = u;
+			return ~index;
+		}
+
+		int left = node + 1;
+		int right = index;
+
+		float importance_left = light_tree_node_importance(kg, left, P);
+		float importance_right = light_tree_node_importance(kg, right, P);
+		float importance = importance_left + importance_right;
+
+		if(importance == 0.0f) {
+			*pdf = 0.0f;
+			return -1;
+		}
+
+		float prob_left = importance_left/importance;
+
+		/* reuse the random number for the next level */
+		if(u < prob_left) {
+			node = left;
+			u = u/prob_left;
+			*pdf *= prob_left;
+		}
+		else {
+			node = right;
+			u = (u - prob_left)/(1.0f - prob_left);
+			*pdf *= 1.0f - prob_left;
+		}
+
+		u = min(u, 1.0f - 1e-7f);
+	}
+}
+
+ccl_device void light_tree_lamp_sample(KernelGlobals *kg, float randu, float randv, float3 P, LightSample *ls)
+{
+	/* traverse with randu rather than rescaling randt within the picked
+	 * distribution entry, with stratified samplers that remainder is the same
+	 * for all samples of a pixel and every sample would pick the same lamp */
+	float pdf;
+	int lamp = light_tree_sample(kg, P, &randu, &pdf);
+
+	if(lamp == -1) {
+		ls->pdf = 0.0f;
+		ls->t = FLT_MAX;
+		ls->eval_fac = 0.0f;
+		return;
+	}
+
+	lamp_light_sample(kg, lamp, randu, randv, P, ls);
+
+	/* the tree replaces the uniform choice among all lamps in the tree, so
+	 * this lamp was picked with probability pdf_lights*num_lamps*pdf */
+	ls->eval_fac /= pdf*kernel_data.integrator.light_tree_num_lamps;
+}
+
+#endif
+
 /* Generic Light */
 
 ccl_device void light_sample(KernelGlobals *kg, float randt, float randu, float randv, float time, float3 P, LightSample *ls)
@@ -670,6 +790,20 @@ ccl_device void light_sample(KernelGlobals *kg, float randt, float randu, float
 	}
 	else {
 		int lamp = -prim-1;
+
+#ifdef __LIGHT_TREE__
+		if(kernel_data.integrator.use_light_tree) {
+			float4 data0 = kernel_tex_fetch(__light_data, lamp*LIGHT_SIZE + 0);
+			LightType type = (LightType)__float_as_int(data0.x);
+
+			/* distant and background lights are not in the tree */
+			if(type != LIGHT_DISTANT && type != LIGHT_BACKGROUND) {
+				light_tree_lamp_sample(kg, randu, randv, P, ls);
+				return;
+			}
+		}
+#endif
+
 		lamp_light_sample(kg, lamp, randu, randv, P, ls);
 	}
 }
@@ -173,5 +173,76 @@ ccl_device_inline void kernel_write_light_passes(KernelGlobals *kg, ccl_global f
 #endif
 }
 
+#ifdef __ADAPTIVE_SAMPLING__
+
+/* Adaptive sampling keeps two floats per pixel: the sum of the squared
+ * luminance of all combined samples, and the sample at which the pixel was
+ * found to be converged (0 while it is still being sampled). */
+
+ccl_device_inline void kernel_write_adaptive_sampling(KernelGlobals *kg, ccl_global float *buffer, int sample, float4 L)
+{
+	if(!(kernel_data.film.pass_flag & PASS_ADAPTIVE_SAMPLING))
+		return;
+
+	ccl_global float *adaptive = buffer + kernel_data.film.pass_adaptive_sampling;
+	float luminance = average(float4_to_float3(L));
+
+	kernel_write_pass_float(adaptive, sample, luminance*luminance);
+	if(sample == 0)
+		adaptive[1] = 0.0f;
+}
+
+/* Returns true when the pixel does not need any more samples. Instead of
+ * tracing, the accumulated passes are scaled as if the sample was taken with
+ * the current mean, so dividing by the full sample count still gives the
+ * correct result for converged pixels. */
+
+ccl_device bool kernel_adaptive_sampling_skip(KernelGlobals *kg, ccl_global float *buffer, int sample)
+{
+	int flag = kernel_data.film.pass_flag;
+
+	if(!(flag & PASS_ADAPTIVE_SAMPLING) || sample == 0)
+		return false;
+
+	int pass_adaptive = kernel_data.film.pass_adaptive_sampling;
+	ccl_global float *adaptive = buffer + pass_adaptive;
+
+	if(adaptive[1] == 0.0f) {
+		if(sample < kernel_data.integrator.adaptive_min_samples)
+			return false;
+
+		/* relative standard error of the mean luminance */
+		float n = (float)sample;
+		float mean = max(average(float4_to_float3(*(ccl_global float4*)buffer))/n, 0.0f);
+		float variance = max(adaptive[0]/n - mean*mean, 0.0f);
+		float error = sqrtf(variance/n)/(mean + 1e-4f);
+
+		if(error > kernel_data.integrator.adaptive_threshold)
+			return false;
+
+		adaptive[1] = n;
+	}
+
+	float scale = (float)(sample + 1)/(float)sample;
+
+	for(int i = 0; i < kernel_data.film.pass_stride; i++) {
+		/* unfiltered passes are only written for the first sample */
+		if(i == pass_adaptive || i == pass_adaptive + 1)
+			continue;
+		if((flag & PASS_DEPTH) && i == kernel_data.film.pass_depth)
+			continue;
+		if((flag & PASS_OBJECT_ID) && i == kernel_data.film.pass_object_id)
+			continue;
+		if((flag & PASS_MATERIAL_ID) && i == kernel_data.film.pass_material_id)
+			continue;
+
+		buffer[i] *= scale;
+	}
+
+	return true;
+}
+
+#endif
+
 CCL_NAMESPACE_END
 
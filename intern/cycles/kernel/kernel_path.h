@@ -54,12 +54,17 @@ CCL_NAMESPACE_BEGIN
 ccl_device void kernel_path_indirect(KernelGlobals *kg, RNG *rng, Ray ray,
 	float3 throughput, int num_samples, PathState state, PathRadiance *L)
 {
+	PROFILING_INIT(kg, PROFILING_PATH_INTEGRATE);
+
 	/* path iteration */
 	for(;;) {
 		/* intersect scene */
 		Intersection isect;
 		uint visibility = path_state_ray_visibility(kg, &state);
+
+		PROFILING_EVENT(PROFILING_INTERSECT_INDIRECT);
 		bool hit = scene_intersect(kg, &ray, visibility, &isect, NULL, 0.0f, 0.0f);
+		PROFILING_EVENT(PROFILING_PATH_INTEGRATE);
 
 #ifdef __LAMP_MIS__
 		if(kernel_data.integrator.use_lamp_mis && !(state.flag & PATH_RAY_CAMERA)) {
@@ -457,6 +462,8 @@ ccl_device bool kernel_path_subsurface_scatter(KernelGlobals *kg, ShaderData *sd
 
 ccl_device float4 kernel_path_integrate(KernelGlobals *kg, RNG *rng, int sample, Ray ray, ccl_global float *buffer)
 {
+	PROFILING_INIT(kg, PROFILING_PATH_INTEGRATE);
+
 	/* initialize */
 	PathRadiance L;
 	float3 throughput = make_float3(1.0f, 1.0f, 1.0f);
@@ -478,6 +485,8 @@ ccl_device float4 kernel_path_integrate(KernelGlobals *kg, RNG *rng, int sample,
 		Intersection isect;
 		uint visibility = path_state_ray_visibility(kg, &state);
 
+		PROFILING_EVENT((state.flag & PATH_RAY_CAMERA)? PROFILING_INTERSECT_CAMERA: PROFILING_INTERSECT_INDIRECT);
+
 #ifdef __HAIR__
 		float difl = 0.0f, extmax = 0.0f;
 		uint lcg_state = 0;
@@ -497,6 +506,7 @@ ccl_device float4 kernel_path_integrate(KernelGlobals *kg, RNG *rng, int sample,
 #else
 		bool hit = scene_intersect(kg, &ray, visibility, &isect, NULL, 0.0f, 0.0f);
 #endif
+		PROFILING_EVENT(PROFILING_PATH_INTEGRATE);
 
 #ifdef __KERNEL_DEBUG__
 		if(state.flag & PATH_RAY_CAMERA) {
@@ -863,6 +873,8 @@ ccl_device void kernel_branched_path_subsurface_scatter(KernelGlobals *kg,
 
 ccl_device float4 kernel_branched_path_integrate(KernelGlobals *kg, RNG *rng, int sample, Ray ray, ccl_global float *buffer)
 {
+	PROFILING_INIT(kg, PROFILING_PATH_INTEGRATE);
+
 	/* initialize */
 	PathRadiance L;
 	float3 throughput = make_float3(1.0f, 1.0f, 1.0f);
@@ -883,6 +895,8 @@ ccl_device float4 kernel_branched_path_integrate(KernelGlobals *kg, RNG *rng, in
 		Intersection isect;
 		uint visibility = path_state_ray_visibility(kg, &state);
 
+		PROFILING_EVENT((state.flag & PATH_RAY_CAMERA)? PROFILING_INTERSECT_CAMERA: PROFILING_INTERSECT_INDIRECT);
+
 #ifdef __HAIR__
 		float difl = 0.0f, extmax = 0.0f;
 		uint lcg_state = 0;
@@ -902,6 +916,7 @@ ccl_device float4 kernel_branched_path_integrate(KernelGlobals *kg, RNG *rng, in
 #else
 		bool hit = scene_intersect(kg, &ray, visibility, &isect, NULL, 0.0f, 0.0f);
 #endif
+		PROFILING_EVENT(PROFILING_PATH_INTEGRATE);
 
 #ifdef __KERNEL_DEBUG__
 		if(state.flag & PATH_RAY_CAMERA) {
@@ -1203,6 +1218,8 @@ ccl_device void kernel_path_trace(KernelGlobals *kg,
 	ccl_global float *buffer, ccl_global uint *rng_state,
 	int sample, int x, int y, int offset, int stride)
 {
+	PROFILING_INIT(kg, PROFILING_RAY_SETUP);
+
 	/* buffer offset */
 	int index = offset + x + y*stride;
 	int pass_stride = kernel_data.film.pass_stride;
@@ -1210,6 +1227,12 @@ ccl_device void kernel_path_trace(KernelGlobals *kg,
 	rng_state += index;
 	buffer += index*pass_stride;
 
+#ifdef __ADAPTIVE_SAMPLING__
+	/* converged pixels are not traced any further */
+	if(kernel_adaptive_sampling_skip(kg, buffer, sample))
+		return;
+#endif
+
 	/* initialize random numbers and ray */
 	RNG rng;
 	Ray ray;
@@ -1225,8 +1248,13 @@ ccl_device void kernel_path_trace(KernelGlobals *kg,
 		L = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
 
 	/* accumulate result in output buffer */
+	PROFILING_EVENT(PROFILING_WRITE_RESULT);
 	kernel_write_pass_float4(buffer, sample, L);
 
+#ifdef __ADAPTIVE_SAMPLING__
+	kernel_write_adaptive_sampling(kg, buffer, sample, L);
+#endif
+
 	path_rng_end(kg, rng_state, rng);
 }
 
@@ -1235,6 +1263,8 @@ ccl_device void kernel_branched_path_trace(KernelGlobals *kg,
 	ccl_global float *buffer, ccl_global uint *rng_state,
 	int sample, int x, int y, int offset, int stride)
 {
+	PROFILING_INIT(kg, PROFILING_RAY_SETUP);
+
 	/* buffer offset */
 	int index = offset + x + y*stride;
 	int pass_stride = kernel_data.film.pass_stride;
@@ -1242,6 +1272,12 @@ ccl_device void kernel_branched_path_trace(KernelGlobals *kg,
 	rng_state += index;
 	buffer += index*pass_stride;
 
+#ifdef __ADAPTIVE_SAMPLING__
+	/* converged pixels are not traced any further */
+	if(kernel_adaptive_sampling_skip(kg, buffer, sample))
+		return;
+#endif
+
 	/* initialize random numbers and ray */
 	RNG rng;
 	Ray ray;
@@ -1257,8 +1293,13 @@ ccl_device void kernel_branched_path_trace(KernelGlobals *kg,
 		L = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
 
 	/* accumulate result in output buffer */
+	PROFILING_EVENT(PROFILING_WRITE_RESULT);
 	kernel_write_pass_float4(buffer, sample, L);
 
+#ifdef __ADAPTIVE_SAMPLING__
+	kernel_write_adaptive_sampling(kg, buffer, sample, L);
+#endif
+
 	path_rng_end(kg, rng_state, rng);
 }
 #endif
@@ -218,6 +218,8 @@ ccl_device_inline void kernel_path_surface_connect_light(KernelGlobals *kg, RNG
 ccl_device_inline bool kernel_path_surface_bounce(KernelGlobals *kg, RNG *rng,
 	ShaderData *sd, float3 *throughput, PathState *state, PathRadiance *L, Ray *ray)
 {
+	PROFILING_INIT(kg, PROFILING_SURFACE_BOUNCE);
+
 	/* no BSDF? we can stop here */
 	if(sd->flag & SD_BSDF) {
 		/* sample BSDF */
@@ -0,0 +1,510 @@
+/*
+ * Copyright 2011-2015 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include "util_algorithm.h"
+#include "util_vector.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Wavefront Path Tracing
+ *
+ * Alternative to kernel_path_integrate for the CPU, where a stream of paths
+ * from a tile advances one bounce at a time through separate stages:
+ * intersect, shade and trace shadow rays. In between, paths are sorted so
+ * rays going in similar directions are traced after each other and surfaces
+ * with the same shader are shaded after each other, which keeps BVH nodes,
+ * shader nodes and textures in the caches.
+ *
+ * The random numbers used are the same as for the megakernel, only the
+ * shadow ray of direct lighting is deferred to its own stage. Branched path
+ * tracing and volumes are not supported, in that case the megakernel is used
+ * for the tile. */
+
+/* number of paths advanced together, limits memory to a few MB per thread */
+#define WAVEFRONT_STREAM_SIZE 4096
+
+typedef struct WavefrontPath {
+	/* pixel index and random number state */
+	int index;
+	RNG rng;
+
+	/* path still has bounces left; ray was generated by the camera; pixel
+	 * converged with adaptive sampling and is not written at all */
+	int active;
+	int traced;
+	int skip;
+
+	PathState state;
+	PathRadiance L;
+	float3 throughput;
+	float L_transparent;
+
+	Ray ray;
+	Intersection isect;
+	int hit;
+
+	/* direct light connection of the last shade stage, the shadow ray is
+	 * traced in the shadow stage using the path state at that point */
+	int has_shadow_ray;
+	int shadow_is_lamp;
+	Ray shadow_ray;
+	BsdfEval shadow_eval;
+	float3 shadow_throughput;
+	PathState shadow_state;
+
+#ifdef __KERNEL_DEBUG__
+	DebugData debug_data;
+#endif
+} WavefrontPath;
+
+/* stream buffers, created once per render thread and reused for every tile
+ * and sample */
+typedef struct WavefrontState {
+	array<WavefrontPath> paths;
+	array<int> active;
+	array<uint64_t> keys;
+} WavefrontState;
+
+ccl_device_inline ccl_global float *kernel_wavefront_buffer(KernelGlobals *kg, ccl_global float *buffer, WavefrontPath *wp)
+{
+	return buffer + wp->index*kernel_data.film.pass_stride;
+}
+
+/* Stages */
+
+ccl_device void kernel_wavefront_init(KernelGlobals *kg, WavefrontPath *wp,
+	ccl_global float *buffer, ccl_global uint *rng_state,
+	int sample, int x, int y, int offset, int stride)
+{
+	PROFILING_INIT(kg, PROFILING_RAY_SETUP);
+
+	wp->index = offset + x + y*stride;
+	wp->active = false;
+	wp->traced = false;
+	wp->skip = false;
+	wp->has_shadow_ray = false;
+
+#ifdef __ADAPTIVE_SAMPLING__
+	/* converged pixels are not traced any further */
+	if(kernel_adaptive_sampling_skip(kg, kernel_wavefront_buffer(kg, buffer, wp), sample)) {
+		wp->skip = true;
+		return;
+	}
+#endif
+
+	kernel_path_trace_setup(kg, rng_state + wp->index, sample, x, y, &wp->rng, &wp->ray);
+
+	if(wp->ray.t == 0.0f)
+		return;
+
+	wp->active = true;
+	wp->traced = true;
+	wp->throughput = make_float3(1.0f, 1.0f, 1.0f);
+	wp->L_transparent = 0.0f;
+
+	path_radiance_init(&wp->L, kernel_data.film.use_light_pass);
+	path_state_init(kg, &wp->state, &wp->rng, sample, &wp->ray);
+
+#ifdef __KERNEL_DEBUG__
+	debug_data_init(&wp->debug_data);
+#endif
+}
+
+ccl_device void kernel_wavefront_intersect(KernelGlobals *kg, WavefrontPath *wp)
+{
+	PathState *state = &wp->state;
+	Ray *ray = &wp->ray;
+	uint visibility = path_state_ray_visibility(kg, state);
+
+	PROFILING_INIT(kg, (state->flag & PATH_RAY_CAMERA)? PROFILING_INTERSECT_CAMERA: PROFILING_INTERSECT_INDIRECT);
+
+#ifdef __HAIR__
+	float difl = 0.0f, extmax = 0.0f;
+	uint lcg_state = 0;
+
+	if(kernel_data.bvh.have_curves) {
+		if((kernel_data.cam.resolution == 1) && (state->flag & PATH_RAY_CAMERA)) {
+			float3 pixdiff = ray->dD.dx + ray->dD.dy;
+			difl = kernel_data.curve.minimum_width * len(pixdiff) * 0.5f;
+		}
+
+		extmax = kernel_data.curve.maximum_width;
+		lcg_state = lcg_state_init(&wp->rng, state, 0x51633e2d);
+	}
+
+	wp->hit = scene_intersect(kg, ray, visibility, &wp->isect, &lcg_state, difl, extmax);
+#else
+	wp->hit = scene_intersect(kg, ray, visibility, &wp->isect, NULL, 0.0f, 0.0f);
+#endif
+
+#ifdef __KERNEL_DEBUG__
+	if(state->flag & PATH_RAY_CAMERA)
+		wp->debug_data.num_bvh_traversal_steps += wp->isect.num_traversal_steps;
+#endif
+}
+
+/* same as kernel_path_surface_connect_light, except that the shadow ray is
+ * stored in the path instead of traced right away */
+ccl_device_inline void kernel_wavefront_connect_light(KernelGlobals *kg, WavefrontPath *wp, ShaderData *sd)
+{
+	wp->has_shadow_ray = false;
+
+#ifdef __EMISSION__
+	if(!(kernel_data.integrator.use_direct_light && (sd->flag & SD_BSDF_HAS_EVAL)))
+		return;
+
+	PathState *state = &wp->state;
+	float light_t = path_state_rng_1D(kg, &wp->rng, state, PRNG_LIGHT);
+	float light_u, light_v;
+	path_state_rng_2D(kg, &wp->rng, state, PRNG_LIGHT_U, &light_u, &light_v);
+
+	bool is_lamp;
+
+#ifdef __OBJECT_MOTION__
+	wp->shadow_ray.time = sd->time;
+#endif
+
+	LightSample ls;
+	light_sample(kg, light_t, light_u, light_v, sd->time, sd->P, &ls);
+
+	if(direct_emission(kg, sd, &ls, &wp->shadow_ray, &wp->shadow_eval, &is_lamp, state->bounce, state->transparent_bounce)) {
+		wp->has_shadow_ray = true;
+		wp->shadow_is_lamp = is_lamp;
+		wp->shadow_throughput = wp->throughput;
+		wp->shadow_state = *state;
+	}
+#endif
+}
+
+ccl_device void kernel_wavefront_shade(KernelGlobals *kg, WavefrontPath *wp, ccl_global float *buffer, int sample)
+{
+	PROFILING_INIT(kg, PROFILING_PATH_INTEGRATE);
+
+	RNG *rng = &wp->rng;
+	PathState *state = &wp->state;
+	PathRadiance *L = &wp->L;
+	Ray *ray = &wp->ray;
+	Intersection *isect = &wp->isect;
+
+	buffer = kernel_wavefront_buffer(kg, buffer, wp);
+	wp->active = false;
+
+#ifdef __LAMP_MIS__
+	if(kernel_data.integrator.use_lamp_mis && !(state->flag & PATH_RAY_CAMERA)) {
+		/* ray starting from previous non-transparent bounce */
+		Ray light_ray;
+
+		light_ray.P = ray->P - state->ray_t*ray->D;
+		state->ray_t += isect->t;
+		light_ray.D = ray->D;
+		light_ray.t = state->ray_t;
+		light_ray.time = ray->time;
+		light_ray.dD = ray->dD;
+		light_ray.dP = ray->dP;
+
+		/* intersect with lamp */
+		float3 emission;
+
+		if(indirect_lamp_emission(kg, state, &light_ray, &emission))
+			path_radiance_accum_emission(L, wp->throughput, emission, state->bounce);
+	}
+#endif
+
+	if(!wp->hit) {
+		/* eval background shader if nothing hit */
+		if(kernel_data.background.transparent && (state->flag & PATH_RAY_CAMERA)) {
+			wp->L_transparent += average(wp->throughput);
+
+#ifdef __PASSES__
+			if(!(kernel_data.film.pass_flag & PASS_BACKGROUND))
+#endif
+				return;
+		}
+
+#ifdef __BACKGROUND__
+		/* sample background shader */
+		float3 L_background = indirect_background(kg, state, ray);
+		path_radiance_accum_background(L, wp->throughput, L_background, state->bounce);
+#endif
+
+		return;
+	}
+
+	/* setup shading */
+	ShaderData sd;
+	shader_setup_from_ray(kg, &sd, isect, ray, state->bounce, state->transparent_bounce);
+	float rbsdf = path_state_rng_1D_for_decision(kg, rng, state, PRNG_BSDF);
+	shader_eval_surface(kg, &sd, rbsdf, state->flag, SHADER_CONTEXT_MAIN);
+
+	/* holdout */
+#ifdef __HOLDOUT__
+	if((sd.flag & (SD_HOLDOUT|SD_HOLDOUT_MASK)) && (state->flag & PATH_RAY_CAMERA)) {
+		if(kernel_data.background.transparent) {
+			float3 holdout_weight;
+
+			if(sd.flag & SD_HOLDOUT_MASK)
+				holdout_weight = make_float3(1.0f, 1.0f, 1.0f);
+			else
+				holdout_weight = shader_holdout_eval(kg, &sd);
+
+			/* any throughput is ok, should all be identical here */
+			wp->L_transparent += average(holdout_weight*wp->throughput);
+		}
+
+		if(sd.flag & SD_HOLDOUT_MASK)
+			return;
+	}
+#endif
+
+	/* holdout mask objects do not write data passes */
+	kernel_write_data_passes(kg, buffer, L, &sd, sample, state, wp->throughput);
+
+	/* blurring of bsdf after bounces, for rays that have a small likelihood
+	 * of following this particular path (diffuse, rough glossy) */
+	if(kernel_data.integrator.filter_glossy != FLT_MAX) {
+		float blur_pdf = kernel_data.integrator.filter_glossy*state->min_ray_pdf;
+
+		if(blur_pdf < 1.0f) {
+			float blur_roughness = sqrtf(1.0f - blur_pdf)*0.5f;
+			shader_bsdf_blur(kg, &sd, blur_roughness);
+		}
+	}
+
+#ifdef __EMISSION__
+	/* emission */
+	if(sd.flag & SD_EMISSION) {
+		float3 emission = indirect_primitive_emission(kg, &sd, isect->t, state->flag, state->ray_pdf);
+		path_radiance_accum_emission(L, wp->throughput, emission, state->bounce);
+	}
+#endif
+
+	/* path termination */
+	float probability = path_state_terminate_probability(kg, state, wp->throughput);
+
+	if(probability == 0.0f) {
+		return;
+	}
+	else if(probability != 1.0f) {
+		float terminate = path_state_rng_1D_for_decision(kg, rng, state, PRNG_TERMINATE);
+
+		if(terminate >= probability)
+			return;
+
+		wp->throughput /= probability;
+	}
+
+#ifdef __AO__
+	/* ambient occlusion */
+	if(kernel_data.integrator.use_ambient_occlusion || (sd.flag & SD_AO)) {
+		kernel_path_ao(kg, &sd, L, state, rng, wp->throughput);
+	}
+#endif
+
+#ifdef __SUBSURFACE__
+	/* bssrdf scatter to a different location on the same object, replacing
+	 * the closures with a diffuse BSDF */
+	if(sd.flag & SD_BSSRDF) {
+		if(kernel_path_subsurface_scatter(kg, &sd, L, state, rng, ray, &wp->throughput))
+			return;
+	}
+#endif
+
+	/* direct lighting, shadow ray is traced in the next stage */
+	kernel_wavefront_connect_light(kg, wp, &sd);
+
+	/* next bounce */
+	wp->active = kernel_path_surface_bounce(kg, rng, &sd, &wp->throughput, state, L, ray);
+}
+
+ccl_device void kernel_wavefront_shadow(KernelGlobals *kg, WavefrontPath *wp)
+{
+	float3 shadow;
+
+	if(!shadow_blocked(kg, &wp->shadow_state, &wp->shadow_ray, &shadow)) {
+		path_radiance_accum_light(&wp->L, wp->shadow_throughput, &wp->shadow_eval, shadow,
+			1.0f, wp->shadow_state.bounce, wp->shadow_is_lamp);
+	}
+
+	wp->has_shadow_ray = false;
+}
+
+ccl_device void kernel_wavefront_finish(KernelGlobals *kg, WavefrontPath *wp,
+	ccl_global float *buffer, ccl_global uint *rng_state, int sample)
+{
+	if(wp->skip)
+		return;
+
+	PROFILING_INIT(kg, PROFILING_WRITE_RESULT);
+
+	buffer = kernel_wavefront_buffer(kg, buffer, wp);
+
+	float4 L;
+
+	if(wp->traced) {
+		float3 L_sum = path_radiance_clamp_and_sum(kg, &wp->L);
+
+		kernel_write_light_passes(kg, buffer, &wp->L, sample);
+
+#ifdef __KERNEL_DEBUG__
+		kernel_write_debug_passes(kg, buffer, &wp->state, &wp->debug_data, sample);
+#endif
+
+		L = make_float4(L_sum.x, L_sum.y, L_sum.z, 1.0f - wp->L_transparent);
+	}
+	else
+		L = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+
+	/* accumulate result in output buffer */
+	kernel_write_pass_float4(buffer, sample, L);
+
+#ifdef __ADAPTIVE_SAMPLING__
+	kernel_write_adaptive_sampling(kg, buffer, sample, L);
+#endif
+
+	path_rng_end(kg, rng_state + wp->index, wp->rng);
+}
+
+/* Sorting */
+
+ccl_device_inline uint kernel_wavefront_direction_key(WavefrontPath *wp)
+{
+	/* octant of the ray direction */
+	float3 D = wp->ray.D;
+	return ((D.x < 0.0f)? 1: 0) | ((D.y < 0.0f)? 2: 0) | ((D.z < 0.0f)? 4: 0);
+}
+
+ccl_device_inline uint kernel_wavefront_shader_key(KernelGlobals *kg, WavefrontPath *wp)
+{
+	/* misses go last, they all evaluate the background shader */
+	if(!wp->hit)
+		return 0xFFFFFFFF;
+
+	int prim = kernel_tex_fetch(__prim_index, wp->isect.prim);
+	int shader;
+
+#ifdef __HAIR__
+	if(wp->isect.type & PRIMITIVE_ALL_CURVE)
+		shader = __float_as_int(kernel_tex_fetch(__curves, prim).z);
+	else
+#endif
+		shader = kernel_tex_fetch(__tri_shader, prim);
+
+	return shader & SHADER_MASK;
+}
+
+/* sort path indices by key, with the index as secondary key so the order
+ * within a group stays the same as in the tile */
+ccl_device void kernel_wavefront_sort(uint64_t *keys, int *indices, int num)
+{
+	for(int i = 0; i < num; i++)
+		keys[i] = (keys[i] << 32) | (uint64_t)indices[i];
+
+	sort(keys, keys + num);
+
+	for(int i = 0; i < num; i++)
+		indices[i] = (int)(keys[i] & 0xFFFFFFFF);
+}
+
+/* Tile */
+
+ccl_device void kernel_path_trace_wavefront(KernelGlobals *kg,
+	WavefrontState *state, ccl_global float *buffer, ccl_global uint *rng_state,
+	int sample, int x, int y, int w, int h, int offset, int stride)
+{
+	bool supported = !kernel_data.integrator.use_volumes;
+
+#ifdef __BRANCHED_PATH__
+	if(kernel_data.integrator.branched)
+		supported = false;
+#endif
+
+	if(!supported) {
+		for(int py = y; py < y + h; py++) {
+			for(int px = x; px < x + w; px++) {
+#ifdef __BRANCHED_PATH__
+				if(kernel_data.integrator.branched)
+					kernel_branched_path_trace(kg, buffer, rng_state, sample, px, py, offset, stride);
+				else
+#endif
+					kernel_path_trace(kg, buffer, rng_state, sample, px, py, offset, stride);
+			}
+		}
+
+		return;
+	}
+
+	int num_pixels = w*h;
+	int stream_size = min(num_pixels, WAVEFRONT_STREAM_SIZE);
+
+	array<WavefrontPath>& paths = state->paths;
+	array<int>& active = state->active;
+	array<uint64_t>& keys = state->keys;
+
+	for(int start = 0; start < num_pixels; start += stream_size) {
+		int num = min(num_pixels - start, stream_size);
+		int num_active = 0;
+
+		/* generate camera rays */
+		for(int i = 0; i < num; i++) {
+			int pixel = start + i;
+			kernel_wavefront_init(kg, &paths[i], buffer, rng_state, sample,
+				x + pixel % w, y + pixel / w, offset, stride);
+
+			if(paths[i].active)
+				active[num_active++] = i;
+		}
+
+		while(num_active > 0) {
+			/* intersect, grouping rays by direction */
+			for(int i = 0; i < num_active; i++)
+				keys[i] = kernel_wavefront_direction_key(&paths[active[i]]);
+			kernel_wavefront_sort(&keys[0], &active[0], num_active);
+
+			for(int i = 0; i < num_active; i++)
+				kernel_wavefront_intersect(kg, &paths[active[i]]);
+
+			/* shade, grouping hits by shader */
+			for(int i = 0; i < num_active; i++)
+				keys[i] = kernel_wavefront_shader_key(kg, &paths[active[i]]);
+			kernel_wavefront_sort(&keys[0], &active[0], num_active);
+
+			for(int i = 0; i < num_active; i++)
+				kernel_wavefront_shade(kg, &paths[active[i]], buffer, sample);
+
+			/* trace shadow rays and remove terminated paths */
+			int num_next = 0;
+
+			for(int i = 0; i < num_active; i++) {
+				WavefrontPath *wp = &paths[active[i]];
+
+				if(wp->has_shadow_ray)
+					kernel_wavefront_shadow(kg, wp);
+
+				if(wp->active)
+					active[num_next++] = active[i];
+			}
+
+			num_active = num_next;
+		}
+
+		/* write results */
+		for(int i = 0; i < num; i++)
+			kernel_wavefront_finish(kg, &paths[i], buffer, rng_state, sample);
+	}
+}
+
+CCL_NAMESPACE_END
+
@@ -786,6 +786,10 @@ ccl_device float3 shader_holdout_eval(KernelGlobals *kg, ShaderData *sd)
 ccl_device void shader_eval_surface(KernelGlobals *kg, ShaderData *sd,
 	float randb, int path_flag, ShaderContext ctx)
 {
+	PROFILING_INIT(kg, PROFILING_SHADER_SURFACE);
+	PROFILING_OBJECT(sd->object);
+	PROFILING_SHADER(sd->shader);
+
 	sd->num_closure = 0;
 	sd->randb_closure = randb;
 
@@ -809,6 +813,8 @@ ccl_device void shader_eval_surface(KernelGlobals *kg, ShaderData *sd,
 
 ccl_device float3 shader_eval_background(KernelGlobals *kg, ShaderData *sd, int path_flag, ShaderContext ctx)
 {
+	PROFILING_INIT(kg, PROFILING_SHADER_BACKGROUND);
+
 	sd->num_closure = 0;
 	sd->randb_closure = 0.0f;
 
@@ -950,6 +956,8 @@ ccl_device int shader_phase_sample_closure(KernelGlobals *kg, const ShaderData *
 ccl_device void shader_eval_volume(KernelGlobals *kg, ShaderData *sd,
 	VolumeStack *stack, int path_flag, ShaderContext ctx)
 {
+	PROFILING_INIT(kg, PROFILING_SHADER_VOLUME);
+
 	/* reset closures once at the start, we will be accumulating the closures
 	 * for all volumes in the stack into a single array of closures */
 	sd->num_closure = 0;
@@ -961,6 +969,9 @@ ccl_device void shader_eval_volume(KernelGlobals *kg, ShaderData *sd,
 		sd->object = stack[i].object;
 		sd->shader = stack[i].shader;
 
+		PROFILING_OBJECT(sd->object);
+		PROFILING_SHADER(sd->shader);
+
 		sd->flag &= ~(SD_SHADER_FLAGS|SD_OBJECT_FLAGS);
 		sd->flag |= kernel_tex_fetch(__shader_flag, (sd->shader & SHADER_MASK)*2);
 
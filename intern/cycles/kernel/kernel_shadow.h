@@ -60,6 +60,8 @@ ccl_device_inline bool shadow_blocked(KernelGlobals *kg, PathState *state, Ray *
 
 	if(ray->t == 0.0f)
 		return false;
+
+	PROFILING_INIT(kg, PROFILING_INTERSECT_SHADOW);
 	
 	bool blocked;
 
@@ -200,6 +202,8 @@ ccl_device_inline bool shadow_blocked(KernelGlobals *kg, PathState *state, Ray *
 	if(ray->t == 0.0f)
 		return false;
 
+	PROFILING_INIT(kg, PROFILING_INTERSECT_SHADOW);
+
 	Intersection isect;
 	bool blocked = scene_intersect(kg, ray, PATH_RAY_SHADOW_OPAQUE, &isect, NULL, 0.0f, 0.0f);
 
@@ -210,6 +210,8 @@ ccl_device void subsurface_color_bump_blur(KernelGlobals *kg, ShaderData *out_sd
 ccl_device int subsurface_scatter_multi_step(KernelGlobals *kg, ShaderData *sd, ShaderData bssrdf_sd[BSSRDF_MAX_HITS],
 	int state_flag, ShaderClosure *sc, uint *lcg_state, float disk_u, float disk_v, bool all)
 {
+	PROFILING_INIT(kg, PROFILING_INTERSECT_SUBSURFACE);
+
 	/* pick random axis in local frame and point on disk */
 	float3 disk_N, disk_T, disk_B;
 	float pick_pdf_N, pick_pdf_T, pick_pdf_B;
@@ -316,6 +318,8 @@ ccl_device int subsurface_scatter_multi_step(KernelGlobals *kg, ShaderData *sd,
 ccl_device void subsurface_scatter_step(KernelGlobals *kg, ShaderData *sd,
 	int state_flag, ShaderClosure *sc, uint *lcg_state, float disk_u, float disk_v, bool all)
 {
+	PROFILING_INIT(kg, PROFILING_INTERSECT_SUBSURFACE);
+
 	float3 eval = make_float3(0.0f, 0.0f, 0.0f);
 	uint num_hits = 0;
 
@@ -54,6 +54,7 @@ KERNEL_TEX(uchar4, texture_uchar4, __attributes_uchar4)
 /* lights */
 KERNEL_TEX(float4, texture_float4, __light_distribution)
 KERNEL_TEX(float4, texture_float4, __light_data)
+KERNEL_TEX(float4, texture_float4, __light_tree_nodes)
 KERNEL_TEX(float2, texture_float2, __light_background_marginal_cdf)
 KERNEL_TEX(float2, texture_float2, __light_background_conditional_cdf)
 
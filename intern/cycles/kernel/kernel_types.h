@@ -30,6 +30,7 @@ CCL_NAMESPACE_BEGIN
 #define OBJECT_SIZE 		11
 #define OBJECT_VECTOR_SIZE	6
 #define LIGHT_SIZE			4
+#define LIGHT_TREE_NODE_SIZE	4
 #define FILTER_TABLE_SIZE	256
 #define RAMP_TABLE_SIZE		256
 #define PARTICLE_SIZE 		5
@@ -155,6 +156,8 @@ CCL_NAMESPACE_BEGIN
 #define __CAMERA_MOTION__
 #define __OBJECT_MOTION__
 #define __HAIR__
+#define __ADAPTIVE_SAMPLING__
+#define __LIGHT_TREE__
 #endif
 
 #ifdef WITH_CYCLES_DEBUG
@@ -320,6 +323,7 @@ typedef enum PassType {
 #ifdef __KERNEL_DEBUG__
 	PASS_BVH_TRAVERSAL_STEPS = (1 << 26),
 #endif
+	PASS_ADAPTIVE_SAMPLING = (1 << 27), /* internal, not written to render result */
 } PassType;
 
 #define PASS_ALL (~0)
@@ -857,7 +861,7 @@ typedef struct KernelFilm {
 	int pass_shadow;
 	float pass_shadow_scale;
 	int filter_table_offset;
-	int pass_pad2;
+	int pass_adaptive_sampling;
 
 	int pass_mist;
 	float mist_start;
@@ -946,6 +950,14 @@ typedef struct KernelIntegrator {
 	int volume_max_steps;
 	float volume_step_size;
 	int volume_samples;
+
+	/* adaptive sampling */
+	float adaptive_threshold;
+	int adaptive_min_samples;
+
+	/* light tree */
+	int use_light_tree;
+	int light_tree_num_lamps;
 } KernelIntegrator;
 
 typedef struct KernelBVH {
@@ -562,6 +562,8 @@ ccl_device VolumeIntegrateResult kernel_volume_integrate_heterogeneous_distance(
 ccl_device_noinline VolumeIntegrateResult kernel_volume_integrate(KernelGlobals *kg,
 	PathState *state, ShaderData *sd, Ray *ray, PathRadiance *L, float3 *throughput, RNG *rng, bool heterogeneous)
 {
+	PROFILING_INIT(kg, PROFILING_VOLUME_INTEGRATE);
+
 	/* workaround to fix correlation bug in T38710, can find better solution
 	 * in random number generator later, for now this is done here to not impact
 	 * performance of rendering without volumes */
@@ -958,6 +960,8 @@ ccl_device void kernel_volume_stack_init(KernelGlobals *kg,
                                          Ray *ray,
                                          VolumeStack *stack)
 {
+	PROFILING_INIT(kg, PROFILING_INTERSECT_VOLUME);
+
 	/* NULL ray happens in the baker, does it need proper initialization of
 	 * camera in volume?
 	 */
@@ -136,10 +136,11 @@ ccl_device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y,
 #ifdef __KERNEL_SSE2__
 	ssef r_ssef;
 	float4 &r = (float4 &)r_ssef;
-	r = kernel_tex_image_interp(id, x, y);
 #else
-	float4 r = kernel_tex_image_interp(id, x, y);
+	float4 r;
 #endif
+	if(!(kg->image_cache && kg->image_cache->lookup(id, x, y, &r)))
+		r = kernel_tex_image_interp(id, x, y);
 #else
 	float4 r;
 
@@ -156,6 +156,36 @@ bool RenderBuffers::copy_from_device()
 	return true;
 }
 
+bool RenderBuffers::get_adaptive_samples_saved(int sample, uint64_t& saved)
+{
+	int pass_offset = 0;
+
+	foreach(Pass& pass, params.passes) {
+		if(pass.type != PASS_ADAPTIVE_SAMPLING) {
+			pass_offset += pass.components;
+			continue;
+		}
+
+		/* second component holds the sample at which the pixel converged */
+		float *in = (float*)buffer.data_pointer + pass_offset + 1;
+		int pass_stride = params.get_passes_size();
+		int size = params.width*params.height;
+
+		saved = 0;
+
+		for(int i = 0; i < size; i++, in += pass_stride) {
+			int converged = (int)*in;
+
+			if(converged > 0 && converged < sample)
+				saved += sample - converged;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
 bool RenderBuffers::get_pass_rect(PassType type, float exposure, int sample, int components, float *pixels)
 {
 	int pass_offset = 0;
@@ -80,6 +80,7 @@ public:
 
 	bool copy_from_device();
 	bool get_pass_rect(PassType type, float exposure, int sample, int components, float *pixels);
+	bool get_adaptive_samples_saved(int sample, uint64_t& saved);
 
 protected:
 	void device_free();
@@ -146,6 +146,10 @@ void Pass::add(PassType type, vector<Pass>& passes)
 		case PASS_LIGHT:
 			/* ignores */
 			break;
+		case PASS_ADAPTIVE_SAMPLING:
+			pass.components = 2;
+			pass.filter = false;
+			break;
 #ifdef WITH_CYCLES_DEBUG
 		case PASS_BVH_TRAVERSAL_STEPS:
 			pass.components = 1;
@@ -394,6 +398,9 @@ void Film::device_update(Device *device, DeviceScene *dscene, Scene *scene)
 			case PASS_LIGHT:
 				kfilm->use_light_pass = 1;
 				break;
+			case PASS_ADAPTIVE_SAMPLING:
+				kfilm->pass_adaptive_sampling = kfilm->pass_stride;
+				break;
 
 #ifdef WITH_CYCLES_DEBUG
 			case PASS_BVH_TRAVERSAL_STEPS:
@@ -18,22 +18,198 @@
 #include "image.h"
 #include "scene.h"
 
+#include "kernel_image_cache.h"
+
 #include "util_foreach.h"
 #include "util_image.h"
+#include "util_logging.h"
 #include "util_path.h"
 #include "util_progress.h"
 
+#include <OpenImageIO/texture.h>
+
 #ifdef WITH_OSL
 #include <OSL/oslexec.h>
 #endif
 
 CCL_NAMESPACE_BEGIN
 
+/* Image Cache
+ *
+ * Streams file images through an OIIO texture system, which reads them in
+ * tiles and keeps only recently used tiles in memory, up to a fixed budget.
+ * Used for the CPU SVM kernel in place of fully loading every image.
+ *
+ * There is no mip level selection. SVM has no texture coordinate derivatives
+ * to compute a filter footprint from, so every lookup reads tiles of the full
+ * resolution image, and no MIP levels are generated for untiled files. The
+ * cache lowers memory use, not the amount of data read for distant or
+ * minified textures. */
+
+class ImageCache : public KernelImageCache {
+public:
+	ImageCache(int max_memory_mb)
+	{
+		ts = TextureSystem::create(false);
+		ts->attribute("automip", 0);
+		ts->attribute("autotile", 64);
+		ts->attribute("gray_to_rgb", 1);
+		ts->attribute("max_memory_MB", (float)max_memory_mb);
+	}
+
+	~ImageCache()
+	{
+		TextureSystem::destroy(ts);
+	}
+
+	bool add_image(int slot, ImageManager::Image *img)
+	{
+		if(img->builtin_data || img->filename == "")
+			return false;
+
+		ustring filename(img->filename);
+		ImageSpec spec;
+
+		/* 3D textures and CMYK jpegs are only handled by the regular loader */
+		if(!ts->get_imagespec(filename, 0, spec))
+			return false;
+		if(spec.depth > 1 || !(spec.nchannels >= 1 && spec.nchannels <= 4))
+			return false;
+		if(spec.nchannels == 4) {
+			const char *fileformat = NULL;
+
+			if(ts->get_texture_info(filename, 0, ustring("fileformat"), TypeDesc::TypeString, &fileformat) &&
+			   fileformat && strcmp(fileformat, "jpeg") == 0)
+				return false;
+		}
+
+		CachedImage cached;
+		cached.handle = ts->get_texture_handle(filename);
+		cached.use_alpha = img->use_alpha;
+
+		switch(img->interpolation) {
+			case INTERPOLATION_CLOSEST: cached.interpmode = TextureOpt::InterpClosest; break;
+			case INTERPOLATION_CUBIC: cached.interpmode = TextureOpt::InterpBicubic; break;
+			case INTERPOLATION_SMART: cached.interpmode = TextureOpt::InterpSmartBicubic; break;
+			default: cached.interpmode = TextureOpt::InterpBilinear; break;
+		}
+
+		if(!cached.handle)
+			return false;
+
+		thread_scoped_lock lock(images_mutex);
+
+		if(slot >= images.size())
+			images.resize(slot + 1);
+
+		/* image is reloaded, drop any tiles still cached from the old file */
+		if(images[slot].handle)
+			ts->invalidate(filename);
+
+		images[slot] = cached;
+
+		return true;
+	}
+
+	void remove_image(int slot)
+	{
+		thread_scoped_lock lock(images_mutex);
+
+		if(slot < images.size())
+			images[slot] = CachedImage();
+	}
+
+	bool lookup(int slot, float x, float y, float4 *result)
+	{
+		if(slot >= images.size() || !images[slot].handle)
+			return false;
+
+		const CachedImage& cached = images[slot];
+		TextureOpt opt;
+		float rgba[4];
+
+		opt.swrap = TextureOpt::WrapPeriodic;
+		opt.twrap = TextureOpt::WrapPeriodic;
+		opt.interpmode = cached.interpmode;
+		opt.fill = 1.0f;
+
+		/* zero derivatives, always level 0, see above. images are stored
+		 * flipped in memory, hence 1 - y. */
+#if OIIO_VERSION < 10500
+		opt.nchannels = 4;
+		bool status = ts->texture(cached.handle, ts->get_perthread_info(),
+		                          opt, x, 1.0f - y, 0.0f, 0.0f, 0.0f, 0.0f,
+		                          rgba);
+#else
+		bool status = ts->texture(cached.handle, ts->get_perthread_info(),
+		                          opt, x, 1.0f - y, 0.0f, 0.0f, 0.0f, 0.0f,
+		                          4, rgba);
+#endif
+
+		if(!status) {
+			*result = make_float4(TEX_IMAGE_MISSING_R, TEX_IMAGE_MISSING_G, TEX_IMAGE_MISSING_B, TEX_IMAGE_MISSING_A);
+			return true;
+		}
+
+		if(!cached.use_alpha) {
+			/* match the regular loader, which reads unassociated colors and
+			 * ignores alpha for these images */
+			if(rgba[3] != 0.0f && rgba[3] != 1.0f) {
+				float inv_alpha = 1.0f/rgba[3];
+				rgba[0] *= inv_alpha;
+				rgba[1] *= inv_alpha;
+				rgba[2] *= inv_alpha;
+			}
+
+			rgba[3] = 1.0f;
+		}
+
+		*result = make_float4(rgba[0], rgba[1], rgba[2], rgba[3]);
+		return true;
+	}
+
+	string stats()
+	{
+		return ts->getstats();
+	}
+
+	void collect_statistics(Stats *stats)
+	{
+		int tiles_created = 0;
+		long long find_tile_calls = 0, bytes_read = 0;
+
+		ts->getattribute("stat:tiles_created", TypeDesc::INT, &tiles_created);
+		ts->getattribute("stat:find_tile_calls", TypeDesc::LONGLONG, &find_tile_calls);
+		ts->getattribute("stat:bytes_read", TypeDesc::LONGLONG, &bytes_read);
+
+		stats->image_cache_tiles_loaded = tiles_created;
+		stats->image_cache_tile_lookups = find_tile_calls;
+		stats->image_cache_bytes_read = bytes_read;
+	}
+
+private:
+	struct CachedImage {
+		CachedImage() : handle(NULL), use_alpha(true), interpmode(TextureOpt::InterpBilinear) {}
+
+		TextureSystem::TextureHandle *handle;
+		bool use_alpha;
+		TextureOpt::InterpMode interpmode;
+	};
+
+	TextureSystem *ts;
+	vector<CachedImage> images;
+	thread_mutex images_mutex;
+};
+
+/* Image Manager */
+
 ImageManager::ImageManager()
 {
 	need_update = true;
 	pack_images = false;
 	osl_texture_system = NULL;
+	image_cache = NULL;
+	compact_images = false;
 	animation_frame = 0;
 
 	tex_num_images = TEX_NUM_IMAGES;
@@ -47,6 +223,8 @@ ImageManager::~ImageManager()
 		assert(!images[slot]);
 	for(size_t slot = 0; slot < float_images.size(); slot++)
 		assert(!float_images[slot]);
+
+	delete image_cache;
 }
 
 void ImageManager::set_pack_images(bool pack_images_)
@@ -54,11 +232,28 @@ void ImageManager::set_pack_images(bool pack_images_)
 	pack_images = pack_images_;
 }
 
+void ImageManager::set_compact_images(bool compact_images_)
+{
+	compact_images = compact_images_;
+}
+
 void ImageManager::set_osl_texture_system(void *texture_system)
 {
 	osl_texture_system = texture_system;
 }
 
+void ImageManager::set_texture_cache_size(int max_memory_mb)
+{
+	delete image_cache;
+	image_cache = (max_memory_mb > 0)? new ImageCache(max_memory_mb): NULL;
+}
+
+void ImageManager::collect_statistics(Stats *stats)
+{
+	if(image_cache)
+		image_cache->collect_statistics(stats);
+}
+
 void ImageManager::set_extended_image_limits(const DeviceInfo& info)
 {
 	if(info.type == DEVICE_CPU) {
@@ -612,6 +807,196 @@ bool ImageManager::file_load_float_image(Image *img, device_vector<float4>& tex_
 	return true;
 }
 
+static TypeDesc image_storage_type(uchar) { return TypeDesc::UINT8; }
+static TypeDesc image_storage_type(half) { return TypeDesc::HALF; }
+static TypeDesc image_storage_type(float) { return TypeDesc::FLOAT; }
+
+/* Load a file image without expanding it to float4 or uchar4. Storage with
+ * one channel is only used for single channel files, storage with four
+ * channels gets greyscale + alpha and RGB expanded like the regular loaders. */
+template<typename StorageType, typename T>
+bool ImageManager::file_load_compact_image(Image *img, T one, device_vector<StorageType>& tex_img)
+{
+	const int storage_channels = sizeof(StorageType)/sizeof(T);
+
+	ImageInput *in = ImageInput::create(img->filename);
+
+	if(!in)
+		return false;
+
+	ImageSpec spec = ImageSpec();
+	ImageSpec config = ImageSpec();
+
+	if(img->use_alpha == false)
+		config.attribute("oiio:UnassociatedAlpha", 1);
+
+	if(!in->open(img->filename, spec, config)) {
+		delete in;
+		return false;
+	}
+
+	int width = spec.width;
+	int height = spec.height;
+	int depth = spec.depth;
+	int components = spec.nchannels;
+
+	if(components < 1 || components > storage_channels || width == 0 || height == 0) {
+		in->close();
+		delete in;
+		return false;
+	}
+
+	T *pixels = (T*)tex_img.resize(width, height, depth);
+
+	if(depth <= 1) {
+		int scanlinesize = width*components*sizeof(T);
+
+		in->read_image(image_storage_type(one),
+			(uchar*)pixels + (height-1)*scanlinesize,
+			AutoStride,
+			-scanlinesize,
+			AutoStride);
+	}
+	else {
+		in->read_image(image_storage_type(one), (uchar*)pixels);
+	}
+
+	in->close();
+	delete in;
+
+	if(storage_channels == 4) {
+		if(components == 1) {
+			/* grayscale */
+			for(int i = width*height*depth-1; i >= 0; i--) {
+				pixels[i*4+3] = one;
+				pixels[i*4+2] = pixels[i];
+				pixels[i*4+1] = pixels[i];
+				pixels[i*4+0] = pixels[i];
+			}
+		}
+		else if(components == 2) {
+			/* grayscale + alpha */
+			for(int i = width*height*depth-1; i >= 0; i--) {
+				pixels[i*4+3] = pixels[i*2+1];
+				pixels[i*4+2] = pixels[i*2+0];
+				pixels[i*4+1] = pixels[i*2+0];
+				pixels[i*4+0] = pixels[i*2+0];
+			}
+		}
+		else if(components == 3) {
+			/* RGB */
+			for(int i = width*height*depth-1; i >= 0; i--) {
+				pixels[i*4+3] = one;
+				pixels[i*4+2] = pixels[i*3+2];
+				pixels[i*4+1] = pixels[i*3+1];
+				pixels[i*4+0] = pixels[i*3+0];
+			}
+		}
+
+		if(img->use_alpha == false) {
+			for(int i = width*height*depth-1; i >= 0; i--) {
+				pixels[i*4+3] = one;
+			}
+		}
+	}
+
+	return true;
+}
+
+/* Single channel images and half float images on the CPU are stored as they
+ * are in the file, instead of as float4 or uchar4. Returns false when the
+ * image needs regular storage. */
+bool ImageManager::device_load_compact_image(Device *device, DeviceScene *dscene, int slot, Image *img, bool is_float)
+{
+	ImageInput *in = ImageInput::create(img->filename);
+
+	if(!in)
+		return false;
+
+	ImageSpec spec;
+
+	if(!in->open(img->filename, spec)) {
+		delete in;
+		return false;
+	}
+
+	int components = spec.nchannels;
+	bool is_half = spec.format == TypeDesc::HALF;
+
+	in->close();
+	delete in;
+
+	device_memory *tex_mem;
+	string name;
+
+	if(!is_float && components == 1) {
+		device_vector<uchar>& tex_img = dscene->tex_byte1_image[slot - tex_image_byte_start];
+
+		device_free_compact_image(device, dscene, slot);
+		if(!file_load_compact_image(img, (uchar)255, tex_img))
+			return false;
+
+		tex_mem = &tex_img;
+		name = string_printf("__tex_image_byte1_%03d", slot);
+	}
+	else if(is_float && components == 1) {
+		device_vector<float>& tex_img = dscene->tex_float1_image[slot];
+
+		device_free_compact_image(device, dscene, slot);
+		if(!file_load_compact_image(img, 1.0f, tex_img))
+			return false;
+
+		tex_mem = &tex_img;
+		name = string_printf("__tex_image_float1_%03d", slot);
+	}
+	else if(is_float && is_half && components <= 4) {
+		device_vector<half4>& tex_img = dscene->tex_half4_image[slot];
+
+		device_free_compact_image(device, dscene, slot);
+		if(!file_load_compact_image(img, (half)0x3C00, tex_img))
+			return false;
+
+		tex_mem = &tex_img;
+		name = string_printf("__tex_image_half4_%03d", slot);
+	}
+	else
+		return false;
+
+	thread_scoped_lock device_lock(device_mutex);
+
+	/* free regular storage from an earlier load of this slot */
+	if(is_float) {
+		device->tex_free(dscene->tex_float_image[slot]);
+		dscene->tex_float_image[slot].clear();
+	}
+	else {
+		device->tex_free(dscene->tex_image[slot - tex_image_byte_start]);
+		dscene->tex_image[slot - tex_image_byte_start].clear();
+	}
+
+	device->tex_alloc(name.c_str(), *tex_mem, img->interpolation, true);
+
+	return true;
+}
+
+void ImageManager::device_free_compact_image(Device *device, DeviceScene *dscene, int slot)
+{
+	thread_scoped_lock device_lock(device_mutex);
+
+	if(slot >= tex_image_byte_start) {
+		device_vector<uchar>& tex_img = dscene->tex_byte1_image[slot - tex_image_byte_start];
+
+		device->tex_free(tex_img);
+		tex_img.clear();
+	}
+	else {
+		device->tex_free(dscene->tex_half4_image[slot]);
+		device->tex_free(dscene->tex_float1_image[slot]);
+		dscene->tex_half4_image[slot].clear();
+		dscene->tex_float1_image[slot].clear();
+	}
+}
+
 void ImageManager::device_load_image(Device *device, DeviceScene *dscene, int slot, Progress *progress)
 {
 	if(progress->get_cancel())
@@ -632,6 +1017,23 @@ void ImageManager::device_load_image(Device *device, DeviceScene *dscene, int sl
 	if(osl_texture_system && !img->builtin_data)
 		return;
 
+	if(image_cache && image_cache->add_image(slot, img)) {
+		/* pixels are read on demand while rendering */
+		img->need_load = false;
+		return;
+	}
+
+	if(compact_images && !img->builtin_data) {
+		progress->set_status("Updating Images", "Loading " + path_filename(img->filename));
+
+		if(device_load_compact_image(device, dscene, slot, img, is_float)) {
+			img->need_load = false;
+			return;
+		}
+
+		device_free_compact_image(device, dscene, slot);
+	}
+
 	if(is_float) {
 		string filename = path_filename(float_images[slot]->filename);
 		progress->set_status("Updating Images", "Loading " + filename);
@@ -715,6 +1117,9 @@ void ImageManager::device_free_image(Device *device, DeviceScene *dscene, int sl
 	}
 
 	if(img) {
+		if(image_cache)
+			image_cache->remove_image(slot);
+
 		if(osl_texture_system && !img->builtin_data) {
 #ifdef WITH_OSL
 			ustring filename(images[slot]->filename);
@@ -731,6 +1136,9 @@ void ImageManager::device_free_image(Device *device, DeviceScene *dscene, int sl
 
 			tex_img.clear();
 
+			if(compact_images)
+				device_free_compact_image(device, dscene, slot);
+
 			delete float_images[slot];
 			float_images[slot] = NULL;
 		}
@@ -744,6 +1152,9 @@ void ImageManager::device_free_image(Device *device, DeviceScene *dscene, int sl
 
 			tex_img.clear();
 
+			if(compact_images)
+				device_free_compact_image(device, dscene, slot);
+
 			delete images[slot - tex_image_byte_start];
 			images[slot - tex_image_byte_start] = NULL;
 		}
@@ -785,6 +1196,9 @@ void ImageManager::device_update(Device *device, DeviceScene *dscene, Progress&
 
 	pool.wait_work();
 
+	if(image_cache)
+		device->image_cache_set(image_cache);
+
 	if(pack_images)
 		device_pack_images(device, dscene, progress);
 
@@ -868,6 +1282,11 @@ void ImageManager::device_free(Device *device, DeviceScene *dscene)
 	dscene->tex_image_packed.clear();
 	dscene->tex_image_packed_info.clear();
 
+	if(image_cache) {
+		VLOG(1) << "Image cache statistics:\n" << image_cache->stats();
+		device->image_cache_set(NULL);
+	}
+
 	images.clear();
 	float_images.clear();
 }
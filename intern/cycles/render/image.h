@@ -48,7 +48,9 @@ CCL_NAMESPACE_BEGIN
 
 class Device;
 class DeviceScene;
+class ImageCache;
 class Progress;
+class Stats;
 
 class ImageManager {
 public:
@@ -67,7 +69,10 @@ public:
 	void device_free_builtin(Device *device, DeviceScene *dscene);
 
 	void set_osl_texture_system(void *texture_system);
+	void set_texture_cache_size(int max_memory_mb);
+	void collect_statistics(Stats *stats);
 	void set_pack_images(bool pack_images_);
+	void set_compact_images(bool compact_images_);
 	void set_extended_image_limits(const DeviceInfo& info);
 	bool set_animation_frame_update(int frame);
 
@@ -100,10 +105,17 @@ private:
 	vector<Image*> images;
 	vector<Image*> float_images;
 	void *osl_texture_system;
+	ImageCache *image_cache;
 	bool pack_images;
+	bool compact_images;
 
 	bool file_load_image(Image *img, device_vector<uchar4>& tex_img);
 	bool file_load_float_image(Image *img, device_vector<float4>& tex_img);
+	template<typename StorageType, typename T>
+	bool file_load_compact_image(Image *img, T one, device_vector<StorageType>& tex_img);
+
+	bool device_load_compact_image(Device *device, DeviceScene *dscene, int slot, Image *img, bool is_float);
+	void device_free_compact_image(Device *device, DeviceScene *dscene, int slot);
 
 	void device_load_image(Device *device, DeviceScene *dscene, int slot, Progress *progess);
 	void device_free_image(Device *device, DeviceScene *dscene, int slot);
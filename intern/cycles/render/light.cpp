@@ -19,13 +19,17 @@
 #include "integrator.h"
 #include "film.h"
 #include "light.h"
+#include "light_tree.h"
 #include "mesh.h"
+#include "nodes.h"
 #include "object.h"
 #include "scene.h"
 #include "shader.h"
 
 #include "util_foreach.h"
+#include "util_logging.h"
 #include "util_progress.h"
+#include "util_time.h"
 
 CCL_NAMESPACE_BEGIN
 
@@ -374,6 +378,107 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 	}
 }
 
+/* Rough estimate of the power emitted by a lamp, used to guide the light tree.
+ * Only a constant emission node connected to the output is taken into account,
+ * other shaders fall back to unit strength. */
+static float light_tree_energy(Scene *scene, Light *light)
+{
+	Shader *shader = scene->shaders[light->shader];
+	float energy = 1.0f;
+
+	if(shader->graph) {
+		ShaderInput *surface = shader->graph->output()->input("Surface");
+
+		if(surface && surface->link && surface->link->parent->name == ustring("emission")) {
+			ShaderNode *emission = surface->link->parent;
+			ShaderInput *color = emission->input("Color");
+			ShaderInput *strength = emission->input("Strength");
+
+			if(!color->link)
+				energy *= average(color->value);
+			if(!strength->link)
+				energy *= strength->value.x;
+		}
+	}
+
+	/* same strength gives pi times more irradiance for area lamps */
+	if(light->type == LIGHT_AREA)
+		energy *= M_PI_F;
+
+	return fabsf(energy);
+}
+
+void LightManager::device_update_tree(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress)
+{
+	KernelIntegrator *kintegrator = &dscene->data.integrator;
+
+	kintegrator->use_light_tree = false;
+	kintegrator->light_tree_num_lamps = 0;
+
+	if(!scene->integrator->use_light_tree || !kintegrator->use_direct_light)
+		return;
+
+	/* distant and background lights have no position, they keep being
+	 * sampled uniformly with the other entries of the distribution */
+	vector<LightTreePrimitive> prims;
+
+	for(size_t i = 0; i < scene->lights.size(); i++) {
+		Light *light = scene->lights[i];
+		LightTreePrimitive prim;
+
+		if(light->type == LIGHT_POINT || light->type == LIGHT_SPOT) {
+			float3 radius = make_float3(light->size, light->size, light->size);
+
+			prim.bounds = BoundBox(light->co - radius, light->co + radius);
+
+			if(light->type == LIGHT_SPOT && len(light->dir) > 0.0f)
+				prim.cone = LightTreeCone(normalize(light->dir), light->spot_angle*0.5f, M_PI_2_F);
+			else
+				prim.cone = LightTreeCone(make_float3(0.0f, 0.0f, 1.0f), M_PI_F, M_PI_2_F);
+		}
+		else if(light->type == LIGHT_AREA) {
+			float3 axisu = light->axisu*(light->sizeu*light->size);
+			float3 axisv = light->axisv*(light->sizev*light->size);
+			float3 corner = light->co - 0.5f*axisu - 0.5f*axisv;
+
+			prim.bounds = BoundBox(corner);
+			prim.bounds.grow(corner + axisu);
+			prim.bounds.grow(corner + axisv);
+			prim.bounds.grow(corner + axisu + axisv);
+
+			if(len(light->dir) > 0.0f)
+				prim.cone = LightTreeCone(normalize(light->dir), 0.0f, M_PI_2_F);
+			else
+				prim.cone = LightTreeCone(make_float3(0.0f, 0.0f, 1.0f), M_PI_F, M_PI_2_F);
+		}
+		else
+			continue;
+
+		prim.energy = light_tree_energy(scene, light);
+		prim.lamp = i;
+		prims.push_back(prim);
+	}
+
+	if(prims.size() == 0)
+		return;
+
+	progress.set_status("Updating Lights", "Building light tree");
+
+	double time_start = time_dt();
+	LightTree tree(prims);
+
+	float4 *nodes = dscene->light_tree_nodes.resize(tree.num_nodes()*LIGHT_TREE_NODE_SIZE);
+	tree.pack(nodes);
+
+	device->tex_alloc("__light_tree_nodes", dscene->light_tree_nodes);
+
+	kintegrator->use_light_tree = true;
+	kintegrator->light_tree_num_lamps = prims.size();
+
+	VLOG(1) << "Built light tree over " << prims.size() << " lamps in "
+	        << time_dt() - time_start << " seconds.";
+}
+
 void LightManager::device_update_background(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress)
 {
 	KernelIntegrator *kintegrator = &dscene->data.integrator;
@@ -631,6 +736,9 @@ void LightManager::device_update(Device *device, DeviceScene *dscene, Scene *sce
 	device_update_distribution(device, dscene, scene, progress);
 	if(progress.get_cancel()) return;
 
+	device_update_tree(device, dscene, scene, progress);
+	if(progress.get_cancel()) return;
+
 	device_update_background(device, dscene, scene, progress);
 	if(progress.get_cancel()) return;
 
@@ -646,11 +754,13 @@ void LightManager::device_free(Device *device, DeviceScene *dscene)
 {
 	device->tex_free(dscene->light_distribution);
 	device->tex_free(dscene->light_data);
+	device->tex_free(dscene->light_tree_nodes);
 	device->tex_free(dscene->light_background_marginal_cdf);
 	device->tex_free(dscene->light_background_conditional_cdf);
 
 	dscene->light_distribution.clear();
 	dscene->light_data.clear();
+	dscene->light_tree_nodes.clear();
 	dscene->light_background_marginal_cdf.clear();
 	dscene->light_background_conditional_cdf.clear();
 }
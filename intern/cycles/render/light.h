@@ -78,6 +78,7 @@ public:
 protected:
 	void device_update_points(Device *device, DeviceScene *dscene, Scene *scene);
 	void device_update_distribution(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress);
+	void device_update_tree(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress);
 	void device_update_background(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress);
 };
 
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2011-2015 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <algorithm>
+
+#include "kernel_types.h"
+#include "light_tree.h"
+
+#include "util_math.h"
+#include "util_transform.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* number of bins per axis used to evaluate split candidates */
+#define LIGHT_TREE_BINS 12
+
+/* Orientation Cone */
+
+LightTreeCone LightTreeCone::merge(const LightTreeCone& cone_a, const LightTreeCone& cone_b)
+{
+	/* make a the cone with the widest spread */
+	const LightTreeCone& a = (cone_a.theta_o >= cone_b.theta_o)? cone_a: cone_b;
+	const LightTreeCone& b = (cone_a.theta_o >= cone_b.theta_o)? cone_b: cone_a;
+
+	float theta_d = acosf(clamp(dot(a.axis, b.axis), -1.0f, 1.0f));
+	float theta_e = max(a.theta_e, b.theta_e);
+
+	/* b is already contained in a */
+	if(min(theta_d + b.theta_o, M_PI_F) <= a.theta_o)
+		return LightTreeCone(a.axis, a.theta_o, theta_e);
+
+	float theta_o = (a.theta_o + theta_d + b.theta_o)*0.5f;
+	float3 rotation_axis = cross(a.axis, b.axis);
+
+	if(theta_o >= M_PI_F || len(rotation_axis) < 1e-6f)
+		return LightTreeCone(a.axis, M_PI_F, theta_e);
+
+	/* rotate axis of a towards b so the new cone bounds both */
+	Transform rotation = transform_rotate(theta_o - a.theta_o, normalize(rotation_axis));
+	float3 axis = normalize(transform_direction(&rotation, a.axis));
+
+	return LightTreeCone(axis, theta_o, theta_e);
+}
+
+float LightTreeCone::measure() const
+{
+	/* integral of the cosine weighted solid angle covered by the cone */
+	float theta_w = min(theta_o + theta_e, M_PI_F);
+	float sin_theta_o = sinf(theta_o);
+	float cos_theta_o = cosf(theta_o);
+
+	return M_2PI_F*(1.0f - cos_theta_o) +
+	       M_PI_2_F*(2.0f*theta_w*sin_theta_o - cosf(theta_o - 2.0f*theta_w) -
+	                 2.0f*theta_o*sin_theta_o + cos_theta_o);
+}
+
+/* Light Tree */
+
+static float light_tree_bounds_measure(const BoundBox& bounds)
+{
+	/* squared diagonal rather than surface area, so point lights that have
+	 * zero volume bounds still give meaningful split costs */
+	float3 size = bounds.size();
+	return dot(size, size);
+}
+
+LightTree::LightTree(const vector<LightTreePrimitive>& primitives)
+: prims(primitives)
+{
+	if(prims.size()) {
+		nodes.reserve(prims.size()*2 - 1);
+		recursive_build(0, prims.size());
+	}
+}
+
+int LightTree::recursive_build(int start, int end)
+{
+	int index = nodes.size();
+	nodes.push_back(Node());
+
+	BoundBox bounds = BoundBox::empty;
+	BoundBox centroid_bounds = BoundBox::empty;
+	LightTreeCone cone = prims[start].cone;
+	float energy = 0.0f;
+
+	for(int i = start; i < end; i++) {
+		bounds.grow(prims[i].bounds);
+		centroid_bounds.grow(prims[i].bounds.center());
+		cone = LightTreeCone::merge(cone, prims[i].cone);
+		energy += prims[i].energy;
+	}
+
+	nodes[index].bounds = bounds;
+	nodes[index].cone = cone;
+	nodes[index].energy = energy;
+
+	if(end - start == 1) {
+		nodes[index].leaf = true;
+		nodes[index].index = prims[start].lamp;
+		return index;
+	}
+
+	int mid = find_split(start, end, centroid_bounds);
+
+	recursive_build(start, mid);
+	int right = recursive_build(mid, end);
+
+	nodes[index].leaf = false;
+	nodes[index].index = right;
+
+	return index;
+}
+
+int LightTree::find_split(int start, int end, const BoundBox& centroid_bounds)
+{
+	float3 extent = centroid_bounds.size();
+	float max_extent = max(max(extent.x, extent.y), extent.z);
+
+	float best_cost = FLT_MAX;
+	int best_dim = -1, best_bin = 0;
+
+	for(int dim = 0; dim < 3; dim++) {
+		if(extent[dim] == 0.0f)
+			continue;
+
+		BoundBox bin_bounds[LIGHT_TREE_BINS];
+		LightTreeCone bin_cone[LIGHT_TREE_BINS];
+		float bin_energy[LIGHT_TREE_BINS];
+		int bin_count[LIGHT_TREE_BINS];
+
+		for(int b = 0; b < LIGHT_TREE_BINS; b++) {
+			bin_bounds[b] = BoundBox::empty;
+			bin_energy[b] = 0.0f;
+			bin_count[b] = 0;
+		}
+
+		float inv_extent = LIGHT_TREE_BINS/extent[dim];
+
+		for(int i = start; i < end; i++) {
+			float centroid = prims[i].bounds.center()[dim];
+			int b = min((int)((centroid - centroid_bounds.min[dim])*inv_extent), LIGHT_TREE_BINS - 1);
+
+			bin_bounds[b].grow(prims[i].bounds);
+			bin_cone[b] = (bin_count[b] == 0)? prims[i].cone: LightTreeCone::merge(bin_cone[b], prims[i].cone);
+			bin_energy[b] += prims[i].energy;
+			bin_count[b]++;
+		}
+
+		/* split before bin j, with regularization against thin nodes */
+		float regularization = max_extent/extent[dim];
+
+		for(int j = 1; j < LIGHT_TREE_BINS; j++) {
+			float cost[2] = {0.0f, 0.0f};
+			int count[2] = {0, 0};
+
+			for(int side = 0; side < 2; side++) {
+				BoundBox bounds = BoundBox::empty;
+				LightTreeCone cone;
+				float energy = 0.0f;
+				int b_start = (side == 0)? 0: j;
+				int b_end = (side == 0)? j: LIGHT_TREE_BINS;
+
+				for(int b = b_start; b < b_end; b++) {
+					if(bin_count[b] == 0)
+						continue;
+
+					bounds.grow(bin_bounds[b]);
+					cone = (count[side] == 0)? bin_cone[b]: LightTreeCone::merge(cone, bin_cone[b]);
+					energy += bin_energy[b];
+					count[side] += bin_count[b];
+				}
+
+				if(count[side])
+					cost[side] = energy*cone.measure()*light_tree_bounds_measure(bounds);
+			}
+
+			if(count[0] == 0 || count[1] == 0)
+				continue;
+
+			float split_cost = regularization*(cost[0] + cost[1]);
+
+			if(split_cost < best_cost) {
+				best_cost = split_cost;
+				best_dim = dim;
+				best_bin = j;
+			}
+		}
+	}
+
+	int mid = (start + end)/2;
+
+	if(best_dim != -1) {
+		/* partition primitives on the chosen bin boundary */
+		float inv_extent = LIGHT_TREE_BINS/extent[best_dim];
+		int left = start;
+
+		for(int i = start; i < end; i++) {
+			float centroid = prims[i].bounds.center()[best_dim];
+			int b = min((int)((centroid - centroid_bounds.min[best_dim])*inv_extent), LIGHT_TREE_BINS - 1);
+
+			if(b < best_bin)
+				std::swap(prims[i], prims[left++]);
+		}
+
+		if(left != start && left != end)
+			mid = left;
+	}
+
+	return mid;
+}
+
+void LightTree::pack(float4 *data) const
+{
+	for(size_t i = 0; i < nodes.size(); i++) {
+		const Node& node = nodes[i];
+		int index = (node.leaf)? ~node.index: node.index;
+
+		data[i*LIGHT_TREE_NODE_SIZE + 0] = make_float4(node.bounds.min.x, node.bounds.min.y, node.bounds.min.z, node.energy);
+		data[i*LIGHT_TREE_NODE_SIZE + 1] = make_float4(node.bounds.max.x, node.bounds.max.y, node.bounds.max.z, __int_as_float(index));
+		data[i*LIGHT_TREE_NODE_SIZE + 2] = make_float4(node.cone.axis.x, node.cone.axis.y, node.cone.axis.z, node.cone.theta_o);
+		data[i*LIGHT_TREE_NODE_SIZE + 3] = make_float4(node.cone.theta_e, 0.0f, 0.0f, 0.0f);
+	}
+}
+
+CCL_NAMESPACE_END
+
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2011-2015 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#ifndef __LIGHT_TREE_H__
+#define __LIGHT_TREE_H__
+
+#include "util_boundbox.h"
+#include "util_types.h"
+#include "util_vector.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Light Tree
+ *
+ * Binary hierarchy over lamps with spatial and orientation bounds, used to
+ * pick a lamp proportional to its estimated contribution at the shading
+ * point. Each leaf holds a single lamp, nodes are stored depth first so the
+ * left child of a node directly follows it. */
+
+/* Bounds on the emission directions of a group of lights: all lights emit
+ * within theta_e of some direction inside the cone of angle theta_o around
+ * axis. */
+struct LightTreeCone {
+	float3 axis;
+	float theta_o;
+	float theta_e;
+
+	LightTreeCone() {}
+	LightTreeCone(const float3& axis_, float theta_o_, float theta_e_)
+	: axis(axis_), theta_o(theta_o_), theta_e(theta_e_) {}
+
+	static LightTreeCone merge(const LightTreeCone& a, const LightTreeCone& b);
+	float measure() const;
+};
+
+struct LightTreePrimitive {
+	BoundBox bounds;
+	LightTreeCone cone;
+	float energy;
+	int lamp;
+};
+
+class LightTree {
+public:
+	LightTree(const vector<LightTreePrimitive>& primitives);
+
+	size_t num_nodes() const { return nodes.size(); }
+	void pack(float4 *data) const;
+
+protected:
+	struct Node {
+		BoundBox bounds;
+		LightTreeCone cone;
+		float energy;
+		/* right child for inner nodes, lamp index for leaves */
+		int index;
+		bool leaf;
+	};
+
+	int recursive_build(int start, int end);
+	int find_split(int start, int end, const BoundBox& centroid_bounds);
+
+	vector<LightTreePrimitive> prims;
+	vector<Node> nodes;
+};
+
+CCL_NAMESPACE_END
+
+#endif /* __LIGHT_TREE_H__ */
+
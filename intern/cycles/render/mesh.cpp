@@ -30,8 +30,10 @@
 
 #include "util_cache.h"
 #include "util_foreach.h"
+#include "util_logging.h"
 #include "util_progress.h"
 #include "util_set.h"
+#include "util_time.h"
 
 CCL_NAMESPACE_BEGIN
 
@@ -505,8 +507,13 @@ void Mesh::compute_bvh(SceneParams *params, Progress *progress, int n, int total
 			progress->set_status(msg, "Refitting BVH");
 			bvh->objects = objects;
 			bvh->refit(*progress);
+
+			/* rebuild when refitting degraded the tree too much */
+			if(params->bvh_refit_threshold > 0.0f && bvh->refit_degradation() > params->bvh_refit_threshold)
+				need_update_rebuild = true;
 		}
-		else {
+
+		if(!bvh || need_update_rebuild) {
 			progress->set_status(msg, "Building BVH");
 
 			BVHParams bparams;
@@ -555,6 +562,8 @@ MeshManager::MeshManager()
 {
 	bvh = NULL;
 	need_update = true;
+	need_bvh_rebuild = true;
+	bvh_time = 0.0;
 }
 
 MeshManager::~MeshManager()
@@ -975,20 +984,91 @@ void MeshManager::device_update_mesh(Device *device, DeviceScene *dscene, Scene
 	}
 }
 
+bool MeshManager::bvh_can_refit(Scene *scene)
+{
+	if(!bvh || need_bvh_rebuild || !scene->params.use_bvh_refit)
+		return false;
+	if(bvh->objects != scene->objects || bvh_objects.size() != scene->objects.size())
+		return false;
+
+	for(size_t i = 0; i < scene->objects.size(); i++) {
+		const Mesh *mesh = scene->objects[i]->mesh;
+		const BVHObject& bob = bvh_objects[i];
+
+		if(bob.mesh != mesh ||
+		   bob.transform_applied != mesh->transform_applied ||
+		   bob.tri_offset != mesh->tri_offset ||
+		   bob.curve_offset != mesh->curve_offset)
+			return false;
+	}
+
+	return true;
+}
+
 void MeshManager::device_update_bvh(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress)
 {
-	/* bvh build */
-	progress.set_status("Updating Scene BVH", "Building");
+	double time_start = time_dt();
+	bool refit = bvh_can_refit(scene);
 
-	BVHParams bparams;
-	bparams.top_level = true;
-	bparams.use_qbvh = scene->params.use_qbvh;
-	bparams.use_spatial_split = scene->params.use_bvh_spatial_split;
-	bparams.use_cache = scene->params.use_bvh_cache;
+	if(refit) {
+		/* bvh refit, same topology as the previous update */
+		progress.set_status("Updating Scene BVH", "Refitting");
 
-	delete bvh;
-	bvh = BVH::create(bparams, scene->objects);
-	bvh->build(progress);
+		bvh->refit(progress);
+
+		if(progress.get_cancel()) {
+			need_bvh_rebuild = true;
+			return;
+		}
+
+		float threshold = scene->params.bvh_refit_threshold;
+
+		if(threshold > 0.0f && bvh->refit_degradation() > threshold) {
+			VLOG(1) << "Top level BVH cost increased " << bvh->refit_degradation()
+			        << " times by refitting, rebuilding.";
+			refit = false;
+		}
+	}
+
+	if(!refit) {
+		/* bvh build */
+		progress.set_status("Updating Scene BVH", "Building");
+
+		BVHParams bparams;
+		bparams.top_level = true;
+		bparams.use_qbvh = scene->params.use_qbvh;
+		bparams.use_spatial_split = scene->params.use_bvh_spatial_split;
+		bparams.use_cache = scene->params.use_bvh_cache;
+
+		delete bvh;
+		bvh = BVH::create(bparams, scene->objects);
+		bvh->build(progress);
+
+		if(progress.get_cancel()) {
+			/* partially built, never refit it */
+			need_bvh_rebuild = true;
+			return;
+		}
+
+		bvh_objects.resize(scene->objects.size());
+
+		for(size_t i = 0; i < scene->objects.size(); i++) {
+			Mesh *mesh = scene->objects[i]->mesh;
+			BVHObject& bob = bvh_objects[i];
+
+			bob.mesh = mesh;
+			bob.transform_applied = mesh->transform_applied;
+			bob.tri_offset = mesh->tri_offset;
+			bob.curve_offset = mesh->curve_offset;
+		}
+
+		need_bvh_rebuild = false;
+	}
+
+	bvh_time += time_dt() - time_start;
+
+	VLOG(1) << (refit? "Refit": "Built") << " top level BVH in "
+	        << time_dt() - time_start << " seconds.";
 
 	if(progress.get_cancel()) return;
 
@@ -1086,10 +1166,17 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 	/* update bvh */
 	size_t i = 0, num_bvh = 0;
 
-	foreach(Mesh *mesh, scene->meshes)
+	foreach(Mesh *mesh, scene->meshes) {
 		if(mesh->need_update && !mesh->transform_applied)
 			num_bvh++;
 
+		/* the top level BVH can only be refit when no primitives were added or
+		 * removed, and instanced BVH's merged into it did not change */
+		if(mesh->need_update && (mesh->need_update_rebuild || !mesh->transform_applied))
+			need_bvh_rebuild = true;
+	}
+
+	double time_start = time_dt();
 	TaskPool pool;
 
 	foreach(Mesh *mesh, scene->meshes) {
@@ -1100,6 +1187,11 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 	}
 
 	pool.wait_work();
+
+	bvh_time = time_dt() - time_start;
+
+	if(num_bvh)
+		VLOG(1) << "Updated " << num_bvh << " mesh BVHs in " << bvh_time << " seconds.";
 	
 	foreach(Shader *shader, scene->shaders)
 		shader->need_update_attributes = false;
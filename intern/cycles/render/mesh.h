@@ -146,6 +146,21 @@ public:
 
 	bool need_update;
 
+	/* state of the objects the top level BVH was built for. when only vertex
+	 * positions and object bounds changed since, it can be refit instead */
+	struct BVHObject {
+		Mesh *mesh;
+		bool transform_applied;
+		size_t tri_offset;
+		size_t curve_offset;
+	};
+
+	vector<BVHObject> bvh_objects;
+	bool need_bvh_rebuild;
+
+	/* seconds spent building and refitting BVHs in the last update */
+	double bvh_time;
+
 	MeshManager();
 	~MeshManager();
 
@@ -160,6 +175,7 @@ public:
 	void device_update_mesh(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress);
 	void device_update_attributes(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress);
 	void device_update_bvh(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress);
+	bool bvh_can_refit(Scene *scene);
 	void device_free(Device *device, DeviceScene *dscene);
 
 	void tag_update(Scene *scene);
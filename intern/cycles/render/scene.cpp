@@ -65,6 +65,13 @@ Scene::Scene(const SceneParams& params_, const DeviceInfo& device_info_)
 
 	/* Extended image limits for CPU and GPUs */
 	image_manager->set_extended_image_limits(device_info_);
+
+	/* Greyscale and half float images in their own storage type, CPU only */
+	image_manager->set_compact_images(device_info_.type == DEVICE_CPU && params.use_compact_images);
+
+	/* Stream file images from disk, SVM on the CPU only */
+	if(device_info_.type == DEVICE_CPU && params.shadingsystem == SHADINGSYSTEM_SVM)
+		image_manager->set_texture_cache_size(params.texture_cache_size);
 }
 
 Scene::~Scene()
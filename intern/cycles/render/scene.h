@@ -90,6 +90,7 @@ public:
 	/* lights */
 	device_vector<float4> light_distribution;
 	device_vector<float4> light_data;
+	device_vector<float4> light_tree_nodes;
 	device_vector<float2> light_background_marginal_cdf;
 	device_vector<float2> light_background_conditional_cdf;
 
@@ -111,6 +112,11 @@ public:
 	device_vector<uchar4> tex_image[TEX_EXTENDED_NUM_IMAGES_CPU];
 	device_vector<float4> tex_float_image[TEX_EXTENDED_NUM_FLOAT_IMAGES];
 
+	/* cpu images in compact storage, greyscale or half float */
+	device_vector<uchar> tex_byte1_image[TEX_EXTENDED_NUM_IMAGES_CPU];
+	device_vector<half4> tex_half4_image[TEX_EXTENDED_NUM_FLOAT_IMAGES];
+	device_vector<float> tex_float1_image[TEX_EXTENDED_NUM_FLOAT_IMAGES];
+
 	/* opencl images */
 	device_vector<uchar4> tex_image_packed;
 	device_vector<uint4> tex_image_packed_info;
@@ -127,7 +133,11 @@ public:
 	bool use_bvh_cache;
 	bool use_bvh_spatial_split;
 	bool use_qbvh;
+	bool use_bvh_refit;
+	float bvh_refit_threshold;
 	bool persistent_data;
+	int texture_cache_size;
+	bool use_compact_images;
 
 	SceneParams()
 	{
@@ -140,7 +150,11 @@ public:
 #else
 		use_qbvh = false;
 #endif
+		use_bvh_refit = false;
+		bvh_refit_threshold = 0.0f;
 		persistent_data = false;
+		texture_cache_size = 0;
+		use_compact_images = false;
 	}
 
 	bool modified(const SceneParams& params)
@@ -149,7 +163,11 @@ public:
 		&& use_bvh_cache == params.use_bvh_cache
 		&& use_bvh_spatial_split == params.use_bvh_spatial_split
 		&& use_qbvh == params.use_qbvh
-		&& persistent_data == params.persistent_data); }
+		&& use_bvh_refit == params.use_bvh_refit
+		&& bvh_refit_threshold == params.bvh_refit_threshold
+		&& persistent_data == params.persistent_data
+		&& texture_cache_size == params.texture_cache_size
+		&& use_compact_images == params.use_compact_images); }
 };
 
 /* Scene */
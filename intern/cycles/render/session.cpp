@@ -14,6 +14,8 @@
  * limitations under the License
  */
 
+#include <algorithm>
+#include <stdio.h>
 #include <string.h>
 #include <limits.h>
 
@@ -21,14 +23,17 @@
 #include "camera.h"
 #include "device.h"
 #include "integrator.h"
+#include "object.h"
 #include "scene.h"
 #include "session.h"
 #include "bake.h"
 
 #include "util_foreach.h"
 #include "util_function.h"
+#include "util_logging.h"
 #include "util_math.h"
 #include "util_opengl.h"
+#include "util_string.h"
 #include "util_task.h"
 #include "util_time.h"
 
@@ -36,12 +41,15 @@ CCL_NAMESPACE_BEGIN
 
 /* Note about  preserve_tile_device option for tile manager:
  * progressive refine and viewport rendering does requires tiles to
- * always be allocated for the same device
+ * always be allocated for the same device. The same goes for background
+ * renders written to an output file, those render into the session buffers
+ * of which every device owns a horizontal slice
  */
 Session::Session(const SessionParams& params_)
 : params(params_),
   tile_manager(params.progressive, params.samples, params.tile_size, params.start_resolution,
-       params.background == false || params.progressive_refine, params.background, params.tile_order,
+       !(params.background && params.output_path.empty()) || params.progressive_refine,
+       params.background && params.output_path.empty(), params.tile_order,
        max(params.device.multi_devices.size(), 1)),
   stats()
 {
@@ -69,6 +77,9 @@ Session::Session(const SessionParams& params_)
 	paused_time = 0.0;
 	last_update_time = 0.0;
 
+	adaptive_samples_saved = 0;
+	adaptive_samples_total = 0;
+
 	delayed_reset.do_reset = false;
 	delayed_reset.samples = 0;
 
@@ -458,6 +469,13 @@ void Session::release_tile(RenderTile& rtile)
 			/* todo: optimize this by making it thread safe and removing lock */
 			write_render_tile_cb(rtile);
 
+			/* buffers were copied from the device by the write callback */
+			uint64_t saved;
+			if(rtile.buffers->get_adaptive_samples_saved(rtile.sample, saved)) {
+				adaptive_samples_saved += saved;
+				adaptive_samples_total += (uint64_t)rtile.w*rtile.h*rtile.sample;
+			}
+
 			delete rtile.buffers;
 		}
 	}
@@ -627,10 +645,27 @@ void Session::run()
 		/* reset number of rendered samples */
 		progress.reset_sample();
 
+		if(params.profile) {
+			stats.profiler.reset();
+			stats.profiler.start();
+		}
+
 		if(device_use_gl)
 			run_gpu();
 		else
 			run_cpu();
+
+		scene->image_manager->collect_statistics(&stats);
+
+		if(params.profile) {
+			stats.profiler.stop();
+			profiling_report();
+		}
+
+		if(adaptive_samples_total > 0) {
+			VLOG(1) << "Adaptive sampling skipped " << adaptive_samples_saved
+			        << " of " << adaptive_samples_total << " samples.";
+		}
 	}
 
 	/* progress update */
@@ -660,6 +695,9 @@ void Session::reset_(BufferParams& buffer_params, int samples)
 
 	tile_manager.reset(buffer_params, samples);
 
+	adaptive_samples_saved = 0;
+	adaptive_samples_total = 0;
+
 	start_time = time_dt();
 	preview_time = 0.0;
 	paused_time = 0.0;
@@ -802,6 +840,11 @@ void Session::update_status_time(bool show_pause, bool show_done)
 
 			substatus += string_printf(", Sample %d/%d", sample, num_samples);
 		}
+
+		if(adaptive_samples_total > 0) {
+			substatus += string_printf(", Adaptive %.1f%% Samples Saved",
+				100.0 * (double)adaptive_samples_saved / (double)adaptive_samples_total);
+		}
 	}
 	else if(tile_manager.num_samples == USHRT_MAX)
 		substatus = string_printf("Path Tracing Sample %d", sample+1);
@@ -850,6 +893,7 @@ void Session::path_trace()
 	task.update_progress_sample = function_bind(&Session::update_progress_sample, this);
 	task.need_finish_queue = params.progressive_refine;
 	task.integrator_branched = scene->integrator->method == Integrator::BRANCHED_PATH;
+	task.integrator_wavefront = params.wavefront;
 
 	device->task_add(task);
 }
@@ -925,4 +969,147 @@ void Session::device_free()
 	 */
 }
 
+/* Profiling */
+
+struct ProfilingEntry {
+	string name;
+	uint64_t samples;
+
+	ProfilingEntry(const string& name_, uint64_t samples_)
+	: name(name_), samples(samples_) {}
+
+	bool operator<(const ProfilingEntry& other) const
+	{
+		return samples > other.samples;
+	}
+};
+
+struct ProfilingEntries {
+	vector<ProfilingEntry> events;
+	vector<ProfilingEntry> shaders;
+	vector<ProfilingEntry> objects;
+	uint64_t num_samples;
+	uint64_t num_shading_samples;
+};
+
+static void profiling_entries(Profiler& profiler, Scene *scene, ProfilingEntries& entries)
+{
+	thread_scoped_lock scene_lock(scene->mutex);
+
+	entries.num_samples = profiler.get_num_samples();
+	entries.num_shading_samples = profiler.get_event(PROFILING_SHADER_SURFACE) +
+	                              profiler.get_event(PROFILING_SHADER_VOLUME);
+
+	for(int i = 0; i < PROFILING_NUM_EVENTS; i++) {
+		ProfilingEvent event = (ProfilingEvent)i;
+		if(profiler.get_event(event))
+			entries.events.push_back(ProfilingEntry(Profiler::event_name(event), profiler.get_event(event)));
+	}
+
+	/* kernel shader ids are two per shader, with and without bump */
+	vector<uint64_t> shader_samples(scene->shaders.size(), 0);
+
+	for(int id = 0; id < profiler.get_num_shaders(); id++)
+		if(id/2 < (int)shader_samples.size())
+			shader_samples[id/2] += profiler.get_shader(id);
+
+	for(size_t i = 0; i < shader_samples.size(); i++)
+		if(shader_samples[i])
+			entries.shaders.push_back(ProfilingEntry(scene->shaders[i]->name, shader_samples[i]));
+
+	for(int i = 0; i < profiler.get_num_objects() && i < (int)scene->objects.size(); i++)
+		if(profiler.get_object(i))
+			entries.objects.push_back(ProfilingEntry(scene->objects[i]->name.string(), profiler.get_object(i)));
+
+	std::sort(entries.events.begin(), entries.events.end());
+	std::sort(entries.shaders.begin(), entries.shaders.end());
+	std::sort(entries.objects.begin(), entries.objects.end());
+}
+
+static void profiling_summary_append(string& summary, const char *title,
+                                     const vector<ProfilingEntry>& entries, uint64_t total)
+{
+	summary += string_printf("%s:\n", title);
+
+	foreach(const ProfilingEntry& entry, entries) {
+		double percent = (total)? 100.0*entry.samples/total: 0.0;
+		summary += string_printf("  %6.2f%%  %s\n", percent, entry.name.c_str());
+	}
+}
+
+static string profiling_json_string(const string& str)
+{
+	string result = "\"";
+
+	for(size_t i = 0; i < str.size(); i++) {
+		unsigned char c = str[i];
+
+		if(c == '"' || c == '\\')
+			result += string("\\") + (char)c;
+		else if(c < 0x20)
+			result += string_printf("\\u%04x", c);
+		else
+			result += (char)c;
+	}
+
+	return result + "\"";
+}
+
+static void profiling_json_append(FILE *f, const char *key, const vector<ProfilingEntry>& entries, bool last)
+{
+	fprintf(f, "  \"%s\": [", key);
+
+	for(size_t i = 0; i < entries.size(); i++) {
+		fprintf(f, "%s\n    {\"name\": %s, \"samples\": %llu}",
+		        (i == 0)? "": ",",
+		        profiling_json_string(entries[i].name).c_str(),
+		        (unsigned long long)entries[i].samples);
+	}
+
+	fprintf(f, "%s]%s\n", (entries.size())? "\n  ": "", (last)? "": ",");
+}
+
+string Session::profiling_summary()
+{
+	ProfilingEntries entries;
+	profiling_entries(stats.profiler, scene, entries);
+
+	string summary = string_printf("Profiling (%llu samples):\n", (unsigned long long)entries.num_samples);
+
+	/* shaders and objects are relative to the time spent shading */
+	profiling_summary_append(summary, "Events", entries.events, entries.num_samples);
+	profiling_summary_append(summary, "Shaders", entries.shaders, entries.num_shading_samples);
+	profiling_summary_append(summary, "Objects", entries.objects, entries.num_shading_samples);
+
+	return summary;
+}
+
+void Session::profiling_report()
+{
+	VLOG(1) << profiling_summary().c_str();
+
+	if(params.profile_path == "")
+		return;
+
+	FILE *f = fopen(params.profile_path.c_str(), "w");
+
+	if(!f) {
+		fprintf(stderr, "Cycles: failed to write profiling data to %s.\n", params.profile_path.c_str());
+		return;
+	}
+
+	ProfilingEntries entries;
+	profiling_entries(stats.profiler, scene, entries);
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"samples\": %llu,\n", (unsigned long long)entries.num_samples);
+	fprintf(f, "  \"shading_samples\": %llu,\n", (unsigned long long)entries.num_shading_samples);
+	profiling_json_append(f, "events", entries.events, false);
+	profiling_json_append(f, "shaders", entries.shaders, false);
+	profiling_json_append(f, "objects", entries.objects, true);
+	fprintf(f, "}\n");
+
+	fclose(f);
+}
+
 CCL_NAMESPACE_END
@@ -53,6 +53,10 @@ public:
 	TileOrder tile_order;
 	int start_resolution;
 	int threads;
+	bool wavefront;
+
+	bool profile;
+	string profile_path;
 
 	bool display_buffer_linear;
 
@@ -74,6 +78,10 @@ public:
 		tile_size = make_int2(64, 64);
 		start_resolution = INT_MAX;
 		threads = 0;
+		wavefront = false;
+
+		profile = false;
+		profile_path = "";
 
 		display_buffer_linear = false;
 
@@ -97,6 +105,9 @@ public:
 		&& tile_size == params.tile_size
 		&& start_resolution == params.start_resolution
 		&& threads == params.threads
+		&& wavefront == params.wavefront
+		&& profile == params.profile
+		&& profile_path == params.profile_path
 		&& display_buffer_linear == params.display_buffer_linear
 		&& cancel_timeout == params.cancel_timeout
 		&& reset_timeout == params.reset_timeout
@@ -142,6 +153,9 @@ public:
 
 	void device_free();
 
+	/* time spent per event, shader and object, when profiling was enabled */
+	string profiling_summary();
+
 protected:
 	struct DelayedReset {
 		thread_mutex mutex;
@@ -172,6 +186,8 @@ protected:
 
 	void update_progress_sample();
 
+	void profiling_report();
+
 	bool device_use_gl;
 
 	thread *session_thread;
@@ -196,6 +212,10 @@ protected:
 	double preview_time;
 	double paused_time;
 
+	/* adaptive sampling statistics */
+	uint64_t adaptive_samples_saved;
+	uint64_t adaptive_samples_total;
+
 	/* progressive refine */
 	double last_update_time;
 	bool update_progressive_refine(bool cancel);
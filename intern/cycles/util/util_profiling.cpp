@@ -0,0 +1,195 @@
+/*
+ * Copyright 2011-2015 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <algorithm>
+
+#include "util_foreach.h"
+#include "util_profiling.h"
+#include "util_time.h"
+
+CCL_NAMESPACE_BEGIN
+
+static const char *profiling_event_names[PROFILING_NUM_EVENTS] = {
+	"Unknown",
+	"Ray Setup",
+	"Path Integrate",
+	"Intersect Camera",
+	"Intersect Indirect",
+	"Intersect Shadow",
+	"Intersect Volume",
+	"Intersect Subsurface",
+	"Shader Surface",
+	"Shader Volume",
+	"Shader Background",
+	"Direct Light",
+	"Indirect Emission",
+	"Surface Bounce",
+	"Volume Integrate",
+	"Write Result",
+};
+
+Profiler::Profiler()
+: worker(NULL), do_stop(false), interval(0.001), num_samples(0)
+{
+	event_samples.resize(PROFILING_NUM_EVENTS, 0);
+}
+
+Profiler::~Profiler()
+{
+	stop();
+}
+
+void Profiler::start(double interval_)
+{
+	if(worker)
+		return;
+
+	interval = interval_;
+	do_stop = false;
+	worker = new thread(function_bind(&Profiler::run, this));
+}
+
+void Profiler::stop()
+{
+	if(!worker)
+		return;
+
+	do_stop = true;
+	worker->join();
+
+	delete worker;
+	worker = NULL;
+}
+
+void Profiler::reset()
+{
+	thread_scoped_lock lock(mutex);
+
+	num_samples = 0;
+	event_samples.clear();
+	event_samples.resize(PROFILING_NUM_EVENTS, 0);
+	shader_samples.clear();
+	object_samples.clear();
+}
+
+void Profiler::add_state(ProfilingState *state)
+{
+	thread_scoped_lock lock(mutex);
+
+	state->event_samples.clear();
+	state->event_samples.resize(PROFILING_NUM_EVENTS, 0);
+	state->shader_samples.clear();
+	state->object_samples.clear();
+	state->active = true;
+
+	states.push_back(state);
+}
+
+void Profiler::remove_state(ProfilingState *state)
+{
+	thread_scoped_lock lock(mutex);
+
+	vector<ProfilingState*>::iterator it = std::find(states.begin(), states.end(), state);
+
+	if(it == states.end())
+		return;
+
+	states.erase(it);
+	state->active = false;
+
+	foreach(uint64_t samples, state->event_samples)
+		num_samples += samples;
+
+	accumulate(event_samples, state->event_samples);
+	accumulate(shader_samples, state->shader_samples);
+	accumulate(object_samples, state->object_samples);
+}
+
+uint64_t Profiler::get_event(ProfilingEvent event) const
+{
+	return event_samples[event];
+}
+
+uint64_t Profiler::get_shader(int shader) const
+{
+	return (shader >= 0 && shader < (int)shader_samples.size())? shader_samples[shader]: 0;
+}
+
+uint64_t Profiler::get_object(int object) const
+{
+	return (object >= 0 && object < (int)object_samples.size())? object_samples[object]: 0;
+}
+
+const char *Profiler::event_name(ProfilingEvent event)
+{
+	return profiling_event_names[event];
+}
+
+void Profiler::accumulate(vector<uint64_t>& totals, const vector<uint64_t>& samples)
+{
+	if(totals.size() < samples.size())
+		totals.resize(samples.size(), 0);
+
+	for(size_t i = 0; i < samples.size(); i++)
+		totals[i] += samples[i];
+}
+
+void Profiler::run()
+{
+	double next_time = time_dt();
+
+	while(!do_stop) {
+		{
+			thread_scoped_lock lock(mutex);
+
+			foreach(ProfilingState *state, states) {
+				/* read once, the render thread keeps changing these */
+				uint32_t event = state->event;
+				int32_t shader = state->shader;
+				int32_t object = state->object;
+
+				if(event < PROFILING_NUM_EVENTS)
+					state->event_samples[event]++;
+
+				/* shader and object are only meaningful while shading */
+				if(event == PROFILING_SHADER_SURFACE || event == PROFILING_SHADER_VOLUME) {
+					if(shader >= 0) {
+						if(shader >= (int32_t)state->shader_samples.size())
+							state->shader_samples.resize(shader + 1, 0);
+						state->shader_samples[shader]++;
+					}
+					if(object >= 0) {
+						if(object >= (int32_t)state->object_samples.size())
+							state->object_samples.resize(object + 1, 0);
+						state->object_samples[object]++;
+					}
+				}
+			}
+		}
+
+		/* keep a fixed rate even if sampling itself takes time */
+		next_time += interval;
+		double sleep_time = next_time - time_dt();
+
+		if(sleep_time > 0.0)
+			time_sleep(sleep_time);
+		else
+			next_time = time_dt();
+	}
+}
+
+CCL_NAMESPACE_END
+
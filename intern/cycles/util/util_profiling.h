@@ -0,0 +1,156 @@
+/*
+ * Copyright 2011-2015 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#ifndef __UTIL_PROFILING_H__
+#define __UTIL_PROFILING_H__
+
+#include "util_thread.h"
+#include "util_types.h"
+#include "util_vector.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Sampling Profiler
+ *
+ * Render threads keep track of what they are currently doing in a
+ * ProfilingState: the event, and the shader and object being shaded. A
+ * profiler thread looks at all registered states at a fixed interval and
+ * counts a sample for each of them, so the fraction of samples gives the
+ * fraction of render time. The kernel only writes a few integers, which
+ * keeps the overhead low enough to profile production frames. */
+
+/* Note: this should match profiling_event_names in util_profiling.cpp */
+enum ProfilingEvent {
+	PROFILING_UNKNOWN = 0,
+	PROFILING_RAY_SETUP,
+	PROFILING_PATH_INTEGRATE,
+	PROFILING_INTERSECT_CAMERA,
+	PROFILING_INTERSECT_INDIRECT,
+	PROFILING_INTERSECT_SHADOW,
+	PROFILING_INTERSECT_VOLUME,
+	PROFILING_INTERSECT_SUBSURFACE,
+	PROFILING_SHADER_SURFACE,
+	PROFILING_SHADER_VOLUME,
+	PROFILING_SHADER_BACKGROUND,
+	PROFILING_DIRECT_LIGHT,
+	PROFILING_INDIRECT_EMISSION,
+	PROFILING_SURFACE_BOUNCE,
+	PROFILING_VOLUME_INTEGRATE,
+	PROFILING_WRITE_RESULT,
+
+	PROFILING_NUM_EVENTS
+};
+
+/* State of a single render thread, only written by that thread. The sample
+ * counts are only written by the profiler thread. */
+struct ProfilingState {
+	volatile uint32_t event;
+	volatile int32_t shader;
+	volatile int32_t object;
+	volatile bool active;
+
+	vector<uint64_t> event_samples;
+	vector<uint64_t> shader_samples;
+	vector<uint64_t> object_samples;
+
+	ProfilingState()
+	: event(PROFILING_UNKNOWN), shader(-1), object(-1), active(false) {}
+};
+
+class Profiler {
+public:
+	Profiler();
+	~Profiler();
+
+	/* sampling interval in seconds */
+	void start(double interval = 0.001);
+	void stop();
+	void reset();
+
+	bool active() const { return worker != NULL; }
+
+	/* register a render thread, its samples are added to the totals when it
+	 * is removed again */
+	void add_state(ProfilingState *state);
+	void remove_state(ProfilingState *state);
+
+	uint64_t get_num_samples() const { return num_samples; }
+	uint64_t get_event(ProfilingEvent event) const;
+	uint64_t get_shader(int shader) const;
+	uint64_t get_object(int object) const;
+	int get_num_shaders() const { return shader_samples.size(); }
+	int get_num_objects() const { return object_samples.size(); }
+
+	static const char *event_name(ProfilingEvent event);
+
+protected:
+	void run();
+	static void accumulate(vector<uint64_t>& totals, const vector<uint64_t>& samples);
+
+	thread_mutex mutex;
+	thread *worker;
+	volatile bool do_stop;
+	double interval;
+
+	vector<ProfilingState*> states;
+
+	/* totals of threads that finished */
+	uint64_t num_samples;
+	vector<uint64_t> event_samples;
+	vector<uint64_t> shader_samples;
+	vector<uint64_t> object_samples;
+};
+
+/* Sets the event for the duration of a scope and restores the previous one
+ * at the end, so nested functions are attributed correctly. */
+class ProfilingHelper {
+public:
+	ProfilingHelper(ProfilingState *state_, ProfilingEvent event)
+	: state(state_)
+	{
+		previous_event = state->event;
+		state->event = event;
+	}
+
+	~ProfilingHelper()
+	{
+		state->event = previous_event;
+	}
+
+	void set_event(ProfilingEvent event)
+	{
+		state->event = event;
+	}
+
+	void set_shader(int shader)
+	{
+		state->shader = shader;
+	}
+
+	void set_object(int object)
+	{
+		state->object = object;
+	}
+
+protected:
+	ProfilingState *state;
+	uint32_t previous_event;
+};
+
+CCL_NAMESPACE_END
+
+#endif /* __UTIL_PROFILING_H__ */
+
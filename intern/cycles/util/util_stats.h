@@ -17,11 +17,14 @@
 #ifndef __UTIL_STATS_H__
 #define __UTIL_STATS_H__
 
+#include "util_profiling.h"
+
 CCL_NAMESPACE_BEGIN
 
 class Stats {
 public:
-	Stats() : mem_used(0), mem_peak(0) {}
+	Stats() : mem_used(0), mem_peak(0), image_cache_tiles_loaded(0),
+	          image_cache_tile_lookups(0), image_cache_bytes_read(0) {}
 
 	void mem_alloc(size_t size) {
 		mem_used += size;
@@ -34,8 +37,24 @@ public:
 		mem_used -= size;
 	}
 
+	/* fraction of image cache tile lookups that found the tile in memory */
+	float image_cache_hit_rate() const {
+		if(image_cache_tile_lookups == 0)
+			return 0.0f;
+		return 1.0f - (float)image_cache_tiles_loaded/(float)image_cache_tile_lookups;
+	}
+
 	size_t mem_used;
 	size_t mem_peak;
+
+	/* image textures read from disk on demand, totals since the cache was
+	 * created, updated after each render */
+	uint64_t image_cache_tiles_loaded;
+	uint64_t image_cache_tile_lookups;
+	uint64_t image_cache_bytes_read;
+
+	/* optional, only running when profiling was requested */
+	Profiler profiler;
 };
 
 CCL_NAMESPACE_END
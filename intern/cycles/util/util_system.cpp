@@ -114,6 +114,39 @@ int system_cpu_bits()
 	return (sizeof(void*)*8);
 }
 
+enum CPUInstructionSet {
+	CPU_INSTRUCTION_NONE = 0,
+	CPU_INSTRUCTION_SSE2,
+	CPU_INSTRUCTION_SSE3,
+	CPU_INSTRUCTION_SSE41,
+	CPU_INSTRUCTION_AVX,
+	CPU_INSTRUCTION_AVX2,
+};
+
+static int system_cpu_instruction_limit = CPU_INSTRUCTION_AVX2;
+
+bool system_cpu_limit_instruction_set(const string& name)
+{
+	if(name == "")
+		system_cpu_instruction_limit = CPU_INSTRUCTION_AVX2;
+	else if(name == "none")
+		system_cpu_instruction_limit = CPU_INSTRUCTION_NONE;
+	else if(name == "sse2")
+		system_cpu_instruction_limit = CPU_INSTRUCTION_SSE2;
+	else if(name == "sse3")
+		system_cpu_instruction_limit = CPU_INSTRUCTION_SSE3;
+	else if(name == "sse41")
+		system_cpu_instruction_limit = CPU_INSTRUCTION_SSE41;
+	else if(name == "avx")
+		system_cpu_instruction_limit = CPU_INSTRUCTION_AVX;
+	else if(name == "avx2")
+		system_cpu_instruction_limit = CPU_INSTRUCTION_AVX2;
+	else
+		return false;
+
+	return true;
+}
+
 #if defined(__x86_64__) || defined(_M_X64) || defined(i386) || defined(_M_IX86)
 
 struct CPUCapabilities {
@@ -209,30 +242,35 @@ static CPUCapabilities& system_cpu_capabilities()
 bool system_cpu_support_sse2()
 {
 	CPUCapabilities& caps = system_cpu_capabilities();
-	return caps.sse && caps.sse2;
+	return system_cpu_instruction_limit >= CPU_INSTRUCTION_SSE2 &&
+	       caps.sse && caps.sse2;
 }
 
 bool system_cpu_support_sse3()
 {
 	CPUCapabilities& caps = system_cpu_capabilities();
-	return caps.sse && caps.sse2 && caps.sse3 && caps.ssse3;
+	return system_cpu_instruction_limit >= CPU_INSTRUCTION_SSE3 &&
+	       caps.sse && caps.sse2 && caps.sse3 && caps.ssse3;
 }
 
 bool system_cpu_support_sse41()
 {
 	CPUCapabilities& caps = system_cpu_capabilities();
-	return caps.sse && caps.sse2 && caps.sse3 && caps.ssse3 && caps.sse41;
+	return system_cpu_instruction_limit >= CPU_INSTRUCTION_SSE41 &&
+	       caps.sse && caps.sse2 && caps.sse3 && caps.ssse3 && caps.sse41;
 }
 
 bool system_cpu_support_avx()
 {
 	CPUCapabilities& caps = system_cpu_capabilities();
-	return caps.sse && caps.sse2 && caps.sse3 && caps.ssse3 && caps.sse41 && caps.avx;
+	return system_cpu_instruction_limit >= CPU_INSTRUCTION_AVX &&
+	       caps.sse && caps.sse2 && caps.sse3 && caps.ssse3 && caps.sse41 && caps.avx;
 }
 bool system_cpu_support_avx2()
 {
 	CPUCapabilities& caps = system_cpu_capabilities();
-	return caps.sse && caps.sse2 && caps.sse3 && caps.ssse3 && caps.sse41 && caps.avx && caps.avx2 && caps.fma3 && caps.bmi1 && caps.bmi2;
+	return system_cpu_instruction_limit >= CPU_INSTRUCTION_AVX2 &&
+	       caps.sse && caps.sse2 && caps.sse3 && caps.ssse3 && caps.sse41 && caps.avx && caps.avx2 && caps.fma3 && caps.bmi1 && caps.bmi2;
 }
 #else
 
@@ -30,6 +30,12 @@ bool system_cpu_support_sse41();
 bool system_cpu_support_avx();
 bool system_cpu_support_avx2();
 
+/* Limit the instruction sets reported as supported, to force a CPU kernel
+ * variant for benchmarking and debugging. Name is one of "none", "sse2",
+ * "sse3", "sse41", "avx" or "avx2", an empty name removes the limit.
+ * Returns false for unknown names. */
+bool system_cpu_limit_instruction_set(const string& name);
+
 CCL_NAMESPACE_END
 
 #endif /* __UTIL_SYSTEM_H__ */
@@ -71,7 +71,7 @@ class MemoryAllocator : public VirtualMemoryAllocator
 private:
 
 /// Constants
-int HEAP_UNIT, HEAP_MASK;
+int HEAP_SHIFT, HEAP_UNIT, HEAP_MASK;
 
 /// Data array
 UCHAR **data;
@@ -97,6 +97,10 @@ int available;
 void allocateDataBlock( )
 {
 	// Allocate a data block
+	if (stackblocknum == 0)
+	{
+		allocateStackBlock( );
+	}
 	datablocknum += 1;
 	data = ( UCHAR ** )realloc(data, sizeof (UCHAR *) * datablocknum);
 	data[datablocknum - 1] = ( UCHAR * )malloc(HEAP_UNIT * N);
@@ -124,27 +128,22 @@ void allocateStackBlock( )
 
 public:
 /**
- * Constructor
+ * Constructor, blocks hold 2^base objects and are only allocated
+ * once the first object is requested
  */
-MemoryAllocator( )
+MemoryAllocator(int base = HEAP_BASE)
 {
-	HEAP_UNIT = 1 << HEAP_BASE;
-	HEAP_MASK = (1 << HEAP_BASE) - 1;
-
-	data = ( UCHAR ** )malloc(sizeof(UCHAR *) );
-	data[0] = ( UCHAR * )malloc(HEAP_UNIT * N);
-	datablocknum = 1;
+	HEAP_SHIFT = base;
+	HEAP_UNIT = 1 << base;
+	HEAP_MASK = (1 << base) - 1;
 
-	stack = ( UCHAR *** )malloc(sizeof (UCHAR * *) );
-	stack[0] = ( UCHAR ** )malloc(HEAP_UNIT * sizeof (UCHAR *) );
-	stackblocknum = 1;
-	stacksize = HEAP_UNIT;
-	available = HEAP_UNIT;
+	data = NULL;
+	datablocknum = 0;
 
-	for (int i = 0; i < HEAP_UNIT; i++)
-	{
-		stack[0][i] = (data[0] + i * N);
-	}
+	stack = NULL;
+	stackblocknum = 0;
+	stacksize = 0;
+	available = 0;
 }
 
 /**
@@ -177,7 +176,7 @@ void *allocate( )
 
 	// printf("Allocating %d\n", header[ allocated ]) ;
 	available--;
-	return (void *)stack[available >> HEAP_BASE][available & HEAP_MASK];
+	return (void *)stack[available >> HEAP_SHIFT][available & HEAP_MASK];
 }
 
 /**
@@ -191,7 +190,7 @@ void deallocate(void *obj)
 	}
 
 	// printf("De-allocating %d\n", ( obj - data ) / N ) ;
-	stack[available >> HEAP_BASE][available & HEAP_MASK] = (UCHAR *)obj;
+	stack[available >> HEAP_SHIFT][available & HEAP_MASK] = (UCHAR *)obj;
 	available++;
 	// printf("%d %d\n", allocated, header[ allocated ]) ;
 }
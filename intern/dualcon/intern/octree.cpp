@@ -206,33 +206,48 @@ void Octree::scanConvert()
 
 void Octree::initMemory()
 {
-	leafalloc[0] = new MemoryAllocator<sizeof(LeafNode)>();
-	leafalloc[1] = new MemoryAllocator<sizeof(LeafNode) + sizeof(float) *EDGE_FLOATS>();
-	leafalloc[2] = new MemoryAllocator<sizeof(LeafNode) + sizeof(float) *EDGE_FLOATS * 2>();
-	leafalloc[3] = new MemoryAllocator<sizeof(LeafNode) + sizeof(float) *EDGE_FLOATS * 3>();
-
-	alloc[0] = new MemoryAllocator<sizeof(InternalNode)>();
-	alloc[1] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *)>();
-	alloc[2] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 2>();
-	alloc[3] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 3>();
-	alloc[4] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 4>();
-	alloc[5] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 5>();
-	alloc[6] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 6>();
-	alloc[7] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 7>();
-	alloc[8] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 8>();
+	initPools(pools, HEAP_BASE);
 }
 
-void Octree::freeMemory()
+void Octree::initPools(NodePools& p, int heap_base)
+{
+	p.leafalloc[0] = new MemoryAllocator<sizeof(LeafNode)>(heap_base);
+	p.leafalloc[1] = new MemoryAllocator<sizeof(LeafNode) + sizeof(float) *EDGE_FLOATS>(heap_base);
+	p.leafalloc[2] = new MemoryAllocator<sizeof(LeafNode) + sizeof(float) *EDGE_FLOATS * 2>(heap_base);
+	p.leafalloc[3] = new MemoryAllocator<sizeof(LeafNode) + sizeof(float) *EDGE_FLOATS * 3>(heap_base);
+
+	p.alloc[0] = new MemoryAllocator<sizeof(InternalNode)>(heap_base);
+	p.alloc[1] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *)>(heap_base);
+	p.alloc[2] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 2>(heap_base);
+	p.alloc[3] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 3>(heap_base);
+	p.alloc[4] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 4>(heap_base);
+	p.alloc[5] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 5>(heap_base);
+	p.alloc[6] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 6>(heap_base);
+	p.alloc[7] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 7>(heap_base);
+	p.alloc[8] = new MemoryAllocator<sizeof(InternalNode) + sizeof(Node *) * 8>(heap_base);
+}
+
+static void free_pools(NodePools& p)
 {
 	for (int i = 0; i < 9; i++) {
-		alloc[i]->destroy();
-		delete alloc[i];
+		p.alloc[i]->destroy();
+		delete p.alloc[i];
 	}
 
 	for (int i = 0; i < 4; i++) {
-		leafalloc[i]->destroy();
-		delete leafalloc[i];
+		p.leafalloc[i]->destroy();
+		delete p.leafalloc[i];
+	}
+}
+
+void Octree::freeMemory()
+{
+	free_pools(pools);
+
+	for (size_t i = 0; i < subtree_pools.size(); i++) {
+		free_pools(subtree_pools[i]);
 	}
+	subtree_pools.clear();
 }
 
 void Octree::printMemUsage()
@@ -240,17 +255,17 @@ void Octree::printMemUsage()
 	int totalbytes = 0;
 	dc_printf("********* Internal nodes: \n");
 	for (int i = 0; i < 9; i++) {
-		alloc[i]->printInfo();
+		pools.alloc[i]->printInfo();
 
-		totalbytes += alloc[i]->getAll() * alloc[i]->getBytes();
+		totalbytes += pools.alloc[i]->getAll() * pools.alloc[i]->getBytes();
 	}
 	dc_printf("********* Leaf nodes: \n");
 	int totalLeafs = 0;
 	for (int i = 0; i < 4; i++) {
-		leafalloc[i]->printInfo();
+		pools.leafalloc[i]->printInfo();
 
-		totalbytes += leafalloc[i]->getAll() * leafalloc[i]->getBytes();
-		totalLeafs += leafalloc[i]->getAllocated();
+		totalbytes += pools.leafalloc[i]->getAll() * pools.leafalloc[i]->getBytes();
+		totalLeafs += pools.leafalloc[i]->getAllocated();
 	}
 
 	dc_printf("Total allocated bytes on disk: %d \n", totalbytes);
@@ -265,89 +280,189 @@ void Octree::resetMinimalEdges()
 void Octree::addAllTriangles()
 {
 	Triangle *trian;
-	int count = 0;
+	std::vector<ProjectedTriangle> triangles;
 
-#if DC_DEBUG
-	int total = reader->getNumTriangles();
-	int unitcount = 1000;
 	dc_printf("\nScan converting to depth %d...\n", maxDepth);
-#endif
 
 	srand(0);
 
+	/* Project all triangles into the grid up front, the reader can
+	   only be walked once */
+	triangles.reserve(reader->getNumTriangles());
 	while ((trian = reader->getNextTriangle()) != NULL) {
-		// Drop triangles
-		{
-			addTriangle(trian, count);
-		}
+		ProjectedTriangle tri;
+		projectTriangle(trian, tri);
+		triangles.push_back(tri);
 		delete trian;
+	}
 
-		count++;
-
-#if DC_DEBUG
-		if (count % unitcount == 0) {
-			putchar(13);
-
-			switch ((count / unitcount) % 4) {
-				case 0: dc_printf("-");
-					break;
-				case 1: dc_printf("/");
-					break;
-				case 2: dc_printf("|");
-					break;
-				case 3: dc_printf("\\");
-					break;
-			}
-
-			float percent = (float) count / total;
-
-			/*
-			   int totbars = 50;
-			   int bars =(int)(percent * totbars);
-			   for(int i = 0; i < bars; i ++) {
-			    putchar(219);
-			   }
-			   for(i = bars; i < totbars; i ++) {
-			    putchar(176);
-			   }
-			 */
-
-			dc_printf(" %d triangles: ", count);
-			dc_printf(" %f%% complete.", 100 * percent);
+	if (maxDepth >= 3) {
+		addTrianglesParallel(triangles);
+	}
+	else {
+		for (int i = 0; i < (int)triangles.size(); i++) {
+			addTriangle(triangles[i], i);
 		}
-#endif
-
 	}
-	putchar(13);
 }
 
-/* Prepare a triangle for insertion into the octree; call the other
-   addTriangle() to (recursively) build the octree */
-void Octree::addTriangle(Triangle *trian, int triind)
+/* Project the triangle's coordinates into the grid */
+void Octree::projectTriangle(Triangle *trian, ProjectedTriangle& tri)
 {
 	int i, j;
 
-	/* Project the triangle's coordinates into the grid */
 	for (i = 0; i < 3; i++) {
 		for (j = 0; j < 3; j++)
 			trian->vt[i][j] = dimen * (trian->vt[i][j] - origin[j]) / range;
 	}
 
-	/* Generate projections */
-	int64_t cube[2][3] = {{0, 0, 0}, {dimen, dimen, dimen}};
-	int64_t trig[3][3];
 	for (i = 0; i < 3; i++) {
 		for (j = 0; j < 3; j++)
-			trig[i][j] = (int64_t)(trian->vt[i][j]);
+			tri.trig[i][j] = (int64_t)(trian->vt[i][j]);
 	}
+}
+
+/* Prepare a triangle for insertion into the octree; call the other
+   addTriangle() to (recursively) build the octree */
+void Octree::addTriangle(const ProjectedTriangle& tri, int triind)
+{
+	/* Generate projections */
+	int64_t cube[2][3] = {{0, 0, 0}, {dimen, dimen, dimen}};
+	int64_t trig[3][3];
+	memcpy(trig, tri.trig, sizeof(trig));
 
 	/* Add triangle to the octree */
 	int64_t errorvec = (int64_t)(0);
-	CubeTriangleIsect *proj = new CubeTriangleIsect(cube, trig, errorvec, triind);
-	root = (Node *)addTriangle(&root->internal, proj, maxDepth);
+	CubeTriangleIsect proj(cube, trig, errorvec, triind);
+	root = (Node *)addTriangle(&root->internal, &proj, maxDepth, pools);
 
-	delete proj->inherit;
-	delete proj;
+	delete proj.inherit;
+}
+
+/* Set up the projections of a triangle for the cell two levels below
+   the root, the first two levels of addTriangle() are done here */
+static void child_isect(CubeTriangleIsect& child, CubeTriangleIsect *parent, int index)
+{
+	int off[3] = {vertmap[index][0], vertmap[index][1], vertmap[index][2]};
+
+	child = CubeTriangleIsect(parent);
+	child.shift(off);
+}
+
+/* Scan convert the 64 cells two levels below the root in parallel.
+   Each cell gets the triangles crossing it in their original order and
+   its own node pools, so the resulting tree is the same as the one
+   built serially. */
+void Octree::addTrianglesParallel(const std::vector<ProjectedTriangle>& triangles)
+{
+	const int tottri = (int)triangles.size();
+	int64_t cube[2][3] = {{0, 0, 0}, {dimen, dimen, dimen}};
+	int64_t errorvec = (int64_t)(0);
+
+	/* Find the root children and grandchildren each triangle crosses */
+	std::vector<unsigned char> childmasks(tottri);
+	std::vector<unsigned char> cellmasks(8 * (size_t)tottri);
+
+#pragma omp parallel for schedule(dynamic, 1024)
+	for (int t = 0; t < tottri; t++) {
+		int64_t trig[3][3];
+		memcpy(trig, triangles[t].trig, sizeof(trig));
+
+		CubeTriangleIsect proj(cube, trig, errorvec, t);
+		CubeTriangleIsect sub, subsub;
+		unsigned char boxmask = proj.getBoxMask();
+		unsigned char childmask = 0;
+		unsigned char *cellmask = &cellmasks[8 * (size_t)t];
+
+		for (int i = 0; i < 8; i++) {
+			if (!(boxmask & (1 << i)))
+				continue;
+
+			child_isect(sub, &proj, i);
+			if (!sub.isIntersecting())
+				continue;
+
+			childmask |= (1 << i);
+
+			unsigned char subboxmask = sub.getBoxMask();
+			for (int j = 0; j < 8; j++) {
+				if (subboxmask & (1 << j)) {
+					child_isect(subsub, &sub, j);
+					if (subsub.isIntersecting()) {
+						cellmask[i] |= (1 << j);
+					}
+				}
+			}
+		}
+
+		childmasks[t] = childmask;
+		delete proj.inherit;
+	}
+
+	std::vector<int> cell_triangles[64];
+	unsigned char rootmask = 0;
+	for (int t = 0; t < tottri; t++) {
+		rootmask |= childmasks[t];
+		for (int c = 0; c < 64; c++) {
+			if (cellmasks[8 * (size_t)t + c / 8] & (1 << (c % 8))) {
+				cell_triangles[c].push_back(t);
+			}
+		}
+	}
+
+	/* Small blocks, most cells only hold a fraction of the tree */
+	subtree_pools.resize(64);
+	for (int c = 0; c < 64; c++) {
+		initPools(subtree_pools[c], 10);
+	}
+
+	InternalNode *cells[64];
+
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int c = 0; c < 64; c++) {
+		cells[c] = NULL;
+		if (cell_triangles[c].empty())
+			continue;
+
+		NodePools& cell_pools = subtree_pools[c];
+		InternalNode *node = createInternal(0, cell_pools);
+
+		for (size_t k = 0; k < cell_triangles[c].size(); k++) {
+			const int t = cell_triangles[c][k];
+			int64_t trig[3][3];
+			memcpy(trig, triangles[t].trig, sizeof(trig));
+
+			CubeTriangleIsect proj(cube, trig, errorvec, t);
+			CubeTriangleIsect sub, subsub;
+			child_isect(sub, &proj, c / 8);
+			child_isect(subsub, &sub, c % 8);
+
+			node = addTriangle(node, &subsub, maxDepth - 2, cell_pools);
+
+			delete proj.inherit;
+		}
+
+		cells[c] = node;
+	}
+
+	/* Link the subtrees to the root in child order */
+	int count = 0;
+	for (int i = 0; i < 8; i++) {
+		if (!(rootmask & (1 << i)))
+			continue;
+
+		InternalNode *chd = createInternal(0);
+		int chdcount = 0;
+		for (int j = 0; j < 8; j++) {
+			if (cells[i * 8 + j]) {
+				chd = addInternalChild(chd, j, chdcount, cells[i * 8 + j], pools);
+				chdcount++;
+			}
+		}
+
+		root = (Node *)addInternalChild(&root->internal, i, count, chd, pools);
+		count++;
+	}
 }
 
 #if 0
@@ -358,7 +473,8 @@ static void print_depth(int height, int maxDepth)
 }
 #endif
 
-InternalNode *Octree::addTriangle(InternalNode *node, CubeTriangleIsect *p, int height)
+InternalNode *Octree::addTriangle(InternalNode *node, CubeTriangleIsect *p, int height,
+                                  NodePools& p_pools)
 {
 	int i;
 	const int vertdiff[8][3] = {
@@ -371,7 +487,7 @@ InternalNode *Octree::addTriangle(InternalNode *node, CubeTriangleIsect *p, int
 		{0,  1, -1},
 		{0,  0,  1}};
 	unsigned char boxmask = p->getBoxMask();
-	CubeTriangleIsect *subp = new CubeTriangleIsect(p);
+	CubeTriangleIsect subp(p);
 	
 	int count = 0;
 	int tempdiff[3] = {0, 0, 0};
@@ -384,23 +500,23 @@ InternalNode *Octree::addTriangle(InternalNode *node, CubeTriangleIsect *p, int
 
 		/* Quick pruning using bounding box */
 		if (boxmask & (1 << i)) {
-			subp->shift(tempdiff);
+			subp.shift(tempdiff);
 			tempdiff[0] = tempdiff[1] = tempdiff[2] = 0;
 
 			/* Pruning using intersection test */
-			if (subp->isIntersecting()) {
+			if (subp.isIntersecting()) {
 				if (!node->has_child(i)) {
 					if (height == 1)
-						node = addLeafChild(node, i, count, createLeaf(0));
+						node = addLeafChild(node, i, count, createLeaf(0, p_pools), p_pools);
 					else
-						node = addInternalChild(node, i, count, createInternal(0));
+						node = addInternalChild(node, i, count, createInternal(0, p_pools), p_pools);
 				}
 				Node *chd = node->get_child(count);
 
 				if (node->is_child_leaf(i))
-					node->set_child(count, (Node *)updateCell(&chd->leaf, subp));
+					node->set_child(count, (Node *)updateCell(&chd->leaf, &subp, p_pools));
 				else
-					node->set_child(count, (Node *)addTriangle(&chd->internal, subp, height - 1));
+					node->set_child(count, (Node *)addTriangle(&chd->internal, &subp, height - 1, p_pools));
 			}
 		}
 
@@ -408,12 +524,10 @@ InternalNode *Octree::addTriangle(InternalNode *node, CubeTriangleIsect *p, int
 			count++;
 	}
 
-	delete subp;
-
 	return node;
 }
 
-LeafNode *Octree::updateCell(LeafNode *node, CubeTriangleIsect *p)
+LeafNode *Octree::updateCell(LeafNode *node, CubeTriangleIsect *p, NodePools& p_pools)
 {
 	int i;
 
@@ -445,7 +559,7 @@ LeafNode *Octree::updateCell(LeafNode *node, CubeTriangleIsect *p)
 
 	if (newc > oldc) {
 		// New offsets added, update this node
-		node = updateEdgeOffsetsNormals(node, oldc, newc, offs, a, b, c);
+		node = updateEdgeOffsetsNormals(node, oldc, newc, offs, a, b, c, p_pools);
 	}
 
 	return node;
@@ -2063,11 +2177,71 @@ void Octree::writeOut()
 	actualVerts = 0;
 	actualQuads = 0;
 
-	generateMinimizer(root, st, dimen, maxDepth, offset);
-	cellProcContour(root, 0, maxDepth);
+	/* Gather cells and assign vertex indices in traversal order, the
+	   QEFs are solved in parallel batches and the vertices emitted in
+	   the same order */
+	std::vector<MinimizerCell> cells;
+	cells.reserve(MINIMIZER_BATCH);
+	generateMinimizer(root, st, dimen, maxDepth, offset, cells);
+	writeMinimizers(cells);
+
+	/* Contour the subtrees two levels below the root in parallel, their
+	   quads are emitted in the serial traversal order as soon as all
+	   earlier jobs are done */
+	std::vector<ContourJob> jobs;
+	gatherContourJobs(root, 0, maxDepth, 2, jobs);
+
+	const int totjob = (int)jobs.size();
+
+#pragma omp parallel for ordered schedule(dynamic, 1)
+	for (int i = 0; i < totjob; i++) {
+		const ContourJob& job = jobs[i];
+		std::vector<int> quads;
+
+		if (job.seams_only)
+			cellProcContourSeams(job.node, job.depth, quads);
+		else
+			cellProcContour(job.node, job.leaf, job.depth, quads);
+
+#pragma omp ordered
+		for (size_t j = 0; j < quads.size(); j += 4) {
+			add_quad(output_mesh, &quads[j]);
+			actualQuads++;
+		}
+	}
+
 	dc_printf("Vertices written: %d Quads written: %d \n", offset, actualQuads);
 }
 
+void Octree::writeMinimizers(std::vector<MinimizerCell>& cells)
+{
+	const int totcell = (int)cells.size();
+	std::vector<float> positions(3 * (size_t)totcell);
+
+#pragma omp parallel for schedule(dynamic, 256) if (totcell > 1024)
+	for (int i = 0; i < totcell; i++) {
+		MinimizerCell& cell = cells[i];
+		float *rvalue = &positions[3 * (size_t)i];
+
+		rvalue[0] = (float) cell.st[0] + cell.len / 2;
+		rvalue[1] = (float) cell.st[1] + cell.len / 2;
+		rvalue[2] = (float) cell.st[2] + cell.len / 2;
+		computeMinimizer(cell.leaf, cell.st, cell.len, rvalue);
+
+		for (int j = 0; j < 3; j++) {
+			rvalue[j] = rvalue[j] * range / dimen + origin[j];
+		}
+	}
+
+	for (int i = 0; i < totcell; i++) {
+		for (int j = 0; j < cells[i].mult; j++) {
+			add_vert(output_mesh, &positions[3 * (size_t)i]);
+		}
+	}
+
+	cells.clear();
+}
+
 void Octree::countIntersection(Node *node, int height, int& nedge, int& ncell, int& nface)
 {
 	if (height > 0) {
@@ -2257,27 +2431,13 @@ void Octree::computeMinimizer(const LeafNode *leaf, int st[3], int len,
 	}
 }
 
-void Octree::generateMinimizer(Node *node, int st[3], int len, int height, int& offset)
+void Octree::generateMinimizer(Node *node, int st[3], int len, int height, int& offset,
+                               std::vector<MinimizerCell>& cells)
 {
-	int i, j;
+	int i;
 
 	if (height == 0) {
-		// Leaf cell, generate
-
-		// First, find minimizer
-		float rvalue[3];
-		rvalue[0] = (float) st[0] + len / 2;
-		rvalue[1] = (float) st[1] + len / 2;
-		rvalue[2] = (float) st[2] + len / 2;
-		computeMinimizer(&node->leaf, st, len, rvalue);
-
-		// Update
-		//float fnst[3];
-		for (j = 0; j < 3; j++) {
-			rvalue[j] = rvalue[j] * range / dimen + origin[j];
-			//fnst[j] = st[j] * range / dimen + origin[j];
-		}
-
+		// Leaf cell, queue for minimizer computation
 		int mult = 0, smask = getSignMask(&node->leaf);
 
 		if (use_manifold) {
@@ -2289,8 +2449,20 @@ void Octree::generateMinimizer(Node *node, int st[3], int len, int height, int&
 			}
 		}
 
-		for (j = 0; j < mult; j++) {
-			add_vert(output_mesh, rvalue);
+		// Cells without vertices only need their index
+		if (mult > 0) {
+			MinimizerCell cell;
+			cell.leaf = &node->leaf;
+			cell.st[0] = st[0];
+			cell.st[1] = st[1];
+			cell.st[2] = st[2];
+			cell.len = len;
+			cell.mult = mult;
+			cells.push_back(cell);
+
+			if ((int)cells.size() == MINIMIZER_BATCH) {
+				writeMinimizers(cells);
+			}
 		}
 
 		// Store the index
@@ -2310,14 +2482,15 @@ void Octree::generateMinimizer(Node *node, int st[3], int len, int height, int&
 				nst[2] = st[2] + vertmap[i][2] * len;
 
 				generateMinimizer(node->internal.get_child(count),
-				                  nst, len, height - 1, offset);
+				                  nst, len, height - 1, offset, cells);
 				count++;
 			}
 		}
 	}
 }
 
-void Octree::processEdgeWrite(Node *node[4], int depth[4], int maxdep, int dir)
+void Octree::processEdgeWrite(Node *node[4], int depth[4], int maxdep, int dir,
+                              std::vector<int>& quads)
 {
 	//int color = 0;
 
@@ -2369,7 +2542,7 @@ void Octree::processEdgeWrite(Node *node[4], int depth[4], int maxdep, int dir)
 						ind[3] = getMinimizerIndex((LeafNode *)(node[2]));
 					}
 
-					add_quad(output_mesh, ind);
+					quads.insert(quads.end(), ind, ind + 4);
 				}
 			}
 			return;
@@ -2381,13 +2554,14 @@ void Octree::processEdgeWrite(Node *node[4], int depth[4], int maxdep, int dir)
 }
 
 
-void Octree::edgeProcContour(Node *node[4], int leaf[4], int depth[4], int maxdep, int dir)
+void Octree::edgeProcContour(Node *node[4], int leaf[4], int depth[4], int maxdep, int dir,
+                             std::vector<int>& quads)
 {
 	if (!(node[0] && node[1] && node[2] && node[3])) {
 		return;
 	}
 	if (leaf[0] && leaf[1] && leaf[2] && leaf[3]) {
-		processEdgeWrite(node, depth, maxdep, dir);
+		processEdgeWrite(node, depth, maxdep, dir, quads);
 	}
 	else {
 		int i, j;
@@ -2423,13 +2597,14 @@ void Octree::edgeProcContour(Node *node[4], int leaf[4], int depth[4], int maxde
 				}
 			}
 
-			edgeProcContour(ne, le, de, maxdep - 1, edgeProcEdgeMask[dir][i][4]);
+			edgeProcContour(ne, le, de, maxdep - 1, edgeProcEdgeMask[dir][i][4], quads);
 		}
 
 	}
 }
 
-void Octree::faceProcContour(Node *node[2], int leaf[2], int depth[2], int maxdep, int dir)
+void Octree::faceProcContour(Node *node[2], int leaf[2], int depth[2], int maxdep, int dir,
+                             std::vector<int>& quads)
 {
 	if (!(node[0] && node[1])) {
 		return;
@@ -2465,7 +2640,7 @@ void Octree::faceProcContour(Node *node[2], int leaf[2], int depth[2], int maxde
 					df[j] = depth[j] - 1;
 				}
 			}
-			faceProcContour(nf, lf, df, maxdep - 1, faceProcFaceMask[dir][i][2]);
+			faceProcContour(nf, lf, df, maxdep - 1, faceProcFaceMask[dir][i][2], quads);
 		}
 
 		// 4 edge calls
@@ -2492,13 +2667,42 @@ void Octree::faceProcContour(Node *node[2], int leaf[2], int depth[2], int maxde
 				}
 			}
 
-			edgeProcContour(ne, le, de, maxdep - 1, faceProcEdgeMask[dir][i][5]);
+			edgeProcContour(ne, le, de, maxdep - 1, faceProcEdgeMask[dir][i][5], quads);
 		}
 	}
 }
 
 
-void Octree::cellProcContour(Node *node, int leaf, int depth)
+void Octree::gatherContourJobs(Node *node, int leaf, int depth, int levels,
+                               std::vector<ContourJob>& jobs)
+{
+	if (node == NULL) {
+		return;
+	}
+
+	ContourJob job;
+	job.node = node;
+	job.leaf = leaf;
+	job.depth = depth;
+	job.seams_only = 0;
+
+	if (leaf || levels == 0) {
+		jobs.push_back(job);
+		return;
+	}
+
+	// Same order as cellProcContour(): children first, then the seams
+	for (int i = 0; i < 8; i++) {
+		Node *chd = node->internal.has_child(i) ?
+		            node->internal.get_child(node->internal.get_child_count(i)) : NULL;
+		gatherContourJobs(chd, node->internal.is_child_leaf(i), depth - 1, levels - 1, jobs);
+	}
+
+	job.seams_only = 1;
+	jobs.push_back(job);
+}
+
+void Octree::cellProcContour(Node *node, int leaf, int depth, std::vector<int>& quads)
 {
 	if (node == NULL) {
 		return;
@@ -2507,50 +2711,60 @@ void Octree::cellProcContour(Node *node, int leaf, int depth)
 	if (!leaf) {
 		int i;
 
-		// Fill children nodes
-		Node *chd[8];
-		for (i = 0; i < 8; i++) {
-			chd[i] = ((!leaf) && node->internal.has_child(i)) ?
-			         node->internal.get_child(node->internal.get_child_count(i)) : NULL;
-		}
-
 		// 8 Cell calls
 		for (i = 0; i < 8; i++) {
-			cellProcContour(chd[i], node->internal.is_child_leaf(i), depth - 1);
+			Node *chd = node->internal.has_child(i) ?
+			            node->internal.get_child(node->internal.get_child_count(i)) : NULL;
+			cellProcContour(chd, node->internal.is_child_leaf(i), depth - 1, quads);
 		}
 
-		// 12 face calls
-		Node *nf[2];
-		int lf[2];
-		int df[2] = {depth - 1, depth - 1};
-		for (i = 0; i < 12; i++) {
-			int c[2] = {cellProcFaceMask[i][0], cellProcFaceMask[i][1]};
+		cellProcContourSeams(node, depth, quads);
+	}
 
-			lf[0] = node->internal.is_child_leaf(c[0]);
-			lf[1] = node->internal.is_child_leaf(c[1]);
+}
 
-			nf[0] = chd[c[0]];
-			nf[1] = chd[c[1]];
+/* Faces and edges shared by the children of an internal node */
+void Octree::cellProcContourSeams(Node *node, int depth, std::vector<int>& quads)
+{
+	int i;
 
-			faceProcContour(nf, lf, df, depth - 1, cellProcFaceMask[i][2]);
-		}
+	// Fill children nodes
+	Node *chd[8];
+	for (i = 0; i < 8; i++) {
+		chd[i] = node->internal.has_child(i) ?
+		         node->internal.get_child(node->internal.get_child_count(i)) : NULL;
+	}
 
-		// 6 edge calls
-		Node *ne[4];
-		int le[4];
-		int de[4] = {depth - 1, depth - 1, depth - 1, depth - 1};
-		for (i = 0; i < 6; i++) {
-			int c[4] = {cellProcEdgeMask[i][0], cellProcEdgeMask[i][1], cellProcEdgeMask[i][2], cellProcEdgeMask[i][3]};
+	// 12 face calls
+	Node *nf[2];
+	int lf[2];
+	int df[2] = {depth - 1, depth - 1};
+	for (i = 0; i < 12; i++) {
+		int c[2] = {cellProcFaceMask[i][0], cellProcFaceMask[i][1]};
 
-			for (int j = 0; j < 4; j++) {
-				le[j] = node->internal.is_child_leaf(c[j]);
-				ne[j] = chd[c[j]];
-			}
+		lf[0] = node->internal.is_child_leaf(c[0]);
+		lf[1] = node->internal.is_child_leaf(c[1]);
 
-			edgeProcContour(ne, le, de, depth - 1, cellProcEdgeMask[i][4]);
-		}
+		nf[0] = chd[c[0]];
+		nf[1] = chd[c[1]];
+
+		faceProcContour(nf, lf, df, depth - 1, cellProcFaceMask[i][2], quads);
 	}
 
+	// 6 edge calls
+	Node *ne[4];
+	int le[4];
+	int de[4] = {depth - 1, depth - 1, depth - 1, depth - 1};
+	for (i = 0; i < 6; i++) {
+		int c[4] = {cellProcEdgeMask[i][0], cellProcEdgeMask[i][1], cellProcEdgeMask[i][2], cellProcEdgeMask[i][3]};
+
+		for (int j = 0; j < 4; j++) {
+			le[j] = node->internal.is_child_leaf(c[j]);
+			ne[j] = chd[c[j]];
+		}
+
+		edgeProcContour(ne, le, de, depth - 1, cellProcEdgeMask[i][4], quads);
+	}
 }
 
 void Octree::processEdgeParity(LeafNode *node[4], int depth[4], int maxdep, int dir)
@@ -27,6 +27,7 @@
 #include <cstring>
 #include <stdio.h>
 #include <math.h>
+#include <vector>
 #include "GeoCommon.h"
 #include "Projections.h"
 #include "ModelReader.h"
@@ -55,6 +56,9 @@
 
 #define EDGE_FLOATS 4
 
+/* Number of leaf cells whose minimizers are solved together */
+#define MINIMIZER_BATCH (1 << 16)
+
 union Node;
 struct LeafNode;
 
@@ -159,8 +163,9 @@ struct InternalNode {
  * Byte 1(4,5,6): mask of primary edges intersections stored
  * Byte 1(7): in flood fill mode, whether the cell is in process
  * Byte 2(0-8): signs
- * Byte 3,4: in coloring mode, the mask for edges
- * Byte 5: edge intersections(4 bytes per inter, or 12 bytes if USE_HERMIT)
+ * Byte 4-7: in coloring mode, the mask for edges, afterwards the
+ *           minimizer index
+ * Byte 8: edge intersections(4 floats per inter)
  */
 struct LeafNode /* TODO: remove this attribute once everything is fixed */ {
 	unsigned short edge_parity : 12;
@@ -172,9 +177,12 @@ struct LeafNode /* TODO: remove this attribute once everything is fixed */ {
 	/* bitfield */
 	char signs;
 
-	int minimizer_index;
-
-	unsigned short flood_fill;
+	/* Flood fill runs before writeOut() assigns the minimizer
+	   indices, so both can share the same storage */
+	union {
+		int minimizer_index;
+		unsigned short flood_fill;
+	};
 
 	float edge_intersections[0];
 };
@@ -222,6 +230,46 @@ struct PathList {
 	PathList *next;
 };
 
+/**
+ * Leaf cell whose minimizer is computed by writeOut(), gathered in
+ * traversal order so vertex indices do not depend on threading
+ */
+struct MinimizerCell {
+	const LeafNode *leaf;
+	int st[3];
+	int len;
+	int mult;
+};
+
+/**
+ * Triangle already projected into the grid, kept around so the
+ * octants can be scan converted in parallel
+ */
+struct ProjectedTriangle {
+	int64_t trig[3][3];
+};
+
+/**
+ * Part of the contouring traversal: either a whole subtree or only the
+ * faces and edges shared by the children of a node. Jobs are gathered
+ * in serial traversal order and their quads are emitted in that order.
+ */
+struct ContourJob {
+	Node *node;
+	int leaf;
+	int depth;
+	int seams_only;
+};
+
+/**
+ * Node allocators: internal nodes by number of children and leaves by
+ * number of stored edge intersections. MemoryAllocator is not
+ * thread-safe, so every subtree built in parallel gets its own pools.
+ */
+struct NodePools {
+	VirtualMemoryAllocator *alloc[9];
+	VirtualMemoryAllocator *leafalloc[4];
+};
 
 /**
  * Class for building and processing an octree
@@ -232,8 +280,11 @@ class Octree
 	/* Public members */
 
 	/// Memory allocators
-	VirtualMemoryAllocator *alloc[9];
-	VirtualMemoryAllocator *leafalloc[4];
+	NodePools pools;
+
+	/// Allocators of the subtrees built in parallel, their nodes stay
+	/// in use until the octree is freed
+	std::vector<NodePools> subtree_pools;
 
 	/// Root node
 	Node *root;
@@ -309,6 +360,7 @@ class Octree
 	 * Initialize memory allocators
 	 */
 	void initMemory();
+	void initPools(NodePools& p, int heap_base);
 
 	/**
 	 * Release memory
@@ -336,13 +388,16 @@ class Octree
 	 * Add triangles to the tree
 	 */
 	void addAllTriangles();
-	void addTriangle(Triangle *trian, int triind);
-	InternalNode *addTriangle(InternalNode *node, CubeTriangleIsect *p, int height);
+	void projectTriangle(Triangle *trian, ProjectedTriangle& tri);
+	void addTriangle(const ProjectedTriangle& tri, int triind);
+	InternalNode *addTriangle(InternalNode *node, CubeTriangleIsect *p, int height,
+	                          NodePools& p_pools);
+	void addTrianglesParallel(const std::vector<ProjectedTriangle>& triangles);
 
 	/**
 	 * Method to update minimizer in a cell: update edge intersections instead
 	 */
-	LeafNode *updateCell(LeafNode *node, CubeTriangleIsect *p);
+	LeafNode *updateCell(LeafNode *node, CubeTriangleIsect *p, NodePools& p_pools);
 
 	/* Routines to detect and patch holes */
 	int numRings;
@@ -421,17 +476,25 @@ class Octree
 	void writeOut();
 
 	void countIntersection(Node *node, int height, int& nedge, int& ncell, int& nface);
-	void generateMinimizer(Node *node, int st[3], int len, int height, int& offset);
+	void generateMinimizer(Node *node, int st[3], int len, int height, int& offset,
+	                       std::vector<MinimizerCell>& cells);
+	void writeMinimizers(std::vector<MinimizerCell>& cells);
 	void computeMinimizer(const LeafNode * leaf, int st[3], int len,
 	                      float rvalue[3]) const;
 	/**
 	 * Traversal functions to generate polygon model
 	 * op: 0 for counting, 1 for writing OBJ, 2 for writing OFF, 3 for writing PLY
 	 */
-	void cellProcContour(Node *node, int leaf, int depth);
-	void faceProcContour(Node * node[2], int leaf[2], int depth[2], int maxdep, int dir);
-	void edgeProcContour(Node * node[4], int leaf[4], int depth[4], int maxdep, int dir);
-	void processEdgeWrite(Node * node[4], int depths[4], int maxdep, int dir);
+	void gatherContourJobs(Node *node, int leaf, int depth, int levels,
+	                       std::vector<ContourJob>& jobs);
+	void cellProcContour(Node *node, int leaf, int depth, std::vector<int>& quads);
+	void cellProcContourSeams(Node *node, int depth, std::vector<int>& quads);
+	void faceProcContour(Node * node[2], int leaf[2], int depth[2], int maxdep, int dir,
+	                     std::vector<int>& quads);
+	void edgeProcContour(Node * node[4], int leaf[4], int depth[4], int maxdep, int dir,
+	                     std::vector<int>& quads);
+	void processEdgeWrite(Node * node[4], int depths[4], int maxdep, int dir,
+	                      std::vector<int>& quads);
 
 	/* output callbacks/data */
 	DualConAllocOutput alloc_output;
@@ -1143,17 +1206,18 @@ class Octree
 
 
 	/// Update method
-	LeafNode *updateEdgeOffsetsNormals(LeafNode *leaf, int oldlen, int newlen, float offs[3], float a[3], float b[3], float c[3])
+	LeafNode *updateEdgeOffsetsNormals(LeafNode *leaf, int oldlen, int newlen, float offs[3], float a[3], float b[3], float c[3],
+	                                   NodePools& p_pools)
 	{
 		// First, create a new leaf node
-		LeafNode *nleaf = createLeaf(newlen);
+		LeafNode *nleaf = createLeaf(newlen, p_pools);
 		*nleaf = *leaf;
 
 		// Next, fill in the offsets
 		setEdgeOffsetsNormals(nleaf, offs, a, b, c, newlen);
 
 		// Finally, delete the old leaf
-		removeLeaf(oldlen, leaf);
+		removeLeaf(oldlen, leaf, p_pools);
 
 		return nleaf;
 	}
@@ -1307,19 +1371,24 @@ class Octree
 	}
 
 	/// Allocate a node
-	InternalNode *createInternal(int length)
+	InternalNode *createInternal(int length, NodePools& p_pools)
 	{
-		InternalNode *inode = (InternalNode *)alloc[length]->allocate();
+		InternalNode *inode = (InternalNode *)p_pools.alloc[length]->allocate();
 		inode->has_child_bitfield = 0;
 		inode->child_is_leaf_bitfield = 0;
 		return inode;
 	}
 
-	LeafNode *createLeaf(int length)
+	InternalNode *createInternal(int length)
+	{
+		return createInternal(length, pools);
+	}
+
+	LeafNode *createLeaf(int length, NodePools& p_pools)
 	{
 		assert(length <= 3);
 
-		LeafNode *lnode = (LeafNode *)leafalloc[length]->allocate();
+		LeafNode *lnode = (LeafNode *)p_pools.leafalloc[length]->allocate();
 		lnode->edge_parity = 0;
 		lnode->primary_edge_intersections = 0;
 		lnode->signs = 0;
@@ -1327,23 +1396,38 @@ class Octree
 		return lnode;
 	}
 
+	LeafNode *createLeaf(int length)
+	{
+		return createLeaf(length, pools);
+	}
+
+	void removeInternal(int num, InternalNode *node, NodePools& p_pools)
+	{
+		p_pools.alloc[num]->deallocate(node);
+	}
+
 	void removeInternal(int num, InternalNode *node)
 	{
-		alloc[num]->deallocate(node);
+		removeInternal(num, node, pools);
 	}
 
-	void removeLeaf(int num, LeafNode *leaf)
+	void removeLeaf(int num, LeafNode *leaf, NodePools& p_pools)
 	{
 		assert(num >= 0 && num <= 3);
-		leafalloc[num]->deallocate(leaf);
+		p_pools.leafalloc[num]->deallocate(leaf);
+	}
+
+	void removeLeaf(int num, LeafNode *leaf)
+	{
+		removeLeaf(num, leaf, pools);
 	}
 
 	/// Add a leaf (by creating a new par node with the leaf added)
 	InternalNode *addLeafChild(InternalNode *par, int index, int count,
-							   LeafNode *leaf)
+							   LeafNode *leaf, NodePools& p_pools)
 	{
 		int num = par->get_num_children() + 1;
-		InternalNode *npar = createInternal(num);
+		InternalNode *npar = createInternal(num, p_pools);
 		*npar = *par;
 
 		if (num == 1) {
@@ -1360,15 +1444,15 @@ class Octree
 			}
 		}
 
-		removeInternal(num - 1, par);
+		removeInternal(num - 1, par, p_pools);
 		return npar;
 	}
 
 	InternalNode *addInternalChild(InternalNode *par, int index, int count,
-								   InternalNode *node)
+								   InternalNode *node, NodePools& p_pools)
 	{
 		int num = par->get_num_children() + 1;
-		InternalNode *npar = createInternal(num);
+		InternalNode *npar = createInternal(num, p_pools);
 		*npar = *par;
 
 		if (num == 1) {
@@ -1385,7 +1469,7 @@ class Octree
 			}
 		}
 
-		removeInternal(num - 1, par);
+		removeInternal(num - 1, par, p_pools);
 		return npar;
 	}
 
@@ -275,6 +275,7 @@ class RENDER_PT_performance(RenderButtonsPanel, Panel):
 
         col.separator()
         col.prop(rd, 'preview_start_resolution')
+        col.prop(rd, "use_threaded_conversion")
 
         col = split.column()
         col.label(text="Memory:")
@@ -140,9 +140,18 @@ void bvhcache_insert(BVHCache *cache, BVHTree *tree, int type);
 
 /*
  * inits and frees a bvhcache
+ *
+ * Trees of freed caches are kept around for a while and refitted when
+ * a derived mesh with the same topology asks for the same tree type.
  */
 void bvhcache_init(BVHCache *cache);
 void bvhcache_free(BVHCache *cache);
 
+/*
+ * frees the trees kept from freed caches, on exit or when loading a file
+ */
+void bvhcache_exit(void);
+void bvhcache_clear_recycled(void);
+
 #endif
 
@@ -30,6 +30,9 @@
 #include "BLI_sys_types.h" // for intptr_t support
 
 #include "BLI_utildefines.h" /* for BLI_assert */
+#include "BLI_alloca.h"
+#include "BLI_ghash.h"
+#include "BLI_task.h"
 
 #include "BKE_ccg.h"
 #include "CCGSubSurf.h"
@@ -42,6 +45,15 @@
 /* With this limit a single triangle becomes over 3 million faces */
 #define CCGSUBSURF_LEVEL_MAX 11
 
+/* number of consecutive coordinate-only syncs after which stencils get built */
+#define CCGSUBSURF_STENCIL_MIN_SYNCS 2
+/* maximum number of subdivisions of probe data to build stencils */
+#define CCGSUBSURF_STENCIL_MAX_PROBES 16
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 /***/
 
 typedef unsigned char byte;
@@ -72,7 +84,12 @@ typedef struct _EHash {
 
 #define EHASH_hash(eh, item)    (((uintptr_t) (item)) % ((unsigned int) (eh)->curSize))
 
+typedef struct CCGSubSurfStencils CCGSubSurfStencils;
+
 static void ccgSubSurf__sync(CCGSubSurf *ss);
+static CCGSubSurfStencils *ccgSubSurf__stencilsBuild(CCGSubSurf *ss);
+static void ccgSubSurf__stencilsEval(CCGSubSurf *ss);
+static void ccgSubSurf__stencilsFree(CCGSubSurf *ss);
 static int _edge_isBoundary(const CCGEdge *e);
 
 static EHash *_ehash_new(int estimatedNumEntries, CCGAllocatorIFC *allocatorIFC, CCGAllocatorHDL allocator)
@@ -418,8 +435,6 @@ struct CCGSubSurf {
 	float defaultCreaseValue;
 	void *defaultEdgeUserData;
 
-	void *q, *r;
-		
 	/* data for calc vert normals */
 	int calcVertNormals;
 	int normalDataOffset;
@@ -442,6 +457,12 @@ struct CCGSubSurf {
 	int lenTempArrays;
 	CCGVert **tempVerts;
 	CCGEdge **tempEdges;
+
+	/* data for stencil evaluation of coordinate-only syncs */
+	int useStencils;
+	int numPartialSyncs;   /* partial syncs since the last full sync */
+	int lowerLevelsStale;  /* only the top level is valid after a stencil evaluation */
+	CCGSubSurfStencils *stencils;
 };
 
 #define CCGSUBSURF_alloc(ss, nb)            ((ss)->allocatorIFC.alloc((ss)->allocator, nb))
@@ -883,9 +904,6 @@ CCGSubSurf *ccgSubSurf_new(CCGMeshIFC *ifc, int subdivLevels, CCGAllocatorIFC *a
 
 		ss->allocMask = 0;
 
-		ss->q = CCGSUBSURF_alloc(ss, ss->meshIFC.vertDataSize);
-		ss->r = CCGSUBSURF_alloc(ss, ss->meshIFC.vertDataSize);
-
 		ss->currentAge = 0;
 
 		ss->syncState = eSyncState_None;
@@ -895,6 +913,11 @@ CCGSubSurf *ccgSubSurf_new(CCGMeshIFC *ifc, int subdivLevels, CCGAllocatorIFC *a
 		ss->tempVerts = NULL;
 		ss->tempEdges = NULL;
 
+		ss->useStencils = 0;
+		ss->numPartialSyncs = 0;
+		ss->lowerLevelsStale = 0;
+		ss->stencils = NULL;
+
 		return ss;
 	}
 }
@@ -913,10 +936,10 @@ void ccgSubSurf_free(CCGSubSurf *ss)
 		MEM_freeN(ss->tempEdges);
 	}
 
-	CCGSUBSURF_free(ss, ss->r);
-	CCGSUBSURF_free(ss, ss->q);
 	if (ss->defaultEdgeUserData) CCGSUBSURF_free(ss, ss->defaultEdgeUserData);
 
+	ccgSubSurf__stencilsFree(ss);
+
 	_ehash_free(ss->fMap, (EHEntryFreeFP) _face_free, ss);
 	_ehash_free(ss->eMap, (EHEntryFreeFP) _edge_free, ss);
 	_ehash_free(ss->vMap, (EHEntryFreeFP) _vert_free, ss);
@@ -962,6 +985,9 @@ CCGError ccgSubSurf_setSubdivisionLevels(CCGSubSurf *ss, int subdivisionLevels)
 		return eCCGError_InvalidValue;
 	}
 	else if (subdivisionLevels != ss->subdivLevels) {
+		ccgSubSurf__stencilsFree(ss);
+		ss->numPartialSyncs = 0;
+		ss->lowerLevelsStale = 0;
 		ss->numGrids = 0;
 		ss->subdivLevels = subdivisionLevels;
 		_ehash_free(ss->vMap, (EHEntryFreeFP) _vert_free, ss);
@@ -1035,9 +1061,32 @@ void ccgSubSurf_setAllocMask(CCGSubSurf *ss, int allocMask, int maskOffset)
 
 void ccgSubSurf_setNumLayers(CCGSubSurf *ss, int numLayers)
 {
+	if (numLayers != ss->meshIFC.numLayers) {
+		ccgSubSurf__stencilsFree(ss);
+	}
 	ss->meshIFC.numLayers = numLayers;
 }
 
+/* Evaluate coordinate-only partial syncs with precomputed stencils.
+ *
+ * Once the same topology was synced a few times in a row, the top level
+ * of every vertex, edge and face is expressed as a weighted sum of the
+ * control vertices, so later syncs skip the intermediate levels. Only
+ * the top level is kept up to date then, so this should not be used for
+ * data which is accessed at lower levels (multires). */
+void ccgSubSurf_setUseStencils(CCGSubSurf *ss, int useStencils)
+{
+	ss->useStencils = !!useStencils;
+	if (!ss->useStencils) {
+		ccgSubSurf__stencilsFree(ss);
+	}
+}
+
+int ccgSubSurf_getUseStencils(const CCGSubSurf *ss)
+{
+	return ss->useStencils;
+}
+
 /***/
 
 CCGError ccgSubSurf_initFullSync(CCGSubSurf *ss)
@@ -1048,6 +1097,9 @@ CCGError ccgSubSurf_initFullSync(CCGSubSurf *ss)
 
 	ss->currentAge++;
 
+	ccgSubSurf__stencilsFree(ss);
+	ss->numPartialSyncs = 0;
+
 	ss->oldVMap = ss->vMap; 
 	ss->oldEMap = ss->eMap; 
 	ss->oldFMap = ss->fMap;
@@ -1075,6 +1127,13 @@ CCGError ccgSubSurf_initPartialSync(CCGSubSurf *ss)
 
 	ss->currentAge++;
 
+	/* build stencils once per topology, when coordinates keep changing */
+	if (ss->useStencils && !ss->useAgeCounts && ss->numPartialSyncs < CCGSUBSURF_STENCIL_MIN_SYNCS) {
+		if (++ss->numPartialSyncs == CCGSUBSURF_STENCIL_MIN_SYNCS) {
+			ss->stencils = ccgSubSurf__stencilsBuild(ss);
+		}
+	}
+
 	ss->syncState = eSyncState_Partial;
 
 	return eCCGError_None;
@@ -1093,6 +1152,7 @@ CCGError ccgSubSurf_syncVertDel(CCGSubSurf *ss, CCGVertHDL vHDL)
 			return eCCGError_InvalidValue;
 		}
 		else {
+			ccgSubSurf__stencilsFree(ss);
 			*prevp = v->next;
 			_vert_free(v, ss);
 		}
@@ -1114,6 +1174,7 @@ CCGError ccgSubSurf_syncEdgeDel(CCGSubSurf *ss, CCGEdgeHDL eHDL)
 			return eCCGError_InvalidValue;
 		}
 		else {
+			ccgSubSurf__stencilsFree(ss);
 			*prevp = e->next;
 			_edge_unlinkMarkAndFree(e, ss);
 		}
@@ -1135,6 +1196,7 @@ CCGError ccgSubSurf_syncFaceDel(CCGSubSurf *ss, CCGFaceHDL fHDL)
 			return eCCGError_InvalidValue;
 		}
 		else {
+			ccgSubSurf__stencilsFree(ss);
 			*prevp = f->next;
 			_face_unlinkMarkAndFree(f, ss);
 		}
@@ -1152,6 +1214,7 @@ CCGError ccgSubSurf_syncVert(CCGSubSurf *ss, CCGVertHDL vHDL, const void *vertDa
 	if (ss->syncState == eSyncState_Partial) {
 		v = _ehash_lookupWithPrev(ss->vMap, vHDL, &prevp);
 		if (!v) {
+			ccgSubSurf__stencilsFree(ss);
 			v = _vert_new(vHDL, ss);
 			VertDataCopy(_vert_getCo(v, 0, ss->meshIFC.vertDataSize), vertData, ss);
 			_ehash_insert(ss->vMap, (EHEntry *) v);
@@ -1165,6 +1228,12 @@ CCGError ccgSubSurf_syncVert(CCGSubSurf *ss, CCGVertHDL vHDL, const void *vertDa
 			VertDataCopy(_vert_getCo(v, 0, ss->meshIFC.vertDataSize), vertData, ss);
 			v->flags = Vert_eEffected | seamflag;
 
+			/* stencils evaluate everything, no need to track neighbors */
+			if (ss->stencils) {
+				if (v_r) *v_r = v;
+				return eCCGError_None;
+			}
+
 			for (i = 0; i < v->numEdges; i++) {
 				CCGEdge *e = v->edges[i];
 				e->v0->flags |= Vert_eEffected;
@@ -1220,6 +1289,8 @@ CCGError ccgSubSurf_syncEdge(CCGSubSurf *ss, CCGEdgeHDL eHDL, CCGVertHDL e_vHDL0
 			CCGVert *v0 = _ehash_lookup(ss->vMap, e_vHDL0);
 			CCGVert *v1 = _ehash_lookup(ss->vMap, e_vHDL1);
 
+			ccgSubSurf__stencilsFree(ss);
+
 			eNew = _edge_new(eHDL, v0, v1, crease, ss);
 
 			if (e) {
@@ -1300,6 +1371,8 @@ CCGError ccgSubSurf_syncFace(CCGSubSurf *ss, CCGFaceHDL fHDL, int numVerts, CCGV
 		}
 
 		if (!f || topologyChanged) {
+			ccgSubSurf__stencilsFree(ss);
+
 			fNew = _face_new(fHDL, ss->tempVerts, ss->tempEdges, numVerts, ss);
 
 			if (f) {
@@ -1396,7 +1469,12 @@ CCGError ccgSubSurf_processSync(CCGSubSurf *ss)
 	if (ss->syncState == eSyncState_Partial) {
 		ss->syncState = eSyncState_None;
 
-		ccgSubSurf__sync(ss);
+		if (ss->stencils) {
+			ccgSubSurf__stencilsEval(ss);
+		}
+		else {
+			ccgSubSurf__sync(ss);
+		}
 	}
 	else if (ss->syncState) {
 		_ehash_free(ss->oldFMap, (EHEntryFreeFP) _face_unlinkMarkAndFree, ss);
@@ -1430,717 +1508,1094 @@ CCGError ccgSubSurf_processSync(CCGSubSurf *ss)
 #define FACE_calcIFNo(f, lvl, S, x, y, no)  _face_calcIFNo(f, lvl, S, x, y, no, subdivLevels, vertDataSize)
 #define FACE_getIENo(f, lvl, S, x)          _face_getIENo(f, lvl, S, x, subdivLevels, vertDataSize, normalDataOffset)
 
-static void ccgSubSurf__calcVertNormals(CCGSubSurf *ss,
-                                        CCGVert **effectedV, CCGEdge **effectedE, CCGFace **effectedF,
-                                        int numEffectedV, int numEffectedE, int numEffectedF)
+/* Data shared by the per-element callbacks of the subdivision passes.
+ *
+ * Each pass only writes data owned by the face, edge or vertex it visits
+ * and only reads data written by earlier passes, so all passes can run
+ * on the task scheduler without locking. */
+typedef struct CCGSubSurfCalcSubdivData {
+	CCGSubSurf *ss;
+	CCGVert **effectedV;
+	CCGEdge **effectedE;
+	CCGFace **effectedF;
+	int numEffectedV;
+	int numEffectedE;
+	int numEffectedF;
+
+	int curLvl;
+} CCGSubSurfCalcSubdivData;
+
+static bool ccgSubSurf__useThreads(int numEffectedF, int lvl)
 {
-	int i, ptrIdx;
-	int subdivLevels = ss->subdivLevels;
-	int lvl = ss->subdivLevels;
-	int edgeSize = ccg_edgesize(lvl);
-	int gridSize = ccg_gridsize(lvl);
-	int normalDataOffset = ss->normalDataOffset;
-	int vertDataSize = ss->meshIFC.vertDataSize;
+	const int edgeSize = ccg_edgesize(lvl);
+	return ((size_t)numEffectedF * edgeSize * edgeSize * 4 >= CCG_OMP_LIMIT);
+}
+
+static void ccgSubSurf__parallelRange(int num, void *userdata, TaskParallelRangeFunc func, bool useThreads)
+{
+	if (num == 0) {
+		return;
+	}
+	else if (useThreads) {
+		/* faces have a varying number of corners, keep scheduling dynamic */
+		BLI_task_parallel_range_ex(0, num, userdata, func, 1, true);
+	}
+	else {
+		int i;
+		for (i = 0; i < num; i++) {
+			func(userdata, i);
+		}
+	}
+}
 
-#pragma omp parallel for private(ptrIdx) if (numEffectedF * edgeSize * edgeSize * 4 >= CCG_OMP_LIMIT)
-	for (ptrIdx = 0; ptrIdx < numEffectedF; ptrIdx++) {
-		CCGFace *f = (CCGFace *) effectedF[ptrIdx];
-		int S, x, y;
-		float no[3];
+static void ccgSubSurf__calcVertNormals_faces_accumulate_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGFace *f = data->effectedF[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int lvl = ss->subdivLevels;
+	const int gridSize = ccg_gridsize(lvl);
+	const int normalDataOffset = ss->normalDataOffset;
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	int S, x, y;
+	float no[3];
 
-		for (S = 0; S < f->numVerts; S++) {
-			for (y = 0; y < gridSize - 1; y++) {
-				for (x = 0; x < gridSize - 1; x++) {
-					NormZero(FACE_getIFNo(f, lvl, S, x, y));
-				}
+	for (S = 0; S < f->numVerts; S++) {
+		for (y = 0; y < gridSize - 1; y++) {
+			for (x = 0; x < gridSize - 1; x++) {
+				NormZero(FACE_getIFNo(f, lvl, S, x, y));
 			}
+		}
 
-			if (FACE_getEdges(f)[(S - 1 + f->numVerts) % f->numVerts]->flags & Edge_eEffected) {
-				for (x = 0; x < gridSize - 1; x++) {
-					NormZero(FACE_getIFNo(f, lvl, S, x, gridSize - 1));
-				}
-			}
-			if (FACE_getEdges(f)[S]->flags & Edge_eEffected) {
-				for (y = 0; y < gridSize - 1; y++) {
-					NormZero(FACE_getIFNo(f, lvl, S, gridSize - 1, y));
-				}
+		if (FACE_getEdges(f)[(S - 1 + f->numVerts) % f->numVerts]->flags & Edge_eEffected) {
+			for (x = 0; x < gridSize - 1; x++) {
+				NormZero(FACE_getIFNo(f, lvl, S, x, gridSize - 1));
 			}
-			if (FACE_getVerts(f)[S]->flags & Vert_eEffected) {
-				NormZero(FACE_getIFNo(f, lvl, S, gridSize - 1, gridSize - 1));
+		}
+		if (FACE_getEdges(f)[S]->flags & Edge_eEffected) {
+			for (y = 0; y < gridSize - 1; y++) {
+				NormZero(FACE_getIFNo(f, lvl, S, gridSize - 1, y));
 			}
 		}
+		if (FACE_getVerts(f)[S]->flags & Vert_eEffected) {
+			NormZero(FACE_getIFNo(f, lvl, S, gridSize - 1, gridSize - 1));
+		}
+	}
 
-		for (S = 0; S < f->numVerts; S++) {
-			int yLimit = !(FACE_getEdges(f)[(S - 1 + f->numVerts) % f->numVerts]->flags & Edge_eEffected);
-			int xLimit = !(FACE_getEdges(f)[S]->flags & Edge_eEffected);
-			int yLimitNext = xLimit;
-			int xLimitPrev = yLimit;
-			
-			for (y = 0; y < gridSize - 1; y++) {
-				for (x = 0; x < gridSize - 1; x++) {
-					int xPlusOk = (!xLimit || x < gridSize - 2);
-					int yPlusOk = (!yLimit || y < gridSize - 2);
-
-					FACE_calcIFNo(f, lvl, S, x, y, no);
-
-					NormAdd(FACE_getIFNo(f, lvl, S, x + 0, y + 0), no);
-					if (xPlusOk)
-						NormAdd(FACE_getIFNo(f, lvl, S, x + 1, y + 0), no);
-					if (yPlusOk)
-						NormAdd(FACE_getIFNo(f, lvl, S, x + 0, y + 1), no);
-					if (xPlusOk && yPlusOk) {
-						if (x < gridSize - 2 || y < gridSize - 2 || FACE_getVerts(f)[S]->flags & Vert_eEffected) {
-							NormAdd(FACE_getIFNo(f, lvl, S, x + 1, y + 1), no);
-						}
+	for (S = 0; S < f->numVerts; S++) {
+		int yLimit = !(FACE_getEdges(f)[(S - 1 + f->numVerts) % f->numVerts]->flags & Edge_eEffected);
+		int xLimit = !(FACE_getEdges(f)[S]->flags & Edge_eEffected);
+		int yLimitNext = xLimit;
+		int xLimitPrev = yLimit;
+
+		for (y = 0; y < gridSize - 1; y++) {
+			for (x = 0; x < gridSize - 1; x++) {
+				int xPlusOk = (!xLimit || x < gridSize - 2);
+				int yPlusOk = (!yLimit || y < gridSize - 2);
+
+				FACE_calcIFNo(f, lvl, S, x, y, no);
+
+				NormAdd(FACE_getIFNo(f, lvl, S, x + 0, y + 0), no);
+				if (xPlusOk)
+					NormAdd(FACE_getIFNo(f, lvl, S, x + 1, y + 0), no);
+				if (yPlusOk)
+					NormAdd(FACE_getIFNo(f, lvl, S, x + 0, y + 1), no);
+				if (xPlusOk && yPlusOk) {
+					if (x < gridSize - 2 || y < gridSize - 2 || FACE_getVerts(f)[S]->flags & Vert_eEffected) {
+						NormAdd(FACE_getIFNo(f, lvl, S, x + 1, y + 1), no);
 					}
+				}
 
-					if (x == 0 && y == 0) {
-						int K;
+				if (x == 0 && y == 0) {
+					int K;
 
-						if (!yLimitNext || 1 < gridSize - 1)
-							NormAdd(FACE_getIFNo(f, lvl, (S + 1) % f->numVerts, 0, 1), no);
-						if (!xLimitPrev || 1 < gridSize - 1)
-							NormAdd(FACE_getIFNo(f, lvl, (S - 1 + f->numVerts) % f->numVerts, 1, 0), no);
+					if (!yLimitNext || 1 < gridSize - 1)
+						NormAdd(FACE_getIFNo(f, lvl, (S + 1) % f->numVerts, 0, 1), no);
+					if (!xLimitPrev || 1 < gridSize - 1)
+						NormAdd(FACE_getIFNo(f, lvl, (S - 1 + f->numVerts) % f->numVerts, 1, 0), no);
 
-						for (K = 0; K < f->numVerts; K++) {
-							if (K != S) {
-								NormAdd(FACE_getIFNo(f, lvl, K, 0, 0), no);
-							}
+					for (K = 0; K < f->numVerts; K++) {
+						if (K != S) {
+							NormAdd(FACE_getIFNo(f, lvl, K, 0, 0), no);
 						}
 					}
-					else if (y == 0) {
-						NormAdd(FACE_getIFNo(f, lvl, (S + 1) % f->numVerts, 0, x), no);
-						if (!yLimitNext || x < gridSize - 2)
-							NormAdd(FACE_getIFNo(f, lvl, (S + 1) % f->numVerts, 0, x + 1), no);
-					}
-					else if (x == 0) {
-						NormAdd(FACE_getIFNo(f, lvl, (S - 1 + f->numVerts) % f->numVerts, y, 0), no);
-						if (!xLimitPrev || y < gridSize - 2)
-							NormAdd(FACE_getIFNo(f, lvl, (S - 1 + f->numVerts) % f->numVerts, y + 1, 0), no);
-					}
+				}
+				else if (y == 0) {
+					NormAdd(FACE_getIFNo(f, lvl, (S + 1) % f->numVerts, 0, x), no);
+					if (!yLimitNext || x < gridSize - 2)
+						NormAdd(FACE_getIFNo(f, lvl, (S + 1) % f->numVerts, 0, x + 1), no);
+				}
+				else if (x == 0) {
+					NormAdd(FACE_getIFNo(f, lvl, (S - 1 + f->numVerts) % f->numVerts, y, 0), no);
+					if (!xLimitPrev || y < gridSize - 2)
+						NormAdd(FACE_getIFNo(f, lvl, (S - 1 + f->numVerts) % f->numVerts, y + 1, 0), no);
 				}
 			}
 		}
 	}
-	/* XXX can I reduce the number of normalisations here? */
-	for (ptrIdx = 0; ptrIdx < numEffectedV; ptrIdx++) {
-		CCGVert *v = (CCGVert *) effectedV[ptrIdx];
-		float *no = VERT_getNo(v, lvl);
+}
 
-		NormZero(no);
+static void ccgSubSurf__calcVertNormals_verts_accumulate_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGVert *v = data->effectedV[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int lvl = ss->subdivLevels;
+	const int gridSize = ccg_gridsize(lvl);
+	const int normalDataOffset = ss->normalDataOffset;
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	float *no = VERT_getNo(v, lvl);
+	int i;
 
-		for (i = 0; i < v->numFaces; i++) {
-			CCGFace *f = v->faces[i];
-			NormAdd(no, FACE_getIFNo(f, lvl, _face_getVertIndex(f, v), gridSize - 1, gridSize - 1));
-		}
+	NormZero(no);
 
-		if (UNLIKELY(v->numFaces == 0)) {
-			NormCopy(no, VERT_getCo(v, lvl));
-		}
+	for (i = 0; i < v->numFaces; i++) {
+		CCGFace *f = v->faces[i];
+		NormAdd(no, FACE_getIFNo(f, lvl, _face_getVertIndex(f, v), gridSize - 1, gridSize - 1));
+	}
 
-		Normalize(no);
+	if (UNLIKELY(v->numFaces == 0)) {
+		NormCopy(no, VERT_getCo(v, lvl));
+	}
 
-		for (i = 0; i < v->numFaces; i++) {
-			CCGFace *f = v->faces[i];
-			NormCopy(FACE_getIFNo(f, lvl, _face_getVertIndex(f, v), gridSize - 1, gridSize - 1), no);
-		}
+	Normalize(no);
+
+	for (i = 0; i < v->numFaces; i++) {
+		CCGFace *f = v->faces[i];
+		NormCopy(FACE_getIFNo(f, lvl, _face_getVertIndex(f, v), gridSize - 1, gridSize - 1), no);
 	}
-	for (ptrIdx = 0; ptrIdx < numEffectedE; ptrIdx++) {
-		CCGEdge *e = (CCGEdge *) effectedE[ptrIdx];
+}
+
+static void ccgSubSurf__calcVertNormals_edges_accumulate_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGEdge *e = data->effectedE[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int lvl = ss->subdivLevels;
+	const int edgeSize = ccg_edgesize(lvl);
+	const int normalDataOffset = ss->normalDataOffset;
+	const int vertDataSize = ss->meshIFC.vertDataSize;
 
-		if (e->numFaces) {
-			CCGFace *fLast = e->faces[e->numFaces - 1];
-			int x;
+	if (e->numFaces) {
+		CCGFace *fLast = e->faces[e->numFaces - 1];
+		int i, x;
 
-			for (i = 0; i < e->numFaces - 1; i++) {
-				CCGFace *f = e->faces[i];
-				const int f_ed_idx = _face_getEdgeIndex(f, e);
-				const int f_ed_idx_last = _face_getEdgeIndex(fLast, e);
+		for (i = 0; i < e->numFaces - 1; i++) {
+			CCGFace *f = e->faces[i];
+			const int f_ed_idx = _face_getEdgeIndex(f, e);
+			const int f_ed_idx_last = _face_getEdgeIndex(fLast, e);
 
-				for (x = 1; x < edgeSize - 1; x++) {
-					NormAdd(_face_getIFNoEdge(fLast, e, f_ed_idx_last, lvl, x, 0, subdivLevels, vertDataSize, normalDataOffset),
-					        _face_getIFNoEdge(f, e, f_ed_idx, lvl, x, 0, subdivLevels, vertDataSize, normalDataOffset));
-				}
+			for (x = 1; x < edgeSize - 1; x++) {
+				NormAdd(_face_getIFNoEdge(fLast, e, f_ed_idx_last, lvl, x, 0, subdivLevels, vertDataSize, normalDataOffset),
+				        _face_getIFNoEdge(f, e, f_ed_idx, lvl, x, 0, subdivLevels, vertDataSize, normalDataOffset));
 			}
+		}
 
-			for (i = 0; i < e->numFaces - 1; i++) {
-				CCGFace *f = e->faces[i];
-				const int f_ed_idx = _face_getEdgeIndex(f, e);
-				const int f_ed_idx_last = _face_getEdgeIndex(fLast, e);
+		for (i = 0; i < e->numFaces - 1; i++) {
+			CCGFace *f = e->faces[i];
+			const int f_ed_idx = _face_getEdgeIndex(f, e);
+			const int f_ed_idx_last = _face_getEdgeIndex(fLast, e);
 
-				for (x = 1; x < edgeSize - 1; x++) {
-					NormCopy(_face_getIFNoEdge(f, e, f_ed_idx, lvl, x, 0, subdivLevels, vertDataSize, normalDataOffset),
-					         _face_getIFNoEdge(fLast, e, f_ed_idx_last, lvl, x, 0, subdivLevels, vertDataSize, normalDataOffset));
-				}
+			for (x = 1; x < edgeSize - 1; x++) {
+				NormCopy(_face_getIFNoEdge(f, e, f_ed_idx, lvl, x, 0, subdivLevels, vertDataSize, normalDataOffset),
+				         _face_getIFNoEdge(fLast, e, f_ed_idx_last, lvl, x, 0, subdivLevels, vertDataSize, normalDataOffset));
 			}
 		}
 	}
+}
 
-#pragma omp parallel for private(ptrIdx) if (numEffectedF * edgeSize * edgeSize * 4 >= CCG_OMP_LIMIT)
-	for (ptrIdx = 0; ptrIdx < numEffectedF; ptrIdx++) {
-		CCGFace *f = (CCGFace *) effectedF[ptrIdx];
-		int S, x, y;
+static void ccgSubSurf__calcVertNormals_faces_finalize_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGFace *f = data->effectedF[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int lvl = ss->subdivLevels;
+	const int gridSize = ccg_gridsize(lvl);
+	const int normalDataOffset = ss->normalDataOffset;
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	int S, x, y;
 
-		for (S = 0; S < f->numVerts; S++) {
-			NormCopy(FACE_getIFNo(f, lvl, (S + 1) % f->numVerts, 0, gridSize - 1),
-			         FACE_getIFNo(f, lvl, S, gridSize - 1, 0));
-		}
+	for (S = 0; S < f->numVerts; S++) {
+		NormCopy(FACE_getIFNo(f, lvl, (S + 1) % f->numVerts, 0, gridSize - 1),
+		         FACE_getIFNo(f, lvl, S, gridSize - 1, 0));
+	}
 
-		for (S = 0; S < f->numVerts; S++) {
-			for (y = 0; y < gridSize; y++) {
-				for (x = 0; x < gridSize; x++) {
-					float *no = FACE_getIFNo(f, lvl, S, x, y);
-					Normalize(no);
-				}
+	for (S = 0; S < f->numVerts; S++) {
+		for (y = 0; y < gridSize; y++) {
+			for (x = 0; x < gridSize; x++) {
+				float *no = FACE_getIFNo(f, lvl, S, x, y);
+				Normalize(no);
 			}
+		}
 
-			VertDataCopy((float *)((byte *)FACE_getCenterData(f) + normalDataOffset),
-			             FACE_getIFNo(f, lvl, S, 0, 0), ss);
+		VertDataCopy((float *)((byte *)FACE_getCenterData(f) + normalDataOffset),
+		             FACE_getIFNo(f, lvl, S, 0, 0), ss);
 
-			for (x = 1; x < gridSize - 1; x++)
-				NormCopy(FACE_getIENo(f, lvl, S, x),
-				         FACE_getIFNo(f, lvl, S, x, 0));
-		}
+		for (x = 1; x < gridSize - 1; x++)
+			NormCopy(FACE_getIENo(f, lvl, S, x),
+			         FACE_getIFNo(f, lvl, S, x, 0));
 	}
+}
 
-	for (ptrIdx = 0; ptrIdx < numEffectedE; ptrIdx++) {
-		CCGEdge *e = (CCGEdge *) effectedE[ptrIdx];
+static void ccgSubSurf__calcVertNormals_edges_finalize_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGEdge *e = data->effectedE[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int lvl = ss->subdivLevels;
+	const int edgeSize = ccg_edgesize(lvl);
+	const int normalDataOffset = ss->normalDataOffset;
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	int x;
 
-		if (e->numFaces) {
-			CCGFace *f = e->faces[0];
-			int x;
-			const int f_ed_idx = _face_getEdgeIndex(f, e);
+	if (e->numFaces) {
+		CCGFace *f = e->faces[0];
+		const int f_ed_idx = _face_getEdgeIndex(f, e);
 
-			for (x = 0; x < edgeSize; x++)
-				NormCopy(EDGE_getNo(e, lvl, x),
-				         _face_getIFNoEdge(f, e, f_ed_idx, lvl, x, 0, subdivLevels, vertDataSize, normalDataOffset));
-		}
-		else {
-			/* set to zero here otherwise the normals are uninitialized memory
-			 * render: tests/animation/knight.blend with valgrind.
-			 * we could be more clever and interpolate vertex normals but these are
-			 * most likely not used so just zero out. */
-			int x;
-
-			for (x = 0; x < edgeSize; x++) {
-				float *no = EDGE_getNo(e, lvl, x);
-				NormCopy(no, EDGE_getCo(e, lvl, x));
-				Normalize(no);
-			}
+		for (x = 0; x < edgeSize; x++)
+			NormCopy(EDGE_getNo(e, lvl, x),
+			         _face_getIFNoEdge(f, e, f_ed_idx, lvl, x, 0, subdivLevels, vertDataSize, normalDataOffset));
+	}
+	else {
+		/* set to zero here otherwise the normals are uninitialized memory
+		 * render: tests/animation/knight.blend with valgrind.
+		 * we could be more clever and interpolate vertex normals but these are
+		 * most likely not used so just zero out. */
+		for (x = 0; x < edgeSize; x++) {
+			float *no = EDGE_getNo(e, lvl, x);
+			NormCopy(no, EDGE_getCo(e, lvl, x));
+			Normalize(no);
 		}
 	}
 }
+
+static void ccgSubSurf__calcVertNormals(CCGSubSurf *ss,
+                                        CCGVert **effectedV, CCGEdge **effectedE, CCGFace **effectedF,
+                                        int numEffectedV, int numEffectedE, int numEffectedF)
+{
+	CCGSubSurfCalcSubdivData data;
+	const bool useThreads = ccgSubSurf__useThreads(numEffectedF, ss->subdivLevels);
+
+	data.ss = ss;
+	data.effectedV = effectedV;
+	data.effectedE = effectedE;
+	data.effectedF = effectedF;
+	data.numEffectedV = numEffectedV;
+	data.numEffectedE = numEffectedE;
+	data.numEffectedF = numEffectedF;
+	data.curLvl = ss->subdivLevels;
+
+	ccgSubSurf__parallelRange(numEffectedF, &data, ccgSubSurf__calcVertNormals_faces_accumulate_cb, useThreads);
+
+	/* XXX can I reduce the number of normalisations here? */
+	ccgSubSurf__parallelRange(numEffectedV, &data, ccgSubSurf__calcVertNormals_verts_accumulate_cb, useThreads);
+	ccgSubSurf__parallelRange(numEffectedE, &data, ccgSubSurf__calcVertNormals_edges_accumulate_cb, useThreads);
+
+	ccgSubSurf__parallelRange(numEffectedF, &data, ccgSubSurf__calcVertNormals_faces_finalize_cb, useThreads);
+	ccgSubSurf__parallelRange(numEffectedE, &data, ccgSubSurf__calcVertNormals_edges_finalize_cb, useThreads);
+}
 #undef FACE_getIFNo
 
 #define FACE_getIECo(f, lvl, S, x)      _face_getIECo(f, lvl, S, x, subdivLevels, vertDataSize)
 #define FACE_getIFCo(f, lvl, S, x, y)   _face_getIFCo(f, lvl, S, x, y, subdivLevels, vertDataSize)
 
-static void ccgSubSurf__calcSubdivLevel(CCGSubSurf *ss,
-                                        CCGVert **effectedV, CCGEdge **effectedE, CCGFace **effectedF,
-                                        int numEffectedV, int numEffectedE, int numEffectedF, int curLvl)
+static void ccgSubSurf__calcSubdivLevel_interior_faces_edges_midpoints_cb(void *userdata, int ptrIdx)
 {
-	int subdivLevels = ss->subdivLevels;
-	int edgeSize = ccg_edgesize(curLvl);
-	int gridSize = ccg_gridsize(curLvl);
-	int nextLvl = curLvl + 1;
-	int ptrIdx, cornerIdx, i;
-	int vertDataSize = ss->meshIFC.vertDataSize;
-	float *q = ss->q, *r = ss->r;
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGFace *f = data->effectedF[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int curLvl = data->curLvl;
+	const int nextLvl = curLvl + 1;
+	const int gridSize = ccg_gridsize(curLvl);
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	int S, x, y;
 
-#pragma omp parallel for private(ptrIdx) if (numEffectedF * edgeSize * edgeSize * 4 >= CCG_OMP_LIMIT)
-	for (ptrIdx = 0; ptrIdx < numEffectedF; ptrIdx++) {
-		CCGFace *f = (CCGFace *) effectedF[ptrIdx];
-		int S, x, y;
+	/* interior face midpoints
+	 * - old interior face points
+	 */
+	for (S = 0; S < f->numVerts; S++) {
+		for (y = 0; y < gridSize - 1; y++) {
+			for (x = 0; x < gridSize - 1; x++) {
+				int fx = 1 + 2 * x;
+				int fy = 1 + 2 * y;
+				const float *co0 = FACE_getIFCo(f, curLvl, S, x + 0, y + 0);
+				const float *co1 = FACE_getIFCo(f, curLvl, S, x + 1, y + 0);
+				const float *co2 = FACE_getIFCo(f, curLvl, S, x + 1, y + 1);
+				const float *co3 = FACE_getIFCo(f, curLvl, S, x + 0, y + 1);
+				float *co = FACE_getIFCo(f, nextLvl, S, fx, fy);
 
-		/* interior face midpoints
-		 * - old interior face points
-		 */
-		for (S = 0; S < f->numVerts; S++) {
-			for (y = 0; y < gridSize - 1; y++) {
-				for (x = 0; x < gridSize - 1; x++) {
-					int fx = 1 + 2 * x;
-					int fy = 1 + 2 * y;
-					const float *co0 = FACE_getIFCo(f, curLvl, S, x + 0, y + 0);
-					const float *co1 = FACE_getIFCo(f, curLvl, S, x + 1, y + 0);
-					const float *co2 = FACE_getIFCo(f, curLvl, S, x + 1, y + 1);
-					const float *co3 = FACE_getIFCo(f, curLvl, S, x + 0, y + 1);
-					float *co = FACE_getIFCo(f, nextLvl, S, fx, fy);
-
-					VertDataAvg4(co, co0, co1, co2, co3, ss);
-				}
+				VertDataAvg4(co, co0, co1, co2, co3, ss);
 			}
 		}
+	}
+
+	/* interior edge midpoints
+	 * - old interior edge points
+	 * - new interior face midpoints
+	 */
+	for (S = 0; S < f->numVerts; S++) {
+		for (x = 0; x < gridSize - 1; x++) {
+			int fx = x * 2 + 1;
+			const float *co0 = FACE_getIECo(f, curLvl, S, x + 0);
+			const float *co1 = FACE_getIECo(f, curLvl, S, x + 1);
+			const float *co2 = FACE_getIFCo(f, nextLvl, (S + 1) % f->numVerts, 1, fx);
+			const float *co3 = FACE_getIFCo(f, nextLvl, S, fx, 1);
+			float *co  = FACE_getIECo(f, nextLvl, S, fx);
+
+			VertDataAvg4(co, co0, co1, co2, co3, ss);
+		}
 
-		/* interior edge midpoints
-		 * - old interior edge points
+		/* interior face interior edge midpoints
+		 * - old interior face points
 		 * - new interior face midpoints
 		 */
-		for (S = 0; S < f->numVerts; S++) {
-			for (x = 0; x < gridSize - 1; x++) {
-				int fx = x * 2 + 1;
-				const float *co0 = FACE_getIECo(f, curLvl, S, x + 0);
-				const float *co1 = FACE_getIECo(f, curLvl, S, x + 1);
-				const float *co2 = FACE_getIFCo(f, nextLvl, (S + 1) % f->numVerts, 1, fx);
-				const float *co3 = FACE_getIFCo(f, nextLvl, S, fx, 1);
-				float *co  = FACE_getIECo(f, nextLvl, S, fx);
-				
-				VertDataAvg4(co, co0, co1, co2, co3, ss);
-			}
 
-			/* interior face interior edge midpoints
-			 * - old interior face points
-			 * - new interior face midpoints
-			 */
+		/* vertical */
+		for (x = 1; x < gridSize - 1; x++) {
+			for (y = 0; y < gridSize - 1; y++) {
+				int fx = x * 2;
+				int fy = y * 2 + 1;
+				const float *co0 = FACE_getIFCo(f, curLvl, S, x, y + 0);
+				const float *co1 = FACE_getIFCo(f, curLvl, S, x, y + 1);
+				const float *co2 = FACE_getIFCo(f, nextLvl, S, fx - 1, fy);
+				const float *co3 = FACE_getIFCo(f, nextLvl, S, fx + 1, fy);
+				float *co  = FACE_getIFCo(f, nextLvl, S, fx, fy);
 
-			/* vertical */
-			for (x = 1; x < gridSize - 1; x++) {
-				for (y = 0; y < gridSize - 1; y++) {
-					int fx = x * 2;
-					int fy = y * 2 + 1;
-					const float *co0 = FACE_getIFCo(f, curLvl, S, x, y + 0);
-					const float *co1 = FACE_getIFCo(f, curLvl, S, x, y + 1);
-					const float *co2 = FACE_getIFCo(f, nextLvl, S, fx - 1, fy);
-					const float *co3 = FACE_getIFCo(f, nextLvl, S, fx + 1, fy);
-					float *co  = FACE_getIFCo(f, nextLvl, S, fx, fy);
-
-					VertDataAvg4(co, co0, co1, co2, co3, ss);
-				}
+				VertDataAvg4(co, co0, co1, co2, co3, ss);
 			}
+		}
 
-			/* horizontal */
-			for (y = 1; y < gridSize - 1; y++) {
-				for (x = 0; x < gridSize - 1; x++) {
-					int fx = x * 2 + 1;
-					int fy = y * 2;
-					const float *co0 = FACE_getIFCo(f, curLvl, S, x + 0, y);
-					const float *co1 = FACE_getIFCo(f, curLvl, S, x + 1, y);
-					const float *co2 = FACE_getIFCo(f, nextLvl, S, fx, fy - 1);
-					const float *co3 = FACE_getIFCo(f, nextLvl, S, fx, fy + 1);
-					float *co  = FACE_getIFCo(f, nextLvl, S, fx, fy);
-
-					VertDataAvg4(co, co0, co1, co2, co3, ss);
-				}
+		/* horizontal */
+		for (y = 1; y < gridSize - 1; y++) {
+			for (x = 0; x < gridSize - 1; x++) {
+				int fx = x * 2 + 1;
+				int fy = y * 2;
+				const float *co0 = FACE_getIFCo(f, curLvl, S, x + 0, y);
+				const float *co1 = FACE_getIFCo(f, curLvl, S, x + 1, y);
+				const float *co2 = FACE_getIFCo(f, nextLvl, S, fx, fy - 1);
+				const float *co3 = FACE_getIFCo(f, nextLvl, S, fx, fy + 1);
+				float *co  = FACE_getIFCo(f, nextLvl, S, fx, fy);
+
+				VertDataAvg4(co, co0, co1, co2, co3, ss);
 			}
 		}
 	}
+}
+
+static void ccgSubSurf__calcSubdivLevel_edges_midpoints_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGEdge *e = data->effectedE[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int curLvl = data->curLvl;
+	const int nextLvl = curLvl + 1;
+	const int edgeSize = ccg_edgesize(curLvl);
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	float sharpness = EDGE_getSharpness(e, curLvl);
+	int x, j;
 
 	/* exterior edge midpoints
 	 * - old exterior edge points
 	 * - new interior face midpoints
 	 */
-	for (ptrIdx = 0; ptrIdx < numEffectedE; ptrIdx++) {
-		CCGEdge *e = (CCGEdge *) effectedE[ptrIdx];
-		float sharpness = EDGE_getSharpness(e, curLvl);
-		int x, j;
+	if (_edge_isBoundary(e) || sharpness > 1.0f) {
+		for (x = 0; x < edgeSize - 1; x++) {
+			int fx = x * 2 + 1;
+			const float *co0 = EDGE_getCo(e, curLvl, x + 0);
+			const float *co1 = EDGE_getCo(e, curLvl, x + 1);
+			float *co  = EDGE_getCo(e, nextLvl, fx);
+
+			VertDataCopy(co, co0, ss);
+			VertDataAdd(co, co1, ss);
+			VertDataMulN(co, 0.5f, ss);
+		}
+	}
+	else {
+		float *q = BLI_array_alloca(q, ss->meshIFC.numLayers);
+		float *r = BLI_array_alloca(r, ss->meshIFC.numLayers);
+
+		for (x = 0; x < edgeSize - 1; x++) {
+			int fx = x * 2 + 1;
+			const float *co0 = EDGE_getCo(e, curLvl, x + 0);
+			const float *co1 = EDGE_getCo(e, curLvl, x + 1);
+			float *co  = EDGE_getCo(e, nextLvl, fx);
+			int numFaces = 0;
 
-		if (_edge_isBoundary(e) || sharpness > 1.0f) {
-			for (x = 0; x < edgeSize - 1; x++) {
-				int fx = x * 2 + 1;
-				const float *co0 = EDGE_getCo(e, curLvl, x + 0);
-				const float *co1 = EDGE_getCo(e, curLvl, x + 1);
-				float *co  = EDGE_getCo(e, nextLvl, fx);
+			VertDataCopy(q, co0, ss);
+			VertDataAdd(q, co1, ss);
 
-				VertDataCopy(co, co0, ss);
-				VertDataAdd(co, co1, ss);
-				VertDataMulN(co, 0.5f, ss);
+			for (j = 0; j < e->numFaces; j++) {
+				CCGFace *f = e->faces[j];
+				const int f_ed_idx = _face_getEdgeIndex(f, e);
+				VertDataAdd(q, _face_getIFCoEdge(f, e, f_ed_idx, nextLvl, fx, 1, subdivLevels, vertDataSize), ss);
+				numFaces++;
 			}
-		}
-		else {
-			for (x = 0; x < edgeSize - 1; x++) {
-				int fx = x * 2 + 1;
-				const float *co0 = EDGE_getCo(e, curLvl, x + 0);
-				const float *co1 = EDGE_getCo(e, curLvl, x + 1);
-				float *co  = EDGE_getCo(e, nextLvl, fx);
-				int numFaces = 0;
-
-				VertDataCopy(q, co0, ss);
-				VertDataAdd(q, co1, ss);
-
-				for (j = 0; j < e->numFaces; j++) {
-					CCGFace *f = e->faces[j];
-					const int f_ed_idx = _face_getEdgeIndex(f, e);
-					VertDataAdd(q, _face_getIFCoEdge(f, e, f_ed_idx, nextLvl, fx, 1, subdivLevels, vertDataSize), ss);
-					numFaces++;
-				}
 
-				VertDataMulN(q, 1.0f / (2.0f + numFaces), ss);
+			VertDataMulN(q, 1.0f / (2.0f + numFaces), ss);
 
-				VertDataCopy(r, co0, ss);
-				VertDataAdd(r, co1, ss);
-				VertDataMulN(r, 0.5f, ss);
+			VertDataCopy(r, co0, ss);
+			VertDataAdd(r, co1, ss);
+			VertDataMulN(r, 0.5f, ss);
 
-				VertDataCopy(co, q, ss);
-				VertDataSub(r, q, ss);
-				VertDataMulN(r, sharpness, ss);
-				VertDataAdd(co, r, ss);
-			}
+			VertDataCopy(co, q, ss);
+			VertDataSub(r, q, ss);
+			VertDataMulN(r, sharpness, ss);
+			VertDataAdd(co, r, ss);
 		}
 	}
+}
+
+static void ccgSubSurf__calcSubdivLevel_verts_shift_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGVert *v = data->effectedV[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int curLvl = data->curLvl;
+	const int nextLvl = curLvl + 1;
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	const float *co = VERT_getCo(v, curLvl);
+	float *nCo = VERT_getCo(v, nextLvl);
+	float *q = BLI_array_alloca(q, ss->meshIFC.numLayers);
+	float *r = BLI_array_alloca(r, ss->meshIFC.numLayers);
+	int sharpCount = 0, allSharp = 1;
+	float avgSharpness = 0.0;
+	int j, seam = VERT_seam(v), seamEdges = 0;
 
 	/* exterior vertex shift
 	 * - old vertex points (shifting)
 	 * - old exterior edge points
 	 * - new interior face midpoints
 	 */
-	for (ptrIdx = 0; ptrIdx < numEffectedV; ptrIdx++) {
-		CCGVert *v = (CCGVert *) effectedV[ptrIdx];
-		const float *co = VERT_getCo(v, curLvl);
-		float *nCo = VERT_getCo(v, nextLvl);
-		int sharpCount = 0, allSharp = 1;
-		float avgSharpness = 0.0;
-		int j, seam = VERT_seam(v), seamEdges = 0;
+	for (j = 0; j < v->numEdges; j++) {
+		CCGEdge *e = v->edges[j];
+		float sharpness = EDGE_getSharpness(e, curLvl);
 
-		for (j = 0; j < v->numEdges; j++) {
-			CCGEdge *e = v->edges[j];
-			float sharpness = EDGE_getSharpness(e, curLvl);
+		if (seam && _edge_isBoundary(e))
+			seamEdges++;
 
-			if (seam && _edge_isBoundary(e))
-				seamEdges++;
+		if (sharpness != 0.0f) {
+			sharpCount++;
+			avgSharpness += sharpness;
+		}
+		else {
+			allSharp = 0;
+		}
+	}
 
-			if (sharpness != 0.0f) {
-				sharpCount++;
-				avgSharpness += sharpness;
-			}
-			else {
-				allSharp = 0;
-			}
+	if (sharpCount) {
+		avgSharpness /= sharpCount;
+		if (avgSharpness > 1.0f) {
+			avgSharpness = 1.0f;
 		}
+	}
 
-		if (sharpCount) {
-			avgSharpness /= sharpCount;
-			if (avgSharpness > 1.0f) {
-				avgSharpness = 1.0f;
+	if (seamEdges < 2 || seamEdges != v->numEdges)
+		seam = 0;
+
+	if (!v->numEdges || ss->meshIFC.simpleSubdiv) {
+		VertDataCopy(nCo, co, ss);
+	}
+	else if (_vert_isBoundary(v)) {
+		int numBoundary = 0;
+
+		VertDataZero(r, ss);
+		for (j = 0; j < v->numEdges; j++) {
+			CCGEdge *e = v->edges[j];
+			if (_edge_isBoundary(e)) {
+				VertDataAdd(r, _edge_getCoVert(e, v, curLvl, 1, vertDataSize), ss);
+				numBoundary++;
 			}
 		}
 
-		if (seamEdges < 2 || seamEdges != v->numEdges)
-			seam = 0;
+		VertDataCopy(nCo, co, ss);
+		VertDataMulN(nCo, 0.75f, ss);
+		VertDataMulN(r, 0.25f / numBoundary, ss);
+		VertDataAdd(nCo, r, ss);
+	}
+	else {
+		int cornerIdx = (1 + (1 << (curLvl))) - 2;
+		int numEdges = 0, numFaces = 0;
 
-		if (!v->numEdges || ss->meshIFC.simpleSubdiv) {
-			VertDataCopy(nCo, co, ss);
+		VertDataZero(q, ss);
+		for (j = 0; j < v->numFaces; j++) {
+			CCGFace *f = v->faces[j];
+			VertDataAdd(q, FACE_getIFCo(f, nextLvl, _face_getVertIndex(f, v), cornerIdx, cornerIdx), ss);
+			numFaces++;
+		}
+		VertDataMulN(q, 1.0f / numFaces, ss);
+		VertDataZero(r, ss);
+		for (j = 0; j < v->numEdges; j++) {
+			CCGEdge *e = v->edges[j];
+			VertDataAdd(r, _edge_getCoVert(e, v, curLvl, 1, vertDataSize), ss);
+			numEdges++;
 		}
-		else if (_vert_isBoundary(v)) {
-			int numBoundary = 0;
+		VertDataMulN(r, 1.0f / numEdges, ss);
 
-			VertDataZero(r, ss);
-			for (j = 0; j < v->numEdges; j++) {
-				CCGEdge *e = v->edges[j];
-				if (_edge_isBoundary(e)) {
-					VertDataAdd(r, _edge_getCoVert(e, v, curLvl, 1, vertDataSize), ss);
-					numBoundary++;
-				}
-			}
+		VertDataCopy(nCo, co, ss);
+		VertDataMulN(nCo, numEdges - 2.0f, ss);
+		VertDataAdd(nCo, q, ss);
+		VertDataAdd(nCo, r, ss);
+		VertDataMulN(nCo, 1.0f / numEdges, ss);
+	}
 
-			VertDataCopy(nCo, co, ss);
-			VertDataMulN(nCo, 0.75f, ss);
-			VertDataMulN(r, 0.25f / numBoundary, ss);
-			VertDataAdd(nCo, r, ss);
+	if ((sharpCount > 1 && v->numFaces) || seam) {
+		VertDataZero(q, ss);
+
+		if (seam) {
+			avgSharpness = 1.0f;
+			sharpCount = seamEdges;
+			allSharp = 1;
 		}
-		else {
-			int cornerIdx = (1 + (1 << (curLvl))) - 2;
-			int numEdges = 0, numFaces = 0;
 
-			VertDataZero(q, ss);
-			for (j = 0; j < v->numFaces; j++) {
-				CCGFace *f = v->faces[j];
-				VertDataAdd(q, FACE_getIFCo(f, nextLvl, _face_getVertIndex(f, v), cornerIdx, cornerIdx), ss);
-				numFaces++;
+		for (j = 0; j < v->numEdges; j++) {
+			CCGEdge *e = v->edges[j];
+			float sharpness = EDGE_getSharpness(e, curLvl);
+
+			if (seam) {
+				if (_edge_isBoundary(e))
+					VertDataAdd(q, _edge_getCoVert(e, v, curLvl, 1, vertDataSize), ss);
 			}
-			VertDataMulN(q, 1.0f / numFaces, ss);
-			VertDataZero(r, ss);
-			for (j = 0; j < v->numEdges; j++) {
-				CCGEdge *e = v->edges[j];
-				VertDataAdd(r, _edge_getCoVert(e, v, curLvl, 1, vertDataSize), ss);
-				numEdges++;
+			else if (sharpness != 0.0f) {
+				VertDataAdd(q, _edge_getCoVert(e, v, curLvl, 1, vertDataSize), ss);
 			}
-			VertDataMulN(r, 1.0f / numEdges, ss);
-
-			VertDataCopy(nCo, co, ss);
-			VertDataMulN(nCo, numEdges - 2.0f, ss);
-			VertDataAdd(nCo, q, ss);
-			VertDataAdd(nCo, r, ss);
-			VertDataMulN(nCo, 1.0f / numEdges, ss);
 		}
 
-		if ((sharpCount > 1 && v->numFaces) || seam) {
-			VertDataZero(q, ss);
-
-			if (seam) {
-				avgSharpness = 1.0f;
-				sharpCount = seamEdges;
-				allSharp = 1;
-			}
-
-			for (j = 0; j < v->numEdges; j++) {
-				CCGEdge *e = v->edges[j];
-				float sharpness = EDGE_getSharpness(e, curLvl);
-
-				if (seam) {
-					if (_edge_isBoundary(e))
-						VertDataAdd(q, _edge_getCoVert(e, v, curLvl, 1, vertDataSize), ss);
-				}
-				else if (sharpness != 0.0f) {
-					VertDataAdd(q, _edge_getCoVert(e, v, curLvl, 1, vertDataSize), ss);
-				}
-			}
-
-			VertDataMulN(q, (float) 1 / sharpCount, ss);
+		VertDataMulN(q, (float) 1 / sharpCount, ss);
 
-			if (sharpCount != 2 || allSharp) {
-				/* q = q + (co - q) * avgSharpness */
-				VertDataCopy(r, co, ss);
-				VertDataSub(r, q, ss);
-				VertDataMulN(r, avgSharpness, ss);
-				VertDataAdd(q, r, ss);
-			}
-
-			/* r = co * 0.75 + q * 0.25 */
+		if (sharpCount != 2 || allSharp) {
+			/* q = q + (co - q) * avgSharpness */
 			VertDataCopy(r, co, ss);
-			VertDataMulN(r, 0.75f, ss);
-			VertDataMulN(q, 0.25f, ss);
-			VertDataAdd(r, q, ss);
-
-			/* nCo = nCo + (r - nCo) * avgSharpness */
-			VertDataSub(r, nCo, ss);
+			VertDataSub(r, q, ss);
 			VertDataMulN(r, avgSharpness, ss);
-			VertDataAdd(nCo, r, ss);
+			VertDataAdd(q, r, ss);
 		}
+
+		/* r = co * 0.75 + q * 0.25 */
+		VertDataCopy(r, co, ss);
+		VertDataMulN(r, 0.75f, ss);
+		VertDataMulN(q, 0.25f, ss);
+		VertDataAdd(r, q, ss);
+
+		/* nCo = nCo + (r - nCo) * avgSharpness */
+		VertDataSub(r, nCo, ss);
+		VertDataMulN(r, avgSharpness, ss);
+		VertDataAdd(nCo, r, ss);
 	}
+}
+
+static void ccgSubSurf__calcSubdivLevel_edges_shift_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGEdge *e = data->effectedE[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int curLvl = data->curLvl;
+	const int nextLvl = curLvl + 1;
+	const int edgeSize = ccg_edgesize(curLvl);
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	float sharpness = EDGE_getSharpness(e, curLvl);
+	int sharpCount = 0;
+	float avgSharpness = 0.0;
+	int x, j;
 
 	/* exterior edge interior shift
 	 * - old exterior edge midpoints (shifting)
 	 * - old exterior edge midpoints
 	 * - new interior face midpoints
 	 */
-	for (ptrIdx = 0; ptrIdx < numEffectedE; ptrIdx++) {
-		CCGEdge *e = (CCGEdge *) effectedE[ptrIdx];
-		float sharpness = EDGE_getSharpness(e, curLvl);
-		int sharpCount = 0;
-		float avgSharpness = 0.0;
-		int x, j;
+	if (sharpness != 0.0f) {
+		sharpCount = 2;
+		avgSharpness += sharpness;
 
-		if (sharpness != 0.0f) {
-			sharpCount = 2;
-			avgSharpness += sharpness;
-
-			if (avgSharpness > 1.0f) {
-				avgSharpness = 1.0f;
-			}
+		if (avgSharpness > 1.0f) {
+			avgSharpness = 1.0f;
 		}
-		else {
-			sharpCount = 0;
-			avgSharpness = 0;
+	}
+	else {
+		sharpCount = 0;
+		avgSharpness = 0;
+	}
+
+	if (_edge_isBoundary(e)) {
+		float *r = BLI_array_alloca(r, ss->meshIFC.numLayers);
+
+		for (x = 1; x < edgeSize - 1; x++) {
+			int fx = x * 2;
+			const float *co = EDGE_getCo(e, curLvl, x);
+			float *nCo = EDGE_getCo(e, nextLvl, fx);
+
+			/* Average previous level's endpoints */
+			VertDataCopy(r, EDGE_getCo(e, curLvl, x - 1), ss);
+			VertDataAdd(r, EDGE_getCo(e, curLvl, x + 1), ss);
+			VertDataMulN(r, 0.5f, ss);
+
+			/* nCo = nCo * 0.75 + r * 0.25 */
+			VertDataCopy(nCo, co, ss);
+			VertDataMulN(nCo, 0.75f, ss);
+			VertDataMulN(r, 0.25f, ss);
+			VertDataAdd(nCo, r, ss);
 		}
+	}
+	else {
+		float *q = BLI_array_alloca(q, ss->meshIFC.numLayers);
+		float *r = BLI_array_alloca(r, ss->meshIFC.numLayers);
 
-		if (_edge_isBoundary(e)) {
-			for (x = 1; x < edgeSize - 1; x++) {
-				int fx = x * 2;
-				const float *co = EDGE_getCo(e, curLvl, x);
-				float *nCo = EDGE_getCo(e, nextLvl, fx);
+		for (x = 1; x < edgeSize - 1; x++) {
+			int fx = x * 2;
+			const float *co = EDGE_getCo(e, curLvl, x);
+			float *nCo = EDGE_getCo(e, nextLvl, fx);
+			int numFaces = 0;
 
-				/* Average previous level's endpoints */
-				VertDataCopy(r, EDGE_getCo(e, curLvl, x - 1), ss);
-				VertDataAdd(r, EDGE_getCo(e, curLvl, x + 1), ss);
-				VertDataMulN(r, 0.5f, ss);
+			VertDataZero(q, ss);
+			VertDataZero(r, ss);
+			VertDataAdd(r, EDGE_getCo(e, curLvl, x - 1), ss);
+			VertDataAdd(r, EDGE_getCo(e, curLvl, x + 1), ss);
+			for (j = 0; j < e->numFaces; j++) {
+				CCGFace *f = e->faces[j];
+				int f_ed_idx = _face_getEdgeIndex(f, e);
+				VertDataAdd(q, _face_getIFCoEdge(f, e, f_ed_idx, nextLvl, fx - 1, 1, subdivLevels, vertDataSize), ss);
+				VertDataAdd(q, _face_getIFCoEdge(f, e, f_ed_idx, nextLvl, fx + 1, 1, subdivLevels, vertDataSize), ss);
+
+				VertDataAdd(r, _face_getIFCoEdge(f, e, f_ed_idx, curLvl, x, 1, subdivLevels, vertDataSize), ss);
+				numFaces++;
+			}
+			VertDataMulN(q, 1.0f / (numFaces * 2.0f), ss);
+			VertDataMulN(r, 1.0f / (2.0f + numFaces), ss);
 
-				/* nCo = nCo * 0.75 + r * 0.25 */
-				VertDataCopy(nCo, co, ss);
-				VertDataMulN(nCo, 0.75f, ss);
-				VertDataMulN(r, 0.25f, ss);
-				VertDataAdd(nCo, r, ss);
+			VertDataCopy(nCo, co, ss);
+			VertDataMulN(nCo, (float) numFaces, ss);
+			VertDataAdd(nCo, q, ss);
+			VertDataAdd(nCo, r, ss);
+			VertDataMulN(nCo, 1.0f / (2 + numFaces), ss);
+
+			if (sharpCount == 2) {
+				VertDataCopy(q, co, ss);
+				VertDataMulN(q, 6.0f, ss);
+				VertDataAdd(q, EDGE_getCo(e, curLvl, x - 1), ss);
+				VertDataAdd(q, EDGE_getCo(e, curLvl, x + 1), ss);
+				VertDataMulN(q, 1 / 8.0f, ss);
+
+				VertDataSub(q, nCo, ss);
+				VertDataMulN(q, avgSharpness, ss);
+				VertDataAdd(nCo, q, ss);
 			}
 		}
-		else {
-			for (x = 1; x < edgeSize - 1; x++) {
+	}
+}
+
+static void ccgSubSurf__calcSubdivLevel_interior_faces_edges_centerpoints_shift_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGFace *f = data->effectedF[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int curLvl = data->curLvl;
+	const int nextLvl = curLvl + 1;
+	const int gridSize = ccg_gridsize(curLvl);
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	float *q = BLI_array_alloca(q, ss->meshIFC.numLayers);
+	float *r = BLI_array_alloca(r, ss->meshIFC.numLayers);
+	int S, x, y;
+
+	/* interior center point shift
+	 * - old face center point (shifting)
+	 * - old interior edge points
+	 * - new interior face midpoints
+	 */
+	VertDataZero(q, ss);
+	for (S = 0; S < f->numVerts; S++) {
+		VertDataAdd(q, FACE_getIFCo(f, nextLvl, S, 1, 1), ss);
+	}
+	VertDataMulN(q, 1.0f / f->numVerts, ss);
+	VertDataZero(r, ss);
+	for (S = 0; S < f->numVerts; S++) {
+		VertDataAdd(r, FACE_getIECo(f, curLvl, S, 1), ss);
+	}
+	VertDataMulN(r, 1.0f / f->numVerts, ss);
+
+	VertDataMulN((float *)FACE_getCenterData(f), f->numVerts - 2.0f, ss);
+	VertDataAdd((float *)FACE_getCenterData(f), q, ss);
+	VertDataAdd((float *)FACE_getCenterData(f), r, ss);
+	VertDataMulN((float *)FACE_getCenterData(f), 1.0f / f->numVerts, ss);
+
+	for (S = 0; S < f->numVerts; S++) {
+		/* interior face shift
+		 * - old interior face point (shifting)
+		 * - new interior edge midpoints
+		 * - new interior face midpoints
+		 */
+		for (x = 1; x < gridSize - 1; x++) {
+			for (y = 1; y < gridSize - 1; y++) {
 				int fx = x * 2;
-				const float *co = EDGE_getCo(e, curLvl, x);
-				float *nCo = EDGE_getCo(e, nextLvl, fx);
-				int numFaces = 0;
-
-				VertDataZero(q, ss);
-				VertDataZero(r, ss);
-				VertDataAdd(r, EDGE_getCo(e, curLvl, x - 1), ss);
-				VertDataAdd(r, EDGE_getCo(e, curLvl, x + 1), ss);
-				for (j = 0; j < e->numFaces; j++) {
-					CCGFace *f = e->faces[j];
-					int f_ed_idx = _face_getEdgeIndex(f, e);
-					VertDataAdd(q, _face_getIFCoEdge(f, e, f_ed_idx, nextLvl, fx - 1, 1, subdivLevels, vertDataSize), ss);
-					VertDataAdd(q, _face_getIFCoEdge(f, e, f_ed_idx, nextLvl, fx + 1, 1, subdivLevels, vertDataSize), ss);
-
-					VertDataAdd(r, _face_getIFCoEdge(f, e, f_ed_idx, curLvl, x, 1, subdivLevels, vertDataSize), ss);
-					numFaces++;
-				}
-				VertDataMulN(q, 1.0f / (numFaces * 2.0f), ss);
-				VertDataMulN(r, 1.0f / (2.0f + numFaces), ss);
+				int fy = y * 2;
+				const float *co = FACE_getIFCo(f, curLvl, S, x, y);
+				float *nCo = FACE_getIFCo(f, nextLvl, S, fx, fy);
+
+				VertDataAvg4(q,
+				             FACE_getIFCo(f, nextLvl, S, fx - 1, fy - 1),
+				             FACE_getIFCo(f, nextLvl, S, fx + 1, fy - 1),
+				             FACE_getIFCo(f, nextLvl, S, fx + 1, fy + 1),
+				             FACE_getIFCo(f, nextLvl, S, fx - 1, fy + 1),
+				             ss);
+
+				VertDataAvg4(r,
+				             FACE_getIFCo(f, nextLvl, S, fx - 1, fy + 0),
+				             FACE_getIFCo(f, nextLvl, S, fx + 1, fy + 0),
+				             FACE_getIFCo(f, nextLvl, S, fx + 0, fy - 1),
+				             FACE_getIFCo(f, nextLvl, S, fx + 0, fy + 1),
+				             ss);
 
 				VertDataCopy(nCo, co, ss);
-				VertDataMulN(nCo, (float) numFaces, ss);
-				VertDataAdd(nCo, q, ss);
+				VertDataSub(nCo, q, ss);
+				VertDataMulN(nCo, 0.25f, ss);
 				VertDataAdd(nCo, r, ss);
-				VertDataMulN(nCo, 1.0f / (2 + numFaces), ss);
-
-				if (sharpCount == 2) {
-					VertDataCopy(q, co, ss);
-					VertDataMulN(q, 6.0f, ss);
-					VertDataAdd(q, EDGE_getCo(e, curLvl, x - 1), ss);
-					VertDataAdd(q, EDGE_getCo(e, curLvl, x + 1), ss);
-					VertDataMulN(q, 1 / 8.0f, ss);
-
-					VertDataSub(q, nCo, ss);
-					VertDataMulN(q, avgSharpness, ss);
-					VertDataAdd(nCo, q, ss);
-				}
 			}
 		}
+
+		/* interior edge interior shift
+		 * - old interior edge point (shifting)
+		 * - new interior edge midpoints
+		 * - new interior face midpoints
+		 */
+		for (x = 1; x < gridSize - 1; x++) {
+			int fx = x * 2;
+			const float *co = FACE_getIECo(f, curLvl, S, x);
+			float *nCo = FACE_getIECo(f, nextLvl, S, fx);
+
+			VertDataAvg4(q,
+			             FACE_getIFCo(f, nextLvl, (S + 1) % f->numVerts, 1, fx - 1),
+			             FACE_getIFCo(f, nextLvl, (S + 1) % f->numVerts, 1, fx + 1),
+			             FACE_getIFCo(f, nextLvl, S, fx + 1, +1),
+			             FACE_getIFCo(f, nextLvl, S, fx - 1, +1), ss);
+
+			VertDataAvg4(r,
+			             FACE_getIECo(f, nextLvl, S, fx - 1),
+			             FACE_getIECo(f, nextLvl, S, fx + 1),
+			             FACE_getIFCo(f, nextLvl, (S + 1) % f->numVerts, 1, fx),
+			             FACE_getIFCo(f, nextLvl, S, fx, 1),
+			             ss);
+
+			VertDataCopy(nCo, co, ss);
+			VertDataSub(nCo, q, ss);
+			VertDataMulN(nCo, 0.25f, ss);
+			VertDataAdd(nCo, r, ss);
+		}
 	}
+}
 
-#pragma omp parallel private(ptrIdx) if (numEffectedF * edgeSize * edgeSize * 4 >= CCG_OMP_LIMIT)
-	{
-		float *q, *r;
+static void ccgSubSurf__calcSubdivLevel_edges_copydown_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGEdge *e = data->effectedE[ptrIdx];
+	const int nextLvl = data->curLvl + 1;
+	const int edgeSize = ccg_edgesize(nextLvl);
+	const int vertDataSize = ss->meshIFC.vertDataSize;
 
-#pragma omp critical
-		{
-			q = MEM_mallocN(ss->meshIFC.vertDataSize, "CCGSubsurf q");
-			r = MEM_mallocN(ss->meshIFC.vertDataSize, "CCGSubsurf r");
+	VertDataCopy(EDGE_getCo(e, nextLvl, 0), VERT_getCo(e->v0, nextLvl), ss);
+	VertDataCopy(EDGE_getCo(e, nextLvl, edgeSize - 1), VERT_getCo(e->v1, nextLvl), ss);
+}
+
+static void ccgSubSurf__calcSubdivLevel_faces_copydown_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGFace *f = data->effectedF[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int nextLvl = data->curLvl + 1;
+	const int gridSize = ccg_gridsize(nextLvl);
+	const int cornerIdx = gridSize - 1;
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	int S, x;
+
+	for (S = 0; S < f->numVerts; S++) {
+		CCGEdge *e = FACE_getEdges(f)[S];
+		CCGEdge *prevE = FACE_getEdges(f)[(S + f->numVerts - 1) % f->numVerts];
+
+		VertDataCopy(FACE_getIFCo(f, nextLvl, S, 0, 0), (float *)FACE_getCenterData(f), ss);
+		VertDataCopy(FACE_getIECo(f, nextLvl, S, 0), (float *)FACE_getCenterData(f), ss);
+		VertDataCopy(FACE_getIFCo(f, nextLvl, S, cornerIdx, cornerIdx), VERT_getCo(FACE_getVerts(f)[S], nextLvl), ss);
+		VertDataCopy(FACE_getIECo(f, nextLvl, S, cornerIdx), EDGE_getCo(FACE_getEdges(f)[S], nextLvl, cornerIdx), ss);
+		for (x = 1; x < gridSize - 1; x++) {
+			float *co = FACE_getIECo(f, nextLvl, S, x);
+			VertDataCopy(FACE_getIFCo(f, nextLvl, S, x, 0), co, ss);
+			VertDataCopy(FACE_getIFCo(f, nextLvl, (S + 1) % f->numVerts, 0, x), co, ss);
 		}
+		for (x = 0; x < gridSize - 1; x++) {
+			int eI = gridSize - 1 - x;
+			VertDataCopy(FACE_getIFCo(f, nextLvl, S, cornerIdx, x), _edge_getCoVert(e, FACE_getVerts(f)[S], nextLvl, eI, vertDataSize), ss);
+			VertDataCopy(FACE_getIFCo(f, nextLvl, S, x, cornerIdx), _edge_getCoVert(prevE, FACE_getVerts(f)[S], nextLvl, eI, vertDataSize), ss);
+		}
+	}
+}
 
-#pragma omp for schedule(static)
-		for (ptrIdx = 0; ptrIdx < numEffectedF; ptrIdx++) {
-			CCGFace *f = (CCGFace *) effectedF[ptrIdx];
-			int S, x, y;
+static void ccgSubSurf__calcSubdivLevel(CCGSubSurf *ss,
+                                        CCGVert **effectedV, CCGEdge **effectedE, CCGFace **effectedF,
+                                        int numEffectedV, int numEffectedE, int numEffectedF, int curLvl)
+{
+	CCGSubSurfCalcSubdivData data;
+	const bool useThreads = ccgSubSurf__useThreads(numEffectedF, curLvl);
 
-			/* interior center point shift
-			 * - old face center point (shifting)
-			 * - old interior edge points
-			 * - new interior face midpoints
-			 */
-			VertDataZero(q, ss);
-			for (S = 0; S < f->numVerts; S++) {
-				VertDataAdd(q, FACE_getIFCo(f, nextLvl, S, 1, 1), ss);
-			}
-			VertDataMulN(q, 1.0f / f->numVerts, ss);
-			VertDataZero(r, ss);
-			for (S = 0; S < f->numVerts; S++) {
-				VertDataAdd(r, FACE_getIECo(f, curLvl, S, 1), ss);
-			}
-			VertDataMulN(r, 1.0f / f->numVerts, ss);
-
-			VertDataMulN((float *)FACE_getCenterData(f), f->numVerts - 2.0f, ss);
-			VertDataAdd((float *)FACE_getCenterData(f), q, ss);
-			VertDataAdd((float *)FACE_getCenterData(f), r, ss);
-			VertDataMulN((float *)FACE_getCenterData(f), 1.0f / f->numVerts, ss);
-
-			for (S = 0; S < f->numVerts; S++) {
-				/* interior face shift
-				 * - old interior face point (shifting)
-				 * - new interior edge midpoints
-				 * - new interior face midpoints
-				 */
-				for (x = 1; x < gridSize - 1; x++) {
-					for (y = 1; y < gridSize - 1; y++) {
-						int fx = x * 2;
-						int fy = y * 2;
-						const float *co = FACE_getIFCo(f, curLvl, S, x, y);
-						float *nCo = FACE_getIFCo(f, nextLvl, S, fx, fy);
-						
-						VertDataAvg4(q,
-						             FACE_getIFCo(f, nextLvl, S, fx - 1, fy - 1),
-						             FACE_getIFCo(f, nextLvl, S, fx + 1, fy - 1),
-						             FACE_getIFCo(f, nextLvl, S, fx + 1, fy + 1),
-						             FACE_getIFCo(f, nextLvl, S, fx - 1, fy + 1),
-						             ss);
-
-						VertDataAvg4(r,
-						             FACE_getIFCo(f, nextLvl, S, fx - 1, fy + 0),
-						             FACE_getIFCo(f, nextLvl, S, fx + 1, fy + 0),
-						             FACE_getIFCo(f, nextLvl, S, fx + 0, fy - 1),
-						             FACE_getIFCo(f, nextLvl, S, fx + 0, fy + 1),
-						             ss);
-
-						VertDataCopy(nCo, co, ss);
-						VertDataSub(nCo, q, ss);
-						VertDataMulN(nCo, 0.25f, ss);
-						VertDataAdd(nCo, r, ss);
-					}
-				}
+	data.ss = ss;
+	data.effectedV = effectedV;
+	data.effectedE = effectedE;
+	data.effectedF = effectedF;
+	data.numEffectedV = numEffectedV;
+	data.numEffectedE = numEffectedE;
+	data.numEffectedF = numEffectedF;
+	data.curLvl = curLvl;
 
-				/* interior edge interior shift
-				 * - old interior edge point (shifting)
-				 * - new interior edge midpoints
-				 * - new interior face midpoints
-				 */
-				for (x = 1; x < gridSize - 1; x++) {
-					int fx = x * 2;
-					const float *co = FACE_getIECo(f, curLvl, S, x);
-					float *nCo = FACE_getIECo(f, nextLvl, S, fx);
-					
-					VertDataAvg4(q,
-					             FACE_getIFCo(f, nextLvl, (S + 1) % f->numVerts, 1, fx - 1),
-					             FACE_getIFCo(f, nextLvl, (S + 1) % f->numVerts, 1, fx + 1),
-					             FACE_getIFCo(f, nextLvl, S, fx + 1, +1),
-					             FACE_getIFCo(f, nextLvl, S, fx - 1, +1), ss);
-
-					VertDataAvg4(r,
-					             FACE_getIECo(f, nextLvl, S, fx - 1),
-					             FACE_getIECo(f, nextLvl, S, fx + 1),
-					             FACE_getIFCo(f, nextLvl, (S + 1) % f->numVerts, 1, fx),
-					             FACE_getIFCo(f, nextLvl, S, fx, 1),
-					             ss);
-
-					VertDataCopy(nCo, co, ss);
-					VertDataSub(nCo, q, ss);
-					VertDataMulN(nCo, 0.25f, ss);
-					VertDataAdd(nCo, r, ss);
-				}
-			}
+	ccgSubSurf__parallelRange(numEffectedF, &data, ccgSubSurf__calcSubdivLevel_interior_faces_edges_midpoints_cb, useThreads);
+	ccgSubSurf__parallelRange(numEffectedE, &data, ccgSubSurf__calcSubdivLevel_edges_midpoints_cb, useThreads);
+	ccgSubSurf__parallelRange(numEffectedV, &data, ccgSubSurf__calcSubdivLevel_verts_shift_cb, useThreads);
+	ccgSubSurf__parallelRange(numEffectedE, &data, ccgSubSurf__calcSubdivLevel_edges_shift_cb, useThreads);
+	ccgSubSurf__parallelRange(numEffectedF, &data, ccgSubSurf__calcSubdivLevel_interior_faces_edges_centerpoints_shift_cb, useThreads);
+
+	/* copy down */
+	ccgSubSurf__parallelRange(numEffectedE, &data, ccgSubSurf__calcSubdivLevel_edges_copydown_cb, useThreads);
+	ccgSubSurf__parallelRange(numEffectedF, &data, ccgSubSurf__calcSubdivLevel_faces_copydown_cb, useThreads);
+}
+
+static void ccgSubSurf__sync_faces_centers_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGFace *f = data->effectedF[ptrIdx];
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	void *co = FACE_getCenterData(f);
+	int i;
+
+	VertDataZero(co, ss);
+	for (i = 0; i < f->numVerts; i++) {
+		VertDataAdd(co, VERT_getCo(FACE_getVerts(f)[i], 0), ss);
+	}
+	VertDataMulN(co, 1.0f / f->numVerts, ss);
+
+	f->flags = 0;
+}
+
+static void ccgSubSurf__sync_edges_midpoints_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGEdge *e = data->effectedE[ptrIdx];
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	const int curLvl = 0;
+	const int nextLvl = curLvl + 1;
+	void *co = EDGE_getCo(e, nextLvl, 1);
+	float sharpness = EDGE_getSharpness(e, curLvl);
+
+	if (_edge_isBoundary(e) || sharpness >= 1.0f) {
+		VertDataCopy(co, VERT_getCo(e->v0, curLvl), ss);
+		VertDataAdd(co, VERT_getCo(e->v1, curLvl), ss);
+		VertDataMulN(co, 0.5f, ss);
+	}
+	else {
+		float *q = BLI_array_alloca(q, ss->meshIFC.numLayers);
+		float *r = BLI_array_alloca(r, ss->meshIFC.numLayers);
+		int i, numFaces = 0;
+
+		VertDataCopy(q, VERT_getCo(e->v0, curLvl), ss);
+		VertDataAdd(q, VERT_getCo(e->v1, curLvl), ss);
+		for (i = 0; i < e->numFaces; i++) {
+			CCGFace *f = e->faces[i];
+			VertDataAdd(q, (float *)FACE_getCenterData(f), ss);
+			numFaces++;
 		}
+		VertDataMulN(q, 1.0f / (2.0f + numFaces), ss);
 
-#pragma omp critical
-		{
-			MEM_freeN(q);
-			MEM_freeN(r);
+		VertDataCopy(r, VERT_getCo(e->v0, curLvl), ss);
+		VertDataAdd(r, VERT_getCo(e->v1, curLvl), ss);
+		VertDataMulN(r, 0.5f, ss);
+
+		VertDataCopy(co, q, ss);
+		VertDataSub(r, q, ss);
+		VertDataMulN(r, sharpness, ss);
+		VertDataAdd(co, r, ss);
+	}
+
+	/* edge flags cleared later */
+}
+
+static void ccgSubSurf__sync_verts_shift_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGVert *v = data->effectedV[ptrIdx];
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	const int curLvl = 0;
+	const int nextLvl = curLvl + 1;
+	void *co = VERT_getCo(v, curLvl);
+	void *nCo = VERT_getCo(v, nextLvl);
+	float *q = BLI_array_alloca(q, ss->meshIFC.numLayers);
+	float *r = BLI_array_alloca(r, ss->meshIFC.numLayers);
+	int sharpCount = 0, allSharp = 1;
+	float avgSharpness = 0.0;
+	int i, seam = VERT_seam(v), seamEdges = 0;
+
+	for (i = 0; i < v->numEdges; i++) {
+		CCGEdge *e = v->edges[i];
+		float sharpness = EDGE_getSharpness(e, curLvl);
+
+		if (seam && _edge_isBoundary(e))
+			seamEdges++;
+
+		if (sharpness != 0.0f) {
+			sharpCount++;
+			avgSharpness += sharpness;
+		}
+		else {
+			allSharp = 0;
 		}
 	}
 
-	/* copy down */
-	edgeSize = ccg_edgesize(nextLvl);
-	gridSize = ccg_gridsize(nextLvl);
-	cornerIdx = gridSize - 1;
+	if (sharpCount) {
+		avgSharpness /= sharpCount;
+		if (avgSharpness > 1.0f) {
+			avgSharpness = 1.0f;
+		}
+	}
 
-#pragma omp parallel for private(i) if (numEffectedF * edgeSize * edgeSize * 4 >= CCG_OMP_LIMIT)
-	for (i = 0; i < numEffectedE; i++) {
-		CCGEdge *e = effectedE[i];
-		VertDataCopy(EDGE_getCo(e, nextLvl, 0), VERT_getCo(e->v0, nextLvl), ss);
-		VertDataCopy(EDGE_getCo(e, nextLvl, edgeSize - 1), VERT_getCo(e->v1, nextLvl), ss);
+	if (seamEdges < 2 || seamEdges != v->numEdges)
+		seam = 0;
+
+	if (!v->numEdges || ss->meshIFC.simpleSubdiv) {
+		VertDataCopy(nCo, co, ss);
 	}
+	else if (_vert_isBoundary(v)) {
+		int numBoundary = 0;
 
-#pragma omp parallel for private(i) if (numEffectedF * edgeSize * edgeSize * 4 >= CCG_OMP_LIMIT)
-	for (i = 0; i < numEffectedF; i++) {
-		CCGFace *f = effectedF[i];
-		int S, x;
+		VertDataZero(r, ss);
+		for (i = 0; i < v->numEdges; i++) {
+			CCGEdge *e = v->edges[i];
+			if (_edge_isBoundary(e)) {
+				VertDataAdd(r, VERT_getCo(_edge_getOtherVert(e, v), curLvl), ss);
+				numBoundary++;
+			}
+		}
+		VertDataCopy(nCo, co, ss);
+		VertDataMulN(nCo, 0.75f, ss);
+		VertDataMulN(r, 0.25f / numBoundary, ss);
+		VertDataAdd(nCo, r, ss);
+	}
+	else {
+		int numEdges = 0, numFaces = 0;
 
-		for (S = 0; S < f->numVerts; S++) {
-			CCGEdge *e = FACE_getEdges(f)[S];
-			CCGEdge *prevE = FACE_getEdges(f)[(S + f->numVerts - 1) % f->numVerts];
+		VertDataZero(q, ss);
+		for (i = 0; i < v->numFaces; i++) {
+			CCGFace *f = v->faces[i];
+			VertDataAdd(q, (float *)FACE_getCenterData(f), ss);
+			numFaces++;
+		}
+		VertDataMulN(q, 1.0f / numFaces, ss);
+		VertDataZero(r, ss);
+		for (i = 0; i < v->numEdges; i++) {
+			CCGEdge *e = v->edges[i];
+			VertDataAdd(r, VERT_getCo(_edge_getOtherVert(e, v), curLvl), ss);
+			numEdges++;
+		}
+		VertDataMulN(r, 1.0f / numEdges, ss);
 
-			VertDataCopy(FACE_getIFCo(f, nextLvl, S, 0, 0), (float *)FACE_getCenterData(f), ss);
-			VertDataCopy(FACE_getIECo(f, nextLvl, S, 0), (float *)FACE_getCenterData(f), ss);
-			VertDataCopy(FACE_getIFCo(f, nextLvl, S, cornerIdx, cornerIdx), VERT_getCo(FACE_getVerts(f)[S], nextLvl), ss);
-			VertDataCopy(FACE_getIECo(f, nextLvl, S, cornerIdx), EDGE_getCo(FACE_getEdges(f)[S], nextLvl, cornerIdx), ss);
-			for (x = 1; x < gridSize - 1; x++) {
-				float *co = FACE_getIECo(f, nextLvl, S, x);
-				VertDataCopy(FACE_getIFCo(f, nextLvl, S, x, 0), co, ss);
-				VertDataCopy(FACE_getIFCo(f, nextLvl, (S + 1) % f->numVerts, 0, x), co, ss);
+		VertDataCopy(nCo, co, ss);
+		VertDataMulN(nCo, numEdges - 2.0f, ss);
+		VertDataAdd(nCo, q, ss);
+		VertDataAdd(nCo, r, ss);
+		VertDataMulN(nCo, 1.0f / numEdges, ss);
+	}
+
+	if (sharpCount > 1 || seam) {
+		VertDataZero(q, ss);
+
+		if (seam) {
+			avgSharpness = 1.0f;
+			sharpCount = seamEdges;
+			allSharp = 1;
+		}
+
+		for (i = 0; i < v->numEdges; i++) {
+			CCGEdge *e = v->edges[i];
+			float sharpness = EDGE_getSharpness(e, curLvl);
+
+			if (seam) {
+				if (_edge_isBoundary(e)) {
+					CCGVert *oV = _edge_getOtherVert(e, v);
+					VertDataAdd(q, VERT_getCo(oV, curLvl), ss);
+				}
 			}
-			for (x = 0; x < gridSize - 1; x++) {
-				int eI = gridSize - 1 - x;
-				VertDataCopy(FACE_getIFCo(f, nextLvl, S, cornerIdx, x), _edge_getCoVert(e, FACE_getVerts(f)[S], nextLvl, eI, vertDataSize), ss);
-				VertDataCopy(FACE_getIFCo(f, nextLvl, S, x, cornerIdx), _edge_getCoVert(prevE, FACE_getVerts(f)[S], nextLvl, eI, vertDataSize), ss);
+			else if (sharpness != 0.0f) {
+				CCGVert *oV = _edge_getOtherVert(e, v);
+				VertDataAdd(q, VERT_getCo(oV, curLvl), ss);
 			}
 		}
+
+		VertDataMulN(q, (float) 1 / sharpCount, ss);
+
+		if (sharpCount != 2 || allSharp) {
+			/* q = q + (co - q) * avgSharpness */
+			VertDataCopy(r, co, ss);
+			VertDataSub(r, q, ss);
+			VertDataMulN(r, avgSharpness, ss);
+			VertDataAdd(q, r, ss);
+		}
+
+		/* r = co * 0.75 + q * 0.25 */
+		VertDataCopy(r, co, ss);
+		VertDataMulN(r, 0.75f, ss);
+		VertDataMulN(q, 0.25f, ss);
+		VertDataAdd(r, q, ss);
+
+		/* nCo = nCo + (r - nCo) * avgSharpness */
+		VertDataSub(r, nCo, ss);
+		VertDataMulN(r, avgSharpness, ss);
+		VertDataAdd(nCo, r, ss);
 	}
+
+	/* vert flags cleared later */
 }
 
+static void ccgSubSurf__sync_edges_copydown_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGEdge *e = data->effectedE[ptrIdx];
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	const int nextLvl = 1;
+
+	VertDataCopy(EDGE_getCo(e, nextLvl, 0), VERT_getCo(e->v0, nextLvl), ss);
+	VertDataCopy(EDGE_getCo(e, nextLvl, 2), VERT_getCo(e->v1, nextLvl), ss);
+}
+
+static void ccgSubSurf__sync_faces_copydown_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGFace *f = data->effectedF[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	const int nextLvl = 1;
+	int S;
+
+	for (S = 0; S < f->numVerts; S++) {
+		CCGEdge *e = FACE_getEdges(f)[S];
+		CCGEdge *prevE = FACE_getEdges(f)[(S + f->numVerts - 1) % f->numVerts];
+
+		VertDataCopy(FACE_getIFCo(f, nextLvl, S, 0, 0), (float *)FACE_getCenterData(f), ss);
+		VertDataCopy(FACE_getIECo(f, nextLvl, S, 0), (float *)FACE_getCenterData(f), ss);
+		VertDataCopy(FACE_getIFCo(f, nextLvl, S, 1, 1), VERT_getCo(FACE_getVerts(f)[S], nextLvl), ss);
+		VertDataCopy(FACE_getIECo(f, nextLvl, S, 1), EDGE_getCo(FACE_getEdges(f)[S], nextLvl, 1), ss);
+
+		VertDataCopy(FACE_getIFCo(f, nextLvl, S, 1, 0), _edge_getCoVert(e, FACE_getVerts(f)[S], nextLvl, 1, vertDataSize), ss);
+		VertDataCopy(FACE_getIFCo(f, nextLvl, S, 0, 1), _edge_getCoVert(prevE, FACE_getVerts(f)[S], nextLvl, 1, vertDataSize), ss);
+	}
+}
 
 static void ccgSubSurf__sync(CCGSubSurf *ss)
 {
@@ -2149,10 +2604,21 @@ static void ccgSubSurf__sync(CCGSubSurf *ss)
 	CCGFace **effectedF;
 	int numEffectedV, numEffectedE, numEffectedF;
 	int subdivLevels = ss->subdivLevels;
-	int vertDataSize = ss->meshIFC.vertDataSize;
-	int i, j, ptrIdx, S;
-	int curLvl, nextLvl;
-	void *q = ss->q, *r = ss->r;
+	int i, j, ptrIdx;
+	int curLvl;
+	CCGSubSurfCalcSubdivData data;
+	bool useThreads;
+
+	/* after a stencil evaluation only the top level is valid, redo everything */
+	if (ss->lowerLevelsStale) {
+		for (i = 0; i < ss->vMap->curSize; i++) {
+			CCGVert *v = (CCGVert *) ss->vMap->buckets[i];
+			for (; v; v = v->next) {
+				v->flags |= Vert_eEffected;
+			}
+		}
+		ss->lowerLevelsStale = 0;
+	}
 
 	effectedV = MEM_mallocN(sizeof(*effectedV) * ss->vMap->numEntries, "CCGSubsurf effectedV");
 	effectedE = MEM_mallocN(sizeof(*effectedE) * ss->eMap->numEntries, "CCGSubsurf effectedE");
@@ -2183,245 +2649,614 @@ static void ccgSubSurf__sync(CCGSubSurf *ss)
 		}
 	}
 
-	curLvl = 0;
-	nextLvl = curLvl + 1;
+	data.ss = ss;
+	data.effectedV = effectedV;
+	data.effectedE = effectedE;
+	data.effectedF = effectedF;
+	data.numEffectedV = numEffectedV;
+	data.numEffectedE = numEffectedE;
+	data.numEffectedF = numEffectedF;
+	data.curLvl = 0;
+
+	useThreads = ccgSubSurf__useThreads(numEffectedF, 1);
+
+	ccgSubSurf__parallelRange(numEffectedF, &data, ccgSubSurf__sync_faces_centers_cb, useThreads);
+	ccgSubSurf__parallelRange(numEffectedE, &data, ccgSubSurf__sync_edges_midpoints_cb, useThreads);
+	ccgSubSurf__parallelRange(numEffectedV, &data, ccgSubSurf__sync_verts_shift_cb, useThreads);
 
-	for (ptrIdx = 0; ptrIdx < numEffectedF; ptrIdx++) {
-		CCGFace *f = effectedF[ptrIdx];
-		void *co = FACE_getCenterData(f);
-		VertDataZero(co, ss);
-		for (i = 0; i < f->numVerts; i++) {
-			VertDataAdd(co, VERT_getCo(FACE_getVerts(f)[i], curLvl), ss);
+	if (ss->useAgeCounts) {
+		for (i = 0; i < numEffectedV; i++) {
+			CCGVert *v = effectedV[i];
+			byte *userData = ccgSubSurf_getVertUserData(ss, v);
+			*((int *) &userData[ss->vertUserAgeOffset]) = ss->currentAge;
+		}
+
+		for (i = 0; i < numEffectedE; i++) {
+			CCGEdge *e = effectedE[i];
+			byte *userData = ccgSubSurf_getEdgeUserData(ss, e);
+			*((int *) &userData[ss->edgeUserAgeOffset]) = ss->currentAge;
+		}
+
+		for (i = 0; i < numEffectedF; i++) {
+			CCGFace *f = effectedF[i];
+			byte *userData = ccgSubSurf_getFaceUserData(ss, f);
+			*((int *) &userData[ss->faceUserAgeOffset]) = ss->currentAge;
 		}
-		VertDataMulN(co, 1.0f / f->numVerts, ss);
+	}
+
+	ccgSubSurf__parallelRange(numEffectedE, &data, ccgSubSurf__sync_edges_copydown_cb, useThreads);
+	ccgSubSurf__parallelRange(numEffectedF, &data, ccgSubSurf__sync_faces_copydown_cb, useThreads);
+
+	for (curLvl = 1; curLvl < subdivLevels; curLvl++) {
+		ccgSubSurf__calcSubdivLevel(ss,
+		                            effectedV, effectedE, effectedF,
+		                            numEffectedV, numEffectedE, numEffectedF, curLvl);
+	}
+
+	if (ss->calcVertNormals)
+		ccgSubSurf__calcVertNormals(ss,
+		                            effectedV, effectedE, effectedF,
+		                            numEffectedV, numEffectedE, numEffectedF);
 
-		f->flags = 0;
+	for (ptrIdx = 0; ptrIdx < numEffectedV; ptrIdx++) {
+		CCGVert *v = effectedV[ptrIdx];
+		v->flags = 0;
 	}
 	for (ptrIdx = 0; ptrIdx < numEffectedE; ptrIdx++) {
 		CCGEdge *e = effectedE[ptrIdx];
-		void *co = EDGE_getCo(e, nextLvl, 1);
-		float sharpness = EDGE_getSharpness(e, curLvl);
+		e->flags = 0;
+	}
 
-		if (_edge_isBoundary(e) || sharpness >= 1.0f) {
-			VertDataCopy(co, VERT_getCo(e->v0, curLvl), ss);
-			VertDataAdd(co, VERT_getCo(e->v1, curLvl), ss);
-			VertDataMulN(co, 0.5f, ss);
-		}
-		else {
-			int numFaces = 0;
-			VertDataCopy(q, VERT_getCo(e->v0, curLvl), ss);
-			VertDataAdd(q, VERT_getCo(e->v1, curLvl), ss);
-			for (i = 0; i < e->numFaces; i++) {
-				CCGFace *f = e->faces[i];
-				VertDataAdd(q, (float *)FACE_getCenterData(f), ss);
-				numFaces++;
-			}
-			VertDataMulN(q, 1.0f / (2.0f + numFaces), ss);
+	MEM_freeN(effectedF);
+	MEM_freeN(effectedE);
+	MEM_freeN(effectedV);
+}
 
-			VertDataCopy(r, VERT_getCo(e->v0, curLvl), ss);
-			VertDataAdd(r, VERT_getCo(e->v1, curLvl), ss);
-			VertDataMulN(r, 0.5f, ss);
+/* Stencils: the top level of the subdivided mesh is a linear combination
+ * of the control vertices, with weights only depending on topology and
+ * creases. The weights are found by syncing indicator data through the
+ * regular subdivision code, probing one control vertex per data slot at
+ * once. Probed vertices share a color, which is chosen so that no point
+ * depends on two vertices of the same color. */
 
-			VertDataCopy(co, q, ss);
-			VertDataSub(r, q, ss);
-			VertDataMulN(r, sharpness, ss);
-			VertDataAdd(co, r, ss);
+struct CCGSubSurfStencils {
+	CCGVert **verts;
+	CCGEdge **edges;
+	CCGFace **faces;
+	int numVerts, numEdges, numFaces;
+	int numLayers;
+
+	/* top level data written by each stencil */
+	float **points;
+	int numPoints;
+
+	/* per point range in indices and weights */
+	int *offsets;
+	int *indices;
+	float *weights;
+
+	/* control vertex data, gathered before evaluation */
+	float (*controlCos)[4];
+};
+
+typedef struct CCGStencilsEntries {
+	int *points;
+	int *indices;
+	float *weights;
+	int num, size;
+} CCGStencilsEntries;
+
+static void ccgSubSurf__stencilsAddEntry(CCGStencilsEntries *entries, int point, int index, float weight)
+{
+	if (UNLIKELY(entries->num == entries->size)) {
+		entries->size *= 2;
+		entries->points = MEM_reallocN(entries->points, sizeof(*entries->points) * entries->size);
+		entries->indices = MEM_reallocN(entries->indices, sizeof(*entries->indices) * entries->size);
+		entries->weights = MEM_reallocN(entries->weights, sizeof(*entries->weights) * entries->size);
+	}
+
+	entries->points[entries->num] = point;
+	entries->indices[entries->num] = index;
+	entries->weights[entries->num] = weight;
+	entries->num++;
+}
+
+static void ccgSubSurf__stencilsFree(CCGSubSurf *ss)
+{
+	CCGSubSurfStencils *st = ss->stencils;
+
+	if (st) {
+		MEM_freeN(st->verts);
+		MEM_freeN(st->edges);
+		MEM_freeN(st->faces);
+		MEM_freeN(st->points);
+		MEM_freeN(st->offsets);
+		MEM_freeN(st->indices);
+		MEM_freeN(st->weights);
+		MEM_freeN(st->controlCos);
+		MEM_freeN(st);
+
+		ss->stencils = NULL;
+
+		/* vertices synced so far did not tag their neighbors */
+		ss->lowerLevelsStale = 1;
+	}
+}
+
+static CCGSubSurfStencils *ccgSubSurf__stencilsBuild(CCGSubSurf *ss)
+{
+	const int subdivLevels = ss->subdivLevels;
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	const int numLayers = ss->meshIFC.numLayers;
+	const int numSlots = vertDataSize / (int)sizeof(float);
+	const int calcVertNormals = ss->calcVertNormals;
+	const int edgeSize = ccg_edgesize(subdivLevels);
+	const int gridSize = ccg_gridsize(subdivLevels);
+	const int numVerts = ss->vMap->numEntries;
+	const int numEdges = ss->eMap->numEntries;
+	const int numFaces = ss->fMap->numEntries;
+	const int numOwners = numVerts + numEdges + numFaces;
+	CCGSubSurfStencils *st;
+	CCGStencilsEntries entries;
+	GHash *vhash;
+	/* vertices of the faces around each vertex, the support of its points */
+	int *nbrOffsets, *nbrIndices, numNbrIndices, sizeNbrIndices;
+	/* control vertices of each vertex, edge and face, and their first point */
+	int *ownerOffsets, *ownerVerts, *ownerPoints;
+	int *colors, *order, *stamp, *slotVert, *cursor;
+	int numColors = 0, numBatches;
+	float *savedCos;
+	short *savedFlags;
+	int i, j, k, b, x, y, S, o;
+
+	if (numVerts <= 0 || numLayers > 4 || numSlots < numLayers || ss->allocMask) {
+		return NULL;
+	}
+
+	st = MEM_callocN(sizeof(*st), "CCGSubsurf stencils");
+	st->verts = MEM_mallocN(sizeof(*st->verts) * numVerts, "CCGSubsurf stencils verts");
+	st->edges = MEM_mallocN(sizeof(*st->edges) * MAX2(numEdges, 1), "CCGSubsurf stencils edges");
+	st->faces = MEM_mallocN(sizeof(*st->faces) * MAX2(numFaces, 1), "CCGSubsurf stencils faces");
+	st->numVerts = st->numEdges = st->numFaces = 0;
+	st->numLayers = numLayers;
+
+	vhash = BLI_ghash_ptr_new_ex("CCGSubsurf stencils vhash", numVerts);
+	for (i = 0; i < ss->vMap->curSize; i++) {
+		CCGVert *v = (CCGVert *) ss->vMap->buckets[i];
+		for (; v; v = v->next) {
+			BLI_ghash_insert(vhash, v, SET_INT_IN_POINTER(st->numVerts));
+			st->verts[st->numVerts++] = v;
 		}
+	}
+	for (i = 0; i < ss->eMap->curSize; i++) {
+		CCGEdge *e = (CCGEdge *) ss->eMap->buckets[i];
+		for (; e; e = e->next) {
+			st->edges[st->numEdges++] = e;
+		}
+	}
+	for (i = 0; i < ss->fMap->curSize; i++) {
+		CCGFace *f = (CCGFace *) ss->fMap->buckets[i];
+		for (; f; f = f->next) {
+			st->faces[st->numFaces++] = f;
+		}
+	}
 
-		/* edge flags cleared later */
+	/* owners are vertices, edges and faces, in that order */
+	ownerOffsets = MEM_mallocN(sizeof(*ownerOffsets) * (numOwners + 1), "CCGSubsurf stencils ownerOffsets");
+	ownerPoints = MEM_mallocN(sizeof(*ownerPoints) * (numOwners + 1), "CCGSubsurf stencils ownerPoints");
+	ownerOffsets[0] = ownerPoints[0] = 0;
+	for (i = 0; i < numVerts; i++) {
+		ownerOffsets[i + 1] = ownerOffsets[i] + 1;
+		ownerPoints[i + 1] = ownerPoints[i] + 1;
+	}
+	for (i = 0; i < numEdges; i++) {
+		o = numVerts + i;
+		ownerOffsets[o + 1] = ownerOffsets[o] + 2;
+		ownerPoints[o + 1] = ownerPoints[o] + edgeSize - 2;
+	}
+	for (i = 0; i < numFaces; i++) {
+		const int numVertsF = st->faces[i]->numVerts;
+		o = numVerts + numEdges + i;
+		ownerOffsets[o + 1] = ownerOffsets[o] + numVertsF;
+		ownerPoints[o + 1] = ownerPoints[o] + 1 + numVertsF * (gridSize - 2) * (gridSize - 1);
 	}
-	for (ptrIdx = 0; ptrIdx < numEffectedV; ptrIdx++) {
-		CCGVert *v = effectedV[ptrIdx];
-		void *co = VERT_getCo(v, curLvl);
-		void *nCo = VERT_getCo(v, nextLvl);
-		int sharpCount = 0, allSharp = 1;
-		float avgSharpness = 0.0;
-		int seam = VERT_seam(v), seamEdges = 0;
 
-		for (i = 0; i < v->numEdges; i++) {
-			CCGEdge *e = v->edges[i];
-			float sharpness = EDGE_getSharpness(e, curLvl);
+	ownerVerts = MEM_mallocN(sizeof(*ownerVerts) * ownerOffsets[numOwners], "CCGSubsurf stencils ownerVerts");
+	st->numPoints = ownerPoints[numOwners];
+	st->points = MEM_mallocN(sizeof(*st->points) * st->numPoints, "CCGSubsurf stencils points");
+
+	for (i = 0; i < numVerts; i++) {
+		ownerVerts[ownerOffsets[i]] = i;
+		st->points[ownerPoints[i]] = VERT_getCo(st->verts[i], subdivLevels);
+	}
+	for (i = 0; i < numEdges; i++) {
+		CCGEdge *e = st->edges[i];
+		int *ov = &ownerVerts[ownerOffsets[numVerts + i]];
+		float **point = &st->points[ownerPoints[numVerts + i]];
 
-			if (seam && _edge_isBoundary(e))
-				seamEdges++;
+		ov[0] = GET_INT_FROM_POINTER(BLI_ghash_lookup(vhash, e->v0));
+		ov[1] = GET_INT_FROM_POINTER(BLI_ghash_lookup(vhash, e->v1));
+		for (x = 1; x < edgeSize - 1; x++) {
+			*point++ = EDGE_getCo(e, subdivLevels, x);
+		}
+	}
+	for (i = 0; i < numFaces; i++) {
+		CCGFace *f = st->faces[i];
+		int *ov = &ownerVerts[ownerOffsets[numVerts + numEdges + i]];
+		float **point = &st->points[ownerPoints[numVerts + numEdges + i]];
 
-			if (sharpness != 0.0f) {
-				sharpCount++;
-				avgSharpness += sharpness;
+		*point++ = (float *)FACE_getCenterData(f);
+		for (S = 0; S < f->numVerts; S++) {
+			ov[S] = GET_INT_FROM_POINTER(BLI_ghash_lookup(vhash, FACE_getVerts(f)[S]));
+			for (x = 1; x < gridSize - 1; x++) {
+				*point++ = FACE_getIECo(f, subdivLevels, S, x);
 			}
-			else {
-				allSharp = 0;
+			for (y = 1; y < gridSize - 1; y++) {
+				for (x = 1; x < gridSize - 1; x++) {
+					*point++ = FACE_getIFCo(f, subdivLevels, S, x, y);
+				}
 			}
 		}
+	}
+
+	/* neighborhoods */
+	stamp = MEM_mallocN(sizeof(*stamp) * (numVerts + 1), "CCGSubsurf stencils stamp");
+	for (i = 0; i < numVerts; i++) {
+		stamp[i] = -1;
+	}
+
+	sizeNbrIndices = numVerts * 8;
+	numNbrIndices = 0;
+	nbrIndices = MEM_mallocN(sizeof(*nbrIndices) * sizeNbrIndices, "CCGSubsurf stencils nbrIndices");
+	nbrOffsets = MEM_mallocN(sizeof(*nbrOffsets) * (numVerts + 1), "CCGSubsurf stencils nbrOffsets");
+
+#define NBR_ADD(index) \
+	{ \
+		const int _index = (index); \
+		if (stamp[_index] != i) { \
+			stamp[_index] = i; \
+			if (UNLIKELY(numNbrIndices == sizeNbrIndices)) { \
+				sizeNbrIndices *= 2; \
+				nbrIndices = MEM_reallocN(nbrIndices, sizeof(*nbrIndices) * sizeNbrIndices); \
+			} \
+			nbrIndices[numNbrIndices++] = _index; \
+		} \
+	} (void)0
+
+	for (i = 0; i < numVerts; i++) {
+		CCGVert *v = st->verts[i];
 
-		if (sharpCount) {
-			avgSharpness /= sharpCount;
-			if (avgSharpness > 1.0f) {
-				avgSharpness = 1.0f;
+		nbrOffsets[i] = numNbrIndices;
+		NBR_ADD(i);
+		for (j = 0; j < v->numEdges; j++) {
+			CCGVert *vOther = _edge_getOtherVert(v->edges[j], v);
+			NBR_ADD(GET_INT_FROM_POINTER(BLI_ghash_lookup(vhash, vOther)));
+		}
+		for (j = 0; j < v->numFaces; j++) {
+			CCGFace *f = v->faces[j];
+			for (k = 0; k < f->numVerts; k++) {
+				NBR_ADD(GET_INT_FROM_POINTER(BLI_ghash_lookup(vhash, FACE_getVerts(f)[k])));
 			}
 		}
+	}
+	nbrOffsets[numVerts] = numNbrIndices;
 
-		if (seamEdges < 2 || seamEdges != v->numEdges)
-			seam = 0;
+#undef NBR_ADD
 
-		if (!v->numEdges || ss->meshIFC.simpleSubdiv) {
-			VertDataCopy(nCo, co, ss);
-		}
-		else if (_vert_isBoundary(v)) {
-			int numBoundary = 0;
+	BLI_ghash_free(vhash, NULL, NULL);
 
-			VertDataZero(r, ss);
-			for (i = 0; i < v->numEdges; i++) {
-				CCGEdge *e = v->edges[i];
-				if (_edge_isBoundary(e)) {
-					VertDataAdd(r, VERT_getCo(_edge_getOtherVert(e, v), curLvl), ss);
-					numBoundary++;
+	/* the points of an owner depend on the neighborhoods of its vertices,
+	 * which overlap for vertices up to three neighborhoods apart. Coloring
+	 * in breadth first order keeps the number of colors low on regular
+	 * meshes, -2 marks queued vertices */
+	colors = MEM_mallocN(sizeof(*colors) * numVerts, "CCGSubsurf stencils colors");
+	order = MEM_mallocN(sizeof(*order) * numVerts, "CCGSubsurf stencils order");
+	for (i = 0; i < numVerts; i++) {
+		colors[i] = -1;
+		stamp[i] = -1;
+	}
+	stamp[numVerts] = -1;
+
+	for (i = 0, j = 0, k = 0; i < numVerts; i++) {
+		if (colors[i] == -1) {
+			colors[i] = -2;
+			order[j++] = i;
+
+			for (; k < j; k++) {
+				int a;
+				for (a = nbrOffsets[order[k]]; a < nbrOffsets[order[k] + 1]; a++) {
+					if (colors[nbrIndices[a]] == -1) {
+						colors[nbrIndices[a]] = -2;
+						order[j++] = nbrIndices[a];
+					}
 				}
 			}
-			VertDataCopy(nCo, co, ss);
-			VertDataMulN(nCo, 0.75f, ss);
-			VertDataMulN(r, 0.25f / numBoundary, ss);
-			VertDataAdd(nCo, r, ss);
 		}
-		else {
-			int numEdges = 0, numFaces = 0;
+	}
 
-			VertDataZero(q, ss);
-			for (i = 0; i < v->numFaces; i++) {
-				CCGFace *f = v->faces[i];
-				VertDataAdd(q, (float *)FACE_getCenterData(f), ss);
-				numFaces++;
-			}
-			VertDataMulN(q, 1.0f / numFaces, ss);
-			VertDataZero(r, ss);
-			for (i = 0; i < v->numEdges; i++) {
-				CCGEdge *e = v->edges[i];
-				VertDataAdd(r, VERT_getCo(_edge_getOtherVert(e, v), curLvl), ss);
-				numEdges++;
+	for (i = 0; i < numVerts; i++) {
+		const int vi = order[i];
+		int a, c, d;
+
+		for (a = nbrOffsets[vi]; a < nbrOffsets[vi + 1]; a++) {
+			const int va = nbrIndices[a];
+			for (c = nbrOffsets[va]; c < nbrOffsets[va + 1]; c++) {
+				const int vc = nbrIndices[c];
+				for (d = nbrOffsets[vc]; d < nbrOffsets[vc + 1]; d++) {
+					const int color = colors[nbrIndices[d]];
+					if (color >= 0) {
+						stamp[color] = vi;
+					}
+				}
 			}
-			VertDataMulN(r, 1.0f / numEdges, ss);
+		}
 
-			VertDataCopy(nCo, co, ss);
-			VertDataMulN(nCo, numEdges - 2.0f, ss);
-			VertDataAdd(nCo, q, ss);
-			VertDataAdd(nCo, r, ss);
-			VertDataMulN(nCo, 1.0f / numEdges, ss);
+		for (c = 0; stamp[c] == vi; c++) {
+			/* pass */
 		}
+		colors[vi] = c;
+		numColors = MAX2(numColors, c + 1);
+	}
 
-		if (sharpCount > 1 || seam) {
-			VertDataZero(q, ss);
+	/* high valence vertices and ngons need many probes, use regular
+	 * subdivision when building would take too long */
+	numBatches = (numColors + numSlots - 1) / numSlots;
+	if (numBatches > CCGSUBSURF_STENCIL_MAX_PROBES) {
+		MEM_freeN(order);
+		MEM_freeN(colors);
+		MEM_freeN(nbrIndices);
+		MEM_freeN(nbrOffsets);
+		MEM_freeN(stamp);
+		MEM_freeN(ownerVerts);
+		MEM_freeN(ownerPoints);
+		MEM_freeN(ownerOffsets);
+		MEM_freeN(st->points);
+		MEM_freeN(st->verts);
+		MEM_freeN(st->edges);
+		MEM_freeN(st->faces);
+		MEM_freeN(st);
+		return NULL;
+	}
 
-			if (seam) {
-				avgSharpness = 1.0f;
-				sharpCount = seamEdges;
-				allSharp = 1;
+	/* probe with all data slots, normals are not needed */
+	savedCos = MEM_mallocN((size_t)vertDataSize * numVerts, "CCGSubsurf stencils savedCos");
+	savedFlags = MEM_mallocN(sizeof(*savedFlags) * numVerts, "CCGSubsurf stencils savedFlags");
+	for (i = 0; i < numVerts; i++) {
+		memcpy(&savedCos[i * numSlots], VERT_getCo(st->verts[i], 0), vertDataSize);
+		savedFlags[i] = st->verts[i]->flags;
+	}
+
+	ss->meshIFC.numLayers = numSlots;
+	ss->calcVertNormals = 0;
+
+	entries.num = 0;
+	entries.size = MAX2(st->numPoints, 1024);
+	entries.points = MEM_mallocN(sizeof(*entries.points) * entries.size, "CCGSubsurf stencils entries");
+	entries.indices = MEM_mallocN(sizeof(*entries.indices) * entries.size, "CCGSubsurf stencils entries");
+	entries.weights = MEM_mallocN(sizeof(*entries.weights) * entries.size, "CCGSubsurf stencils entries");
+
+	slotVert = BLI_array_alloca(slotVert, numSlots);
+
+	for (b = 0; b < numBatches; b++) {
+		for (i = 0; i < numVerts; i++) {
+			float *co = VERT_getCo(st->verts[i], 0);
+
+			memset(co, 0, vertDataSize);
+			if (colors[i] / numSlots == b) {
+				co[colors[i] % numSlots] = 1.0f;
 			}
+			st->verts[i]->flags = savedFlags[i] | Vert_eEffected;
+		}
 
-			for (i = 0; i < v->numEdges; i++) {
-				CCGEdge *e = v->edges[i];
-				float sharpness = EDGE_getSharpness(e, curLvl);
+		ccgSubSurf__sync(ss);
 
-				if (seam) {
-					if (_edge_isBoundary(e)) {
-						CCGVert *oV = _edge_getOtherVert(e, v);
-						VertDataAdd(q, VERT_getCo(oV, curLvl), ss);
+		for (o = 0; o < numOwners; o++) {
+			int p;
+
+			for (k = 0; k < numSlots; k++) {
+				slotVert[k] = -1;
+			}
+			for (j = ownerOffsets[o]; j < ownerOffsets[o + 1]; j++) {
+				const int vj = ownerVerts[j];
+				for (k = nbrOffsets[vj]; k < nbrOffsets[vj + 1]; k++) {
+					const int vk = nbrIndices[k];
+					if (colors[vk] / numSlots == b) {
+						slotVert[colors[vk] % numSlots] = vk;
 					}
 				}
-				else if (sharpness != 0.0f) {
-					CCGVert *oV = _edge_getOtherVert(e, v);
-					VertDataAdd(q, VERT_getCo(oV, curLvl), ss);
+			}
+
+			for (p = ownerPoints[o]; p < ownerPoints[o + 1]; p++) {
+				const float *co = st->points[p];
+				for (k = 0; k < numSlots; k++) {
+					if (co[k] != 0.0f) {
+						BLI_assert(slotVert[k] != -1);
+						if (slotVert[k] != -1) {
+							ccgSubSurf__stencilsAddEntry(&entries, p, slotVert[k], co[k]);
+						}
+					}
 				}
 			}
+		}
+	}
 
-			VertDataMulN(q, (float) 1 / sharpCount, ss);
+	for (i = 0; i < numVerts; i++) {
+		memcpy(VERT_getCo(st->verts[i], 0), &savedCos[i * numSlots], vertDataSize);
+		st->verts[i]->flags = savedFlags[i];
+	}
 
-			if (sharpCount != 2 || allSharp) {
-				/* q = q + (co - q) * avgSharpness */
-				VertDataCopy(r, co, ss);
-				VertDataSub(r, q, ss);
-				VertDataMulN(r, avgSharpness, ss);
-				VertDataAdd(q, r, ss);
-			}
+	ss->meshIFC.numLayers = numLayers;
+	ss->calcVertNormals = calcVertNormals;
 
-			/* r = co * 0.75 + q * 0.25 */
-			VertDataCopy(r, co, ss);
-			VertDataMulN(r, 0.75f, ss);
-			VertDataMulN(q, 0.25f, ss);
-			VertDataAdd(r, q, ss);
+	/* the probes overwrote all levels */
+	ss->lowerLevelsStale = 1;
 
-			/* nCo = nCo + (r - nCo) * avgSharpness */
-			VertDataSub(r, nCo, ss);
-			VertDataMulN(r, avgSharpness, ss);
-			VertDataAdd(nCo, r, ss);
-		}
+	/* sort entries by point */
+	st->offsets = MEM_callocN(sizeof(*st->offsets) * (st->numPoints + 1), "CCGSubsurf stencils offsets");
+	st->indices = MEM_mallocN(sizeof(*st->indices) * MAX2(entries.num, 1), "CCGSubsurf stencils indices");
+	st->weights = MEM_mallocN(sizeof(*st->weights) * MAX2(entries.num, 1), "CCGSubsurf stencils weights");
 
-		/* vert flags cleared later */
+	for (i = 0; i < entries.num; i++) {
+		st->offsets[entries.points[i] + 1]++;
+	}
+	for (i = 0; i < st->numPoints; i++) {
+		st->offsets[i + 1] += st->offsets[i];
 	}
 
-	if (ss->useAgeCounts) {
-		for (i = 0; i < numEffectedV; i++) {
-			CCGVert *v = effectedV[i];
-			byte *userData = ccgSubSurf_getVertUserData(ss, v);
-			*((int *) &userData[ss->vertUserAgeOffset]) = ss->currentAge;
-		}
+	cursor = MEM_mallocN(sizeof(*cursor) * MAX2(st->numPoints, 1), "CCGSubsurf stencils cursor");
+	memcpy(cursor, st->offsets, sizeof(*cursor) * st->numPoints);
+	for (i = 0; i < entries.num; i++) {
+		const int dst = cursor[entries.points[i]]++;
+		st->indices[dst] = entries.indices[i];
+		st->weights[dst] = entries.weights[i];
+	}
 
-		for (i = 0; i < numEffectedE; i++) {
-			CCGEdge *e = effectedE[i];
-			byte *userData = ccgSubSurf_getEdgeUserData(ss, e);
-			*((int *) &userData[ss->edgeUserAgeOffset]) = ss->currentAge;
-		}
+	st->controlCos = MEM_callocN(sizeof(*st->controlCos) * numVerts, "CCGSubsurf stencils controlCos");
 
-		for (i = 0; i < numEffectedF; i++) {
-			CCGFace *f = effectedF[i];
-			byte *userData = ccgSubSurf_getFaceUserData(ss, f);
-			*((int *) &userData[ss->faceUserAgeOffset]) = ss->currentAge;
-		}
+	MEM_freeN(cursor);
+	MEM_freeN(entries.points);
+	MEM_freeN(entries.indices);
+	MEM_freeN(entries.weights);
+	MEM_freeN(savedFlags);
+	MEM_freeN(savedCos);
+	MEM_freeN(order);
+	MEM_freeN(colors);
+	MEM_freeN(nbrIndices);
+	MEM_freeN(nbrOffsets);
+	MEM_freeN(stamp);
+	MEM_freeN(ownerVerts);
+	MEM_freeN(ownerPoints);
+	MEM_freeN(ownerOffsets);
+
+	return st;
+}
+
+static void ccgSubSurf__stencilsEval_points_cb(void *userdata, int i)
+{
+	const CCGSubSurfStencils *st = userdata;
+	const int *index = &st->indices[st->offsets[i]];
+	const int *index_end = &st->indices[st->offsets[i + 1]];
+	const float *weight = &st->weights[st->offsets[i]];
+#ifdef __SSE2__
+	__m128 co_r = _mm_setzero_ps();
+	float co[4];
+
+	for (; index != index_end; index++, weight++) {
+		co_r = _mm_add_ps(co_r, _mm_mul_ps(_mm_loadu_ps(st->controlCos[*index]), _mm_set1_ps(*weight)));
 	}
+	_mm_storeu_ps(co, co_r);
+#else
+	float co[4] = {0.0f, 0.0f, 0.0f, 0.0f};
 
-	for (i = 0; i < numEffectedE; i++) {
-		CCGEdge *e = effectedE[i];
-		VertDataCopy(EDGE_getCo(e, nextLvl, 0), VERT_getCo(e->v0, nextLvl), ss);
-		VertDataCopy(EDGE_getCo(e, nextLvl, 2), VERT_getCo(e->v1, nextLvl), ss);
+	for (; index != index_end; index++, weight++) {
+		const float *controlCo = st->controlCos[*index];
+		co[0] += *weight * controlCo[0];
+		co[1] += *weight * controlCo[1];
+		co[2] += *weight * controlCo[2];
+		co[3] += *weight * controlCo[3];
 	}
-	for (i = 0; i < numEffectedF; i++) {
-		CCGFace *f = effectedF[i];
-		for (S = 0; S < f->numVerts; S++) {
-			CCGEdge *e = FACE_getEdges(f)[S];
-			CCGEdge *prevE = FACE_getEdges(f)[(S + f->numVerts - 1) % f->numVerts];
+#endif
 
-			VertDataCopy(FACE_getIFCo(f, nextLvl, S, 0, 0), (float *)FACE_getCenterData(f), ss);
-			VertDataCopy(FACE_getIECo(f, nextLvl, S, 0), (float *)FACE_getCenterData(f), ss);
-			VertDataCopy(FACE_getIFCo(f, nextLvl, S, 1, 1), VERT_getCo(FACE_getVerts(f)[S], nextLvl), ss);
-			VertDataCopy(FACE_getIECo(f, nextLvl, S, 1), EDGE_getCo(FACE_getEdges(f)[S], nextLvl, 1), ss);
+	memcpy(st->points[i], co, sizeof(float) * st->numLayers);
+}
 
-			VertDataCopy(FACE_getIFCo(f, nextLvl, S, 1, 0), _edge_getCoVert(e, FACE_getVerts(f)[S], nextLvl, 1, vertDataSize), ss);
-			VertDataCopy(FACE_getIFCo(f, nextLvl, S, 0, 1), _edge_getCoVert(prevE, FACE_getVerts(f)[S], nextLvl, 1, vertDataSize), ss);
-		}
+static void ccgSubSurf__stencilsEval_edges_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGEdge *e = data->effectedE[ptrIdx];
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	const int lvl = data->curLvl;
+	const int edgeSize = ccg_edgesize(lvl);
+
+	VertDataCopy(EDGE_getCo(e, lvl, 0), VERT_getCo(e->v0, lvl), ss);
+	VertDataCopy(EDGE_getCo(e, lvl, edgeSize - 1), VERT_getCo(e->v1, lvl), ss);
+}
+
+static void ccgSubSurf__stencilsEval_faces_cb(void *userdata, int ptrIdx)
+{
+	CCGSubSurfCalcSubdivData *data = userdata;
+	CCGSubSurf *ss = data->ss;
+	CCGFace *f = data->effectedF[ptrIdx];
+	const int subdivLevels = ss->subdivLevels;
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	const int lvl = data->curLvl;
+	const int gridSize = ccg_gridsize(lvl);
+	const int cornerIdx = gridSize - 1;
+	int S, x;
+
+	for (S = 0; S < f->numVerts; S++) {
+		VertDataCopy(FACE_getIECo(f, lvl, S, 0), (float *)FACE_getCenterData(f), ss);
+		VertDataCopy(FACE_getIECo(f, lvl, S, cornerIdx), EDGE_getCo(FACE_getEdges(f)[S], lvl, cornerIdx), ss);
 	}
 
-	for (curLvl = 1; curLvl < subdivLevels; curLvl++) {
-		ccgSubSurf__calcSubdivLevel(ss,
-		                            effectedV, effectedE, effectedF,
-		                            numEffectedV, numEffectedE, numEffectedF, curLvl);
+	/* same as ccgSubSurf_updateToFaces */
+	for (S = 0; S < f->numVerts; S++) {
+		int prevS = (S + f->numVerts - 1) % f->numVerts;
+		CCGEdge *e = FACE_getEdges(f)[S];
+		CCGEdge *prevE = FACE_getEdges(f)[prevS];
+
+		for (x = 0; x < gridSize; x++) {
+			int eI = gridSize - 1 - x;
+			VertDataCopy(FACE_getIFCo(f, lvl, S, cornerIdx, x), _edge_getCoVert(e, FACE_getVerts(f)[S], lvl, eI, vertDataSize), ss);
+			VertDataCopy(FACE_getIFCo(f, lvl, S, x, cornerIdx), _edge_getCoVert(prevE, FACE_getVerts(f)[S], lvl, eI, vertDataSize), ss);
+		}
+
+		for (x = 1; x < gridSize - 1; x++) {
+			VertDataCopy(FACE_getIFCo(f, lvl, S, 0, x), FACE_getIECo(f, lvl, prevS, x), ss);
+			VertDataCopy(FACE_getIFCo(f, lvl, S, x, 0), FACE_getIECo(f, lvl, S, x), ss);
+		}
+
+		VertDataCopy(FACE_getIFCo(f, lvl, S, 0, 0), (float *)FACE_getCenterData(f), ss);
+		VertDataCopy(FACE_getIFCo(f, lvl, S, cornerIdx, cornerIdx), VERT_getCo(FACE_getVerts(f)[S], lvl), ss);
 	}
+}
 
-	if (ss->calcVertNormals)
-		ccgSubSurf__calcVertNormals(ss,
-		                            effectedV, effectedE, effectedF,
-		                            numEffectedV, numEffectedE, numEffectedF);
+static void ccgSubSurf__stencilsEval(CCGSubSurf *ss)
+{
+	CCGSubSurfStencils *st = ss->stencils;
+	CCGSubSurfCalcSubdivData data;
+	const int vertDataSize = ss->meshIFC.vertDataSize;
+	const bool useThreads = ccgSubSurf__useThreads(st->numFaces, ss->subdivLevels);
+	int i;
 
-	for (ptrIdx = 0; ptrIdx < numEffectedV; ptrIdx++) {
-		CCGVert *v = effectedV[ptrIdx];
-		v->flags = 0;
+	for (i = 0; i < st->numVerts; i++) {
+		memcpy(st->controlCos[i], VERT_getCo(st->verts[i], 0), sizeof(float) * st->numLayers);
 	}
-	for (ptrIdx = 0; ptrIdx < numEffectedE; ptrIdx++) {
-		CCGEdge *e = effectedE[ptrIdx];
-		e->flags = 0;
+
+	if (st->numPoints) {
+		BLI_task_parallel_range_ex(0, st->numPoints, st, ccgSubSurf__stencilsEval_points_cb, 1024, false);
 	}
 
-	MEM_freeN(effectedF);
-	MEM_freeN(effectedE);
-	MEM_freeN(effectedV);
+	data.ss = ss;
+	data.effectedV = st->verts;
+	data.effectedE = st->edges;
+	data.effectedF = st->faces;
+	data.numEffectedV = st->numVerts;
+	data.numEffectedE = st->numEdges;
+	data.numEffectedF = st->numFaces;
+	data.curLvl = ss->subdivLevels;
+
+	ccgSubSurf__parallelRange(st->numEdges, &data, ccgSubSurf__stencilsEval_edges_cb, useThreads);
+	ccgSubSurf__parallelRange(st->numFaces, &data, ccgSubSurf__stencilsEval_faces_cb, useThreads);
+
+	if (ss->calcVertNormals) {
+		for (i = 0; i < st->numVerts; i++)
+			st->verts[i]->flags |= Vert_eEffected;
+		for (i = 0; i < st->numEdges; i++)
+			st->edges[i]->flags |= Edge_eEffected;
+
+		ccgSubSurf__calcVertNormals(ss,
+		                            st->verts, st->edges, st->faces,
+		                            st->numVerts, st->numEdges, st->numFaces);
+	}
+
+	for (i = 0; i < st->numVerts; i++)
+		st->verts[i]->flags = 0;
+	for (i = 0; i < st->numEdges; i++)
+		st->edges[i]->flags = 0;
+
+	ss->lowerLevelsStale = 1;
 }
 
 static void ccgSubSurf__allFaces(CCGSubSurf *ss, CCGFace ***faces, int *numFaces, int *freeFaces)
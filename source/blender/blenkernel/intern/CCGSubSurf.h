@@ -102,6 +102,8 @@ CCGError	ccgSubSurf_setCalcVertexNormals		(CCGSubSurf *ss, int useVertNormals, i
 void		ccgSubSurf_setAllocMask				(CCGSubSurf *ss, int allocMask, int maskOffset);
 
 void		ccgSubSurf_setNumLayers				(CCGSubSurf *ss, int numLayers);
+void		ccgSubSurf_setUseStencils			(CCGSubSurf *ss, int useStencils);
+int			ccgSubSurf_getUseStencils			(const CCGSubSurf *ss);
 
 /***/
 
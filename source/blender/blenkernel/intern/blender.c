@@ -64,6 +64,7 @@
 #include "BKE_blender.h"
 #include "BKE_bpath.h"
 #include "BKE_brush.h"
+#include "BKE_bvhutils.h"
 #include "BKE_context.h"
 #include "BKE_depsgraph.h"
 #include "BKE_global.h"
@@ -122,6 +123,8 @@ void free_blender(void)
 	BKE_brush_system_exit();
 	RE_exit_texture_rng();	
 
+	bvhcache_exit();
+
 	BLI_callback_global_finalize();
 
 	BKE_sequencer_cache_destruct();
@@ -254,6 +257,12 @@ static void setup_app_data(bContext *C, BlendFileData *bfd, const char *filepath
 	/* free G.main Main database */
 //	CTX_wm_manager_set(C, NULL);
 	clear_global();
+
+	/* trees kept for refitting belong to meshes of the old file, undo keeps
+	 * them since the same meshes are loaded again */
+	if (mode != LOAD_UNDO) {
+		bvhcache_clear_recycled();
+	}
 	
 	/* clear old property update cache, in case some old references are left dangling */
 	RNA_property_update_cache_free();
@@ -39,15 +39,33 @@
 #include "BLI_utildefines.h"
 #include "BLI_linklist.h"
 #include "BLI_math.h"
+#include "BLI_task.h"
 #include "BLI_threads.h"
 
 #include "BKE_DerivedMesh.h"
 #include "BKE_editmesh.h"
+#include "BKE_global.h"
 
 #include "MEM_guardedalloc.h"
 
+#include "atomic_ops.h"
+
 static ThreadRWMutex cache_rwlock = BLI_RWLOCK_INITIALIZER;
 
+static BVHTree *bvhcache_recycle_find(int type, unsigned int topology_hash, int totelem,
+                                      float epsilon, int tree_type, int axis);
+static void bvhcache_insert_ex(BVHCache *cache, BVHTree *tree, int type, unsigned int topology_hash, int totelem,
+                               float epsilon, int tree_type, int axis);
+
+/* number of trees used from a derived mesh cache, refitted from a
+ * previous derived mesh with the same topology, and built from scratch */
+static struct {
+	unsigned int hits, refits, rebuilds;
+} bvhcache_stats = {0};
+
+/* below this many elements refitting is done on a single thread */
+#define BVHCACHE_REFIT_THREADED_LIMIT 10000
+
 /* Math stuff for ray casting on mesh faces and for nearest surface */
 
 float bvhtree_ray_tri_intersection(const BVHTreeRay *ray, const float UNUSED(m_dist), const float v0[3], const float v1[3], const float v2[3])
@@ -239,6 +257,90 @@ static void mesh_edges_nearest_point(void *userdata, int index, const float co[3
 	}
 }
 
+/*
+ * Refitting of trees from a derived mesh with the same topology
+ */
+
+typedef struct BVHTreeRefitData {
+	BVHTree *tree;
+	const MVert *vert;
+	const MEdge *edge;
+	const MFace *face;
+} BVHTreeRefitData;
+
+static void bvhtree_refit_verts_cb(void *userdata, int i)
+{
+	BVHTreeRefitData *data = userdata;
+
+	BLI_bvhtree_update_node(data->tree, i, data->vert[i].co, NULL, 1);
+}
+
+static void bvhtree_refit_edges_cb(void *userdata, int i)
+{
+	BVHTreeRefitData *data = userdata;
+	const MEdge *edge = &data->edge[i];
+	float co[2][3];
+
+	copy_v3_v3(co[0], data->vert[edge->v1].co);
+	copy_v3_v3(co[1], data->vert[edge->v2].co);
+
+	BLI_bvhtree_update_node(data->tree, i, co[0], NULL, 2);
+}
+
+static void bvhtree_refit_faces_cb(void *userdata, int i)
+{
+	BVHTreeRefitData *data = userdata;
+	const MFace *face = &data->face[i];
+	float co[4][3];
+
+	copy_v3_v3(co[0], data->vert[face->v1].co);
+	copy_v3_v3(co[1], data->vert[face->v2].co);
+	copy_v3_v3(co[2], data->vert[face->v3].co);
+	if (face->v4)
+		copy_v3_v3(co[3], data->vert[face->v4].co);
+
+	BLI_bvhtree_update_node(data->tree, i, co[0], NULL, face->v4 ? 4 : 3);
+}
+
+/* leaf nodes are independent, only the bottom-up pass is serial */
+static void bvhtree_refit(BVHTreeRefitData *data, int totelem, TaskParallelRangeFunc func)
+{
+	if (totelem != 0) {
+		BLI_task_parallel_range_ex(0, totelem, data, func, BVHCACHE_REFIT_THREADED_LIMIT, false);
+	}
+	BLI_bvhtree_update_tree(data->tree);
+
+	atomic_add_uint32(&bvhcache_stats.refits, 1);
+}
+
+static unsigned int bvhcache_topology_hash_edges(const MEdge *edge, int numEdges)
+{
+	unsigned int hash = 0;
+	int i;
+
+	for (i = 0; i < numEdges; i++, edge++) {
+		hash = hash * 31 + edge->v1;
+		hash = hash * 31 + edge->v2;
+	}
+
+	return hash;
+}
+
+static unsigned int bvhcache_topology_hash_faces(const MFace *face, int numFaces)
+{
+	unsigned int hash = 0;
+	int i;
+
+	for (i = 0; i < numFaces; i++, face++) {
+		hash = hash * 31 + face->v1;
+		hash = hash * 31 + face->v2;
+		hash = hash * 31 + face->v3;
+		hash = hash * 31 + face->v4;
+	}
+
+	return hash;
+}
+
 /*
  * BVH builders
  */
@@ -264,25 +366,59 @@ BVHTree *bvhtree_from_mesh_verts(BVHTreeFromMesh *data, DerivedMesh *dm, float e
 			int numVerts = dm->getNumVerts(dm);
 
 			if (vert != NULL) {
-				tree = BLI_bvhtree_new(numVerts, epsilon, tree_type, axis);
+				/* the edges tell apart meshes with the same number of vertices,
+				 * trees of meshes without edges are not recycled */
+				const int numEdges = dm->getNumEdges(dm);
+				unsigned int topology_hash = 0;
 
-				if (tree != NULL) {
-					for (i = 0; i < numVerts; i++) {
-						BLI_bvhtree_insert(tree, i, vert[i].co, 1);
+				if (numEdges != 0) {
+					bool edge_allocated;
+					MEdge *edge = DM_get_edge_array(dm, &edge_allocated);
+
+					topology_hash = bvhcache_topology_hash_edges(edge, numEdges);
+
+					if (edge_allocated) {
+						MEM_freeN(edge);
 					}
 
-					BLI_bvhtree_balance(tree);
+					tree = bvhcache_recycle_find(BVHTREE_FROM_VERTICES, topology_hash, numVerts,
+					                             epsilon, tree_type, axis);
+				}
+
+				if (tree != NULL) {
+					BVHTreeRefitData refit_data = {tree, vert, NULL, NULL};
+
+					bvhtree_refit(&refit_data, numVerts, bvhtree_refit_verts_cb);
+				}
+				else {
+					tree = BLI_bvhtree_new(numVerts, epsilon, tree_type, axis);
 
+					if (tree != NULL) {
+						for (i = 0; i < numVerts; i++) {
+							BLI_bvhtree_insert(tree, i, vert[i].co, 1);
+						}
+
+						BLI_bvhtree_balance(tree);
+						atomic_add_uint32(&bvhcache_stats.rebuilds, 1);
+					}
+				}
+
+				if (tree != NULL) {
 					/* Save on cache for later use */
-//					printf("BVHTree built and saved on cache\n");
-					bvhcache_insert(&dm->bvhCache, tree, BVHTREE_FROM_VERTICES);
+					if (numEdges != 0) {
+						bvhcache_insert_ex(&dm->bvhCache, tree, BVHTREE_FROM_VERTICES, topology_hash, numVerts,
+						                   epsilon, tree_type, axis);
+					}
+					else {
+						bvhcache_insert(&dm->bvhCache, tree, BVHTREE_FROM_VERTICES);
+					}
 				}
 			}
 		}
 		BLI_rw_mutex_unlock(&cache_rwlock);
 	}
 	else {
-//		printf("BVHTree is already build, using cached tree\n");
+		atomic_add_uint32(&bvhcache_stats.hits, 1);
 	}
 
 
@@ -319,8 +455,8 @@ BVHTree *bvhtree_from_mesh_faces(BVHTreeFromMesh *data, DerivedMesh *dm, float e
 	BMEditMesh *em = data->em_evil;
 	const int bvhcache_type = em ? BVHTREE_FROM_FACES_EDITMESH : BVHTREE_FROM_FACES;
 	BVHTree *tree;
-	MVert *vert;
-	MFace *face;
+	MVert *vert = NULL;
+	MFace *face = NULL;
 	bool vert_allocated = false, face_allocated = false;
 
 	BLI_rw_mutex_lock(&cache_rwlock, THREAD_LOCK_READ);
@@ -339,6 +475,8 @@ BVHTree *bvhtree_from_mesh_faces(BVHTreeFromMesh *data, DerivedMesh *dm, float e
 		if (tree == NULL) {
 			int i;
 			int numFaces;
+			/* only used for derived mesh faces, edit-mesh trees skip hidden and selected faces */
+			unsigned int topology_hash = 0;
 
 			/* BMESH specific check that we have tessfaces,
 			 * we _could_ tessellate here but rather not - campbell
@@ -353,9 +491,22 @@ BVHTree *bvhtree_from_mesh_faces(BVHTreeFromMesh *data, DerivedMesh *dm, float e
 				BLI_assert(!(numFaces == 0 && dm->getNumPolys(dm) != 0));
 			}
 
-			if (numFaces != 0) {
+			if (numFaces != 0 && em == NULL && vert != NULL && face != NULL) {
+				/* deformed mesh with the same faces as a previous one, only refit */
+				topology_hash = bvhcache_topology_hash_faces(face, numFaces);
+				tree = bvhcache_recycle_find(bvhcache_type, topology_hash, numFaces, epsilon, tree_type, axis);
+
+				if (tree != NULL) {
+					BVHTreeRefitData refit_data = {tree, vert, NULL, face};
+
+					bvhtree_refit(&refit_data, numFaces, bvhtree_refit_faces_cb);
+					bvhcache_insert_ex(&dm->bvhCache, tree, bvhcache_type, topology_hash, numFaces,
+					                   epsilon, tree_type, axis);
+				}
+			}
+
+			if (numFaces != 0 && tree == NULL) {
 				/* Create a bvh-tree of the given target */
-				// printf("%s: building BVH, total=%d\n", __func__, numFaces);
 				tree = BLI_bvhtree_new(numFaces, epsilon, tree_type, axis);
 				if (tree != NULL) {
 					if (em) {
@@ -435,17 +586,19 @@ BVHTree *bvhtree_from_mesh_faces(BVHTreeFromMesh *data, DerivedMesh *dm, float e
 						}
 					}
 					BLI_bvhtree_balance(tree);
+					atomic_add_uint32(&bvhcache_stats.rebuilds, 1);
 
 					/* Save on cache for later use */
-//					printf("BVHTree built and saved on cache\n");
-					bvhcache_insert(&dm->bvhCache, tree, bvhcache_type);
+					bvhcache_insert_ex(&dm->bvhCache, tree, bvhcache_type, topology_hash,
+					                   (em == NULL && vert != NULL && face != NULL) ? numFaces : -1,
+					                   epsilon, tree_type, axis);
 				}
 			}
 		}
 		BLI_rw_mutex_unlock(&cache_rwlock);
 	}
 	else {
-//		printf("BVHTree is already build, using cached tree\n");
+		atomic_add_uint32(&bvhcache_stats.hits, 1);
 	}
 
 
@@ -510,28 +663,43 @@ BVHTree *bvhtree_from_mesh_edges(BVHTreeFromMesh *data, DerivedMesh *dm, float e
 			int numEdges = dm->getNumEdges(dm);
 
 			if (vert != NULL && edge != NULL) {
-				/* Create a bvh-tree of the given target */
-				tree = BLI_bvhtree_new(numEdges, epsilon, tree_type, axis);
+				const unsigned int topology_hash = bvhcache_topology_hash_edges(edge, numEdges);
+
+				tree = bvhcache_recycle_find(BVHTREE_FROM_EDGES, topology_hash, numEdges,
+				                             epsilon, tree_type, axis);
+
 				if (tree != NULL) {
-					for (i = 0; i < numEdges; i++) {
-						float co[4][3];
-						copy_v3_v3(co[0], vert[edge[i].v1].co);
-						copy_v3_v3(co[1], vert[edge[i].v2].co);
+					BVHTreeRefitData refit_data = {tree, vert, edge, NULL};
 
-						BLI_bvhtree_insert(tree, i, co[0], 2);
+					bvhtree_refit(&refit_data, numEdges, bvhtree_refit_edges_cb);
+				}
+				else {
+					/* Create a bvh-tree of the given target */
+					tree = BLI_bvhtree_new(numEdges, epsilon, tree_type, axis);
+					if (tree != NULL) {
+						for (i = 0; i < numEdges; i++) {
+							float co[4][3];
+							copy_v3_v3(co[0], vert[edge[i].v1].co);
+							copy_v3_v3(co[1], vert[edge[i].v2].co);
+
+							BLI_bvhtree_insert(tree, i, co[0], 2);
+						}
+						BLI_bvhtree_balance(tree);
+						atomic_add_uint32(&bvhcache_stats.rebuilds, 1);
 					}
-					BLI_bvhtree_balance(tree);
+				}
 
+				if (tree != NULL) {
 					/* Save on cache for later use */
-//					printf("BVHTree built and saved on cache\n");
-					bvhcache_insert(&dm->bvhCache, tree, BVHTREE_FROM_EDGES);
+					bvhcache_insert_ex(&dm->bvhCache, tree, BVHTREE_FROM_EDGES, topology_hash, numEdges,
+					                   epsilon, tree_type, axis);
 				}
 			}
 		}
 		BLI_rw_mutex_unlock(&cache_rwlock);
 	}
 	else {
-//		printf("BVHTree is already build, using cached tree\n");
+		atomic_add_uint32(&bvhcache_stats.hits, 1);
 	}
 
 
@@ -591,8 +759,29 @@ typedef struct BVHCacheItem {
 	int type;
 	BVHTree *tree;
 
+	/* what the tree was built from, so it can be refitted for another
+	 * derived mesh with the same topology once this cache is freed.
+	 * totelem is -1 for trees that can't be reused */
+	unsigned int topology_hash;
+	int totelem;
+	float epsilon;
+	int tree_type, axis;
 } BVHCacheItem;
 
+/* Trees of freed derived mesh caches. Modifier stacks create a new derived
+ * mesh on every evaluation, keeping the most recently freed trees around
+ * allows to refit them instead of building from scratch when only coordinates
+ * change (animation playback, shrinkwrap targets, snapping during transform).
+ *
+ * Edit-mesh trees are not kept, they skip hidden and selected faces, so a
+ * tree for the same topology can still contain different faces. */
+static LinkNode *bvhcache_recycled = NULL;
+static size_t bvhcache_recycled_mem = 0;
+static ThreadMutex bvhcache_recycled_lock = BLI_MUTEX_INITIALIZER;
+
+/* memory of the kept trees, enough for about 800k faces in binary trees */
+#define BVHCACHE_RECYCLED_MAX_MEM (128 * 1024 * 1024)
+
 static void bvhcacheitem_set_if_match(void *_cached, void *_search)
 {
 	BVHCacheItem *cached = (BVHCacheItem *)_cached;
@@ -613,7 +802,8 @@ BVHTree *bvhcache_find(BVHCache *cache, int type)
 	return item.tree;
 }
 
-void bvhcache_insert(BVHCache *cache, BVHTree *tree, int type)
+static void bvhcache_insert_ex(BVHCache *cache, BVHTree *tree, int type, unsigned int topology_hash, int totelem,
+                               float epsilon, int tree_type, int axis)
 {
 	BVHCacheItem *item = NULL;
 
@@ -625,10 +815,58 @@ void bvhcache_insert(BVHCache *cache, BVHTree *tree, int type)
 
 	item->type = type;
 	item->tree = tree;
+	item->topology_hash = topology_hash;
+	item->totelem = totelem;
+	item->epsilon = epsilon;
+	item->tree_type = tree_type;
+	item->axis = axis;
 
 	BLI_linklist_prepend(cache, item);
 }
 
+void bvhcache_insert(BVHCache *cache, BVHTree *tree, int type)
+{
+	bvhcache_insert_ex(cache, tree, type, 0, -1, 0.0f, 0, 0);
+}
+
+/* Take a tree built for the same topology out of the recycled trees.
+ * Refitting gives a valid tree for any mesh with the same number of
+ * elements, matching topology only keeps the tree quality. */
+static BVHTree *bvhcache_recycle_find(int type, unsigned int topology_hash, int totelem,
+                                      float epsilon, int tree_type, int axis)
+{
+	LinkNode *node, *prev = NULL;
+	BVHTree *tree = NULL;
+
+	BLI_mutex_lock(&bvhcache_recycled_lock);
+
+	for (node = bvhcache_recycled; node; prev = node, node = node->next) {
+		BVHCacheItem *item = node->link;
+
+		if (item->type == type &&
+		    item->topology_hash == topology_hash &&
+		    item->totelem == totelem &&
+		    item->epsilon == epsilon &&
+		    item->tree_type == tree_type &&
+		    item->axis == axis)
+		{
+			if (prev)
+				prev->next = node->next;
+			else
+				bvhcache_recycled = node->next;
+			bvhcache_recycled_mem -= BLI_bvhtree_get_memory_size(item->tree);
+
+			tree = item->tree;
+			MEM_freeN(item);
+			MEM_freeN(node);
+			break;
+		}
+	}
+
+	BLI_mutex_unlock(&bvhcache_recycled_lock);
+
+	return tree;
+}
 
 void bvhcache_init(BVHCache *cache)
 {
@@ -643,11 +881,67 @@ static void bvhcacheitem_free(void *_item)
 	MEM_freeN(item);
 }
 
+static void bvhcacheitem_recycle(void *_item)
+{
+	BVHCacheItem *item = (BVHCacheItem *)_item;
+	size_t mem;
+
+	if (item->totelem == -1 || item->type == BVHTREE_FROM_FACES_EDITMESH) {
+		bvhcacheitem_free(item);
+		return;
+	}
+
+	mem = BLI_bvhtree_get_memory_size(item->tree);
+
+	if (mem > BVHCACHE_RECYCLED_MAX_MEM) {
+		bvhcacheitem_free(item);
+		return;
+	}
+
+	BLI_mutex_lock(&bvhcache_recycled_lock);
+
+	BLI_linklist_prepend(&bvhcache_recycled, item);
+	bvhcache_recycled_mem += mem;
+
+	/* drop the least recently freed trees */
+	while (bvhcache_recycled_mem > BVHCACHE_RECYCLED_MAX_MEM) {
+		LinkNode *node = bvhcache_recycled;
+		BVHCacheItem *item_last;
+
+		while (node->next->next)
+			node = node->next;
+
+		item_last = node->next->link;
+		bvhcache_recycled_mem -= BLI_bvhtree_get_memory_size(item_last->tree);
+		bvhcacheitem_free(item_last);
+		MEM_freeN(node->next);
+		node->next = NULL;
+	}
+
+	BLI_mutex_unlock(&bvhcache_recycled_lock);
+}
 
 void bvhcache_free(BVHCache *cache)
 {
-	BLI_linklist_free(*cache, (LinkNodeFreeFP)bvhcacheitem_free);
+	BLI_linklist_free(*cache, (LinkNodeFreeFP)bvhcacheitem_recycle);
 	*cache = NULL;
 }
 
+void bvhcache_exit(void)
+{
+	if (G.debug & G_DEBUG) {
+		printf("BVH cache: %u hits, %u refits, %u rebuilds\n",
+		       bvhcache_stats.hits, bvhcache_stats.refits, bvhcache_stats.rebuilds);
+	}
+
+	bvhcache_clear_recycled();
+}
 
+void bvhcache_clear_recycled(void)
+{
+	BLI_mutex_lock(&bvhcache_recycled_lock);
+	BLI_linklist_free(bvhcache_recycled, (LinkNodeFreeFP)bvhcacheitem_free);
+	bvhcache_recycled = NULL;
+	bvhcache_recycled_mem = 0;
+	BLI_mutex_unlock(&bvhcache_recycled_lock);
+}
@@ -2253,11 +2253,183 @@ static void psys_update_particle_bvhtree(ParticleSystem *psys, float cfra)
 			BLI_bvhtree_balance(psys->bvhtree);
 			
 			psys->bvhtree_frame = cfra;
+
+			psys_sph_grid_free(psys->sphgrid);
+			psys->sphgrid = NULL;
 			
 			BLI_rw_mutex_unlock(&psys_bvhtree_rwlock);
 		}
 	}
 }
+
+/* Uniform grid for SPH neighbour search. Points are counting sorted into
+ * hashed cells the size of the interaction radius, so a range query only
+ * visits the neighbouring cells and reads their points from contiguous memory.
+ *
+ * The BVH tree search is kept for comparison, start with '--debug-value 44'
+ * to use it instead. With '--debug' each fluid step prints its particle-steps/s. */
+#define SPH_DEBUG_VALUE_BVH 44
+
+typedef struct SPHGridPoint {
+	float co[3];
+	int cell[3];
+	int index;
+} SPHGridPoint;
+
+typedef struct SPHGrid {
+	float frame;
+	float invcellsize;
+	unsigned int hashmask;
+	unsigned int *cellstart;	/* hashmask + 2 offsets into points */
+	SPHGridPoint *points;		/* sorted by cell, then by particle index */
+	int totpoint;
+} SPHGrid;
+
+BLI_INLINE void sph_grid_cell(const SPHGrid *grid, const float co[3], int r_cell[3])
+{
+	r_cell[0] = (int)floorf(co[0] * grid->invcellsize);
+	r_cell[1] = (int)floorf(co[1] * grid->invcellsize);
+	r_cell[2] = (int)floorf(co[2] * grid->invcellsize);
+}
+
+BLI_INLINE unsigned int sph_grid_hash(const int cell[3], unsigned int hashmask)
+{
+	return (((unsigned int)cell[0] * 73856093u) ^
+	        ((unsigned int)cell[1] * 19349663u) ^
+	        ((unsigned int)cell[2] * 83492791u)) & hashmask;
+}
+
+void psys_sph_grid_free(SPHGrid *grid)
+{
+	if (grid) {
+		MEM_freeN(grid->cellstart);
+		MEM_freeN(grid->points);
+		MEM_freeN(grid);
+	}
+}
+
+static void psys_update_particle_sphgrid(ParticleSystem *psys, float cellsize, float cfra)
+{
+	if (psys) {
+		PARTICLE_P;
+		SPHGrid *grid;
+		SPHGridPoint *points;
+		unsigned int *cellstart, *hashes, tablesize, h;
+		int *sorted;
+		int totpoint = 0, i;
+		bool need_rebuild;
+
+		BLI_rw_mutex_lock(&psys_bvhtree_rwlock, THREAD_LOCK_READ);
+		need_rebuild = !psys->sphgrid || psys->sphgrid->frame != cfra;
+		BLI_rw_mutex_unlock(&psys_bvhtree_rwlock);
+
+		if (!need_rebuild)
+			return;
+
+		LOOP_SHOWN_PARTICLES {
+			if (pa->alive == PARS_ALIVE)
+				totpoint++;
+		}
+
+		points = MEM_mallocN(sizeof(SPHGridPoint) * max_ii(totpoint, 1), "sph grid unsorted points");
+		i = 0;
+		LOOP_SHOWN_PARTICLES {
+			if (pa->alive == PARS_ALIVE) {
+				copy_v3_v3(points[i].co, (pa->state.time == cfra) ? pa->prev_state.co : pa->state.co);
+				points[i].index = p;
+				i++;
+			}
+		}
+
+		tablesize = (unsigned int)power_of_2_max_i(max_ii(totpoint, 1));
+
+		grid = MEM_callocN(sizeof(SPHGrid), "sph grid");
+		grid->frame = cfra;
+		grid->invcellsize = 1.0f / cellsize;
+		grid->hashmask = tablesize - 1;
+		grid->totpoint = totpoint;
+		grid->cellstart = cellstart = MEM_callocN(sizeof(unsigned int) * (tablesize + 1), "sph grid cells");
+		grid->points = MEM_mallocN(sizeof(SPHGridPoint) * max_ii(totpoint, 1), "sph grid points");
+
+		hashes = MEM_mallocN(sizeof(unsigned int) * max_ii(totpoint, 1), "sph grid hashes");
+		sorted = MEM_mallocN(sizeof(int) * max_ii(totpoint, 1), "sph grid order");
+
+		/* hash points and count them per cell */
+#pragma omp parallel for schedule(static) if (totpoint > 10000)
+		for (i = 0; i < totpoint; i++) {
+			unsigned int ph;
+
+			sph_grid_cell(grid, points[i].co, points[i].cell);
+			ph = hashes[i] = sph_grid_hash(points[i].cell, grid->hashmask);
+
+#pragma omp atomic
+			cellstart[ph]++;
+		}
+
+		/* cell ends, turned into cell starts while filling in reverse order,
+		 * which keeps points within a cell sorted by particle index */
+		for (h = 1; h < tablesize; h++)
+			cellstart[h] += cellstart[h - 1];
+		cellstart[tablesize] = totpoint;
+
+		for (i = totpoint - 1; i >= 0; i--)
+			sorted[--cellstart[hashes[i]]] = i;
+
+#pragma omp parallel for schedule(static) if (totpoint > 10000)
+		for (i = 0; i < totpoint; i++)
+			grid->points[i] = points[sorted[i]];
+
+		MEM_freeN(points);
+		MEM_freeN(hashes);
+		MEM_freeN(sorted);
+
+		BLI_rw_mutex_lock(&psys_bvhtree_rwlock, THREAD_LOCK_WRITE);
+
+		psys_sph_grid_free(psys->sphgrid);
+		psys->sphgrid = grid;
+
+		BLI_bvhtree_free(psys->bvhtree);
+		psys->bvhtree = NULL;
+
+		BLI_rw_mutex_unlock(&psys_bvhtree_rwlock);
+	}
+}
+
+static void sph_grid_range_query(SPHGrid *grid, const float co[3], float radius, BVHTree_RangeQuery callback, void *userdata)
+{
+	const float radius_sq = radius * radius;
+	float bmin[3], bmax[3];
+	int cmin[3], cmax[3], cell[3];
+
+	bmin[0] = co[0] - radius; bmin[1] = co[1] - radius; bmin[2] = co[2] - radius;
+	bmax[0] = co[0] + radius; bmax[1] = co[1] + radius; bmax[2] = co[2] + radius;
+
+	sph_grid_cell(grid, bmin, cmin);
+	sph_grid_cell(grid, bmax, cmax);
+
+	for (cell[2] = cmin[2]; cell[2] <= cmax[2]; cell[2]++) {
+		for (cell[1] = cmin[1]; cell[1] <= cmax[1]; cell[1]++) {
+			for (cell[0] = cmin[0]; cell[0] <= cmax[0]; cell[0]++) {
+				const unsigned int h = sph_grid_hash(cell, grid->hashmask);
+				const SPHGridPoint *pt = grid->points + grid->cellstart[h];
+				const SPHGridPoint *pt_end = grid->points + grid->cellstart[h + 1];
+
+				for (; pt != pt_end; pt++) {
+					float dist_sq;
+
+					/* skip points of other cells sharing the hash */
+					if (pt->cell[0] != cell[0] || pt->cell[1] != cell[1] || pt->cell[2] != cell[2])
+						continue;
+
+					dist_sq = len_squared_v3v3(co, pt->co);
+					if (dist_sq < radius_sq)
+						callback(userdata, pt->index, dist_sq);
+				}
+			}
+		}
+	}
+}
+
 void psys_update_particle_tree(ParticleSystem *psys, float cfra)
 {
 	if (psys) {
@@ -2574,7 +2746,10 @@ static void sph_evaluate_func(BVHTree *tree, ParticleSystem **psys, float co[3],
 		else {
 			BLI_rw_mutex_lock(&psys_bvhtree_rwlock, THREAD_LOCK_READ);
 			
-			BLI_bvhtree_range_query(psys[i]->bvhtree, co, interaction_radius, callback, pfr);
+			if (psys[i]->sphgrid)
+				sph_grid_range_query(psys[i]->sphgrid, co, interaction_radius, callback, pfr);
+			else
+				BLI_bvhtree_range_query(psys[i]->bvhtree, co, interaction_radius, callback, pfr);
 			
 			BLI_rw_mutex_unlock(&psys_bvhtree_rwlock);
 		}
@@ -3187,6 +3362,166 @@ static void basic_rotate(ParticleSettings *part, ParticleData *pa, float dfra, f
 	normalize_qt(pa->state.rot);
 }
 
+/* Newtonian particles are integrated in chunks: the state of a chunk of
+ * particles is copied to structure-of-arrays buffers, effectors and the
+ * integration step run over those, and the result is written back.
+ * Set debug value to PARTICLE_DEBUG_VALUE_AOS to integrate one particle at a time. */
+#define PARTICLE_CHUNK_SIZE 256
+#define PARTICLE_DEBUG_VALUE_AOS 45
+
+typedef struct ParticleChunk {
+	int index[PARTICLE_CHUNK_SIZE];
+	bool use_euler[PARTICLE_CHUNK_SIZE];
+
+	float co[PARTICLE_CHUNK_SIZE][3];
+	float vel[PARTICLE_CHUNK_SIZE][3];
+	float prev_co[PARTICLE_CHUNK_SIZE][3];
+	float prev_vel[PARTICLE_CHUNK_SIZE][3];
+	float force[PARTICLE_CHUNK_SIZE][3];
+	float impulse[PARTICLE_CHUNK_SIZE][3];
+
+	float dtime[PARTICLE_CHUNK_SIZE];
+	float mass[PARTICLE_CHUNK_SIZE];
+	float drag[PARTICLE_CHUNK_SIZE];
+	float field[PARTICLE_CHUNK_SIZE];
+	float gravity[PARTICLE_CHUNK_SIZE];
+	float damp[PARTICLE_CHUNK_SIZE];
+} ParticleChunk;
+
+static bool basic_integrate_chunks_supported(ParticleSimulationData *sim)
+{
+	ParticleSettings *part = sim->psys->part;
+	EffectorCache *eff;
+
+	/* brownian force and effector noise use shared random generators */
+	if (part->type == PART_HAIR || part->brownfac != 0.0f)
+		return false;
+
+	if (!ELEM(part->integrator, PART_INT_EULER, PART_INT_VERLET))
+		return false;
+
+	/* particles of this system acting as effectors are read while other threads move them */
+	if (part->flag & PART_SELF_EFFECT)
+		return false;
+
+	if (sim->psys->effectors) {
+		for (eff = sim->psys->effectors->first; eff; eff = eff->next) {
+			if (eff->pd->forcefield == PFIELD_GUIDE || eff->pd->f_noise != 0.0f)
+				return false;
+			if (eff->psys == sim->psys)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/* same as basic_integrate for the supported settings, for particles start to end */
+static void basic_integrate_chunk(ParticleSimulationData *sim, int start, int end, float cfra)
+{
+	ParticleSystem *psys = sim->psys;
+	ParticleSettings *part = psys->part;
+	ParticleChunk chunk;
+	ParticleTexture ptex;
+	EffectedPoint epoint;
+	float timestep = psys_get_timestep(sim);
+	float gravity[3];
+	bool use_gravity = psys_uses_gravity(sim);
+	int p, i, tot = 0;
+
+	if (use_gravity)
+		copy_v3_v3(gravity, sim->scene->physics_settings.gravity);
+
+	for (p = start; p < end; p++) {
+		ParticleData *pa = psys->particles + p;
+
+		if (pa->state.time <= 0.0f)
+			continue;
+
+		psys_get_texture(sim, pa, &ptex, PAMAP_PHYSICS, cfra);
+
+		chunk.index[tot] = p;
+		/* Verlet integration behaves strangely with moving emitters, so do first step with euler. */
+		chunk.use_euler[tot] = (part->integrator == PART_INT_EULER || pa->prev_state.time < 0.0f);
+
+		copy_v3_v3(chunk.co[tot], pa->state.co);
+		copy_v3_v3(chunk.vel[tot], pa->state.vel);
+		copy_v3_v3(chunk.prev_co[tot], pa->prev_state.co);
+		copy_v3_v3(chunk.prev_vel[tot], pa->prev_state.vel);
+
+		chunk.dtime[tot] = pa->state.time * timestep;
+		chunk.mass[tot] = (part->flag & PART_SIZEMASS ? part->mass * pa->size : part->mass);
+		chunk.drag[tot] = -part->dragfac * pa->size * pa->size;
+		chunk.field[tot] = ptex.field;
+		chunk.gravity[tot] = part->effector_weights->global_gravity * ptex.gravity;
+		chunk.damp[tot] = ptex.damp;
+
+		/* maintain angular velocity */
+		copy_v3_v3(pa->state.ave, pa->prev_state.ave);
+
+		tot++;
+	}
+
+	/* effectors, dynamic rotation writes directly to the particle state */
+	for (i = 0; i < tot; i++) {
+		ParticleData *pa = psys->particles + chunk.index[i];
+
+		pd_point_from_particle(sim, pa, &pa->state, &epoint);
+		epoint.loc = chunk.co[i];
+		epoint.vel = chunk.vel[i];
+
+		zero_v3(chunk.force[i]);
+		zero_v3(chunk.impulse[i]);
+		pdDoEffectors(psys->effectors, sim->colliders, part->effector_weights, &epoint, chunk.force[i], chunk.impulse[i]);
+	}
+
+	for (i = 0; i < tot; i++) {
+		float *co = chunk.co[i], *vel = chunk.vel[i];
+		float dtime = chunk.dtime[i];
+		float acceleration[3];
+
+		mul_v3_fl(chunk.force[i], chunk.field[i]);
+		mul_v3_fl(chunk.impulse[i], chunk.field[i]);
+
+		/* calculate air-particle interaction */
+		if (part->dragfac != 0.0f)
+			madd_v3_v3fl(chunk.force[i], vel, chunk.drag[i] * len_v3(vel));
+
+		mul_v3_v3fl(acceleration, chunk.force[i], 1.0f / chunk.mass[i]);
+
+		if (use_gravity)
+			madd_v3_v3fl(acceleration, gravity, chunk.gravity[i]);
+
+		add_v3_v3(vel, chunk.impulse[i]);
+
+		if (chunk.use_euler[i]) {
+			madd_v3_v3fl(co, vel, dtime);
+			madd_v3_v3fl(vel, acceleration, dtime);
+		}
+		else {
+			float oldpos[3];
+
+			copy_v3_v3(oldpos, co);
+			madd_v3_v3v3fl(vel, chunk.prev_vel[i], acceleration, dtime);
+			madd_v3_v3v3fl(co, chunk.prev_co[i], vel, dtime);
+
+			sub_v3_v3v3(vel, co, oldpos);
+			mul_v3_fl(vel, 1.0f / dtime);
+		}
+
+		/* damp affects final velocity */
+		if (part->dampfac != 0.f)
+			mul_v3_fl(vel, 1.f - part->dampfac * chunk.damp[i] * 25.f * dtime);
+	}
+
+	for (i = 0; i < tot; i++) {
+		ParticleData *pa = psys->particles + chunk.index[i];
+
+		copy_v3_v3(pa->state.co, chunk.co[i]);
+		copy_v3_v3(pa->state.vel, chunk.vel[i]);
+	}
+}
+
 /************************************************
  *			Collisions
  *
@@ -4273,6 +4608,7 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 	/* frame & time changes */
 	float dfra, dtime;
 	float birthtime, dietime;
+	double sph_time = 0.0;
 
 	/* where have we gone in time since last time */
 	dfra= cfra - psys->cfra;
@@ -4326,11 +4662,26 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 		case PART_PHYS_FLUID:
 		{
 			ParticleTarget *pt = psys->targets.first;
-			psys_update_particle_bvhtree(psys, cfra);
-			
-			for (; pt; pt=pt->next) {  /* Updating others systems particle tree for fluid-fluid interaction */
-				if (pt->ob)
-					psys_update_particle_bvhtree(BLI_findlink(&pt->ob->particlesystem, pt->psys-1), cfra);
+			SPHFluidSettings *fluid = part->fluid;
+			float interaction_radius = fluid->radius * (fluid->flag & SPH_FAC_RADIUS ? 4.0f * part->size : 1.0f);
+
+			sph_time = PIL_check_seconds_timer();
+
+			if (G.debug_value == SPH_DEBUG_VALUE_BVH) {
+				psys_update_particle_bvhtree(psys, cfra);
+
+				for (; pt; pt=pt->next) {  /* Updating others systems particle tree for fluid-fluid interaction */
+					if (pt->ob)
+						psys_update_particle_bvhtree(BLI_findlink(&pt->ob->particlesystem, pt->psys-1), cfra);
+				}
+			}
+			else {
+				psys_update_particle_sphgrid(psys, interaction_radius, cfra);
+
+				for (; pt; pt=pt->next) {  /* Updating others systems particle grid for fluid-fluid interaction */
+					if (pt->ob)
+						psys_update_particle_sphgrid(BLI_findlink(&pt->ob->particlesystem, pt->psys-1), interaction_radius, cfra);
+				}
 			}
 			break;
 		}
@@ -4381,16 +4732,48 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 	switch (part->phystype) {
 		case PART_PHYS_NEWTON:
 		{
-			LOOP_DYNAMIC_PARTICLES {
-				/* do global forces & effectors */
-				basic_integrate(sim, p, pa->state.time, cfra);
-	
-				/* deflection */
-				if (sim->colliders)
-					collision_check(sim, p, pa->state.time, cfra);
+			double time = PIL_check_seconds_timer();
+			bool use_chunks = (G.debug_value != PARTICLE_DEBUG_VALUE_AOS) && basic_integrate_chunks_supported(sim);
+
+			if (use_chunks) {
+				int totchunk = (psys->totpart + PARTICLE_CHUNK_SIZE - 1) / PARTICLE_CHUNK_SIZE;
+				int chunk;
+
+#pragma omp parallel for schedule(dynamic) if (psys->totpart > 4 * PARTICLE_CHUNK_SIZE)
+				for (chunk = 0; chunk < totchunk; chunk++) {
+					basic_integrate_chunk(sim, chunk * PARTICLE_CHUNK_SIZE,
+					                      min_ii((chunk + 1) * PARTICLE_CHUNK_SIZE, psys->totpart), cfra);
+				}
+
+				/* collisions use the global random generator, keep them in particle order */
+				LOOP_DYNAMIC_PARTICLES {
+					/* deflection */
+					if (sim->colliders)
+						collision_check(sim, p, pa->state.time, cfra);
 
-				/* rotations */
-				basic_rotate(part, pa, pa->state.time, timestep);
+					/* rotations */
+					basic_rotate(part, pa, pa->state.time, timestep);
+				}
+			}
+			else {
+				LOOP_DYNAMIC_PARTICLES {
+					/* do global forces & effectors */
+					basic_integrate(sim, p, pa->state.time, cfra);
+
+					/* deflection */
+					if (sim->colliders)
+						collision_check(sim, p, pa->state.time, cfra);
+
+					/* rotations */
+					basic_rotate(part, pa, pa->state.time, timestep);
+				}
+			}
+
+			if (G.debug & G_DEBUG) {
+				time = PIL_check_seconds_timer() - time;
+				printf("Newtonian %s: %d particles, %.4fs, %.0f particle-steps/s (%s)\n",
+				       psys->name, psys->totpart, time, (time > 0.0) ? psys->totpart / time : 0.0,
+				       use_chunks ? "chunks" : "per particle");
 			}
 			break;
 		}
@@ -4480,6 +4863,13 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 			}
 
 			psys_sph_finalise(&sphdata);
+
+			if (G.debug & G_DEBUG) {
+				double time = PIL_check_seconds_timer() - sph_time;
+				printf("SPH %s: %d particles, %.4fs, %.0f particle-steps/s (%s search)\n",
+				       psys->name, psys->totpart, time, (time > 0.0) ? psys->totpart / time : 0.0,
+				       (G.debug_value == SPH_DEBUG_VALUE_BVH) ? "bvh" : "grid");
+			}
 			break;
 		}
 	}
@@ -567,30 +567,78 @@ static void free_ss_weights(WeightTable *wtable)
 		MEM_freeN(wtable->weight_table);
 }
 
-static void ss_sync_from_derivedmesh(CCGSubSurf *ss, DerivedMesh *dm,
-                                     float (*vertexCos)[3], int useFlatSubdiv)
+/* Check whether the subsurf was last synced from a mesh with the same topology,
+ * in which case only the vertex coordinates have to be synced again.
+ *
+ * Original indices stored in the edge and face user data are refreshed while
+ * checking, a full sync overwrites them anyway when the topology differs. */
+static bool ss_sync_topology_matches(CCGSubSurf *ss, DerivedMesh *dm, int useFlatSubdiv)
 {
 	float creaseFactor = (float) ccgSubSurf_getSubdivisionLevels(ss);
-#ifndef USE_DYNSIZE
-	CCGVertHDL *fVerts = NULL;
-	BLI_array_declare(fVerts);
-#endif
-	MVert *mvert = dm->getVertArray(dm);
-	MEdge *medge = dm->getEdgeArray(dm);
-	/* MFace *mface = dm->getTessFaceArray(dm); */ /* UNUSED */
-	MVert *mv;
-	MEdge *me;
+	MEdge *medge = dm->getEdgeArray(dm), *me;
 	MLoop *mloop = dm->getLoopArray(dm), *ml;
 	MPoly *mpoly = dm->getPolyArray(dm), *mp;
-	/*MFace *mf;*/ /*UNUSED*/
-	int totvert = dm->getNumVerts(dm);
 	int totedge = dm->getNumEdges(dm);
-	/*int totface = dm->getNumTessFaces(dm);*/ /*UNUSED*/
-	/*int totpoly = dm->getNumFaces(dm);*/ /*UNUSED*/
 	int i, j;
 	int *index;
 
-	ccgSubSurf_initFullSync(ss);
+	if (ccgSubSurf_getNumVerts(ss) != dm->getNumVerts(dm) ||
+	    ccgSubSurf_getNumEdges(ss) != totedge ||
+	    ccgSubSurf_getNumFaces(ss) != dm->numPolyData)
+	{
+		return false;
+	}
+
+	me = medge;
+	index = (int *)dm->getEdgeDataArray(dm, CD_ORIGINDEX);
+	for (i = 0; i < totedge; i++, me++) {
+		CCGEdge *e = ccgSubSurf_getEdge(ss, SET_INT_IN_POINTER(i));
+		float crease;
+
+		crease = useFlatSubdiv ? creaseFactor :
+		         me->crease * creaseFactor / 255.0f;
+
+		if (e == NULL ||
+		    ccgSubSurf_getVertVertHandle(ccgSubSurf_getEdgeVert0(e)) != SET_UINT_IN_POINTER(me->v1) ||
+		    ccgSubSurf_getVertVertHandle(ccgSubSurf_getEdgeVert1(e)) != SET_UINT_IN_POINTER(me->v2) ||
+		    ccgSubSurf_getEdgeCrease(e) != crease)
+		{
+			return false;
+		}
+
+		((int *)ccgSubSurf_getEdgeUserData(ss, e))[1] = (index) ? *index++ : i;
+	}
+
+	mp = mpoly;
+	index = (int *)dm->getPolyDataArray(dm, CD_ORIGINDEX);
+	for (i = 0; i < dm->numPolyData; i++, mp++) {
+		CCGFace *f = ccgSubSurf_getFace(ss, SET_INT_IN_POINTER(i));
+
+		if (f == NULL || ccgSubSurf_getFaceNumVerts(f) != mp->totloop) {
+			return false;
+		}
+
+		ml = mloop + mp->loopstart;
+		for (j = 0; j < mp->totloop; j++, ml++) {
+			if (ccgSubSurf_getVertVertHandle(ccgSubSurf_getFaceVert(f, j)) != SET_UINT_IN_POINTER(ml->v)) {
+				return false;
+			}
+		}
+
+		((int *)ccgSubSurf_getFaceUserData(ss, f))[1] = (index) ? *index++ : i;
+	}
+
+	return true;
+}
+
+static void ss_sync_verts_from_derivedmesh(CCGSubSurf *ss, DerivedMesh *dm,
+                                           float (*vertexCos)[3])
+{
+	MVert *mvert = dm->getVertArray(dm);
+	MVert *mv;
+	int totvert = dm->getNumVerts(dm);
+	int i;
+	int *index;
 
 	mv = mvert;
 	index = (int *)dm->getVertDataArray(dm, CD_ORIGINDEX);
@@ -606,6 +654,65 @@ static void ss_sync_from_derivedmesh(CCGSubSurf *ss, DerivedMesh *dm,
 
 		((int *)ccgSubSurf_getVertUserData(ss, v))[1] = (index) ? *index++ : i;
 	}
+}
+
+/* Sync only vertex coordinates, topology must match (see ss_sync_topology_matches). */
+static void ss_sync_coords_from_derivedmesh(CCGSubSurf *ss, DerivedMesh *dm,
+                                            float (*vertexCos)[3])
+{
+	double start_time = 0.0;
+
+	if (G.debug & G_DEBUG) {
+		start_time = PIL_check_seconds_timer();
+	}
+
+	/* Only coordinates changed (deformed mesh, animation playback), keep
+	 * edges and faces and only subdivide the parts affected by moved
+	 * vertices, or evaluate the stencils when the subsurf uses them. */
+	ccgSubSurf_initPartialSync(ss);
+	ss_sync_verts_from_derivedmesh(ss, dm, vertexCos);
+	ccgSubSurf_processSync(ss);
+
+	if (G.debug & G_DEBUG) {
+		printf("%s: coordinates sync of %d vertices took %f sec%s\n",
+		       __func__, dm->getNumVerts(dm), PIL_check_seconds_timer() - start_time,
+		       ccgSubSurf_getUseStencils(ss) ? " (stencils enabled)" : "");
+	}
+}
+
+static void ss_sync_from_derivedmesh(CCGSubSurf *ss, DerivedMesh *dm,
+                                     float (*vertexCos)[3], int useFlatSubdiv)
+{
+	float creaseFactor = (float) ccgSubSurf_getSubdivisionLevels(ss);
+#ifndef USE_DYNSIZE
+	CCGVertHDL *fVerts = NULL;
+	BLI_array_declare(fVerts);
+#endif
+	MEdge *medge = dm->getEdgeArray(dm);
+	/* MFace *mface = dm->getTessFaceArray(dm); */ /* UNUSED */
+	MEdge *me;
+	MLoop *mloop = dm->getLoopArray(dm), *ml;
+	MPoly *mpoly = dm->getPolyArray(dm), *mp;
+	/*MFace *mf;*/ /*UNUSED*/
+	int totedge = dm->getNumEdges(dm);
+	/*int totface = dm->getNumTessFaces(dm);*/ /*UNUSED*/
+	/*int totpoly = dm->getNumFaces(dm);*/ /*UNUSED*/
+	int i, j;
+	int *index;
+	double start_time = 0.0;
+
+	if (ss_sync_topology_matches(ss, dm, useFlatSubdiv)) {
+		ss_sync_coords_from_derivedmesh(ss, dm, vertexCos);
+		return;
+	}
+
+	if (G.debug & G_DEBUG) {
+		start_time = PIL_check_seconds_timer();
+	}
+
+	ccgSubSurf_initFullSync(ss);
+
+	ss_sync_verts_from_derivedmesh(ss, dm, vertexCos);
 
 	me = medge;
 	index = (int *)dm->getEdgeDataArray(dm, CD_ORIGINDEX);
@@ -663,6 +770,11 @@ static void ss_sync_from_derivedmesh(CCGSubSurf *ss, DerivedMesh *dm,
 
 	ccgSubSurf_processSync(ss);
 
+	if (G.debug & G_DEBUG) {
+		printf("%s: full sync of %d vertices took %f sec\n",
+		       __func__, dm->getNumVerts(dm), PIL_check_seconds_timer() - start_time);
+	}
+
 #ifndef USE_DYNSIZE
 	BLI_array_free(fVerts);
 #endif
@@ -3963,6 +4075,21 @@ struct DerivedMesh *subsurf_make_derived_from_derived(
 			CCGFlags ccg_flags = useSimple | CCG_USE_ARENA | CCG_CALC_NORMALS;
 			
 			if (smd->mCache && (flags & SUBSURF_IS_FINAL_CALC)) {
+				/* Keep the previous subsurf when only vertex coordinates changed,
+				 * a full sync into its arena would leak the replaced elements. */
+				if (!(flags & SUBSURF_ALLOC_PAINT_MASK) &&
+				    ccgSubSurf_getUseStencils(smd->mCache) &&
+				    ccgSubSurf_getSubdivisionLevels(smd->mCache) == MAX2(levels, 1) &&
+				    ccgSubSurf_getSimpleSubdiv(smd->mCache) == !!useSimple &&
+				    ss_sync_topology_matches(smd->mCache, dm, useSimple))
+				{
+					ss_sync_coords_from_derivedmesh(smd->mCache, dm, vertCos);
+
+					return (DerivedMesh *)getCCGDerivedMesh(smd->mCache,
+					                                        drawInteriorEdges,
+					                                        useSubsurfUv, dm);
+				}
+
 				ccgSubSurf_free(smd->mCache);
 				smd->mCache = NULL;
 			}
@@ -3975,10 +4102,17 @@ struct DerivedMesh *subsurf_make_derived_from_derived(
 
 			result = getCCGDerivedMesh(ss, drawInteriorEdges, useSubsurfUv, dm);
 
-			if (flags & SUBSURF_IS_FINAL_CALC)
+			if (flags & SUBSURF_IS_FINAL_CALC) {
 				smd->mCache = ss;
-			else
+
+				/* following coordinate syncs (animation playback) reuse this
+				 * subsurf, evaluate them with stencils */
+				if (!(flags & SUBSURF_ALLOC_PAINT_MASK))
+					ccgSubSurf_setUseStencils(ss, 1);
+			}
+			else {
 				result->freeSS = 1;
+			}
 
 			if (flags & SUBSURF_ALLOC_PAINT_MASK)
 				ccgSubSurf_setNumLayers(ss, 4);
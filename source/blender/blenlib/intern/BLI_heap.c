@@ -235,6 +235,18 @@ void BLI_heap_remove(Heap *heap, HeapNode *node)
 	BLI_heap_popmin(heap);
 }
 
+void BLI_heap_node_value_update(Heap *heap, HeapNode *node, float value)
+{
+	if (value < node->value) {
+		node->value = value;
+		heap_up(heap, node->index);
+	}
+	else {
+		node->value = value;
+		heap_down(heap, node->index);
+	}
+}
+
 float BLI_heap_node_value(HeapNode *node)
 {
 	return node->value;
@@ -1023,6 +1023,16 @@ float BLI_bvhtree_getepsilon(const BVHTree *tree)
 	return tree->epsilon;
 }
 
+/* memory allocated for a tree with this many leafs, see BLI_bvhtree_new */
+size_t BLI_bvhtree_get_memory_size(const BVHTree *tree)
+{
+	const size_t numnodes = (size_t)(tree->totleaf + implicit_needed_branches(tree->tree_type, tree->totleaf) +
+	                                 tree->tree_type);
+
+	return sizeof(BVHTree) + numnodes * (sizeof(BVHNode *) + sizeof(float) * tree->axis +
+	                                     sizeof(BVHNode *) * tree->tree_type + sizeof(BVHNode));
+}
+
 
 /* -------------------------------------------------------------------- */
 /* BLI_bvhtree_overlap */
@@ -3909,6 +3909,7 @@ static void direct_link_particlesystems(FileData *fd, ListBase *particles)
 		
 		psys->tree = NULL;
 		psys->bvhtree = NULL;
+		psys->sphgrid = NULL;
 	}
 	return;
 }
@@ -191,10 +191,6 @@ static void bm_decim_build_edge_cost_single(BMEdge *e,
 	float optimize_co[3];
 	float cost;
 
-	if (eheap_table[BM_elem_index_get(e)]) {
-		BLI_heap_remove(eheap, eheap_table[BM_elem_index_get(e)]);
-	}
-
 	/* check we can collapse, some edges we better not touch */
 	if (BM_edge_is_boundary(e)) {
 		if (e->l->f->len == 3) {
@@ -202,8 +198,7 @@ static void bm_decim_build_edge_cost_single(BMEdge *e,
 		}
 		else {
 			/* only collapse tri's */
-			eheap_table[BM_elem_index_get(e)] = NULL;
-			return;
+			goto clear;
 		}
 	}
 	else if (BM_edge_is_manifold(e)) {
@@ -212,13 +207,11 @@ static void bm_decim_build_edge_cost_single(BMEdge *e,
 		}
 		else {
 			/* only collapse tri's */
-			eheap_table[BM_elem_index_get(e)] = NULL;
-			return;
+			goto clear;
 		}
 	}
 	else {
-		eheap_table[BM_elem_index_get(e)] = NULL;
-		return;
+		goto clear;
 	}
 
 	if (vweights) {
@@ -226,8 +219,7 @@ static void bm_decim_build_edge_cost_single(BMEdge *e,
 		    (vweights[BM_elem_index_get(e->v2)] >= BM_MESH_DECIM_WEIGHT_MAX))
 		{
 			/* skip collapsing this edge */
-			eheap_table[BM_elem_index_get(e)] = NULL;
-			return;
+			goto clear;
 		}
 	}
 	/* end sanity check */
@@ -252,7 +244,21 @@ static void bm_decim_build_edge_cost_single(BMEdge *e,
 	/* note, 'cost' shouldn't be negative but happens sometimes with small values.
 	 * this can cause faces that make up a flat surface to over-collapse, see [#37121] */
 	cost = fabsf(cost);
-	eheap_table[BM_elem_index_get(e)] = BLI_heap_insert(eheap, cost, e);
+
+	/* edges are updated far more often than added, update in place when possible */
+	if (eheap_table[BM_elem_index_get(e)]) {
+		BLI_heap_node_value_update(eheap, eheap_table[BM_elem_index_get(e)], cost);
+	}
+	else {
+		eheap_table[BM_elem_index_get(e)] = BLI_heap_insert(eheap, cost, e);
+	}
+	return;
+
+clear:
+	if (eheap_table[BM_elem_index_get(e)]) {
+		BLI_heap_remove(eheap, eheap_table[BM_elem_index_get(e)]);
+		eheap_table[BM_elem_index_get(e)] = NULL;
+	}
 }
 
 
@@ -306,6 +306,7 @@ typedef struct ParticleSystem {
 
 	struct KDTree *tree;					/* used for interactions with self and other systems */
 	struct BVHTree *bvhtree;				/* used for interactions with self and other systems */
+	struct SPHGrid *sphgrid;				/* uniform grid for SPH fluid neighbour search */
 
 	struct ParticleDrawData *pdd;
 
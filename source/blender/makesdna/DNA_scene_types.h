@@ -1341,6 +1341,7 @@ typedef struct Scene {
 #define R_SIMPLIFY			0x1000000
 #define R_EDGE_FRS			0x2000000 /* R_EDGE reserved for Freestyle */
 #define R_PERSISTENT_DATA	0x4000000 /* keep data around for re-render */
+#define R_THREADED_CONVERT	0x8000000 /* convert meshes to render data in parallel */
 
 /* seq_flag */
 #define R_SEQ_GL_PREV 1
@@ -5157,6 +5157,13 @@ static void rna_def_scene_render_data(BlenderRNA *brna)
 	RNA_def_property_ui_text(prop, "Persistent Data", "Keep render data around for faster re-renders");
 	RNA_def_property_update(prop, 0, "rna_Scene_use_persistent_data_update");
 
+	prop = RNA_def_property(srna, "use_threaded_conversion", PROP_BOOLEAN, PROP_NONE);
+	RNA_def_property_boolean_sdna(prop, NULL, "mode", R_THREADED_CONVERT);
+	RNA_def_property_ui_text(prop, "Threaded Conversion",
+	                         "Convert meshes to render data using multiple threads, "
+	                         "uses more memory while preparing the scene");
+	RNA_def_property_clear_flag(prop, PROP_ANIMATABLE);
+
 	/* Freestyle line thickness options */
 	prop = RNA_def_property(srna, "line_thickness_mode", PROP_ENUM, PROP_NONE);
 	RNA_def_property_enum_sdna(prop, NULL, "line_thickness_mode");
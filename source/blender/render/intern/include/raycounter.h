@@ -39,6 +39,19 @@
 extern "C" {
 #endif
 
+/* raytree build statistics, these are cheap to gather so always available */
+
+typedef struct RayBuildStats {
+	int totobject;			/* instanced object trees built */
+	int totprimitive;		/* primitives in the top level tree */
+	double object_time;		/* building object trees, wall clock time */
+	double object_cpu_time;	/* building object trees, summed over threads */
+	double tree_time;		/* building the top level tree */
+	double total_time;
+} RayBuildStats;
+
+void RE_RC_BUILD_INFO(RayBuildStats *stats);
+
 #ifdef RE_RAYCOUNTER
 
 /* ray counter functions */
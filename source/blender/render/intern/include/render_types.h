@@ -49,6 +49,7 @@
 #include "RE_pipeline.h"
 #include "RE_shader_ext.h"	/* TexResult, ShadeResult, ShadeInput */
 #include "sunsky.h"
+#include "raycounter.h"
 
 #include "BLI_sys_types.h" // for intptr_t support
 
@@ -114,6 +115,8 @@ typedef struct RenderPart {
 	short thread;					/* thread id */
 	
 	char *clipflag;					/* clipflags for part zbuffering */
+
+	double rendertime;				/* time spent rendering the part, for stats */
 } RenderPart;
 
 enum {
@@ -145,6 +148,8 @@ struct Render
 	 * write lock, all external code must use a read lock. internal code is assumed
 	 * to not conflict with writes, so no lock used for that */
 	ThreadRWMutex resultmutex;
+	/* with save buffers, writes finished tiles to the exr files */
+	struct ExrTileWriter *exrwriter;
 	
 	/* window size, display rect, viewplane */
 	int winx, winy;			/* buffer width and height with percentage applied
@@ -204,6 +209,7 @@ struct Render
 	struct RayFace *rayfaces;
 	struct VlakPrimitive *rayprimitives;
 	float maxdist; /* needed for keeping an incorrect behavior of SUN and HEMI lights (avoid breaking old scenes) */
+	RayBuildStats raybuild_stats;
 
 	/* occlusion tree */
 	void *occlusiontree;
@@ -221,6 +227,10 @@ struct Render
 	
 	ListBase objecttable;
 
+	/* objects being converted in threads, see database_init_objects */
+	struct TaskPool *convert_pool;
+	ListBase convert_jobs;
+
 	struct ObjectInstanceRen *objectinstance;
 	ListBase instancetable;
 	int totinstance;
@@ -333,6 +343,7 @@ typedef struct ObjectRen {
 	int  actmtface, actmcol, bakemtface;
 
 	float obmat[4][4];	/* only used in convertblender.c, for instancing */
+	struct RenderMeshConvert *convert;	/* only set while converted in a thread */
 
 	/* used on makeraytree */
 	struct RayObject *raytree;
@@ -42,6 +42,7 @@ struct ZSpan;
 struct APixstrand;
 struct APixstr;
 struct StrandShadeCache;
+struct rcti;
 
 void fillrect(int *rect, int x, int y, int val);
 
@@ -53,8 +54,8 @@ void projectvert(const float v1[3], float winmat[4][4], float adr[4]);
 void projectverto(const float v1[3], float winmat[4][4], float adr[4]);
 int testclip(const float v[3]);
 
-void zbuffer_shadow(struct Render *re, float winmat[4][4], struct LampRen *lar, int *rectz, int size, float jitx, float jity);
-void zbuffer_abuf_shadow(struct Render *re, struct LampRen *lar, float winmat[4][4], struct APixstr *APixbuf, struct APixstrand *apixbuf, struct ListBase *apsmbase, int size, int samples, float (*jit)[2]);
+void zbuffer_shadow(struct Render *re, float winmat[4][4], struct LampRen *lar, int *rectz, int size, const struct rcti *rect, float jitx, float jity);
+void zbuffer_abuf_shadow(struct Render *re, struct LampRen *lar, float winmat[4][4], struct APixstr *APixbuf, struct APixstrand *apixbuf, struct ListBase *apsmbase, int size, const struct rcti *rect, int samples, float (*jit)[2]);
 void zbuffer_solid(struct RenderPart *pa, struct RenderLayer *rl, void (*fillfunc)(struct RenderPart *, struct ZSpan *, int, void *), void *data);
 
 unsigned short *zbuffer_transp_shade(struct RenderPart *pa, struct RenderLayer *rl, float *pass, struct ListBase *psmlist);
@@ -30,9 +30,23 @@
  */
 
 
+#include <stdio.h>
+
 #include "rayobject.h"
 #include "raycounter.h"
 
+void RE_RC_BUILD_INFO(RayBuildStats *stats)
+{
+	printf("----------- Raytree build ----------\n");
+	printf("Object trees: %d\n", stats->totobject);
+	printf("Object trees time: %fs\n", stats->object_time);
+	printf("Object trees thread time: %fs\n", stats->object_cpu_time);
+	printf("Top level primitives: %d\n", stats->totprimitive);
+	printf("Top level tree time: %fs\n", stats->tree_time);
+	printf("Total time: %fs\n", stats->total_time);
+	printf("------------------------------------\n");
+}
+
 #ifdef RE_RAYCOUNTER
 
 void RE_RC_INFO(RayCounter *info)
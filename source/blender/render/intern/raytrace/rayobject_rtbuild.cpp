@@ -40,13 +40,57 @@
 #include "MEM_guardedalloc.h"
 
 #include "BLI_math.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 #include "BLI_utildefines.h"
 
+/* nodes with less primitives are sorted and split on a single thread,
+ * for those the overhead of tasks is larger than the gain */
+#define RTBUILD_PARALLEL_THRESHOLD 4096
+
+typedef void (*RTBuildAxisFunc)(void *userdata, int axis);
+
+struct RTBuildAxisTasks {
+	RTBuildAxisFunc func;
+	void *userdata;
+};
+
+static void rtbuild_axis_task(TaskPool *pool, void *taskdata, int UNUSED(threadid))
+{
+	RTBuildAxisTasks *tasks = (RTBuildAxisTasks *)BLI_task_pool_userdata(pool);
+	tasks->func(tasks->userdata, GET_INT_FROM_POINTER(taskdata));
+}
+
+/* run func for each of the three axes, in parallel if the node is large */
+static void rtbuild_foreach_axis(bool parallel, RTBuildAxisFunc func, void *userdata)
+{
+	if (!parallel) {
+		for (int axis = 0; axis < 3; axis++)
+			func(userdata, axis);
+		return;
+	}
+
+	RTBuildAxisTasks tasks = {func, userdata};
+	TaskPool *pool = BLI_task_pool_create(BLI_task_scheduler_get(), &tasks);
+
+	for (int axis = 0; axis < 3; axis++)
+		BLI_task_pool_push(pool, rtbuild_axis_task, SET_INT_IN_POINTER(axis), false, TASK_PRIORITY_HIGH);
+
+	BLI_task_pool_work_and_wait(pool);
+	BLI_task_pool_free(pool);
+}
+
 static bool selected_node(RTBuilder::Object *node)
 {
 	return node->selected;
 }
 
+static void rtbuild_partition_axis(void *userdata, int axis)
+{
+	RTBuilder *b = (RTBuilder *)userdata;
+	std::stable_partition(b->sorted_begin[axis], b->sorted_end[axis], selected_node);
+}
+
 static void rtbuild_init(RTBuilder *b)
 {
 	b->split_axis = -1;
@@ -153,16 +197,28 @@ static void object_sort(Item *begin, Item *end, int axis)
 	assert(false);
 }
 
-void rtbuild_done(RTBuilder *b, RayObjectControl *ctrl)
+struct RTBuildSort {
+	RTBuilder *b;
+	RayObjectControl *ctrl;
+};
+
+static void rtbuild_sort_axis(void *userdata, int axis)
 {
-	for (int i = 0; i < 3; i++) {
-		if (b->sorted_begin[i]) {
-			if (RE_rayobjectcontrol_test_break(ctrl)) break;
-			object_sort(b->sorted_begin[i], b->sorted_end[i], i);
-		}
+	RTBuildSort *data = (RTBuildSort *)userdata;
+	RTBuilder *b = data->b;
+
+	if (b->sorted_begin[axis]) {
+		if (RE_rayobjectcontrol_test_break(data->ctrl)) return;
+		object_sort(b->sorted_begin[axis], b->sorted_end[axis], axis);
 	}
 }
 
+void rtbuild_done(RTBuilder *b, RayObjectControl *ctrl)
+{
+	RTBuildSort data = {b, ctrl};
+	rtbuild_foreach_axis(rtbuild_size(b) >= RTBUILD_PARALLEL_THRESHOLD, rtbuild_sort_axis, &data);
+}
+
 RayObject *rtbuild_get_primitive(RTBuilder *b, int index)
 {
 	return b->sorted_begin[0][index]->obj;
@@ -321,6 +377,99 @@ struct SweepCost {
 	float cost;
 };
 
+struct RTBuildSplit {
+	RTBuilder *b;
+	int size;
+	bool parallel;
+	SweepCost *sweep;
+
+	/* best split found so far, when running serially it is used to stop
+	 * sweeping the next axes early */
+	float bound;
+
+	/* best split per axis */
+	float cost[3];
+	int offset[3];
+};
+
+static void rtbuild_heuristic_split_axis(void *userdata, int axis)
+{
+	RTBuildSplit *split = (RTBuildSplit *)userdata;
+	int size = split->size;
+	float bcost = split->bound;
+	int boffset = -1;
+
+	/* each axis needs its own sweep when running in parallel */
+	SweepCost *sweep = split->sweep + ((split->parallel) ? axis * size : 0);
+	SweepCost sweep_left;
+
+	RTBuilder::Object **obj = split->b->sorted_begin[axis];
+
+//	float right_cost = 0;
+	for (int i = size - 1; i >= 0; i--) {
+		if (i == size - 1) {
+			copy_v3_v3(sweep[i].bb, obj[i]->bb);
+			copy_v3_v3(sweep[i].bb + 3, obj[i]->bb + 3);
+			sweep[i].cost = obj[i]->cost;
+		}
+		else {
+			sweep[i].bb[0] = min_ff(obj[i]->bb[0], sweep[i + 1].bb[0]);
+			sweep[i].bb[1] = min_ff(obj[i]->bb[1], sweep[i + 1].bb[1]);
+			sweep[i].bb[2] = min_ff(obj[i]->bb[2], sweep[i + 1].bb[2]);
+			sweep[i].bb[3] = max_ff(obj[i]->bb[3], sweep[i + 1].bb[3]);
+			sweep[i].bb[4] = max_ff(obj[i]->bb[4], sweep[i + 1].bb[4]);
+			sweep[i].bb[5] = max_ff(obj[i]->bb[5], sweep[i + 1].bb[5]);
+			sweep[i].cost  = obj[i]->cost + sweep[i + 1].cost;
+		}
+//		right_cost += obj[i]->cost;
+	}
+	
+	sweep_left.bb[0] = obj[0]->bb[0];
+	sweep_left.bb[1] = obj[0]->bb[1];
+	sweep_left.bb[2] = obj[0]->bb[2];
+	sweep_left.bb[3] = obj[0]->bb[3];
+	sweep_left.bb[4] = obj[0]->bb[4];
+	sweep_left.bb[5] = obj[0]->bb[5];
+	sweep_left.cost  = obj[0]->cost;
+	
+//	right_cost -= obj[0]->cost;	if (right_cost < 0) right_cost = 0;
+
+	for (int i = 1; i < size; i++) {
+		//Worst case heuristic (cost of each child is linear)
+		float hcost, left_side, right_side;
+		
+		// not using log seems to have no impact on raytracing perf, but
+		// makes tree construction quicker, left out for now to test (brecht)
+		// left_side  = bb_area(sweep_left.bb, sweep_left.bb + 3) * (sweep_left.cost + logf((float)i));
+		// right_side = bb_area(sweep[i].bb,   sweep[i].bb   + 3) * (sweep[i].cost   + logf((float)size - i));
+		left_side = bb_area(sweep_left.bb, sweep_left.bb + 3) * (sweep_left.cost);
+		right_side = bb_area(sweep[i].bb, sweep[i].bb + 3) * (sweep[i].cost);
+		hcost = left_side + right_side;
+
+		assert(left_side >= 0);
+		assert(right_side >= 0);
+		
+		if (left_side > bcost) break;   //No way we can find a better heuristic in this axis
+
+		assert(hcost >= 0);
+		if (hcost < bcost) {
+			bcost = hcost;
+			boffset = i;
+		}
+		DO_MIN(obj[i]->bb,   sweep_left.bb);
+		DO_MAX(obj[i]->bb + 3, sweep_left.bb + 3);
+
+		sweep_left.cost += obj[i]->cost;
+//		right_cost -= obj[i]->cost; if (right_cost < 0) right_cost = 0;
+	}
+
+	split->cost[axis] = (boffset == -1) ? FLT_MAX : bcost;
+	split->offset[axis] = boffset;
+
+	if (!split->parallel && boffset != -1)
+		split->bound = bcost;
+}
+
 /* Object Surface Area Heuristic splitter */
 int rtbuild_heuristic_object_split(RTBuilder *b, int nchilds)
 {
@@ -330,83 +479,33 @@ int rtbuild_heuristic_object_split(RTBuilder *b, int nchilds)
 	int baxis = -1, boffset = 0;
 
 	if (size > nchilds) {
+		RTBuildSplit split;
 		float bcost = FLT_MAX;
 		baxis = -1, boffset = size / 2;
 
-		SweepCost *sweep = (SweepCost *)MEM_mallocN(sizeof(SweepCost) * size, "RTBuilder.HeuristicSweep");
-		
-		for (int axis = 0; axis < 3; axis++) {
-			SweepCost sweep_left;
+		split.b = b;
+		split.size = size;
+		split.parallel = (size >= RTBUILD_PARALLEL_THRESHOLD);
+		split.bound = FLT_MAX;
+		split.sweep = (SweepCost *)MEM_mallocN(sizeof(SweepCost) * size * ((split.parallel) ? 3 : 1), "RTBuilder.HeuristicSweep");
 
-			RTBuilder::Object **obj = b->sorted_begin[axis];
-			
-//			float right_cost = 0;
-			for (int i = size - 1; i >= 0; i--) {
-				if (i == size - 1) {
-					copy_v3_v3(sweep[i].bb, obj[i]->bb);
-					copy_v3_v3(sweep[i].bb + 3, obj[i]->bb + 3);
-					sweep[i].cost = obj[i]->cost;
-				}
-				else {
-					sweep[i].bb[0] = min_ff(obj[i]->bb[0], sweep[i + 1].bb[0]);
-					sweep[i].bb[1] = min_ff(obj[i]->bb[1], sweep[i + 1].bb[1]);
-					sweep[i].bb[2] = min_ff(obj[i]->bb[2], sweep[i + 1].bb[2]);
-					sweep[i].bb[3] = max_ff(obj[i]->bb[3], sweep[i + 1].bb[3]);
-					sweep[i].bb[4] = max_ff(obj[i]->bb[4], sweep[i + 1].bb[4]);
-					sweep[i].bb[5] = max_ff(obj[i]->bb[5], sweep[i + 1].bb[5]);
-					sweep[i].cost  = obj[i]->cost + sweep[i + 1].cost;
-				}
-//				right_cost += obj[i]->cost;
-			}
-			
-			sweep_left.bb[0] = obj[0]->bb[0];
-			sweep_left.bb[1] = obj[0]->bb[1];
-			sweep_left.bb[2] = obj[0]->bb[2];
-			sweep_left.bb[3] = obj[0]->bb[3];
-			sweep_left.bb[4] = obj[0]->bb[4];
-			sweep_left.bb[5] = obj[0]->bb[5];
-			sweep_left.cost  = obj[0]->cost;
-			
-//			right_cost -= obj[0]->cost;	if (right_cost < 0) right_cost = 0;
-
-			for (int i = 1; i < size; i++) {
-				//Worst case heuristic (cost of each child is linear)
-				float hcost, left_side, right_side;
-				
-				// not using log seems to have no impact on raytracing perf, but
-				// makes tree construction quicker, left out for now to test (brecht)
-				// left_side  = bb_area(sweep_left.bb, sweep_left.bb + 3) * (sweep_left.cost + logf((float)i));
-				// right_side = bb_area(sweep[i].bb,   sweep[i].bb   + 3) * (sweep[i].cost   + logf((float)size - i));
-				left_side = bb_area(sweep_left.bb, sweep_left.bb + 3) * (sweep_left.cost);
-				right_side = bb_area(sweep[i].bb, sweep[i].bb + 3) * (sweep[i].cost);
-				hcost = left_side + right_side;
-
-				assert(left_side >= 0);
-				assert(right_side >= 0);
-				
-				if (left_side > bcost) break;   //No way we can find a better heuristic in this axis
-
-				assert(hcost >= 0);
-				// this makes sure the tree built is the same whatever is the order of the sorting axis
-				if (hcost < bcost || (hcost == bcost && axis < baxis)) {
-					bcost = hcost;
-					baxis = axis;
-					boffset = i;
-				}
-				DO_MIN(obj[i]->bb,   sweep_left.bb);
-				DO_MAX(obj[i]->bb + 3, sweep_left.bb + 3);
-
-				sweep_left.cost += obj[i]->cost;
-//				right_cost -= obj[i]->cost; if (right_cost < 0) right_cost = 0;
+		rtbuild_foreach_axis(split.parallel, rtbuild_heuristic_split_axis, &split);
+
+		// this makes sure the tree built is the same whatever is the order of the sorting axis,
+		// and whether the axes were swept in parallel or not
+		for (int axis = 0; axis < 3; axis++) {
+			if (split.offset[axis] != -1 && split.cost[axis] < bcost) {
+				bcost = split.cost[axis];
+				baxis = axis;
+				boffset = split.offset[axis];
 			}
-			
-			//assert(baxis >= 0 && baxis < 3);
-			if (!(baxis >= 0 && baxis < 3))
-				baxis = 0;
 		}
 			
+		//assert(baxis >= 0 && baxis < 3);
+		if (!(baxis >= 0 && baxis < 3))
+			baxis = 0;
 		
-		MEM_freeN(sweep);
+		MEM_freeN(split.sweep);
 	}
 	else if (size == 2) {
 		baxis = 0;
@@ -426,8 +525,7 @@ int rtbuild_heuristic_object_split(RTBuilder *b, int nchilds)
 	/* Adjust sorted arrays for childs */
 	for (int i = 0; i < boffset; i++) b->sorted_begin[baxis][i]->selected = true;
 	for (int i = boffset; i < size; i++) b->sorted_begin[baxis][i]->selected = false;
-	for (int i = 0; i < 3; i++)
-		std::stable_partition(b->sorted_begin[i], b->sorted_end[i], selected_node);
+	rtbuild_foreach_axis(size >= RTBUILD_PARALLEL_THRESHOLD, rtbuild_partition_axis, b);
 
 	return nchilds;
 }
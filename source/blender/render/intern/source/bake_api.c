@@ -66,16 +66,21 @@
 #include "MEM_guardedalloc.h"
 
 #include "BLI_math.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 
 #include "DNA_mesh_types.h"
 
 #include "BKE_cdderivedmesh.h"
+#include "BKE_global.h"
 #include "BKE_image.h"
 #include "BKE_node.h"
 
 #include "IMB_imbuf_types.h"
 #include "IMB_imbuf.h"
 
+#include "PIL_time.h"
+
 #include "RE_bake.h"
 
 /* local include */
@@ -273,7 +278,7 @@ static void calc_barycentric_from_point(
 static bool cast_ray_highpoly(
         BVHTreeFromMesh *treeData, TriTessFace *triangles[], BakeHighPolyData *highpoly,
         const float co[3], const float dir[3], const int pixel_id, const int tot_highpoly,
-        const float du_dx, const float du_dy, const float dv_dx, const float dv_dy)
+        const float du_dx, const float du_dy, const float dv_dx, const float dv_dy, BVHTreeRayHit *hits)
 {
 	int i;
 	int primitive_id = -1;
@@ -281,9 +286,6 @@ static bool cast_ray_highpoly(
 	int hit_mesh = -1;
 	float hit_distance = FLT_MAX;
 
-	BVHTreeRayHit *hits;
-	hits = MEM_mallocN(sizeof(BVHTreeRayHit) * tot_highpoly, "Bake Highpoly to Lowpoly: BVH Rays");
-
 	for (i = 0; i < tot_highpoly; i++) {
 		float co_high[3], dir_high[3];
 
@@ -340,7 +342,6 @@ static bool cast_ray_highpoly(
 		}
 	}
 
-	MEM_freeN(hits);
 	return hit_mesh != -1;
 }
 
@@ -436,17 +437,95 @@ static void mesh_calc_tri_tessface(
 	BLI_assert(p_id < me->totface * 2);
 }
 
+/* pixels are cast in chunks, consecutive pixels are close together in the
+ * image and usually on the mesh too, so rays of a chunk traverse the same
+ * part of the highpoly trees */
+#define BAKE_RAYCAST_CHUNK_SIZE 4096
+
+typedef struct BakeRayCastData {
+	BakePixel *pixel_array_from;
+	BakeHighPolyData *highpoly;
+	int tot_highpoly;
+	size_t num_pixels;
+
+	BVHTreeFromMesh *treeData;
+	TriTessFace **tris_high;
+	TriTessFace *tris_low;
+	TriTessFace *tris_cage;
+
+	bool is_cage, is_custom_cage;
+	float cage_extrusion;
+	float (*mat_low)[4];
+	float (*mat_cage)[4];
+	float imat_low[4][4];
+} BakeRayCastData;
+
+static void bake_raycast_chunk(TaskPool *pool, void *taskdata, int UNUSED(threadid))
+{
+	BakeRayCastData *data = BLI_task_pool_userdata(pool);
+	BakePixel *pixel_array_from = data->pixel_array_from;
+	const size_t start = (size_t)GET_INT_FROM_POINTER(taskdata) * BAKE_RAYCAST_CHUNK_SIZE;
+	const size_t end = MIN2(start + BAKE_RAYCAST_CHUNK_SIZE, data->num_pixels);
+	BVHTreeRayHit *hits;
+	size_t i;
+
+	hits = MEM_mallocN(sizeof(BVHTreeRayHit) * data->tot_highpoly, "Bake Highpoly to Lowpoly: BVH Rays");
+
+	for (i = start; i < end; i++) {
+		float co[3];
+		float dir[3];
+		float u, v;
+		int primitive_id = pixel_array_from[i].primitive_id;
+
+		if (primitive_id == -1) {
+			int j;
+			for (j = 0; j < data->tot_highpoly; j++) {
+				data->highpoly[j].pixel_array[i].primitive_id = -1;
+			}
+			continue;
+		}
+
+		u = pixel_array_from[i].uv[0];
+		v = pixel_array_from[i].uv[1];
+
+		/* calculate from low poly mesh cage */
+		if (data->is_custom_cage) {
+			calc_point_from_barycentric_cage(data->tris_low, data->tris_cage, data->mat_low, data->mat_cage,
+			                                 primitive_id, u, v, co, dir);
+		}
+		else if (data->is_cage) {
+			calc_point_from_barycentric_extrusion(data->tris_cage, data->mat_low, data->imat_low, primitive_id,
+			                                      u, v, data->cage_extrusion, co, dir, true);
+		}
+		else {
+			calc_point_from_barycentric_extrusion(data->tris_low, data->mat_low, data->imat_low, primitive_id,
+			                                      u, v, data->cage_extrusion, co, dir, false);
+		}
+
+		/* cast ray */
+		if (!cast_ray_highpoly(data->treeData, data->tris_high, data->highpoly, co, dir, i, data->tot_highpoly,
+		                       pixel_array_from[i].du_dx, pixel_array_from[i].du_dy,
+		                       pixel_array_from[i].dv_dx, pixel_array_from[i].dv_dy, hits)) {
+			/* if it fails mask out the original pixel array */
+			pixel_array_from[i].primitive_id = -1;
+		}
+	}
+
+	MEM_freeN(hits);
+}
+
 bool RE_bake_pixels_populate_from_objects(
         struct Mesh *me_low, BakePixel pixel_array_from[],
         BakeHighPolyData highpoly[], const int tot_highpoly, const size_t num_pixels, const bool is_custom_cage,
         const float cage_extrusion, float mat_low[4][4], float mat_cage[4][4], struct Mesh *me_cage)
 {
 	size_t i;
-	int primitive_id;
-	float u, v;
-	float imat_low [4][4];
 	bool is_cage = me_cage != NULL;
 	bool result = true;
+	BakeRayCastData data;
+	TaskPool *task_pool;
+	double time;
+	int totchunk, chunk;
 
 	DerivedMesh *dm_low = NULL;
 	DerivedMesh **dm_highpoly;
@@ -481,7 +560,7 @@ bool RE_bake_pixels_populate_from_objects(
 		mesh_calc_tri_tessface(tris_cage, me_cage, false, NULL);
 	}
 
-	invert_m4_m4(imat_low, mat_low);
+	invert_m4_m4(data.imat_low, mat_low);
 
 	for (i = 0; i < tot_highpoly; i++) {
 		tris_high[i] = MEM_mallocN(sizeof(TriTessFace) * highpoly[i].me->totface, "MVerts Highpoly Mesh");
@@ -501,44 +580,38 @@ bool RE_bake_pixels_populate_from_objects(
 		}
 	}
 
-	for (i = 0; i < num_pixels; i++) {
-		float co[3];
-		float dir[3];
-
-		primitive_id = pixel_array_from[i].primitive_id;
-
-		if (primitive_id == -1) {
-			int j;
-			for (j = 0; j < tot_highpoly; j++) {
-				highpoly[j].pixel_array[i].primitive_id = -1;
-			}
-			continue;
-		}
-
-		u = pixel_array_from[i].uv[0];
-		v = pixel_array_from[i].uv[1];
+	data.pixel_array_from = pixel_array_from;
+	data.highpoly = highpoly;
+	data.tot_highpoly = tot_highpoly;
+	data.num_pixels = num_pixels;
+	data.treeData = treeData;
+	data.tris_high = tris_high;
+	data.tris_low = tris_low;
+	data.tris_cage = tris_cage;
+	data.is_cage = is_cage;
+	data.is_custom_cage = is_custom_cage;
+	data.cage_extrusion = cage_extrusion;
+	data.mat_low = mat_low;
+	data.mat_cage = mat_cage;
+
+	time = PIL_check_seconds_timer();
+
+	task_pool = BLI_task_pool_create(BLI_task_scheduler_get(), &data);
+
+	totchunk = (int)((num_pixels + BAKE_RAYCAST_CHUNK_SIZE - 1) / BAKE_RAYCAST_CHUNK_SIZE);
+	for (chunk = 0; chunk < totchunk; chunk++) {
+		BLI_task_pool_push(task_pool, bake_raycast_chunk, SET_INT_IN_POINTER(chunk), false, TASK_PRIORITY_HIGH);
+	}
 
-		/* calculate from low poly mesh cage */
-		if (is_custom_cage) {
-			calc_point_from_barycentric_cage(tris_low, tris_cage, mat_low, mat_cage, primitive_id, u, v, co, dir);
-		}
-		else if (is_cage) {
-			calc_point_from_barycentric_extrusion(tris_cage, mat_low, imat_low, primitive_id, u, v, cage_extrusion, co, dir, true);
-		}
-		else {
-			calc_point_from_barycentric_extrusion(tris_low, mat_low, imat_low, primitive_id, u, v, cage_extrusion, co, dir, false);
-		}
+	BLI_task_pool_work_and_wait(task_pool);
+	BLI_task_pool_free(task_pool);
 
-		/* cast ray */
-		if (!cast_ray_highpoly(treeData, tris_high, highpoly, co, dir, i, tot_highpoly,
-		                       pixel_array_from[i].du_dx, pixel_array_from[i].du_dy,
-		                       pixel_array_from[i].dv_dx, pixel_array_from[i].dv_dy)) {
-			/* if it fails mask out the original pixel array */
-			pixel_array_from[i].primitive_id = -1;
-		}
+	if (G.debug & G_DEBUG) {
+		time = PIL_check_seconds_timer() - time;
+		printf("Baking: cast rays for %lu pixels to %d objects in %.2fs, %.0f pixels/s\n",
+		       (unsigned long)num_pixels, tot_highpoly, time, (time > 0.0) ? num_pixels / time : 0.0);
 	}
 
-
 	/* garbage collection */
 cleanup:
 	for (i = 0; i < tot_highpoly; i++) {
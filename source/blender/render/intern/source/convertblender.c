@@ -40,6 +40,8 @@
 #include "BLI_utildefines.h"
 #include "BLI_rand.h"
 #include "BLI_memarena.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 #ifdef WITH_FREESTYLE
 #  include "BLI_edgehash.h"
 #endif
@@ -3084,40 +3086,54 @@ static bool has_freestyle_edge_mark(EdgeHash *edge_hash, int v1, int v2)
 }
 #endif
 
-static void init_render_mesh(Render *re, ObjectRen *obr, int timeoffset)
+/* Mesh conversion is split in two parts: preparing reads the Blender data
+ * and creates the derived mesh, converting fills in the render vertices
+ * and faces of the object. With threaded conversion only the first part
+ * runs on the main thread, see init_render_mesh() */
+typedef struct RenderMeshConvert {
+	struct RenderMeshConvert *next, *prev;
+	ObjectRen *obr;
+
+	DerivedMesh *dm;
+	Material **materials;	/* per material slot, at least one */
+	float mat[4][4], imat[3][3];
+	float *orco;
+	int totvert, timeoffset, negative_scale;
+	bool need_stress, need_tangent, need_nmap_tangent, need_origindex;
+	bool do_autosmooth, do_displace, use_original_normals;
+	bool is_animated, threaded;
+
+	/* results of threaded conversion, applied when all objects are done */
+	float smoothresh;
+	bool finalized;
+	int totadd;
+	double prepare_time, convert_time;
+} RenderMeshConvert;
+
+static bool init_render_mesh_prepare(Render *re, ObjectRen *obr, int timeoffset, RenderMeshConvert *conv)
 {
 	Object *ob= obr->ob;
 	Mesh *me;
-	MVert *mvert = NULL;
-	MFace *mface;
-	VlakRen *vlr; //, *vlr1;
-	VertRen *ver;
 	Material *ma;
 	DerivedMesh *dm;
 	CustomDataMask mask;
-	float xn, yn, zn,  imat[3][3], mat[4][4];  //nor[3],
 	float *orco = NULL;
-	short (*loop_nors)[4][3] = NULL;
 	bool need_orco = false, need_stress = false, need_nmap_tangent = false, need_tangent = false, need_origindex = false;
-	int a, a1, ok, vertofs;
-	int end, totvert = 0;
+	int a, totcol;
 	bool do_autosmooth = false, do_displace = false;
-	bool use_original_normals = false;
-	int recalc_normals = 0;	/* false by default */
-	int negative_scale;
-#ifdef WITH_FREESTYLE
-	FreestyleFace *ffa;
-#endif
+
+	memset(conv, 0, sizeof(*conv));
+	conv->obr= obr;
 
 	me= ob->data;
 
-	mul_m4_m4m4(mat, re->viewmat, ob->obmat);
-	invert_m4_m4(ob->imat, mat);
-	copy_m3_m4(imat, ob->imat);
-	negative_scale= is_negative_m4(mat);
+	mul_m4_m4m4(conv->mat, re->viewmat, ob->obmat);
+	invert_m4_m4(ob->imat, conv->mat);
+	copy_m3_m4(conv->imat, ob->imat);
+	conv->negative_scale= is_negative_m4(conv->mat);
 
 	if (me->totvert==0)
-		return;
+		return false;
 	
 	need_orco= 0;
 	for (a=1; a<=ob->totcol; a++) {
@@ -3177,7 +3193,7 @@ static void init_render_mesh(Render *re, ObjectRen *obr, int timeoffset)
 		dm= mesh_create_derived_view(re->scene, ob, mask);
 	else
 		dm= mesh_create_derived_render(re->scene, ob, mask);
-	if (dm==NULL) return;	/* in case duplicated object fails? */
+	if (dm==NULL) return false;	/* in case duplicated object fails? */
 
 	if (mask & CD_MASK_ORCO) {
 		orco = get_object_orco(re, ob);
@@ -3190,15 +3206,84 @@ static void init_render_mesh(Render *re, ObjectRen *obr, int timeoffset)
 		}
 	}
 
-	mvert= dm->getVertArray(dm);
-	totvert= dm->getNumVerts(dm);
+	conv->totvert= dm->getNumVerts(dm);
 
 	/* attempt to autsmooth on original mesh, only without subsurf */
-	if (do_autosmooth && me->totvert==totvert && me->totface==dm->getNumTessFaces(dm))
-		use_original_normals= true;
-	
-	ma= give_render_material(re, ob, 1);
+	if (do_autosmooth && me->totvert==conv->totvert && me->totface==dm->getNumTessFaces(dm))
+		conv->use_original_normals= true;
 
+	/* look up materials here, this sets flags on them and the render */
+	totcol= max_ii(ob->totcol, 1);
+	conv->materials= MEM_mallocN(sizeof(Material *) * totcol, "render mesh materials");
+	for (a=0; a<totcol; a++)
+		conv->materials[a]= give_render_material(re, ob, a+1);
+	ma= conv->materials[0];
+
+	if (!timeoffset && ma->material_type != MA_TYPE_HALO) {
+		/* store customdata names, because DerivedMesh is freed */
+		RE_set_customdata_names(obr, &dm->faceData);
+
+		/* add tangent layer if we need one */
+		if (need_nmap_tangent!=0 && CustomData_get_layer_index(&dm->faceData, CD_TANGENT) == -1)
+			DM_add_tangent_layer(dm);
+	}
+
+	/* for finalizing, and to be sure the texture space is computed before threads read it */
+	if (!timeoffset) {
+		conv->is_animated= BKE_object_is_animated(re->scene, ob);
+		if (need_stress)
+			BKE_mesh_texspace_get(me, NULL, NULL, NULL);
+	}
+
+	conv->dm= dm;
+	conv->orco= orco;
+	conv->timeoffset= timeoffset;
+	conv->need_stress= need_stress;
+	conv->need_tangent= need_tangent;
+	conv->need_nmap_tangent= need_nmap_tangent;
+	conv->need_origindex= need_origindex;
+	conv->do_autosmooth= do_autosmooth;
+	conv->do_displace= do_displace;
+
+	/* halos, displacement and stress (which edits orco shared between
+	 * instances) use data of other objects and the render, and particle
+	 * systems render with the emitter afterwards, so those stay serial */
+	conv->threaded= (!timeoffset && !do_displace && !need_stress &&
+	                 ma->material_type != MA_TYPE_HALO && ob->particlesystem.first == NULL);
+
+	return true;
+}
+
+/* frees the derived mesh and materials of conv */
+static void init_render_mesh_convert(Render *re, ObjectRen *obr, RenderMeshConvert *conv)
+{
+	Object *ob= obr->ob;
+	Mesh *me= ob->data;
+	DerivedMesh *dm= conv->dm;
+	MVert *mvert;
+	MFace *mface;
+	VlakRen *vlr; //, *vlr1;
+	VertRen *ver;
+	Material *ma;
+	float xn, yn, zn;  //nor[3],
+	float (*mat)[4]= conv->mat, (*imat)[3]= conv->imat;
+	float *orco= conv->orco;
+	short (*loop_nors)[4][3] = NULL;
+	const bool need_stress= conv->need_stress, need_tangent= conv->need_tangent;
+	const bool need_nmap_tangent= conv->need_nmap_tangent, need_origindex= conv->need_origindex;
+	const bool do_autosmooth= conv->do_autosmooth, do_displace= conv->do_displace;
+	const bool use_original_normals= conv->use_original_normals;
+	const int timeoffset= conv->timeoffset, negative_scale= conv->negative_scale;
+	int a, a1, ok, vertofs;
+	int end, totvert= conv->totvert;
+	int recalc_normals = 0;	/* false by default */
+#ifdef WITH_FREESTYLE
+	FreestyleFace *ffa;
+#endif
+
+	mvert= dm->getVertArray(dm);
+	
+	ma= conv->materials[0];
 
 	if (ma->material_type == MA_TYPE_HALO) {
 		make_render_halos(re, obr, me, totvert, mvert, ma, orco);
@@ -3254,20 +3339,13 @@ static void init_render_mesh(Render *re, ObjectRen *obr, int timeoffset)
 			edge_hash = make_freestyle_edge_mark_hash(dm);
 #endif
 
-			/* store customdata names, because DerivedMesh is freed */
-			RE_set_customdata_names(obr, &dm->faceData);
-
-			/* add tangent layer if we need one */
-			if (need_nmap_tangent!=0 && CustomData_get_layer_index(&dm->faceData, CD_TANGENT) == -1)
-				DM_add_tangent_layer(dm);
-			
 			/* still to do for keys: the correct local texture coordinate */
 
 			/* faces in order of color blocks */
 			vertofs= obr->totvert - totvert;
 			for (a1=0; (a1<ob->totcol || (a1==0 && ob->totcol==0)); a1++) {
 
-				ma= give_render_material(re, ob, a1+1);
+				ma= conv->materials[a1];
 				
 				/* test for 100% transparent */
 				ok = 1;
@@ -3457,7 +3535,7 @@ static void init_render_mesh(Render *re, ObjectRen *obr, int timeoffset)
 			/* exception... we do edges for wire mode. potential conflict when faces exist... */
 			end= dm->getNumEdges(dm);
 			mvert= dm->getVertArray(dm);
-			ma= give_render_material(re, ob, 1);
+			ma= conv->materials[0];
 			if (end && (ma->material_type == MA_TYPE_WIRE)) {
 				MEdge *medge;
 				struct edgesort *edgetable;
@@ -3522,6 +3600,7 @@ static void init_render_mesh(Render *re, ObjectRen *obr, int timeoffset)
 	}
 
 	MEM_SAFE_FREE(loop_nors);
+	MEM_freeN(conv->materials);
 
 	dm->release(dm);
 }
@@ -4047,7 +4126,7 @@ void init_render_world(Render *re)
 /* ------------------------------------------------------------------------- */
 
 /* prevent phong interpolation for giving ray shadow errors (terminator problem) */
-static void set_phong_threshold(ObjectRen *obr)
+static void set_phong_threshold(ObjectRen *obr, float *r_smoothresh)
 {
 //	VertRen *ver;
 	VlakRen *vlr;
@@ -4090,7 +4169,7 @@ static void set_phong_threshold(ObjectRen *obr)
 	
 	if (tot) {
 		thresh/= (float)tot;
-		obr->ob->smoothresh= cosf(0.5f*(float)M_PI-saacos(thresh));
+		*r_smoothresh= cosf(0.5f*(float)M_PI-saacos(thresh));
 	}
 }
 
@@ -4332,15 +4411,78 @@ static void check_non_flat_quads(ObjectRen *obr)
 	}
 }
 
-static void finalize_render_object(Render *re, ObjectRen *obr, int timeoffset)
+/* only touches obr itself, so it can run in a thread for meshes */
+static void finalize_render_object_geometry(Render *re, ObjectRen *obr, bool is_animated, float *r_smoothresh)
 {
-	Object *ob= obr->ob;
 	VertRen *ver= NULL;
 	StrandRen *strand= NULL;
 	StrandBound *sbound= NULL;
 	float min[3], max[3], smin[3], smax[3];
 	int a, b;
 
+	/* phong normal interpolation can cause error in tracing
+	 * (terminator problem) */
+	if ((re->r.mode & R_RAYTRACE) && (re->r.mode & R_SHADOW))
+		set_phong_threshold(obr, r_smoothresh);
+	
+	if (re->flag & R_BAKING && re->r.bake_quad_split != 0) {
+		/* Baking lets us define a quad split order */
+		split_quads(obr, re->r.bake_quad_split);
+	}
+	else if (is_animated)
+		split_quads(obr, 1);
+	else {
+		if ((re->r.mode & R_SIMPLIFY && re->r.simplify_flag & R_SIMPLE_NO_TRIANGULATE) == 0)
+			check_non_flat_quads(obr);
+	}
+	
+	set_fullsample_trace_flag(re, obr);
+
+	/* compute bounding boxes for clipping */
+	INIT_MINMAX(min, max);
+	for (a=0; a<obr->totvert; a++) {
+		if ((a & 255)==0) ver= obr->vertnodes[a>>8].vert;
+		else ver++;
+
+		minmax_v3v3_v3(min, max, ver->co);
+	}
+
+	if (obr->strandbuf) {
+		float width;
+		
+		/* compute average bounding box of strandpoint itself (width) */
+		if (obr->strandbuf->flag & R_STRAND_B_UNITS)
+			obr->strandbuf->maxwidth = max_ff(obr->strandbuf->ma->strand_sta, obr->strandbuf->ma->strand_end);
+		else
+			obr->strandbuf->maxwidth= 0.0f;
+		
+		width= obr->strandbuf->maxwidth;
+		sbound= obr->strandbuf->bound;
+		for (b=0; b<obr->strandbuf->totbound; b++, sbound++) {
+			
+			INIT_MINMAX(smin, smax);
+
+			for (a=sbound->start; a<sbound->end; a++) {
+				strand= RE_findOrAddStrand(obr, a);
+				strand_minmax(strand, smin, smax, width);
+			}
+
+			copy_v3_v3(sbound->boundbox[0], smin);
+			copy_v3_v3(sbound->boundbox[1], smax);
+
+			minmax_v3v3_v3(min, max, smin);
+			minmax_v3v3_v3(min, max, smax);
+		}
+	}
+
+	copy_v3_v3(obr->boundbox[0], min);
+	copy_v3_v3(obr->boundbox[1], max);
+}
+
+static void finalize_render_object(Render *re, ObjectRen *obr, int timeoffset)
+{
+	Object *ob= obr->ob;
+
 	if (obr->totvert || obr->totvlak || obr->tothalo || obr->totstrand) {
 		/* the exception below is because displace code now is in init_render_mesh call, 
 		 * I will look at means to have autosmooth enabled for all object types
@@ -4349,66 +4491,116 @@ static void finalize_render_object(Render *re, ObjectRen *obr, int timeoffset)
 			displace(re, obr);
 	
 		if (!timeoffset) {
-			/* phong normal interpolation can cause error in tracing
-			 * (terminator problem) */
 			ob->smoothresh= 0.0;
-			if ((re->r.mode & R_RAYTRACE) && (re->r.mode & R_SHADOW))
-				set_phong_threshold(obr);
-			
-			if (re->flag & R_BAKING && re->r.bake_quad_split != 0) {
-				/* Baking lets us define a quad split order */
-				split_quads(obr, re->r.bake_quad_split);
-			}
-			else if (BKE_object_is_animated(re->scene, ob))
-				split_quads(obr, 1);
-			else {
-				if ((re->r.mode & R_SIMPLIFY && re->r.simplify_flag & R_SIMPLE_NO_TRIANGULATE) == 0)
-					check_non_flat_quads(obr);
-			}
-			
-			set_fullsample_trace_flag(re, obr);
+			finalize_render_object_geometry(re, obr, BKE_object_is_animated(re->scene, ob), &ob->smoothresh);
+		}
+	}
+}
 
-			/* compute bounding boxes for clipping */
-			INIT_MINMAX(min, max);
-			for (a=0; a<obr->totvert; a++) {
-				if ((a & 255)==0) ver= obr->vertnodes[a>>8].vert;
-				else ver++;
+/* ------------------------------------------------------------------------- */
+/* Threaded Conversion														 */
+/* ------------------------------------------------------------------------- */
 
-				minmax_v3v3_v3(min, max, ver->co);
-			}
+static void render_mesh_convert_task(TaskPool *pool, void *taskdata, int UNUSED(threadid))
+{
+	Render *re= BLI_task_pool_userdata(pool);
+	RenderMeshConvert *conv= taskdata;
+	ObjectRen *obr= conv->obr;
+	double time= PIL_check_seconds_timer();
 
-			if (obr->strandbuf) {
-				float width;
-				
-				/* compute average bounding box of strandpoint itself (width) */
-				if (obr->strandbuf->flag & R_STRAND_B_UNITS)
-					obr->strandbuf->maxwidth = max_ff(obr->strandbuf->ma->strand_sta, obr->strandbuf->ma->strand_end);
-				else
-					obr->strandbuf->maxwidth= 0.0f;
-				
-				width= obr->strandbuf->maxwidth;
-				sbound= obr->strandbuf->bound;
-				for (b=0; b<obr->strandbuf->totbound; b++, sbound++) {
-					
-					INIT_MINMAX(smin, smax);
+	init_render_mesh_convert(re, obr, conv);
 
-					for (a=sbound->start; a<sbound->end; a++) {
-						strand= RE_findOrAddStrand(obr, a);
-						strand_minmax(strand, smin, smax, width);
-					}
+	if (obr->totvert || obr->totvlak) {
+		finalize_render_object_geometry(re, obr, conv->is_animated, &conv->smoothresh);
+		conv->finalized= true;
+	}
 
-					copy_v3_v3(sbound->boundbox[0], smin);
-					copy_v3_v3(sbound->boundbox[1], smax);
+	conv->convert_time= PIL_check_seconds_timer() - time;
+}
 
-					minmax_v3v3_v3(min, max, smin);
-					minmax_v3v3_v3(min, max, smax);
-				}
-			}
+/* with threaded conversion the mesh is converted and finalized in a task,
+ * and obr->convert is set until render_mesh_convert_flush() */
+static void init_render_mesh(Render *re, ObjectRen *obr, int timeoffset)
+{
+	RenderMeshConvert conv, *job;
+	double time= PIL_check_seconds_timer();
+
+	if (!init_render_mesh_prepare(re, obr, timeoffset, &conv))
+		return;
+
+	if (re->convert_pool && conv.threaded) {
+		job= MEM_mallocN(sizeof(RenderMeshConvert), "RenderMeshConvert");
+		*job= conv;
+		job->prepare_time= PIL_check_seconds_timer() - time;
+
+		obr->convert= job;
+		BLI_addtail(&re->convert_jobs, job);
+		BLI_task_pool_push(re->convert_pool, render_mesh_convert_task, job, false, TASK_PRIORITY_HIGH);
+	}
+	else
+		init_render_mesh_convert(re, obr, &conv);
+}
 
-			copy_v3_v3(obr->boundbox[0], min);
-			copy_v3_v3(obr->boundbox[1], max);
+static void add_render_object_totals(Render *re, ObjectRen *obr)
+{
+	/* still being converted, added once done */
+	if (obr->convert) {
+		obr->convert->totadd++;
+		return;
+	}
+
+	re->totvert += obr->totvert;
+	re->totvlak += obr->totvlak;
+	re->tothalo += obr->tothalo;
+	re->totstrand += obr->totstrand;
+}
+
+/* wait for all objects to be converted and add them to the totals */
+static void render_mesh_convert_flush(Render *re)
+{
+	RenderMeshConvert *conv;
+	double time, prepare_time= 0.0, convert_time= 0.0;
+	int a, totjob= 0;
+
+	if (re->convert_pool == NULL)
+		return;
+
+	time= PIL_check_seconds_timer();
+
+	BLI_task_pool_work_and_wait(re->convert_pool);
+	BLI_task_pool_free(re->convert_pool);
+	re->convert_pool= NULL;
+
+	time= PIL_check_seconds_timer() - time;
+
+	for (conv= re->convert_jobs.first; conv; conv= conv->next) {
+		ObjectRen *obr= conv->obr;
+
+		obr->convert= NULL;
+
+		/* same as finalize_render_object, last one converted wins */
+		if (conv->finalized)
+			obr->ob->smoothresh= conv->smoothresh;
+
+		for (a=0; a<conv->totadd; a++)
+			add_render_object_totals(re, obr);
+
+		if (G.debug & G_DEBUG) {
+			printf("Converted %s: %d vertices, %d faces, prepare %.3fs, convert %.3fs\n",
+			       obr->ob->id.name + 2, obr->totvert, obr->totvlak, conv->prepare_time, conv->convert_time);
 		}
+
+		prepare_time += conv->prepare_time;
+		convert_time += conv->convert_time;
+		totjob++;
 	}
+
+	if (G.debug & G_DEBUG) {
+		printf("Threaded conversion of %d meshes: prepare %.3fs, convert %.3fs, waited %.3fs\n",
+		       totjob, prepare_time, convert_time, time);
+	}
+
+	BLI_freelistN(&re->convert_jobs);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -4451,12 +4643,8 @@ static void find_dupli_instances(Render *re, ObjectRen *obr, DupliObject *dob)
 				obi->dupliuv[1]= dob->uv[1];
 			}
 
-			if (!first) {
-				re->totvert += obr->totvert;
-				re->totvlak += obr->totvlak;
-				re->tothalo += obr->tothalo;
-				re->totstrand += obr->totstrand;
-			}
+			if (!first)
+				add_render_object_totals(re, obr);
 			else
 				first= 0;
 		}
@@ -4487,10 +4675,7 @@ static void assign_dupligroup_dupli(Render *re, ObjectInstanceRen *obi, ObjectRe
 		obi->dupliuv[1]= dob->uv[1];
 	}
 
-	re->totvert += obr->totvert;
-	re->totvlak += obr->totvlak;
-	re->tothalo += obr->tothalo;
-	re->totstrand += obr->totstrand;
+	add_render_object_totals(re, obr);
 }
 
 static ObjectRen *find_dupligroup_dupli(Render *re, Object *ob, int psysindex)
@@ -4590,12 +4775,11 @@ static void init_render_object_data(Render *re, ObjectRen *obr, int timeoffset)
 			init_render_mball(re, obr);
 	}
 
-	finalize_render_object(re, obr, timeoffset);
+	/* threaded conversion finalizes itself */
+	if (obr->convert == NULL)
+		finalize_render_object(re, obr, timeoffset);
 
-	re->totvert += obr->totvert;
-	re->totvlak += obr->totvlak;
-	re->tothalo += obr->tothalo;
-	re->totstrand += obr->totstrand;
+	add_render_object_totals(re, obr);
 }
 
 static void add_render_object(Render *re, Object *ob, Object *par, DupliObject *dob, float omat[4][4], int timeoffset)
@@ -4938,6 +5122,10 @@ static void database_init_objects(Render *re, unsigned int renderlay, int nolamp
 	 * NULL is just for init */
 	set_dupli_tex_mat(NULL, NULL, NULL, NULL);
 
+	/* meshes are converted in tasks while we go over the objects */
+	if ((re->r.mode & R_THREADED_CONVERT) && !timeoffset)
+		re->convert_pool= BLI_task_pool_create(BLI_task_scheduler_get(), re);
+
 	/* loop over all objects rather then using SETLOOPER because we may
 	 * reference an mtex-mapped object which isn't rendered or is an
 	 * empty in a dupli group. We could scan all render material/lamp/world
@@ -5105,6 +5293,8 @@ static void database_init_objects(Render *re, unsigned int renderlay, int nolamp
 	for (group= re->main->group.first; group; group=group->id.next)
 		add_group_render_dupli_obs(re, group, nolamps, onlyselected, actob, timeoffset, 0);
 
+	render_mesh_convert_flush(re);
+
 	if (!re->test_break(re->tbh))
 		RE_makeRenderInstances(re);
 }
@@ -34,6 +34,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include "MEM_guardedalloc.h"
 
 #include "DNA_material_types.h"
@@ -45,9 +49,12 @@
 
 #include "BLF_translation.h"
 
+#include "BKE_global.h"
 #include "BKE_node.h"
 #include "BKE_scene.h"
 
+#include "PIL_time.h"
+
 
 #include "RE_shader_ext.h"
 
@@ -93,6 +100,27 @@ typedef struct OccNode {
 	} child[TOTCHILD];
 } OccNode;
 
+/* Copy of the tree in one array for lookups of 4 receivers at once. The
+ * child nodes of a node are stored next to each other, and face children
+ * are stored as -(face + 1). */
+typedef struct OccFlatNode {
+	float co[3], area;
+	float sh[9], dco;
+	float occlusion, rad[3];
+	int totchild;
+	int child[TOTCHILD];
+} OccFlatNode;
+
+typedef struct OccFlatStack {
+	int node;
+	int mask;	/* receivers that still traverse the node */
+} OccFlatStack;
+
+typedef struct OcclusionStats {
+	int totlookup, totlookup_4;
+	double time, time_4;
+} OcclusionStats;
+
 typedef struct OcclusionTree {
 	MemArena *arena;
 
@@ -107,6 +135,12 @@ typedef struct OcclusionTree {
 	OccNode **stack[BLENDER_MAX_THREADS];
 	int maxdepth;
 
+	OccFlatNode *flatnodes;
+	OccFlatStack *flatstack[BLENDER_MAX_THREADS];
+	int totflatnode;
+
+	OcclusionStats stats[BLENDER_MAX_THREADS];
+
 	int totface;
 
 	float error;
@@ -746,9 +780,13 @@ static void occ_free_tree(OcclusionTree *tree)
 
 	if (tree) {
 		if (tree->arena) BLI_memarena_free(tree->arena);
-		for (a = 0; a < BLENDER_MAX_THREADS; a++)
+		for (a = 0; a < BLENDER_MAX_THREADS; a++) {
 			if (tree->stack[a])
 				MEM_freeN(tree->stack[a]);
+			if (tree->flatstack[a])
+				MEM_freeN(tree->flatstack[a]);
+		}
+		if (tree->flatnodes) MEM_freeN(tree->flatnodes);
 		if (tree->occlusion) MEM_freeN(tree->occlusion);
 		if (tree->cache) MEM_freeN(tree->cache);
 		if (tree->face) MEM_freeN(tree->face);
@@ -757,6 +795,65 @@ static void occ_free_tree(OcclusionTree *tree)
 	}
 }
 
+static int occ_count_nodes(OccNode *node)
+{
+	int b, totnode = 1;
+
+	for (b = 0; b < TOTCHILD; b++)
+		if (!(node->childflag & (1 << b)) && node->child[b].node)
+			totnode += occ_count_nodes(node->child[b].node);
+
+	return totnode;
+}
+
+static void occ_flatten_node(OcclusionTree *tree, OccNode *node, int index)
+{
+	OccFlatNode *flat = &tree->flatnodes[index];
+	OccNode *children[TOTCHILD];
+	int b, totnode = 0, first;
+
+	copy_v3_v3(flat->co, node->co);
+	flat->area = node->area;
+	memcpy(flat->sh, node->sh, sizeof(flat->sh));
+	flat->dco = node->dco;
+	flat->occlusion = node->occlusion;
+	copy_v3_v3(flat->rad, node->rad);
+	flat->totchild = 0;
+
+	for (b = 0; b < TOTCHILD; b++) {
+		if (node->childflag & (1 << b))
+			flat->child[flat->totchild++] = -(node->child[b].face + 1);
+		else if (node->child[b].node)
+			children[totnode++] = node->child[b].node;
+	}
+
+	/* reserve child nodes next to each other */
+	first = tree->totflatnode;
+	tree->totflatnode += totnode;
+
+	for (b = 0; b < totnode; b++) {
+		flat->child[flat->totchild++] = first + b;
+		occ_flatten_node(tree, children[b], first + b);
+	}
+}
+
+/* must be done again when occlusion or radiance of nodes change */
+static void occ_tree_flatten(OcclusionTree *tree)
+{
+	int a, totnode = occ_count_nodes(tree->root);
+
+	if (tree->flatnodes)
+		MEM_freeN(tree->flatnodes);
+
+	tree->flatnodes = MEM_mallocN(sizeof(OccFlatNode) * totnode, "OccFlatNodes");
+	tree->totflatnode = 1;
+	occ_flatten_node(tree, tree->root, 0);
+
+	for (a = 0; a < BLENDER_MAX_THREADS; a++)
+		if (!tree->flatstack[a])
+			tree->flatstack[a] = MEM_mallocN(sizeof(OccFlatStack) * TOTCHILD * (tree->maxdepth + 1), "OccFlatStack");
+}
+
 /* ------------------------- Traversal --------------------------- */
 
 static float occ_solid_angle(OccNode *node, const float v[3], float d2, float invd2, const float receivenormal[3])
@@ -810,14 +907,52 @@ static float occ_form_factor(OccFace *face, float *p, float *n)
 	return contrib;
 }
 
+/* accumulate occlusion with face form factor */
+static void occ_lookup_face(OcclusionTree *tree, int f, const OccFace *exclude, const float p[3], const float n[3],
+                            float *resultocc, float resultrad[3], float bentn[3])
+{
+	OccFace *face = &tree->face[f];
+	float v[3], co[3], fac, d2, invd2, weight, distfac = tree->distfac;
+
+	if (exclude && face->obi == exclude->obi && face->facenr == exclude->facenr)
+		return;
+
+	if (bentn || distfac != 0.0f) {
+		occ_face(face, co, NULL, NULL); 
+		sub_v3_v3v3(v, co, p);
+		d2 = dot_v3v3(v, v) + 1e-16f;
+
+		fac = (distfac == 0.0f) ? 1.0f : 1.0f / (1.0f + distfac * d2);
+		if (fac < 0.01f)
+			return;
+	}
+	else
+		fac = 1.0f;
+
+	weight = occ_form_factor(face, (float *)p, (float *)n);
+
+	if (resultrad)
+		madd_v3_v3fl(resultrad, tree->rad[f], weight * fac);
+
+	weight *= tree->occlusion[f];
+
+	if (bentn) {
+		invd2 = 1.0f / sqrtf(d2);
+		bentn[0] -= weight * invd2 * v[0];
+		bentn[1] -= weight * invd2 * v[1];
+		bentn[2] -= weight * invd2 * v[2];
+	}
+
+	*resultocc += weight * fac;
+}
+
 static void occ_lookup(OcclusionTree *tree, int thread, OccFace *exclude,
                        const float pp[3], const float pn[3], float *occ, float rad[3], float bentn[3])
 {
 	OccNode *node, **stack;
-	OccFace *face;
-	float resultocc, resultrad[3], v[3], p[3], n[3], co[3], invd2;
+	float resultocc, resultrad[3], v[3], p[3], n[3], invd2;
 	float distfac, fac, error, d2, weight, emitarea;
-	int b, f, totstack;
+	int b, totstack;
 
 	/* init variables */
 	copy_v3_v3(p, pp);
@@ -876,39 +1011,8 @@ static void occ_lookup(OcclusionTree *tree, int thread, OccFace *exclude,
 			/* traverse into children */
 			for (b = 0; b < TOTCHILD; b++) {
 				if (node->childflag & (1 << b)) {
-					f = node->child[b].face;
-					face = &tree->face[f];
-
-					/* accumulate occlusion with face form factor */
-					if (!exclude || !(face->obi == exclude->obi && face->facenr == exclude->facenr)) {
-						if (bentn || distfac != 0.0f) {
-							occ_face(face, co, NULL, NULL); 
-							sub_v3_v3v3(v, co, p);
-							d2 = dot_v3v3(v, v) + 1e-16f;
-
-							fac = (distfac == 0.0f) ? 1.0f : 1.0f / (1.0f + distfac * d2);
-							if (fac < 0.01f)
-								continue;
-						}
-						else
-							fac = 1.0f;
-
-						weight = occ_form_factor(face, p, n);
-
-						if (rad)
-							madd_v3_v3fl(resultrad, tree->rad[f], weight * fac);
-
-						weight *= tree->occlusion[f];
-
-						if (bentn) {
-							invd2 = 1.0f / sqrtf(d2);
-							bentn[0] -= weight * invd2 * v[0];
-							bentn[1] -= weight * invd2 * v[1];
-							bentn[2] -= weight * invd2 * v[2];
-						}
-
-						resultocc += weight * fac;
-					}
+					occ_lookup_face(tree, node->child[b].face, exclude, p, n,
+					                &resultocc, (rad) ? resultrad : NULL, bentn);
 				}
 				else if (node->child[b].node) {
 					/* push child on the stack */
@@ -931,6 +1035,231 @@ static void occ_lookup(OcclusionTree *tree, int thread, OccFace *exclude,
 	if (bentn) normalize_v3(bentn);
 }
 
+/* Lookups of 4 receivers at once in the flattened tree. All receivers
+ * traverse the tree together; the nodes are evaluated for all of them at
+ * once, receivers that are far enough from a node take its spherical
+ * harmonics approximation and stop traversing it. */
+
+typedef struct OccLookup4 {
+	float p[3][4], n[3][4];	/* receivers, one per lane */
+	float weight[4], fac[4], invd2[4], v[3][4];
+} OccLookup4;
+
+/* returns the receivers in mask for which the node approximation is used,
+ * their weight is set to zero when they are too far away to count */
+#ifdef __SSE__
+static int occ_flat_node_eval_4(const OccFlatNode *node, OccLookup4 *lk, int mask, float error, float distfac)
+{
+	static const float c1 = 0.429043f, c2 = 0.511664f, c3 = 0.743125f;
+	static const float c4 = 0.886227f, c5 = 0.247708f;
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set_ps1(1.0f);
+	const float *sh = node->sh;
+	__m128 vx, vy, vz, d2, far, fac, invd2, x, y, z, sum, dotreceive, weight;
+	int farmask;
+
+	vx = _mm_sub_ps(_mm_set_ps1(node->co[0]), _mm_loadu_ps(lk->p[0]));
+	vy = _mm_sub_ps(_mm_set_ps1(node->co[1]), _mm_loadu_ps(lk->p[1]));
+	vz = _mm_sub_ps(_mm_set_ps1(node->co[2]), _mm_loadu_ps(lk->p[2]));
+	d2 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)),
+	                _mm_set_ps1(1e-16f));
+
+	far = _mm_cmpgt_ps(_mm_mul_ps(d2, _mm_set_ps1(error)), _mm_set_ps1(MAX2(node->area, node->dco)));
+	farmask = _mm_movemask_ps(far) & mask;
+
+	if (!farmask)
+		return 0;
+
+	if (distfac != 0.0f) {
+		fac = _mm_div_ps(one, _mm_add_ps(one, _mm_mul_ps(_mm_set_ps1(distfac), d2)));
+		far = _mm_and_ps(far, _mm_cmpge_ps(fac, _mm_set_ps1(0.01f)));
+	}
+	else
+		fac = one;
+
+	/* occ_solid_angle */
+	invd2 = _mm_div_ps(one, _mm_sqrt_ps(d2));
+	x = _mm_sub_ps(zero, _mm_mul_ps(vx, invd2));
+	y = _mm_sub_ps(zero, _mm_mul_ps(vy, invd2));
+	z = _mm_sub_ps(zero, _mm_mul_ps(vz, invd2));
+
+	/* sh_eval */
+	sum = _mm_mul_ps(_mm_set_ps1(c1 * sh[8]), _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+	sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(_mm_set_ps1(c3 * sh[6]), z), z));
+	sum = _mm_add_ps(sum, _mm_set_ps1(c4 * sh[0]));
+	sum = _mm_add_ps(sum, _mm_set_ps1(-c5 * sh[6]));
+	sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set_ps1(2.0f * c1),
+	                 _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_set_ps1(sh[4]), x), y),
+	                                       _mm_mul_ps(_mm_mul_ps(_mm_set_ps1(sh[7]), x), z)),
+	                            _mm_mul_ps(_mm_mul_ps(_mm_set_ps1(sh[5]), y), z))));
+	sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set_ps1(2.0f * c2),
+	                 _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set_ps1(sh[3]), x), _mm_mul_ps(_mm_set_ps1(sh[1]), y)),
+	                            _mm_mul_ps(_mm_set_ps1(sh[2]), z))));
+
+	dotreceive = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(lk->n[0]), vx), _mm_mul_ps(_mm_loadu_ps(lk->n[1]), vy)),
+	                        _mm_mul_ps(_mm_loadu_ps(lk->n[2]), vz));
+	dotreceive = _mm_mul_ps(dotreceive, invd2);
+
+	sum = _mm_min_ps(_mm_max_ps(sum, zero), one);
+	dotreceive = _mm_min_ps(_mm_max_ps(dotreceive, zero), one);
+
+	weight = _mm_mul_ps(_mm_mul_ps(_mm_set_ps1(node->area), sum), dotreceive);
+	weight = _mm_div_ps(weight, _mm_add_ps(d2, _mm_set_ps1(node->area * INVPI)));
+	weight = _mm_mul_ps(weight, _mm_set_ps1(INVPI));
+
+	_mm_storeu_ps(lk->weight, _mm_and_ps(weight, far));
+	_mm_storeu_ps(lk->fac, fac);
+	_mm_storeu_ps(lk->invd2, invd2);
+	_mm_storeu_ps(lk->v[0], vx);
+	_mm_storeu_ps(lk->v[1], vy);
+	_mm_storeu_ps(lk->v[2], vz);
+
+	return farmask;
+}
+#else
+static int occ_flat_node_eval_4(const OccFlatNode *node, OccLookup4 *lk, int mask, float error, float distfac)
+{
+	OccNode shnode;
+	float v[3], n[3], d2, emitarea = MAX2(node->area, node->dco);
+	int i, farmask = 0;
+
+	/* only the members used by occ_solid_angle */
+	memcpy(shnode.sh, node->sh, sizeof(shnode.sh));
+	shnode.area = node->area;
+
+	for (i = 0; i < 4; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+
+		v[0] = node->co[0] - lk->p[0][i];
+		v[1] = node->co[1] - lk->p[1][i];
+		v[2] = node->co[2] - lk->p[2][i];
+		d2 = dot_v3v3(v, v) + 1e-16f;
+
+		if (!(d2 * error > emitarea))
+			continue;
+
+		farmask |= (1 << i);
+		lk->fac[i] = (distfac != 0.0f) ? 1.0f / (1.0f + distfac * d2) : 1.0f;
+		lk->weight[i] = 0.0f;
+
+		if (lk->fac[i] < 0.01f)
+			continue;
+
+		n[0] = lk->n[0][i];
+		n[1] = lk->n[1][i];
+		n[2] = lk->n[2][i];
+
+		lk->invd2[i] = 1.0f / sqrtf(d2);
+		lk->weight[i] = occ_solid_angle(&shnode, v, d2, lk->invd2[i], n);
+		lk->v[0][i] = v[0];
+		lk->v[1][i] = v[1];
+		lk->v[2][i] = v[2];
+	}
+
+	return farmask;
+}
+#endif
+
+/* same as occ_lookup for tot <= 4 receivers, exclude may be NULL */
+static void occ_lookup_4(OcclusionTree *tree, int thread, int tot, OccFace **exclude,
+                         const float pp[][3], const float pn[][3], float *occ, float (*rad)[3], float (*bentn)[3])
+{
+	OccFlatStack *stack;
+	OccFlatNode *node;
+	OccLookup4 lk;
+	float p[4][3], n[4][3], resultocc[4], resultrad[4][3], weight;
+	int b, i, child, mask, farmask, totstack;
+
+	if (!tree->flatnodes) {
+		for (i = 0; i < tot; i++)
+			occ_lookup(tree, thread, (exclude) ? exclude[i] : NULL, pp[i], pn[i], &occ[i],
+			           (rad) ? rad[i] : NULL, (bentn) ? bentn[i] : NULL);
+		return;
+	}
+
+	/* init variables, unused lanes get copies of the first receiver */
+	memset(&lk, 0, sizeof(lk));
+
+	for (i = 0; i < 4; i++) {
+		copy_v3_v3(p[i], pp[(i < tot) ? i : 0]);
+		copy_v3_v3(n[i], pn[(i < tot) ? i : 0]);
+		madd_v3_v3fl(p[i], n[i], 1e-4f);
+
+		for (b = 0; b < 3; b++) {
+			lk.p[b][i] = p[i][b];
+			lk.n[b][i] = n[i][b];
+		}
+
+		resultocc[i] = 0.0f;
+		zero_v3(resultrad[i]);
+		if (bentn && i < tot)
+			copy_v3_v3(bentn[i], n[i]);
+	}
+
+	/* init stack */
+	stack = tree->flatstack[thread];
+	stack[0].node = 0;
+	stack[0].mask = (1 << tot) - 1;
+	totstack = 1;
+
+	while (totstack) {
+		/* pop node off the stack */
+		totstack--;
+		node = &tree->flatnodes[stack[totstack].node];
+		mask = stack[totstack].mask;
+
+		/* accumulate occlusion from spherical harmonics */
+		farmask = occ_flat_node_eval_4(node, &lk, mask, tree->error, tree->distfac);
+
+		for (i = 0; i < tot; i++) {
+			if (!(farmask & (1 << i)) || lk.weight[i] == 0.0f)
+				continue;
+
+			weight = lk.weight[i];
+
+			if (rad)
+				madd_v3_v3fl(resultrad[i], node->rad, weight * lk.fac[i]);
+
+			weight *= node->occlusion;
+
+			if (bentn) {
+				bentn[i][0] -= weight * lk.invd2[i] * lk.v[0][i];
+				bentn[i][1] -= weight * lk.invd2[i] * lk.v[1][i];
+				bentn[i][2] -= weight * lk.invd2[i] * lk.v[2][i];
+			}
+
+			resultocc[i] += weight * lk.fac[i];
+		}
+
+		/* traverse into children for the other receivers */
+		mask &= ~farmask;
+		if (!mask)
+			continue;
+
+		for (b = 0; b < node->totchild; b++) {
+			child = node->child[b];
+
+			if (child < 0) {
+				for (i = 0; i < tot; i++)
+					if (mask & (1 << i))
+						occ_lookup_face(tree, -child - 1, (exclude) ? exclude[i] : NULL, p[i], n[i],
+						                &resultocc[i], (rad) ? resultrad[i] : NULL, (bentn) ? bentn[i] : NULL);
+			}
+			else {
+				stack[totstack].node = child;
+				stack[totstack].mask = mask;
+				totstack++;
+			}
+		}
+	}
+
+	for (i = 0; i < tot; i++) {
+		if (occ) occ[i] = resultocc[i];
+		if (rad) copy_v3_v3(rad[i], resultrad[i]);
+		if (bentn) normalize_v3(bentn[i]);
+	}
+}
+
 static void occ_compute_bounces(Render *re, OcclusionTree *tree, int totbounce)
 {
 	float (*rad)[3], (*sum)[3], (*tmp)[3], co[3], n[3], occ;
@@ -1005,21 +1334,16 @@ static void occ_compute_passes(Render *re, OcclusionTree *tree, int totpass)
 	MEM_freeN(occ);
 }
 
-static void sample_occ_tree(Render *re, OcclusionTree *tree, OccFace *exclude,
-                            const float co[3], const float n[3], int thread, int onlyshadow,
-                            float *ao, float *env, float *indirect)
+static void sample_occ_result(Render *re, OcclusionTree *tree, int onlyshadow, float occ, const float rad[3],
+                              const float bn[3], float *ao, float *env, float *indirect)
 {
-	float nn[3], bn[3], fac, occ, occlusion, correction, rad[3];
+	float fac, occlusion, correction;
 	int envcolor;
 
 	envcolor = re->wrld.aocolor;
 	if (onlyshadow)
 		envcolor = WO_AOPLAIN;
 
-	negate_v3_v3(nn, n);
-
-	occ_lookup(tree, thread, exclude, co, nn, &occ, (tree->doindirect) ? rad : NULL, (env && envcolor) ? bn : NULL);
-
 	correction = re->wrld.ao_approx_correction;
 
 	occlusion = (1.0f - correction) * (1.0f - occ);
@@ -1066,6 +1390,58 @@ static void sample_occ_tree(Render *re, OcclusionTree *tree, OccFace *exclude,
 	else zero_v3(indirect);
 }
 
+static void sample_occ_tree(Render *re, OcclusionTree *tree, OccFace *exclude,
+                            const float co[3], const float n[3], int thread, int onlyshadow,
+                            float *ao, float *env, float *indirect)
+{
+	float nn[3], bn[3], occ, rad[3];
+	double time = 0.0;
+	int envcolor = (onlyshadow) ? WO_AOPLAIN : re->wrld.aocolor;
+
+	if (G.debug & G_DEBUG)
+		time = PIL_check_seconds_timer();
+
+	negate_v3_v3(nn, n);
+
+	occ_lookup(tree, thread, exclude, co, nn, &occ, (tree->doindirect) ? rad : NULL, (env && envcolor) ? bn : NULL);
+
+	sample_occ_result(re, tree, onlyshadow, occ, rad, bn, ao, env, indirect);
+
+	if (G.debug & G_DEBUG) {
+		tree->stats[thread].totlookup++;
+		tree->stats[thread].time += PIL_check_seconds_timer() - time;
+	}
+}
+
+/* same as sample_occ_tree for tot <= 4 receivers */
+static void sample_occ_tree_4(Render *re, OcclusionTree *tree, int tot, OccFace **exclude,
+                              const float co[][3], const float n[][3], int thread, const int *onlyshadow,
+                              float (*ao)[3], float (*env)[3], float (*indirect)[3])
+{
+	float nn[4][3], bn[4][3], occ[4], rad[4][3];
+	double time = 0.0;
+	int i, envcolor = 0;
+
+	if (G.debug & G_DEBUG)
+		time = PIL_check_seconds_timer();
+
+	for (i = 0; i < tot; i++) {
+		negate_v3_v3(nn[i], n[i]);
+		envcolor |= (onlyshadow[i]) ? WO_AOPLAIN : re->wrld.aocolor;
+	}
+
+	occ_lookup_4(tree, thread, tot, exclude, co, (const float (*)[3])nn, occ,
+	             (tree->doindirect) ? rad : NULL, (env && envcolor) ? bn : NULL);
+
+	for (i = 0; i < tot; i++)
+		sample_occ_result(re, tree, onlyshadow[i], occ[i], rad[i], bn[i], ao[i], (env) ? env[i] : NULL, indirect[i]);
+
+	if (G.debug & G_DEBUG) {
+		tree->stats[thread].totlookup_4 += tot;
+		tree->stats[thread].time_4 += PIL_check_seconds_timer() - time;
+	}
+}
+
 /* ---------------------------- Caching ------------------------------- */
 
 static OcclusionCacheSample *find_occ_sample(OcclusionCache *cache, int x, int y)
@@ -1228,31 +1604,35 @@ static void *exec_strandsurface_sample(void *data)
 	OcclusionThread *othread = (OcclusionThread *)data;
 	Render *re = othread->re;
 	StrandSurface *mesh = othread->mesh;
-	float ao[3], env[3], indirect[3], co[3], n[3], *co1, *co2, *co3, *co4;
-	int a, *face;
+	float co[4][3], n[4][3], *co1, *co2, *co3, *co4;
+	int a, i, tot, *face, onlyshadow[4] = {0, 0, 0, 0};
 
-	for (a = othread->begin; a < othread->end; a++) {
-		face = mesh->face[a];
-		co1 = mesh->co[face[0]];
-		co2 = mesh->co[face[1]];
-		co3 = mesh->co[face[2]];
+	/* sample 4 faces at once */
+	for (a = othread->begin; a < othread->end; a += tot) {
+		tot = MIN2(othread->end - a, 4);
 
-		if (face[3]) {
-			co4 = mesh->co[face[3]];
+		for (i = 0; i < tot; i++) {
+			face = mesh->face[a + i];
+			co1 = mesh->co[face[0]];
+			co2 = mesh->co[face[1]];
+			co3 = mesh->co[face[2]];
 
-			mid_v3_v3v3(co, co1, co3);
-			normal_quad_v3(n, co1, co2, co3, co4);
-		}
-		else {
-			cent_tri_v3(co, co1, co2, co3);
-			normal_tri_v3(n, co1, co2, co3);
+			if (face[3]) {
+				co4 = mesh->co[face[3]];
+
+				mid_v3_v3v3(co[i], co1, co3);
+				normal_quad_v3(n[i], co1, co2, co3, co4);
+			}
+			else {
+				cent_tri_v3(co[i], co1, co2, co3);
+				normal_tri_v3(n[i], co1, co2, co3);
+			}
+			negate_v3(n[i]);
 		}
-		negate_v3(n);
 
-		sample_occ_tree(re, re->occlusiontree, NULL, co, n, othread->thread, 0, ao, env, indirect);
-		copy_v3_v3(othread->faceao[a], ao);
-		copy_v3_v3(othread->faceenv[a], env);
-		copy_v3_v3(othread->faceindirect[a], indirect);
+		sample_occ_tree_4(re, re->occlusiontree, tot, NULL, (const float (*)[3])co, (const float (*)[3])n,
+		                  othread->thread, onlyshadow, othread->faceao + a, othread->faceenv + a,
+		                  othread->faceindirect + a);
 	}
 
 	return NULL;
@@ -1281,6 +1661,9 @@ void make_occ_tree(Render *re)
 		if (tree->doindirect && (re->wrld.mode & WO_INDIRECT_LIGHT))
 			occ_compute_bounces(re, tree, re->wrld.ao_indirect_bounces);
 
+		if (!re->test_break(re->tbh))
+			occ_tree_flatten(tree);
+
 		for (mesh = re->strandsurface.first; mesh; mesh = mesh->next) {
 			if (!mesh->face || !mesh->co || !mesh->ao)
 				continue;
@@ -1361,7 +1744,29 @@ void make_occ_tree(Render *re)
 
 void free_occ(Render *re)
 {
-	if (re->occlusiontree) {
+	OcclusionTree *tree = re->occlusiontree;
+	OcclusionStats stats = {0};
+	int a;
+
+	if (tree) {
+		if (G.debug & G_DEBUG) {
+			/* single lookups are pixel cache misses and traced rays, timed
+			 * the same way so both rates can be compared on one render */
+			for (a = 0; a < BLENDER_MAX_THREADS; a++) {
+				stats.totlookup += tree->stats[a].totlookup;
+				stats.totlookup_4 += tree->stats[a].totlookup_4;
+				stats.time += tree->stats[a].time;
+				stats.time_4 += tree->stats[a].time_4;
+			}
+
+			if (stats.totlookup)
+				printf("approximate AO: %d single lookups, %.0f lookups/s per thread\n",
+				       stats.totlookup, stats.totlookup / stats.time);
+			if (stats.totlookup_4)
+				printf("approximate AO: %d batched lookups, %.0f lookups/s per thread\n",
+				       stats.totlookup_4, stats.totlookup_4 / stats.time_4);
+		}
+
 		occ_free_tree(re->occlusiontree);
 		re->occlusiontree = NULL;
 	}
@@ -1422,17 +1827,46 @@ void sample_occ(Render *re, ShadeInput *shi)
 	}
 }
 
+static void cache_occ_samples_4(Render *re, OcclusionTree *tree, int thread, int tot,
+                                OcclusionCacheSample **samples, OccFace *exclude, int *onlyshadow)
+{
+	OccFace *excludep[4];
+	float co[4][3], n[4][3], ao[4][3], env[4][3], indirect[4][3];
+	OcclusionCacheSample *sample;
+	int i;
+
+	for (i = 0; i < tot; i++) {
+		copy_v3_v3(co[i], samples[i]->co);
+		copy_v3_v3(n[i], samples[i]->n);
+		excludep[i] = &exclude[i];
+	}
+
+	sample_occ_tree_4(re, tree, tot, excludep, (const float (*)[3])co, (const float (*)[3])n, thread, onlyshadow,
+	                  ao, env, indirect);
+
+	for (i = 0; i < tot; i++) {
+		sample = samples[i];
+		copy_v3_v3(sample->ao, ao[i]);
+		copy_v3_v3(sample->env, env[i]);
+		copy_v3_v3(sample->indirect, indirect[i]);
+		sample->intensity = max_fff(sample->ao[0], sample->ao[1], sample->ao[2]);
+		sample->intensity = max_ff(sample->intensity, max_fff(sample->env[0], sample->env[1], sample->env[2]));
+		sample->intensity = max_ff(sample->intensity, max_fff(sample->indirect[0], sample->indirect[1], sample->indirect[2]));
+		sample->filled = 1;
+	}
+}
+
 void cache_occ_samples(Render *re, RenderPart *pa, ShadeSample *ssamp)
 {
 	OcclusionTree *tree = re->occlusiontree;
 	PixStr ps;
 	OcclusionCache *cache;
-	OcclusionCacheSample *sample;
-	OccFace exclude;
+	OcclusionCacheSample *sample, *batch[4];
+	OccFace exclude[4];
 	ShadeInput *shi;
 	intptr_t *rd = NULL;
-	int *ro = NULL, *rp = NULL, *rz = NULL, onlyshadow;
-	int x, y, step = CACHE_STEP;
+	int *ro = NULL, *rp = NULL, *rz = NULL, onlyshadow[4];
+	int x, y, step = CACHE_STEP, totbatch = 0;
 
 	if (!tree->cache)
 		return;
@@ -1483,29 +1917,31 @@ void cache_occ_samples(Render *re, RenderPart *pa, ShadeSample *ssamp)
 
 			shi = ssamp->shi;
 			if (shi->vlr) {
-				onlyshadow = (shi->mat->mode & MA_ONLYSHADOW);
-				exclude.obi = shi->obi - re->objectinstance;
-				exclude.facenr = shi->vlr->index;
-				sample_occ_tree(re, tree, &exclude, shi->co, shi->vno, shi->thread, onlyshadow, shi->ao, shi->env, shi->indirect);
+				/* collect samples to look up 4 at once */
+				onlyshadow[totbatch] = (shi->mat->mode & MA_ONLYSHADOW);
+				exclude[totbatch].obi = shi->obi - re->objectinstance;
+				exclude[totbatch].facenr = shi->vlr->index;
 
 				copy_v3_v3(sample->co, shi->co);
 				copy_v3_v3(sample->n, shi->vno);
-				copy_v3_v3(sample->ao, shi->ao);
-				copy_v3_v3(sample->env, shi->env);
-				copy_v3_v3(sample->indirect, shi->indirect);
-				sample->intensity = max_fff(sample->ao[0], sample->ao[1], sample->ao[2]);
-				sample->intensity = max_ff(sample->intensity, max_fff(sample->env[0], sample->env[1], sample->env[2]));
-				sample->intensity = max_ff(sample->intensity, max_fff(sample->indirect[0], sample->indirect[1], sample->indirect[2]));
 				sample->dist2 = dot_v3v3(shi->dxco, shi->dxco) + dot_v3v3(shi->dyco, shi->dyco);
 				sample->x = shi->xs;
 				sample->y = shi->ys;
-				sample->filled = 1;
+				batch[totbatch++] = sample;
+
+				if (totbatch == 4) {
+					cache_occ_samples_4(re, tree, pa->thread, totbatch, batch, exclude, onlyshadow);
+					totbatch = 0;
+				}
 			}
 
 			if (re->test_break(re->tbh))
 				break;
 		}
 	}
+
+	if (totbatch)
+		cache_occ_samples_4(re, tree, pa->thread, totbatch, batch, exclude, onlyshadow);
 }
 
 void free_occ_samples(Render *re, RenderPart *pa)
@@ -902,6 +902,7 @@ static int render_display_update_enabled(Render *re)
 static void *do_part_thread(void *pa_v)
 {
 	RenderPart *pa = pa_v;
+	double starttime = PIL_check_seconds_timer();
 
 	pa->status = PART_STATUS_IN_PROGRESS;
 
@@ -934,7 +935,7 @@ static void *do_part_thread(void *pa_v)
 		
 		/* merge too on break! */
 		if (R.result->do_exr_tile) {
-			render_result_exr_file_merge(R.result, pa->result);
+			render_result_exr_file_merge(&R, R.result, pa->result);
 		}
 		else if (render_display_update_enabled(&R)) {
 			/* on break, don't merge in result for preview renders, looks nicer */
@@ -949,6 +950,7 @@ static void *do_part_thread(void *pa_v)
 		BLI_rw_mutex_unlock(&R.resultmutex);
 	}
 	
+	pa->rendertime = PIL_check_seconds_timer() - starttime;
 	pa->status = PART_STATUS_READY;
 	
 	return NULL;
@@ -1082,24 +1084,126 @@ static void print_part_stats(Render *re, RenderPart *pa)
 	re->i.infostr = NULL;
 }
 
+/* Parts are handed out to the render threads on demand, in the order from
+ * find_next_part. Near the end of a slice, when there are fewer parts left
+ * than threads, the largest remaining parts are split in two so no thread
+ * is left idle while a big part is still being rendered. Threads are kept
+ * rather than using the task scheduler, since per-thread render data is
+ * indexed by the render thread number. */
+
+/* minimum width or height of a part after splitting */
+#define PART_SPLIT_MIN_SIZE 32
+
+typedef struct RenderPartQueue {
+	ThreadMutex mutex;
+	Render *re;			/* owner of the parts list, not the R copy */
+	RenderPart **parts;	/* in render order */
+	int totpart, maxpart;
+	int next;			/* first part not handed out yet */
+	int totpending;		/* parts not returned to the main thread yet */
+	int lastnr;
+	bool do_split;
+} RenderPartQueue;
+
 typedef struct RenderThread {
-	ThreadQueue *workqueue;
+	RenderPartQueue *queue;
 	ThreadQueue *donequeue;
 	
 	int number;
+	double busytime;
 
 	void (*display_update)(void *handle, RenderResult *rr, volatile rcti *rect);
 	void *duh;
 } RenderThread;
 
+static void render_part_queue_add(RenderPartQueue *queue, RenderPart *pa)
+{
+	if (queue->totpart == queue->maxpart) {
+		queue->maxpart = MAX2(2 * queue->maxpart, 16);
+		queue->parts = MEM_reallocN(queue->parts, sizeof(RenderPart *) * queue->maxpart);
+	}
+
+	queue->parts[queue->totpart++] = pa;
+}
+
+/* split a part that was not started yet in two, the new part is added to
+ * the end of the queue */
+static bool render_part_split(RenderPartQueue *queue, RenderPart *pa)
+{
+	Render *re = queue->re;
+	RenderPart *newpa;
+	int rectx = pa->rectx - 2 * pa->crop, recty = pa->recty - 2 * pa->crop, mid;
+
+	/* sizes without the filter border */
+	if (MAX2(rectx, recty) < 2 * PART_SPLIT_MIN_SIZE)
+		return false;
+
+	newpa = MEM_callocN(sizeof(RenderPart), "new part");
+	newpa->crop = pa->crop;
+	newpa->disprect = pa->disprect;
+
+	if (rectx >= recty) {
+		mid = pa->disprect.xmin + pa->crop + rectx / 2;
+		pa->disprect.xmax = mid + pa->crop;
+		newpa->disprect.xmin = mid - pa->crop;
+	}
+	else {
+		mid = pa->disprect.ymin + pa->crop + recty / 2;
+		pa->disprect.ymax = mid + pa->crop;
+		newpa->disprect.ymin = mid - pa->crop;
+	}
+
+	pa->rectx = BLI_rcti_size_x(&pa->disprect);
+	pa->recty = BLI_rcti_size_y(&pa->disprect);
+	newpa->rectx = BLI_rcti_size_x(&newpa->disprect);
+	newpa->recty = BLI_rcti_size_y(&newpa->disprect);
+	newpa->nr = ++queue->lastnr;
+
+	BLI_insertlinkafter(&re->parts, pa, newpa);
+	re->i.totpart++;
+
+	render_part_queue_add(queue, newpa);
+	queue->totpending++;
+
+	return true;
+}
+
+static RenderPart *render_part_queue_pop(RenderPartQueue *queue, int totthread)
+{
+	RenderPart *pa = NULL, *largest;
+	int a;
+
+	BLI_mutex_lock(&queue->mutex);
+
+	/* split the largest remaining parts while threads would run out of work */
+	while (queue->do_split && queue->next < queue->totpart && queue->totpart - queue->next < totthread) {
+		largest = NULL;
+
+		for (a = queue->next; a < queue->totpart; a++)
+			if (!largest || queue->parts[a]->rectx * queue->parts[a]->recty > largest->rectx * largest->recty)
+				largest = queue->parts[a];
+
+		if (!render_part_split(queue, largest))
+			break;
+	}
+
+	if (queue->next < queue->totpart)
+		pa = queue->parts[queue->next++];
+
+	BLI_mutex_unlock(&queue->mutex);
+
+	return pa;
+}
+
 static void *do_render_thread(void *thread_v)
 {
 	RenderThread *thread = thread_v;
 	RenderPart *pa;
 	
-	while ((pa = BLI_thread_queue_pop(thread->workqueue))) {
+	while ((pa = render_part_queue_pop(thread->queue, R.r.threads))) {
 		pa->thread = thread->number;
 		do_part_thread(pa);
+		thread->busytime += pa->rendertime;
 
 		if (thread->display_update) {
 			thread->display_update(thread->duh, pa->result, NULL);
@@ -1114,15 +1218,47 @@ static void *do_render_thread(void *thread_v)
 	return NULL;
 }
 
+static void print_part_times(Render *re, RenderThread *thread, int totthread, double elapsed)
+{
+	RenderPart *pa, *slowest = NULL;
+	double totaltime = 0.0;
+	int a, totpart = 0;
+
+	for (pa = re->parts.first; pa; pa = pa->next) {
+		if (pa->status != PART_STATUS_READY)
+			continue;
+
+		if (!slowest || pa->rendertime > slowest->rendertime)
+			slowest = pa;
+
+		totaltime += pa->rendertime;
+		totpart++;
+	}
+
+	if (!slowest)
+		return;
+
+	printf("Parts: %d rendered in %.3fs, average %.3fs, slowest part %d (%dx%d) %.3fs\n",
+	       totpart, elapsed, totaltime / totpart, slowest->nr, slowest->rectx, slowest->recty, slowest->rendertime);
+
+	for (pa = re->parts.first; pa; pa = pa->next)
+		if (pa->status == PART_STATUS_READY)
+			printf("  part %d (%dx%d) thread %d: %.3fs\n", pa->nr, pa->rectx, pa->recty, pa->thread, pa->rendertime);
+
+	for (a = 0; a < totthread; a++)
+		printf("  thread %d: busy %.3fs, idle %.3fs\n", a, thread[a].busytime, MAX2(elapsed - thread[a].busytime, 0.0));
+}
+
 static void threaded_tile_processor(Render *re)
 {
 	RenderThread thread[BLENDER_MAX_THREADS];
-	ThreadQueue *workqueue, *donequeue;
+	RenderPartQueue queue;
+	ThreadQueue *donequeue;
 	ListBase threads;
 	RenderPart *pa;
 	rctf viewplane = re->viewplane;
-	double lastdraw, elapsed, redrawtime = 1.0f;
-	int totpart = 0, minx = 0, slice = 0, a, wait;
+	double starttime, lastdraw, elapsed, redrawtime = 1.0f;
+	int minx = 0, slice = 0, a, wait, totpending;
 	
 	BLI_rw_mutex_lock(&re->resultmutex, THREAD_LOCK_WRITE);
 
@@ -1157,28 +1293,35 @@ static void threaded_tile_processor(Render *re)
 	/* set threadsafe break */
 	R.test_break = thread_break;
 	
-	/* create and fill work queue */
-	workqueue = BLI_thread_queue_init();
+	/* create work queue, split parts only when they don't map to exr tiles or pano slices */
+	memset(&queue, 0, sizeof(queue));
+	BLI_mutex_init(&queue.mutex);
+	queue.re = re;
+	queue.do_split = !re->result->do_exr_tile && !(re->r.mode & R_PANORAMA);
+
 	donequeue = BLI_thread_queue_init();
+	starttime = PIL_check_seconds_timer();
 	
 	/* for panorama we loop over slices */
 	while (find_next_pano_slice(re, &slice, &minx, &viewplane)) {
 		/* gather parts into queue */
+		queue.totpart = queue.next = 0;
+
 		while ((pa = find_next_part(re, minx))) {
-			pa->nr = totpart + 1; /* for nicest part, and for stats */
-			totpart++;
-			BLI_thread_queue_push(workqueue, pa);
+			pa->nr = ++queue.lastnr; /* for nicest part, and for stats */
+			render_part_queue_add(&queue, pa);
 		}
-		
-		BLI_thread_queue_nowait(workqueue);
+
+		queue.totpending = queue.totpart;
 		
 		/* start all threads */
 		BLI_init_threads(&threads, do_render_thread, re->r.threads);
 		
 		for (a = 0; a < re->r.threads; a++) {
-			thread[a].workqueue = workqueue;
+			thread[a].queue = &queue;
 			thread[a].donequeue = donequeue;
 			thread[a].number = a;
+			thread[a].busytime = 0.0;
 
 			if (render_display_update_enabled(re)) {
 				thread[a].display_update = re->display_update;
@@ -1192,7 +1335,8 @@ static void threaded_tile_processor(Render *re)
 			BLI_insert_thread(&threads, &thread[a]);
 		}
 		
-		/* wait for results to come back */
+		/* wait for results to come back, finished parts wake up the main thread
+		 * right away, parts in progress are redrawn every redrawtime */
 		lastdraw = PIL_check_seconds_timer();
 		
 		while (1) {
@@ -1210,30 +1354,43 @@ static void threaded_tile_processor(Render *re)
 					re->progress(re->prh, re->i.partsdone / (float)re->i.totpart);
 				}
 				
-				totpart--;
+				BLI_mutex_lock(&queue.mutex);
+				queue.totpending--;
+				BLI_mutex_unlock(&queue.mutex);
 			}
 			
 			/* check for render cancel */
 			if ((g_break=re->test_break(re->tbh)))
 				break;
 			
-			/* or done with parts */
-			if (totpart == 0)
+			/* or done with parts, parts are only split while others are pending */
+			BLI_mutex_lock(&queue.mutex);
+			totpending = queue.totpending;
+			BLI_mutex_unlock(&queue.mutex);
+
+			if (totpending == 0)
 				break;
 			
 			/* redraw in progress parts */
 			elapsed = PIL_check_seconds_timer() - lastdraw;
 			if (elapsed > redrawtime) {
-				if (render_display_update_enabled(re))
+				if (render_display_update_enabled(re)) {
+					/* split parts are added to the list by the render threads */
+					BLI_mutex_lock(&queue.mutex);
 					for (pa = re->parts.first; pa; pa = pa->next)
 						if ((pa->status == PART_STATUS_IN_PROGRESS) && pa->nr && pa->result)
 							re->display_update(re->duh, pa->result, &pa->result->renrect);
+					BLI_mutex_unlock(&queue.mutex);
+				}
 				
 				lastdraw = PIL_check_seconds_timer();
 			}
 		}
 		
 		BLI_end_threads(&threads);
+
+		if (G.debug & G_DEBUG)
+			print_part_times(re, thread, re->r.threads, PIL_check_seconds_timer() - starttime);
 		
 		if ((g_break=re->test_break(re->tbh)))
 			break;
@@ -1253,7 +1410,9 @@ static void threaded_tile_processor(Render *re)
 	}
 
 	BLI_thread_queue_free(donequeue);
-	BLI_thread_queue_free(workqueue);
+	BLI_mutex_end(&queue.mutex);
+	if (queue.parts)
+		MEM_freeN(queue.parts);
 	
 	if (re->result->do_exr_tile) {
 		BLI_rw_mutex_lock(&re->resultmutex, THREAD_LOCK_WRITE);
@@ -41,13 +41,17 @@
 #include "DNA_lamp_types.h"
 
 #include "BLI_blenlib.h"
+#include "BLI_ghash.h"
 #include "BLI_system.h"
 #include "BLI_math.h"
 #include "BLI_rand.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 #include "BLI_utildefines.h"
 
 #include "BLF_translation.h"
 
+#include "BKE_global.h"
 #include "BKE_node.h"
 
 
@@ -187,6 +191,7 @@ void freeraytree(Render *re)
 		int i;
 		for (i=0; i<BLENDER_MAX_THREADS; i++)
 			RE_RC_MERGE(&sum, re_rc_counter+i);
+		RE_RC_BUILD_INFO(&re->raybuild_stats);
 		RE_RC_INFO(&sum);
 	}
 #endif
@@ -220,7 +225,7 @@ static int is_raytraceable(Render *re, ObjectInstanceRen *obi)
 }
 
 
-RayObject* makeraytree_object(Render *re, ObjectInstanceRen *obi)
+static void makeraytree_object_build(Render *re, ObjectInstanceRen *obi)
 {
 	/*TODO
 	 * out-of-memory safeproof
@@ -243,7 +248,7 @@ RayObject* makeraytree_object(Render *re, ObjectInstanceRen *obi)
 		}
 		
 		if (faces == 0)
-			return NULL;
+			return;
 
 		//Create Ray cast accelaration structure
 		raytree = rayobject_create( re,  re->r.raytrace_structure, faces );
@@ -276,6 +281,13 @@ RayObject* makeraytree_object(Render *re, ObjectInstanceRen *obi)
 		else
 			obr->raytree= raytree;
 	}
+}
+
+RayObject* makeraytree_object(Render *re, ObjectInstanceRen *obi)
+{
+	ObjectRen *obr = obi->obr;
+
+	makeraytree_object_build(re, obi);
 
 	if (obr->raytree) {
 		if ((obi->flag & R_TRANSFORMED) && obi->raytree == NULL) {
@@ -305,6 +317,77 @@ static bool has_special_rayobject(Render *re, ObjectInstanceRen *obi)
 	}
 	return 0;
 }
+typedef struct RayObjectBuildTask {
+	Render *re;
+	ObjectInstanceRen *obi;
+	double time;
+} RayObjectBuildTask;
+
+static void makeraytree_object_task(TaskPool *UNUSED(pool), void *taskdata, int UNUSED(threadid))
+{
+	RayObjectBuildTask *task = (RayObjectBuildTask *)taskdata;
+	double start = PIL_check_seconds_timer();
+
+	if (!test_break(task->re))
+		makeraytree_object_build(task->re, task->obi);
+
+	task->time = PIL_check_seconds_timer() - start;
+}
+
+/*
+ * build the trees of all instanced objects in parallel, each object only
+ * once even if it has multiple instances
+ */
+static void makeraytree_objects(Render *re)
+{
+	RayObjectBuildTask *tasks;
+	ObjectInstanceRen *obi;
+	TaskPool *task_pool;
+	GSet *obrs;
+	int i, tottask = 0;
+	double start = PIL_check_seconds_timer();
+
+	tasks = MEM_mallocN(sizeof(RayObjectBuildTask) * BLI_countlist(&re->instancetable), "RayObjectBuildTask");
+	obrs = BLI_gset_ptr_new(__func__);
+
+	/* first instance of an object in the table is used, like when building
+	 * the trees one by one */
+	for (obi=re->instancetable.first; obi; obi=obi->next) {
+		if (obi->obr->raytree == NULL && is_raytraceable(re, obi) && has_special_rayobject(re, obi)) {
+			if (!BLI_gset_haskey(obrs, obi->obr)) {
+				BLI_gset_insert(obrs, obi->obr);
+
+				tasks[tottask].re = re;
+				tasks[tottask].obi = obi;
+				tasks[tottask].time = 0.0;
+				tottask++;
+			}
+		}
+	}
+
+	BLI_gset_free(obrs, NULL);
+
+	if (tottask) {
+		re->i.infostr = IFACE_("Raytree.. building objects");
+		re->stats_draw(re->sdh, &re->i);
+
+		task_pool = BLI_task_pool_create(BLI_task_scheduler_get(), NULL);
+
+		for (i = 0; i < tottask; i++)
+			BLI_task_pool_push(task_pool, makeraytree_object_task, &tasks[i], false, TASK_PRIORITY_HIGH);
+
+		BLI_task_pool_work_and_wait(task_pool);
+		BLI_task_pool_free(task_pool);
+	}
+
+	re->raybuild_stats.totobject = tottask;
+	re->raybuild_stats.object_time = PIL_check_seconds_timer() - start;
+	for (i = 0; i < tottask; i++)
+		re->raybuild_stats.object_cpu_time += tasks[i].time;
+
+	MEM_freeN(tasks);
+}
+
 /*
  * create a single raytrace structure with all faces
  */
@@ -338,6 +421,10 @@ static void makeraytree_single(Render *re)
 		re->raytree = RE_rayobject_empty_create();
 		return;
 	}
+
+	/* instanced object trees are independent, build them up front */
+	if (special)
+		makeraytree_objects(re);
 	
 	//Create raytree
 	raytree = re->raytree = rayobject_create( re, re->r.raytrace_structure, faces+special );
@@ -398,18 +485,26 @@ static void makeraytree_single(Render *re)
 	}
 	
 	if (!test_break(re)) {
+		double start = PIL_check_seconds_timer();
+
 		re->i.infostr = IFACE_("Raytree.. building");
 		re->stats_draw(re->sdh, &re->i);
 
 		RE_rayobject_done(raytree);
+
+		re->raybuild_stats.totprimitive = faces + special;
+		re->raybuild_stats.tree_time = PIL_check_seconds_timer() - start;
 	}
 }
 
 void makeraytree(Render *re)
 {
 	float min[3], max[3], sub[3];
+	double start = PIL_check_seconds_timer();
 	int i;
 	
+	memset(&re->raybuild_stats, 0, sizeof(re->raybuild_stats));
+
 	re->i.infostr = IFACE_("Raytree.. preparing");
 	re->stats_draw(re->sdh, &re->i);
 
@@ -446,6 +541,11 @@ void makeraytree(Render *re)
 
 		re->i.infostr = IFACE_("Raytree finished");
 		re->stats_draw(re->sdh, &re->i);
+
+		re->raybuild_stats.total_time = PIL_check_seconds_timer() - start;
+
+		if (G.debug & G_DEBUG)
+			RE_RC_BUILD_INFO(&re->raybuild_stats);
 	}
 
 #ifdef RE_RAYCOUNTER
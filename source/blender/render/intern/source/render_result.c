@@ -56,6 +56,8 @@
 #include "IMB_imbuf_types.h"
 #include "IMB_colormanagement.h"
 
+#include "PIL_time.h"
+
 #include "intern/openexr/openexr_multi.h"
 
 #include "render_result.h"
@@ -930,14 +932,72 @@ void render_result_single_layer_end(Render *re)
 
 /************************* EXR Tile File Rendering ***************************/
 
-static void save_render_result_tile(RenderResult *rr, RenderResult *rrpart)
+/* Finished tiles are copied and written to the exr files by a separate thread,
+ * so render threads don't wait for compression and disk writes. The number of
+ * queued tiles is limited, to bound the memory used by the copies. */
+
+typedef struct ExrTileChannel {
+	RenderLayer *rl;
+	const char *passname;
+	int xstride;
+	float *rect;
+} ExrTileChannel;
+
+typedef struct ExrTile {
+	struct ExrTile *next, *prev;
+	int partx, party, rectx;
+	int totchan;
+	ExrTileChannel *chan;
+	float *buffer;
+} ExrTile;
+
+typedef struct ExrTileWriter {
+	ListBase threads;
+	ThreadMutex mutex;
+	ThreadCondition cond;
+	ListBase queue;
+	int queuelen, maxqueuelen;
+	bool stop;
+
+	/* statistics */
+	int tottile;
+	double write_time, wait_time;
+} ExrTileWriter;
+
+static ExrTile *exr_tile_new(RenderResult *rr, RenderResult *rrpart)
 {
+	ExrTile *tile;
+	ExrTileChannel *chan;
 	RenderLayer *rlp, *rl;
 	RenderPass *rpassp;
-	int offs, partx, party;
-	
-	BLI_lock_thread(LOCK_IMAGE);
-	
+	float *buffer;
+	size_t totpixel = (size_t)rrpart->rectx * rrpart->recty, totfloat = 0;
+	int totchan = 0, offs, a;
+
+	for (rlp = rrpart->layers.first; rlp; rlp = rlp->next) {
+		if (rlp->rectf) {
+			totchan += 4;
+			totfloat += 4 * totpixel;
+		}
+		for (rpassp = rlp->passes.first; rpassp; rpassp = rpassp->next) {
+			totchan += rpassp->channels;
+			totfloat += rpassp->channels * totpixel;
+		}
+	}
+
+	tile = MEM_callocN(sizeof(ExrTile), "ExrTile");
+	tile->chan = MEM_callocN(sizeof(ExrTileChannel) * MAX2(totchan, 1), "ExrTileChannel");
+	tile->buffer = MEM_mallocN(sizeof(float) * MAX2(totfloat, 1), "ExrTile buffer");
+	tile->partx = rrpart->tilerect.xmin + rrpart->crop;
+	tile->party = rrpart->tilerect.ymin + rrpart->crop;
+	tile->rectx = rrpart->rectx;
+
+	/* filters add pixel extra */
+	offs = (rrpart->crop) ? (rrpart->crop + rrpart->crop * rrpart->rectx) : 0;
+
+	chan = tile->chan;
+	buffer = tile->buffer;
+
 	for (rlp = rrpart->layers.first; rlp; rlp = rlp->next) {
 		rl = RE_GetRenderLayer(rr, rlp->name);
 
@@ -947,49 +1007,150 @@ static void save_render_result_tile(RenderResult *rr, RenderResult *rrpart)
 			continue;
 		}
 
-		if (rrpart->crop) { /* filters add pixel extra */
-			offs = (rrpart->crop + rrpart->crop * rrpart->rectx);
-		}
-		else {
-			offs = 0;
-		}
-		
 		/* combined */
 		if (rlp->rectf) {
-			int a, xstride = 4;
-			for (a = 0; a < xstride; a++) {
-				IMB_exr_set_channel(rl->exrhandle, rlp->name, get_pass_name(SCE_PASS_COMBINED, a), 
-				                    xstride, xstride * rrpart->rectx, rlp->rectf + a + xstride * offs);
+			int xstride = 4;
+			memcpy(buffer, rlp->rectf, sizeof(float) * xstride * totpixel);
+			for (a = 0; a < xstride; a++, chan++) {
+				chan->rl = rl;
+				chan->passname = get_pass_name(SCE_PASS_COMBINED, a);
+				chan->xstride = xstride;
+				chan->rect = buffer + a + xstride * offs;
 			}
+			buffer += xstride * totpixel;
 		}
-		
+
 		/* passes are allocated in sync */
 		for (rpassp = rlp->passes.first; rpassp; rpassp = rpassp->next) {
-			int a, xstride = rpassp->channels;
-			for (a = 0; a < xstride; a++) {
-				IMB_exr_set_channel(rl->exrhandle, rlp->name, get_pass_name(rpassp->passtype, a), 
-				                    xstride, xstride * rrpart->rectx, rpassp->rect + a + xstride * offs);
+			int xstride = rpassp->channels;
+			memcpy(buffer, rpassp->rect, sizeof(float) * xstride * totpixel);
+			for (a = 0; a < xstride; a++, chan++) {
+				chan->rl = rl;
+				chan->passname = get_pass_name(rpassp->passtype, a);
+				chan->xstride = xstride;
+				chan->rect = buffer + a + xstride * offs;
 			}
+			buffer += xstride * totpixel;
 		}
-		
 	}
 
-	party = rrpart->tilerect.ymin + rrpart->crop;
-	partx = rrpart->tilerect.xmin + rrpart->crop;
+	tile->totchan = chan - tile->chan;
 
-	for (rlp = rrpart->layers.first; rlp; rlp = rlp->next) {
-		rl = RE_GetRenderLayer(rr, rlp->name);
+	return tile;
+}
 
-		/* should never happen but prevents crash if it does */
-		BLI_assert(rl);
-		if (UNLIKELY(rl == NULL)) {
-			continue;
-		}
+static void exr_tile_free(ExrTile *tile)
+{
+	MEM_freeN(tile->chan);
+	MEM_freeN(tile->buffer);
+	MEM_freeN(tile);
+}
+
+static void exr_tile_write(ExrTile *tile)
+{
+	ExrTileChannel *chan;
+	int a;
 
-		IMB_exrtile_write_channels(rl->exrhandle, partx, party, 0);
+	for (a = 0, chan = tile->chan; a < tile->totchan; a++, chan++) {
+		IMB_exr_set_channel(chan->rl->exrhandle, chan->rl->name, chan->passname,
+		                    chan->xstride, chan->xstride * tile->rectx, chan->rect);
 	}
 
-	BLI_unlock_thread(LOCK_IMAGE);
+	/* channels of a layer are consecutive, write each layer once */
+	for (a = 0, chan = tile->chan; a < tile->totchan; a++, chan++) {
+		if (a == 0 || chan->rl != (chan - 1)->rl)
+			IMB_exrtile_write_channels(chan->rl->exrhandle, tile->partx, tile->party, 0);
+	}
+}
+
+static void *exr_tile_writer_thread(void *writer_v)
+{
+	ExrTileWriter *writer = writer_v;
+	ExrTile *tile;
+	double time;
+
+	BLI_mutex_lock(&writer->mutex);
+
+	while (true) {
+		while (writer->queue.first == NULL && !writer->stop)
+			BLI_condition_wait(&writer->cond, &writer->mutex);
+
+		/* only stop once all queued tiles are written */
+		tile = BLI_pophead(&writer->queue);
+		if (tile == NULL)
+			break;
+
+		BLI_mutex_unlock(&writer->mutex);
+
+		time = PIL_check_seconds_timer();
+		exr_tile_write(tile);
+		time = PIL_check_seconds_timer() - time;
+
+		exr_tile_free(tile);
+
+		BLI_mutex_lock(&writer->mutex);
+		writer->queuelen--;
+		writer->tottile++;
+		writer->write_time += time;
+		BLI_condition_notify_all(&writer->cond);
+	}
+
+	BLI_mutex_unlock(&writer->mutex);
+
+	return NULL;
+}
+
+static ExrTileWriter *exr_tile_writer_new(int maxqueuelen)
+{
+	ExrTileWriter *writer = MEM_callocN(sizeof(ExrTileWriter), "ExrTileWriter");
+
+	BLI_mutex_init(&writer->mutex);
+	BLI_condition_init(&writer->cond);
+	writer->maxqueuelen = maxqueuelen;
+
+	BLI_init_threads(&writer->threads, exr_tile_writer_thread, 1);
+	BLI_insert_thread(&writer->threads, writer);
+
+	return writer;
+}
+
+/* waits for the queued tiles to be written */
+static void exr_tile_writer_free(ExrTileWriter *writer)
+{
+	BLI_mutex_lock(&writer->mutex);
+	writer->stop = true;
+	BLI_condition_notify_all(&writer->cond);
+	BLI_mutex_unlock(&writer->mutex);
+
+	BLI_end_threads(&writer->threads);
+
+	printf("exr tmp file: %d tiles, writing %.2fs, render threads waited %.2fs\n",
+	       writer->tottile, writer->write_time, writer->wait_time);
+
+	BLI_condition_end(&writer->cond);
+	BLI_mutex_end(&writer->mutex);
+	MEM_freeN(writer);
+}
+
+static void exr_tile_writer_push(ExrTileWriter *writer, ExrTile *tile)
+{
+	double time;
+
+	BLI_mutex_lock(&writer->mutex);
+
+	/* block the render thread when the writer can't keep up */
+	if (writer->queuelen >= writer->maxqueuelen) {
+		time = PIL_check_seconds_timer();
+		while (writer->queuelen >= writer->maxqueuelen)
+			BLI_condition_wait(&writer->cond, &writer->mutex);
+		writer->wait_time += PIL_check_seconds_timer() - time;
+	}
+
+	BLI_addtail(&writer->queue, tile);
+	writer->queuelen++;
+	BLI_condition_notify_all(&writer->cond);
+
+	BLI_mutex_unlock(&writer->mutex);
 }
 
 static void save_empty_result_tiles(Render *re)
@@ -1027,13 +1188,25 @@ void render_result_exr_file_begin(Render *re)
 			IMB_exrtile_begin_write(rl->exrhandle, str, 0, rr->rectx, rr->recty, re->partx, re->party);
 		}
 	}
+
+	re->exrwriter = exr_tile_writer_new(MAX2(2 * re->r.threads, 4));
 }
 
-/* end write of exr tile file, read back first sample */
+/* end write of exr tile file, read back first sample
+ *
+ * The read back is not streamed into the result while rendering: that would
+ * keep the full result in memory during the render, which is what save buffers
+ * avoids. Each layer file is read once, sequentially, when the render is done. */
 void render_result_exr_file_end(Render *re)
 {
 	RenderResult *rr;
 	RenderLayer *rl;
+	double time;
+
+	if (re->exrwriter) {
+		exr_tile_writer_free(re->exrwriter);
+		re->exrwriter = NULL;
+	}
 
 	save_empty_result_tiles(re);
 	
@@ -1049,14 +1222,16 @@ void render_result_exr_file_end(Render *re)
 	render_result_free_list(&re->fullresult, re->result);
 	re->result = NULL;
 
+	time = PIL_check_seconds_timer();
 	render_result_exr_file_read_sample(re, 0);
+	printf("exr tmp file: read back in %.2fs\n", PIL_check_seconds_timer() - time);
 }
 
-/* save part into exr file */
-void render_result_exr_file_merge(RenderResult *rr, RenderResult *rrpart)
+/* queue part for writing into exr file, rrpart can be freed afterwards */
+void render_result_exr_file_merge(Render *re, RenderResult *rr, RenderResult *rrpart)
 {
 	for (; rr && rrpart; rr = rr->next, rrpart = rrpart->next)
-		save_render_result_tile(rr, rrpart);
+		exr_tile_writer_push(re->exrwriter, exr_tile_new(rr, rrpart));
 }
 
 /* path to temporary exr file */
@@ -43,6 +43,8 @@
 #include "BLI_jitter.h"
 #include "BLI_memarena.h"
 #include "BLI_rand.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 #include "BLI_utildefines.h"
 
 #include "BKE_global.h"
@@ -86,8 +88,10 @@ extern struct Render R;
 
 /* ------------------------------------------------------------------------- */
 
-static void copy_to_ztile(int *rectz, int size, int x1, int y1, int tile, char *r1)
+/* x1, y1 are in the shadow buffer of given size, rectz only holds the part of it in rect */
+static void copy_to_ztile(int *rectz, const rcti *rect, int size, int x1, int y1, int tile, char *r1)
 {
+	const int rectx= BLI_rcti_size_x(rect);
 	int len4, *rz;
 	int x2, y2;
 	
@@ -99,10 +103,10 @@ static void copy_to_ztile(int *rectz, int size, int x1, int y1, int tile, char *
 	if (x1>=x2 || y1>=y2) return;
 
 	len4= 4*(x2- x1);
-	rz= rectz + size*y1 + x1;
+	rz= rectz + rectx*(y1 - rect->ymin) + (x1 - rect->xmin);
 	for (; y1<y2; y1++) {
 		memcpy(r1, rz, len4);
-		rz+= size;
+		rz+= rectx;
 		r1+= len4;
 	}
 }
@@ -305,9 +309,9 @@ static float deep_alpha(Render *re, int obinr, int facenr, int strand)
 	return ma->shad_alpha;
 }
 
-static void compress_deepshadowbuf(Render *re, ShadBuf *shb, APixstr *apixbuf, APixstrand *apixbufstrand)
+/* the apixbufs only hold the pixels in rect */
+static void compress_deepshadowbuf(Render *re, ShadBuf *shb, ShadSampleBuf *shsample, APixstr *apixbuf, APixstrand *apixbufstrand, const rcti *rect)
 {
-	ShadSampleBuf *shsample;
 	DeepSample *ds[RE_MAX_OSA], *sampleds[RE_MAX_OSA], *dsb, *newbuf;
 	APixstr *ap, *apn;
 	APixstrand *aps, *apns;
@@ -317,19 +321,17 @@ static void compress_deepshadowbuf(Render *re, ShadBuf *shb, APixstr *apixbuf, A
 	const float totbuf_f= (float)shb->totbuf;
 	const float totbuf_f_inv= 1.0f/totbuf_f;
 	const int size= shb->size;
+	const int rectx= BLI_rcti_size_x(rect), recty= BLI_rcti_size_y(rect);
 
-	int a, b, c, tot, minz, found, prevtot, newtot;
+	int i, a, b, c, tot, minz, found, prevtot, newtot;
 	int sampletot[RE_MAX_OSA], totsample = 0, totsamplec = 0;
-	
-	shsample= MEM_callocN(sizeof(ShadSampleBuf), "shad sample buf");
-	BLI_addtail(&shb->buffers, shsample);
-
-	shsample->totbuf = MEM_callocN(sizeof(int) * size * size, "deeptotbuf");
-	shsample->deepbuf = MEM_callocN(sizeof(DeepSample *) * size * size, "deepbuf");
 
 	ap= apixbuf;
 	aps= apixbufstrand;
-	for (a=0; a<size*size; a++, ap++, aps++) {
+	for (i=0; i<rectx*recty; i++, ap++, aps++) {
+		/* index in the full buffer */
+		a= (rect->ymin + i/rectx)*size + rect->xmin + i%rectx;
+
 		/* count number of samples */
 		for (c=0; c<totbuf; c++)
 			sampletot[c]= 0;
@@ -504,32 +506,26 @@ static void compress_deepshadowbuf(Render *re, ShadBuf *shb, APixstr *apixbuf, A
 }
 
 /* create Z tiles (for compression): this system is 24 bits!!! */
-static void compress_shadowbuf(ShadBuf *shb, int *rectz, int square)
+/* rectz only holds the pixels in rect, which is aligned to the 16x16 tiles */
+static void compress_shadowbuf(ShadBuf *shb, ShadSampleBuf *shsample, int *rectz, const rcti *rect, int square)
 {
-	ShadSampleBuf *shsample;
 	float dist;
 	uintptr_t *ztile;
 	int *rz, *rz1, verg, verg1, size= shb->size;
 	int a, x, y, minx, miny, byt1, byt2;
 	char *rc, *rcline, *ctile, *zt;
 	
-	shsample= MEM_callocN(sizeof(ShadSampleBuf), "shad sample buf");
-	BLI_addtail(&shb->buffers, shsample);
-	
-	shsample->zbuf= MEM_mallocN(sizeof(uintptr_t)*(size*size)/256, "initshadbuf2");
-	shsample->cbuf= MEM_callocN((size*size)/256, "initshadbuf3");
-	
-	ztile= (uintptr_t *)shsample->zbuf;
-	ctile= shsample->cbuf;
-	
 	/* help buffer */
 	rcline= MEM_mallocN(256*4+sizeof(int), "makeshadbuf2");
 	
-	for (y=0; y<size; y+=16) {
+	for (y=rect->ymin; y<rect->ymax; y+=16) {
 		if (y< size/2) miny= y+15-size/2;
 		else miny= y-size/2;
+
+		ztile= (uintptr_t *)shsample->zbuf + (y/16)*(size/16) + rect->xmin/16;
+		ctile= shsample->cbuf + (y/16)*(size/16) + rect->xmin/16;
 		
-		for (x=0; x<size; x+=16) {
+		for (x=rect->xmin; x<rect->xmax; x+=16) {
 			
 			/* is tile within spotbundle? */
 			a= size/2;
@@ -543,7 +539,7 @@ static void compress_shadowbuf(ShadBuf *shb, int *rectz, int square)
 				rz1= (&verg)+1;
 			}
 			else {
-				copy_to_ztile(rectz, size, x, y, 16, rcline);
+				copy_to_ztile(rectz, rect, size, x, y, 16, rcline);
 				rz1= (int *)rcline;
 				
 				verg= (*rz1 & 0xFFFFFF00);
@@ -717,43 +713,128 @@ static void shadowbuf_autoclip(Render *re, LampRen *lar)
 	}
 }
 
-static void makeflatshadowbuf(Render *re, LampRen *lar, float *jitbuf)
+/* Shadow buffers are rendered and compressed in tiles in parallel, so a
+ * single large buffer still uses all threads. The tile size is a multiple
+ * of the 16x16 blocks the buffers are compressed in. */
+#define SHADBUF_TILE_SIZE 256
+
+typedef struct ShadowTileData {
+	Render *re;
+	LampRen *lar;
+	float *jitbuf;
+	ShadSampleBuf **shsamples;	/* one per jitter sample, or one deep buffer */
+	int tottile_x, tottile;
+} ShadowTileData;
+
+static void shadowbuf_tile_rect(ShadowTileData *data, int tile, rcti *rect)
+{
+	const int size= data->lar->shb->size;
+	const int x= (tile % data->tottile_x) * SHADBUF_TILE_SIZE;
+	const int y= (tile / data->tottile_x) * SHADBUF_TILE_SIZE;
+
+	BLI_rcti_init(rect, x, min_ii(x + SHADBUF_TILE_SIZE, size), y, min_ii(y + SHADBUF_TILE_SIZE, size));
+}
+
+static void makeshadowbuf_tiles(Render *re, LampRen *lar, float *jitbuf, ShadSampleBuf **shsamples, int totsample,
+                                TaskRunFunction run)
+{
+	ShadowTileData data;
+	TaskPool *task_pool;
+	int a;
+
+	data.re= re;
+	data.lar= lar;
+	data.jitbuf= jitbuf;
+	data.shsamples= shsamples;
+	data.tottile_x= (lar->shb->size + SHADBUF_TILE_SIZE - 1) / SHADBUF_TILE_SIZE;
+	data.tottile= data.tottile_x * data.tottile_x;
+
+	task_pool= BLI_task_pool_create(BLI_task_scheduler_get(), &data);
+
+	for (a=0; a<totsample*data.tottile; a++)
+		BLI_task_pool_push(task_pool, run, SET_INT_IN_POINTER(a), false, TASK_PRIORITY_HIGH);
+
+	BLI_task_pool_work_and_wait(task_pool);
+	BLI_task_pool_free(task_pool);
+}
+
+static void makeflatshadowbuf_tile(TaskPool *pool, void *taskdata, int UNUSED(threadid))
 {
+	ShadowTileData *data= BLI_task_pool_userdata(pool);
+	Render *re= data->re;
+	LampRen *lar= data->lar;
 	ShadBuf *shb= lar->shb;
-	int *rectz, samples;
+	int index= GET_INT_FROM_POINTER(taskdata);
+	int sample= index / data->tottile;
+	int *rectz;
+	rcti rect;
+
+	if (re->test_break(re->tbh))
+		return;
+
+	shadowbuf_tile_rect(data, index % data->tottile, &rect);
 
 	/* zbuffering */
-	rectz= MEM_mapallocN(sizeof(int)*shb->size*shb->size, "makeshadbuf");
-	
+	rectz= MEM_mallocN(sizeof(int)*BLI_rcti_size_x(&rect)*BLI_rcti_size_y(&rect), "makeshadbuf");
+	zbuffer_shadow(re, shb->persmat, lar, rectz, shb->size, &rect, data->jitbuf[2*sample], data->jitbuf[2*sample+1]);
+
+	/* create Z tiles (for compression): this system is 24 bits!!! */
+	compress_shadowbuf(shb, data->shsamples[sample], rectz, &rect, lar->mode & LA_SQUARE);
+
+	MEM_freeN(rectz);
+}
+
+static void makeflatshadowbuf(Render *re, LampRen *lar, float *jitbuf)
+{
+	ShadBuf *shb= lar->shb;
+	ShadSampleBuf **shsamples;
+	int samples, size= shb->size;
+
+	/* allocated here, so the buffers keep the order of the jitter samples */
+	shsamples= MEM_mallocN(sizeof(ShadSampleBuf *)*shb->totbuf, "shad sample bufs");
+
 	for (samples=0; samples<shb->totbuf; samples++) {
-		zbuffer_shadow(re, shb->persmat, lar, rectz, shb->size, jitbuf[2*samples], jitbuf[2*samples+1]);
-		/* create Z tiles (for compression): this system is 24 bits!!! */
-		compress_shadowbuf(shb, rectz, lar->mode & LA_SQUARE);
+		ShadSampleBuf *shsample= MEM_callocN(sizeof(ShadSampleBuf), "shad sample buf");
+		BLI_addtail(&shb->buffers, shsample);
 
-		if (re->test_break(re->tbh))
-			break;
+		shsample->zbuf= MEM_mallocN(sizeof(uintptr_t)*(size*size)/256, "initshadbuf2");
+		shsample->cbuf= MEM_callocN((size*size)/256, "initshadbuf3");
+		shsamples[samples]= shsample;
 	}
-	
-	MEM_freeN(rectz);
+
+	makeshadowbuf_tiles(re, lar, jitbuf, shsamples, shb->totbuf, makeflatshadowbuf_tile);
+
+	MEM_freeN(shsamples);
 }
 
-static void makedeepshadowbuf(Render *re, LampRen *lar, float *jitbuf)
+static void makedeepshadowbuf_tile(TaskPool *pool, void *taskdata, int UNUSED(threadid))
 {
+	ShadowTileData *data= BLI_task_pool_userdata(pool);
+	Render *re= data->re;
+	LampRen *lar= data->lar;
 	ShadBuf *shb= lar->shb;
 	APixstr *apixbuf;
 	APixstrand *apixbufstrand= NULL;
 	ListBase apsmbase= {NULL, NULL};
+	int totpixel;
+	rcti rect;
+
+	if (re->test_break(re->tbh))
+		return;
+
+	shadowbuf_tile_rect(data, GET_INT_FROM_POINTER(taskdata), &rect);
+	totpixel= BLI_rcti_size_x(&rect)*BLI_rcti_size_y(&rect);
 
 	/* zbuffering */
-	apixbuf= MEM_callocN(sizeof(APixstr)*shb->size*shb->size, "APixbuf");
+	apixbuf= MEM_callocN(sizeof(APixstr)*totpixel, "APixbuf");
 	if (re->totstrand)
-		apixbufstrand= MEM_callocN(sizeof(APixstrand)*shb->size*shb->size, "APixbufstrand");
+		apixbufstrand= MEM_callocN(sizeof(APixstrand)*totpixel, "APixbufstrand");
 
-	zbuffer_abuf_shadow(re, lar, shb->persmat, apixbuf, apixbufstrand, &apsmbase, shb->size,
-		shb->totbuf, (float(*)[2])jitbuf);
+	zbuffer_abuf_shadow(re, lar, shb->persmat, apixbuf, apixbufstrand, &apsmbase, shb->size, &rect,
+		shb->totbuf, (float(*)[2])data->jitbuf);
 
 	/* create Z tiles (for compression): this system is 24 bits!!! */
-	compress_deepshadowbuf(re, shb, apixbuf, apixbufstrand);
+	compress_deepshadowbuf(re, shb, data->shsamples[0], apixbuf, apixbufstrand, &rect);
 	
 	MEM_freeN(apixbuf);
 	if (apixbufstrand)
@@ -761,6 +842,22 @@ static void makedeepshadowbuf(Render *re, LampRen *lar, float *jitbuf)
 	freepsA(&apsmbase);
 }
 
+static void makedeepshadowbuf(Render *re, LampRen *lar, float *jitbuf)
+{
+	ShadBuf *shb= lar->shb;
+	ShadSampleBuf *shsample;
+	const int size= shb->size;
+
+	shsample= MEM_callocN(sizeof(ShadSampleBuf), "shad sample buf");
+	BLI_addtail(&shb->buffers, shsample);
+
+	shsample->totbuf = MEM_callocN(sizeof(int) * size * size, "deeptotbuf");
+	shsample->deepbuf = MEM_callocN(sizeof(DeepSample *) * size * size, "deepbuf");
+
+	/* all jitter samples are rendered into one deep buffer */
+	makeshadowbuf_tiles(re, lar, jitbuf, &shsample, 1, makedeepshadowbuf_tile);
+}
+
 void makeshadowbuf(Render *re, LampRen *lar)
 {
 	ShadBuf *shb= lar->shb;
@@ -54,6 +54,8 @@
 #include "BLI_utildefines.h"
 #include "BLI_ghash.h"
 #include "BLI_memarena.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 
 #include "BLF_translation.h"
 
@@ -92,6 +94,9 @@
 #define MAX_OCTREE_NODE_POINTS	8
 #define MAX_OCTREE_DEPTH		15
 
+/* subtrees with more points are built in a separate task */
+#define SSS_TASK_MIN_POINTS		4096
+
 /* Struct Definitions */
 
 struct ScatterSettings {
@@ -137,13 +142,31 @@ typedef struct ScatterNode {
 	struct ScatterNode *child[8];
 } ScatterNode;
 
+/* node of the tree after building, all nodes are stored in one array with
+ * the children of a node next to each other */
+typedef struct ScatterFlatNode {
+	float co[3];
+	float rad[3];
+	float backrad[3];
+	float area, backarea;
+
+	int totpoint;
+	int points;		/* offset in tree->points */
+
+	float split[3];
+	int child[8];	/* index in tree->nodes, -1 if empty */
+} ScatterFlatNode;
+
 struct ScatterTree {
-	MemArena *arena;
+	MemArena **arenas;	/* one per task thread during building */
+	int totarena;
 
 	ScatterSettings *ss[3];
 	float error, scale;
 
 	ScatterNode *root;
+	ScatterFlatNode *nodes;
+	int totnode;
 	ScatterPoint *points;
 	ScatterPoint **refpoints;
 	ScatterPoint **tmppoints;
@@ -380,7 +403,7 @@ static void add_radiance(ScatterTree *tree, float *frontrad, float *backrad, flo
 	}
 }
 
-static void traverse_octree(ScatterTree *tree, ScatterNode *node, const float co[3], int self, ScatterResult *result)
+static void traverse_octree(ScatterTree *tree, ScatterFlatNode *node, const float co[3], int self, ScatterResult *result)
 {
 	float sub[3], dist;
 	int i, index = 0;
@@ -388,7 +411,7 @@ static void traverse_octree(ScatterTree *tree, ScatterNode *node, const float co
 	if (node->totpoint > 0) {
 		/* leaf - add radiance from all samples */
 		for (i=0; i<node->totpoint; i++) {
-			ScatterPoint *p= &node->points[i];
+			ScatterPoint *p= &tree->points[node->points + i];
 
 			sub_v3_v3v3(sub, co, p->co);
 			dist= dot_v3v3(sub, sub);
@@ -405,8 +428,8 @@ static void traverse_octree(ScatterTree *tree, ScatterNode *node, const float co
 			index = SUBNODE_INDEX(co, node->split);
 
 		for (i=0; i<8; i++) {
-			if (node->child[i]) {
-				ScatterNode *subnode= node->child[i];
+			if (node->child[i] != -1) {
+				ScatterFlatNode *subnode= &tree->nodes[node->child[i]];
 
 				if (self && index == i) {
 					/* always traverse node containing the point */
@@ -438,7 +461,7 @@ static void compute_radiance(ScatterTree *tree, const float co[3], float *rad)
 
 	memset(&result, 0, sizeof(result));
 
-	traverse_octree(tree, tree->root, co, 1, &result);
+	traverse_octree(tree, tree->nodes, co, 1, &result);
 
 	/* the original paper doesn't do this, but we normalize over the
 	 * sampled area and multiply with the reflectance. this is because
@@ -640,6 +663,73 @@ static void sum_radiance(ScatterTree *tree, ScatterNode *node)
 	}
 }
 
+static void sum_radiance_task(TaskPool *pool, void *taskdata, int UNUSED(threadid))
+{
+	sum_radiance(BLI_task_pool_userdata(pool), taskdata);
+}
+
+/* sum the nodes above depth, the subtrees at depth are already done */
+static void sum_radiance_upper(ScatterTree *tree, ScatterNode *node, int depth)
+{
+	int i;
+
+	if (node->totpoint > 0 || depth == 0)
+		return;
+
+	for (i=0; i<8; i++)
+		if (node->child[i])
+			sum_radiance_upper(tree, node->child[i], depth-1);
+
+	sum_branch_radiance(tree, node);
+}
+
+static void sum_radiance_threaded(ScatterTree *tree, TaskPool *pool)
+{
+	ScatterNode **nodes, **newnodes, *node;
+	int i, j, totnode = 1, totnewnode, depth = 0, mintotnode;
+
+	/* find enough subtrees to sum in parallel, leaves above the depth
+	 * at which we stop are kept as subtrees too */
+	mintotnode = 4 * BLI_task_scheduler_num_threads(BLI_task_scheduler_get());
+	nodes = MEM_mallocN(sizeof(ScatterNode *), "ScatterNodes");
+	nodes[0] = tree->root;
+
+	while (totnode < mintotnode && depth < MAX_OCTREE_DEPTH) {
+		newnodes = MEM_mallocN(sizeof(ScatterNode *) * totnode * 8, "ScatterNodes");
+		totnewnode = 0;
+
+		for (i=0; i<totnode; i++) {
+			node = nodes[i];
+
+			if (node->totpoint > 0)
+				newnodes[totnewnode++] = node;
+			else
+				for (j=0; j<8; j++)
+					if (node->child[j])
+						newnodes[totnewnode++] = node->child[j];
+		}
+
+		MEM_freeN(nodes);
+		nodes = newnodes;
+
+		if (totnewnode == totnode) {
+			/* only leaves left */
+			break;
+		}
+
+		totnode = totnewnode;
+		depth++;
+	}
+
+	for (i=0; i<totnode; i++)
+		BLI_task_pool_push(pool, sum_radiance_task, nodes[i], false, TASK_PRIORITY_HIGH);
+
+	BLI_task_pool_work_and_wait(pool);
+	MEM_freeN(nodes);
+
+	sum_radiance_upper(tree, tree->root, depth);
+}
+
 static void subnode_middle(int i, float *mid, float *subsize, float *submid)
 {
 	int x= i & 1, y= i & 2, z= i & 4;
@@ -649,10 +739,42 @@ static void subnode_middle(int i, float *mid, float *subsize, float *submid)
 	submid[2]= mid[2] + ((z)? subsize[2]: -subsize[2]);
 }
 
-static void create_octree_node(ScatterTree *tree, ScatterNode *node, float *mid, float *size, ScatterPoint **refpoints, int depth)
+typedef struct ScatterBuildTask {
+	ScatterNode *node;
+	float mid[3], size[3];
+	ScatterPoint **refpoints, **tmppoints;
+	int depth;
+} ScatterBuildTask;
+
+static void create_octree_node(ScatterTree *tree, TaskPool *pool, int thread, ScatterNode *node,
+                               float *mid, float *size, ScatterPoint **refpoints, ScatterPoint **tmppoints, int depth);
+
+static void create_octree_node_task(TaskPool *pool, void *taskdata, int threadid)
+{
+	ScatterBuildTask *task = taskdata;
+
+	create_octree_node(BLI_task_pool_userdata(pool), pool, threadid, task->node, task->mid, task->size,
+	                   task->refpoints, task->tmppoints, task->depth);
+}
+
+static MemArena *scatter_tree_arena(ScatterTree *tree, int thread)
+{
+	/* only accessed by the thread itself */
+	if (!tree->arenas[thread]) {
+		tree->arenas[thread] = BLI_memarena_new(0x8000 * sizeof(ScatterNode), "sss tree arena");
+		BLI_memarena_use_calloc(tree->arenas[thread]);
+	}
+
+	return tree->arenas[thread];
+}
+
+/* refpoints and tmppoints point to the part of the buffers with the points
+ * of this node, so subtrees can be built in parallel */
+static void create_octree_node(ScatterTree *tree, TaskPool *pool, int thread, ScatterNode *node,
+                               float *mid, float *size, ScatterPoint **refpoints, ScatterPoint **tmppoints, int depth)
 {
 	ScatterNode *subnode;
-	ScatterPoint **subrefpoints, **tmppoints= tree->tmppoints;
+	ScatterPoint **subrefpoints;
 	int index, nsize[8], noffset[8], i, subco, used_nodes, usedi;
 	float submid[3], subsize[3];
 
@@ -696,7 +818,7 @@ static void create_octree_node(ScatterTree *tree, ScatterNode *node, float *mid,
 	
 	if (used_nodes <= 1) {
 		subnode_middle(usedi, mid, subsize, submid);
-		create_octree_node(tree, node, submid, subsize, refpoints, depth+1);
+		create_octree_node(tree, pool, thread, node, submid, subsize, refpoints, tmppoints, depth+1);
 		return;
 	}
 
@@ -710,7 +832,7 @@ static void create_octree_node(ScatterTree *tree, ScatterNode *node, float *mid,
 	/* create subnodes */
 	for (subco=0, i=0; i<8; subco+=nsize[i], i++) {
 		if (nsize[i] > 0) {
-			subnode= BLI_memarena_alloc(tree->arena, sizeof(ScatterNode));
+			subnode= BLI_memarena_alloc(scatter_tree_arena(tree, thread), sizeof(ScatterNode));
 			node->child[i]= subnode;
 			subnode->points= node->points + subco;
 			subnode->totpoint= nsize[i];
@@ -718,8 +840,22 @@ static void create_octree_node(ScatterTree *tree, ScatterNode *node, float *mid,
 
 			subnode_middle(i, mid, subsize, submid);
 
-			create_octree_node(tree, subnode, submid, subsize, subrefpoints,
-				depth+1);
+			if (pool && nsize[i] >= SSS_TASK_MIN_POINTS) {
+				ScatterBuildTask *task = MEM_mallocN(sizeof(ScatterBuildTask), "ScatterBuildTask");
+
+				task->node = subnode;
+				copy_v3_v3(task->mid, submid);
+				copy_v3_v3(task->size, subsize);
+				task->refpoints = subrefpoints;
+				task->tmppoints = tmppoints + subco;
+				task->depth = depth+1;
+
+				BLI_task_pool_push(pool, create_octree_node_task, task, true, TASK_PRIORITY_HIGH);
+			}
+			else {
+				create_octree_node(tree, pool, thread, subnode, submid, subsize, subrefpoints,
+					tmppoints + subco, depth+1);
+			}
 		}
 		else
 			node->child[i]= NULL;
@@ -729,6 +865,44 @@ static void create_octree_node(ScatterTree *tree, ScatterNode *node, float *mid,
 	node->totpoint= 0;
 }
 
+static int count_octree_nodes(ScatterNode *node)
+{
+	int i, totnode = 1;
+
+	for (i=0; i<8; i++)
+		if (node->child[i])
+			totnode += count_octree_nodes(node->child[i]);
+
+	return totnode;
+}
+
+static void flatten_octree_node(ScatterTree *tree, ScatterNode *node, int index)
+{
+	ScatterFlatNode *flat= &tree->nodes[index];
+	int i, first= tree->totnode;
+
+	copy_v3_v3(flat->co, node->co);
+	copy_v3_v3(flat->rad, node->rad);
+	copy_v3_v3(flat->backrad, node->backrad);
+	flat->area= node->area;
+	flat->backarea= node->backarea;
+	flat->totpoint= node->totpoint;
+	flat->points= (node->points) ? node->points - tree->points : 0;
+	copy_v3_v3(flat->split, node->split);
+
+	/* reserve child nodes next to each other */
+	for (i=0; i<8; i++) {
+		if (node->child[i])
+			flat->child[i]= tree->totnode++;
+		else
+			flat->child[i]= -1;
+	}
+
+	for (i=0; i<8; i++)
+		if (node->child[i])
+			flatten_octree_node(tree, node->child[i], first++);
+}
+
 /* public functions */
 
 ScatterTree *scatter_tree_new(ScatterSettings *ss[3], float scale, float error,
@@ -774,19 +948,24 @@ ScatterTree *scatter_tree_new(ScatterSettings *ss[3], float scale, float error,
 
 void scatter_tree_build(ScatterTree *tree)
 {
+	TaskScheduler *task_scheduler= BLI_task_scheduler_get();
+	TaskPool *task_pool= NULL;
 	ScatterPoint *newpoints, **tmppoints;
 	float mid[3], size[3];
-	int totpoint= tree->totpoint;
+	int i, totpoint= tree->totpoint;
 
 	newpoints = MEM_callocN(sizeof(ScatterPoint) * totpoint, "ScatterPoints");
 	tmppoints = MEM_callocN(sizeof(ScatterPoint *) * totpoint, "ScatterTmpPoints");
 	tree->tmppoints= tmppoints;
 
-	tree->arena= BLI_memarena_new(0x8000 * sizeof(ScatterNode), "sss tree arena");
-	BLI_memarena_use_calloc(tree->arena);
+	tree->totarena= BLI_task_scheduler_num_threads(task_scheduler);
+	tree->arenas= MEM_callocN(sizeof(MemArena *) * tree->totarena, "sss tree arenas");
+
+	if (totpoint >= SSS_TASK_MIN_POINTS && tree->totarena > 1)
+		task_pool= BLI_task_pool_create(task_scheduler, tree);
 
 	/* build tree */
-	tree->root= BLI_memarena_alloc(tree->arena, sizeof(ScatterNode));
+	tree->root= BLI_memarena_alloc(scatter_tree_arena(tree, 0), sizeof(ScatterNode));
 	tree->root->points= newpoints;
 	tree->root->totpoint= totpoint;
 
@@ -798,7 +977,10 @@ void scatter_tree_build(ScatterTree *tree)
 	size[1]= (tree->max[1]-tree->min[1])*0.5f;
 	size[2]= (tree->max[2]-tree->min[2])*0.5f;
 
-	create_octree_node(tree, tree->root, mid, size, tree->refpoints, 0);
+	create_octree_node(tree, task_pool, 0, tree->root, mid, size, tree->refpoints, tree->tmppoints, 0);
+
+	if (task_pool)
+		BLI_task_pool_work_and_wait(task_pool);
 
 	MEM_freeN(tree->points);
 	MEM_freeN(tree->refpoints);
@@ -808,7 +990,25 @@ void scatter_tree_build(ScatterTree *tree)
 	tree->points= newpoints;
 	
 	/* sum radiance at nodes */
-	sum_radiance(tree, tree->root);
+	if (task_pool) {
+		sum_radiance_threaded(tree, task_pool);
+		BLI_task_pool_free(task_pool);
+	}
+	else
+		sum_radiance(tree, tree->root);
+
+	/* flatten for lookups, the nodes are not needed anymore after this */
+	tree->nodes= MEM_mallocN(sizeof(ScatterFlatNode) * count_octree_nodes(tree->root), "ScatterFlatNodes");
+	tree->totnode= 1;
+	flatten_octree_node(tree, tree->root, 0);
+
+	for (i=0; i<tree->totarena; i++)
+		if (tree->arenas[i])
+			BLI_memarena_free(tree->arenas[i]);
+
+	MEM_freeN(tree->arenas);
+	tree->arenas= NULL;
+	tree->root= NULL;
 }
 
 void scatter_tree_sample(ScatterTree *tree, const float co[3], float color[3])
@@ -823,7 +1023,7 @@ void scatter_tree_sample(ScatterTree *tree, const float co[3], float color[3])
 
 void scatter_tree_free(ScatterTree *tree)
 {
-	if (tree->arena) BLI_memarena_free(tree->arena);
+	if (tree->nodes) MEM_freeN(tree->nodes);
 	if (tree->points) MEM_freeN(tree->points);
 	if (tree->refpoints) MEM_freeN(tree->refpoints);
 		
@@ -854,6 +1054,7 @@ static void sss_create_tree_mat(Render *re, Material *mat)
 	RenderResult *rr;
 	ListBase points;
 	float (*co)[3] = NULL, (*color)[3] = NULL, *area = NULL;
+	double time_start, time_points = 0.0;
 	int totpoint = 0, osa, osaflag, frsflag, partsdone;
 
 	if (re->test_break(re->tbh))
@@ -882,6 +1083,8 @@ static void sss_create_tree_mat(Render *re, Material *mat)
 		re->result= NULL;
 	BLI_rw_mutex_unlock(&re->resultmutex);
 
+	time_start = PIL_check_seconds_timer();
+
 	RE_TileProcessor(re);
 	
 	BLI_rw_mutex_lock(&re->resultmutex, THREAD_LOCK_WRITE);
@@ -949,8 +1152,15 @@ static void sss_create_tree_mat(Render *re, Material *mat)
 		MEM_freeN(color);
 		MEM_freeN(area);
 
+		time_points = PIL_check_seconds_timer();
+
 		scatter_tree_build(sss->tree);
 
+		if (G.debug & G_DEBUG) {
+			printf("SSS %s: %d points, shading %.3fs, tree build %.3fs\n", mat->id.name + 2, totpoint,
+			       time_points - time_start, PIL_check_seconds_timer() - time_points);
+		}
+
 		BLI_ghash_insert(re->sss_hash, mat, sss);
 	}
 	else {
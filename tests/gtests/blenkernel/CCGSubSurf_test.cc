@@ -0,0 +1,189 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+#include <math.h>
+#include <stdio.h>
+
+extern "C" {
+#include "BLI_utildefines.h"
+#include "BLI_sys_types.h"
+#include "PIL_time.h"
+#include "CCGSubSurf.h"
+};
+
+#define GRID_SIZE 96
+#define LEVELS 3
+#define FRAMES 10
+#define RUNS 5
+
+#define HDL(i) ((void *)(intptr_t)(i))
+
+/* Grid of quads with a wave moving through it, like a deforming character. */
+static void sync_grid(CCGSubSurf *ss, int n, float t, bool coords_only)
+{
+	int i, j, e = 0, f = 0;
+
+	if (coords_only)
+		ccgSubSurf_initPartialSync(ss);
+	else
+		ccgSubSurf_initFullSync(ss);
+
+	for (j = 0; j <= n; j++) {
+		for (i = 0; i <= n; i++) {
+			float co[3] = {(float)i, (float)j, sinf(t + i * 0.3f) * cosf(t * 0.5f + j * 0.2f)};
+			ccgSubSurf_syncVert(ss, HDL(j * (n + 1) + i), co, 0, NULL);
+		}
+	}
+
+	if (!coords_only) {
+		for (j = 0; j <= n; j++)
+			for (i = 0; i < n; i++)
+				ccgSubSurf_syncEdge(ss, HDL(e++), HDL(j * (n + 1) + i), HDL(j * (n + 1) + i + 1), 0.0f, NULL);
+		for (j = 0; j < n; j++)
+			for (i = 0; i <= n; i++)
+				ccgSubSurf_syncEdge(ss, HDL(e++), HDL(j * (n + 1) + i), HDL((j + 1) * (n + 1) + i), 0.0f, NULL);
+
+		for (j = 0; j < n; j++) {
+			for (i = 0; i < n; i++) {
+				CCGVertHDL verts[4] = {HDL(j * (n + 1) + i), HDL(j * (n + 1) + i + 1),
+				                       HDL((j + 1) * (n + 1) + i + 1), HDL((j + 1) * (n + 1) + i)};
+				ccgSubSurf_syncFace(ss, HDL(f++), 4, verts, NULL);
+			}
+		}
+	}
+
+	ccgSubSurf_processSync(ss);
+}
+
+static CCGSubSurf *subsurf_new(int levels)
+{
+	CCGMeshIFC ifc = {8, 8, 8, 3, 6 * sizeof(float), 0};
+	CCGSubSurf *ss = ccgSubSurf_new(&ifc, levels, NULL, NULL);
+
+	ccgSubSurf_setCalcVertexNormals(ss, 1, 3 * sizeof(float));
+	return ss;
+}
+
+static float subsurf_max_difference(CCGSubSurf *a, CCGSubSurf *b, int n)
+{
+	int gridsize = ccgSubSurf_getGridSize(a);
+	float maxdiff = 0.0f;
+	int f, S, x, y, k;
+
+	for (f = 0; f < n * n; f++) {
+		CCGFace *fa = ccgSubSurf_getFace(a, HDL(f));
+		CCGFace *fb = ccgSubSurf_getFace(b, HDL(f));
+
+		for (S = 0; S < 4; S++) {
+			for (y = 0; y < gridsize; y++) {
+				for (x = 0; x < gridsize; x++) {
+					float *da = (float *)ccgSubSurf_getFaceGridData(a, fa, S, x, y);
+					float *db = (float *)ccgSubSurf_getFaceGridData(b, fb, S, x, y);
+
+					for (k = 0; k < 6; k++) {
+						if (fabsf(da[k] - db[k]) > maxdiff)
+							maxdiff = fabsf(da[k] - db[k]);
+					}
+				}
+			}
+		}
+	}
+
+	return maxdiff;
+}
+
+TEST(ccg_subsurf, CoordinateSyncMatchesFullSync)
+{
+	CCGSubSurf *a = subsurf_new(LEVELS), *b = subsurf_new(LEVELS);
+	int frame;
+
+	sync_grid(a, 16, 0.0f, false);
+
+	for (frame = 1; frame <= 3; frame++) {
+		sync_grid(a, 16, frame * 0.4f, true);
+		sync_grid(b, 16, frame * 0.4f, false);
+		EXPECT_LT(subsurf_max_difference(a, b, 16), 1e-5f);
+	}
+
+	ccgSubSurf_free(a);
+	ccgSubSurf_free(b);
+}
+
+/* Stencils are only built after a few coordinate syncs, so deform for more
+ * frames than that and check every frame against a fresh full sync. */
+TEST(ccg_subsurf, StencilSyncMatchesFullSync)
+{
+	int levels, frame;
+
+	for (levels = 2; levels <= 3; levels++) {
+		CCGSubSurf *a = subsurf_new(levels);
+
+		ccgSubSurf_setUseStencils(a, 1);
+		sync_grid(a, 16, 0.0f, false);
+
+		for (frame = 1; frame <= 5; frame++) {
+			CCGSubSurf *b = subsurf_new(levels);
+
+			sync_grid(a, 16, frame * 0.4f, true);
+			sync_grid(b, 16, frame * 0.4f, false);
+			EXPECT_LT(subsurf_max_difference(a, b, 16), 1e-4f) << "level " << levels << ", frame " << frame;
+
+			ccgSubSurf_free(b);
+		}
+
+		EXPECT_EQ(ccgSubSurf_getUseStencils(a), 1);
+		ccgSubSurf_free(a);
+	}
+}
+
+/* Frame time of a deforming mesh: a full topology sync every frame, as before
+ * the coordinate-only path, compared to syncing only the coordinates. Runs are
+ * repeated to show the spread between them. */
+static void frame_time_stats(const double *times, double *r_mean, double *r_stddev)
+{
+	double sum = 0.0, sq = 0.0;
+	int run;
+
+	for (run = 0; run < RUNS; run++)
+		sum += times[run];
+	*r_mean = sum / RUNS;
+
+	for (run = 0; run < RUNS; run++)
+		sq += (times[run] - *r_mean) * (times[run] - *r_mean);
+	*r_stddev = sqrt(sq / (RUNS - 1));
+}
+
+TEST(ccg_subsurf, FrameTime)
+{
+	CCGSubSurf *ss = subsurf_new(LEVELS);
+	double full_time[RUNS], coords_time[RUNS];
+	double full_mean, full_stddev, coords_mean, coords_stddev;
+	double start;
+	int run, frame;
+
+	sync_grid(ss, GRID_SIZE, 0.0f, false);
+
+	for (run = 0; run < RUNS; run++) {
+		start = PIL_check_seconds_timer();
+		for (frame = 1; frame <= FRAMES; frame++)
+			sync_grid(ss, GRID_SIZE, frame * 0.1f, false);
+		full_time[run] = (PIL_check_seconds_timer() - start) * 1000.0 / FRAMES;
+
+		start = PIL_check_seconds_timer();
+		for (frame = 1; frame <= FRAMES; frame++)
+			sync_grid(ss, GRID_SIZE, frame * 0.1f, true);
+		coords_time[run] = (PIL_check_seconds_timer() - start) * 1000.0 / FRAMES;
+	}
+
+	frame_time_stats(full_time, &full_mean, &full_stddev);
+	frame_time_stats(coords_time, &coords_mean, &coords_stddev);
+
+	printf("%d faces at level %d, %d runs of %d frames: "
+	       "full sync %.2f +/- %.2f ms/frame, coordinate sync %.2f +/- %.2f ms/frame\n",
+	       GRID_SIZE * GRID_SIZE, LEVELS, RUNS, FRAMES,
+	       full_mean, full_stddev, coords_mean, coords_stddev);
+
+	EXPECT_EQ(ccgSubSurf_getNumFaces(ss), GRID_SIZE * GRID_SIZE);
+
+	ccgSubSurf_free(ss);
+}
@@ -0,0 +1,144 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+extern "C" {
+#include "BLI_compiler_attrs.h"
+#include "BLI_heap.h"
+#include "BLI_utildefines.h"
+};
+
+#define SIZE 1024
+
+TEST(heap, Empty)
+{
+	Heap *heap;
+
+	heap = BLI_heap_new();
+	EXPECT_EQ(BLI_heap_is_empty(heap), true);
+	EXPECT_EQ(BLI_heap_size(heap), 0);
+	BLI_heap_free(heap, NULL);
+}
+
+TEST(heap, Range)
+{
+	const int tot = SIZE;
+	Heap *heap = BLI_heap_new();
+	int i;
+
+	for (i = 0; i < tot; i++) {
+		BLI_heap_insert(heap, (float)i, SET_INT_IN_POINTER(i));
+	}
+	for (i = 0; i < tot; i++) {
+		EXPECT_EQ(GET_INT_FROM_POINTER(BLI_heap_popmin(heap)), i);
+	}
+	EXPECT_EQ(BLI_heap_is_empty(heap), true);
+	BLI_heap_free(heap, NULL);
+}
+
+TEST(heap, RangeReverse)
+{
+	const int tot = SIZE;
+	Heap *heap = BLI_heap_new();
+	int i;
+
+	for (i = 0; i < tot; i++) {
+		BLI_heap_insert(heap, (float)-i, SET_INT_IN_POINTER(-i));
+	}
+	for (i = tot - 1; i >= 0; i--) {
+		EXPECT_EQ(GET_INT_FROM_POINTER(BLI_heap_popmin(heap)), -i);
+	}
+	EXPECT_EQ(BLI_heap_is_empty(heap), true);
+	BLI_heap_free(heap, NULL);
+}
+
+TEST(heap, ValueUpdateRaise)
+{
+	const int tot = SIZE;
+	Heap *heap = BLI_heap_new();
+	HeapNode *nodes[SIZE];
+	int i;
+
+	for (i = 0; i < tot; i++) {
+		nodes[i] = BLI_heap_insert(heap, (float)i, SET_INT_IN_POINTER(i));
+	}
+
+	/* move the first half behind the second half */
+	for (i = 0; i < tot / 2; i++) {
+		BLI_heap_node_value_update(heap, nodes[i], (float)(tot + i));
+		EXPECT_EQ(BLI_heap_node_value(nodes[i]), (float)(tot + i));
+	}
+
+	EXPECT_EQ(BLI_heap_size(heap), tot);
+	for (i = 0; i < tot; i++) {
+		EXPECT_EQ(GET_INT_FROM_POINTER(BLI_heap_popmin(heap)), (i + tot / 2) % tot);
+	}
+	EXPECT_EQ(BLI_heap_is_empty(heap), true);
+	BLI_heap_free(heap, NULL);
+}
+
+TEST(heap, ValueUpdateLower)
+{
+	const int tot = SIZE;
+	Heap *heap = BLI_heap_new();
+	HeapNode *nodes[SIZE];
+	int i;
+
+	for (i = 0; i < tot; i++) {
+		nodes[i] = BLI_heap_insert(heap, (float)i, SET_INT_IN_POINTER(i));
+	}
+
+	/* move the second half in front of the first half */
+	for (i = tot / 2; i < tot; i++) {
+		BLI_heap_node_value_update(heap, nodes[i], (float)(i - tot));
+	}
+
+	EXPECT_EQ(GET_INT_FROM_POINTER(BLI_heap_node_ptr(BLI_heap_top(heap))), tot / 2);
+	for (i = 0; i < tot; i++) {
+		EXPECT_EQ(GET_INT_FROM_POINTER(BLI_heap_popmin(heap)), (i + tot / 2) % tot);
+	}
+	EXPECT_EQ(BLI_heap_is_empty(heap), true);
+	BLI_heap_free(heap, NULL);
+}
+
+TEST(heap, ValueUpdateRandom)
+{
+	/* mixed raises and lowers, nodes still pop in order of their final value */
+	const int tot = SIZE;
+	Heap *heap = BLI_heap_new();
+	HeapNode *nodes[SIZE];
+	float values[SIZE];
+	unsigned int seed = 1;
+	int i, pass;
+
+	for (i = 0; i < tot; i++) {
+		values[i] = (float)i;
+		nodes[i] = BLI_heap_insert(heap, values[i], SET_INT_IN_POINTER(i));
+	}
+
+	for (pass = 0; pass < 4; pass++) {
+		for (i = 0; i < tot; i++) {
+			seed = seed * 1103515245u + 12345u;
+			if (seed & (1u << 16)) {
+				/* distinct values, so the pop order is fully defined */
+				values[i] = (float)((seed >> 17) % 65536) + (float)i / (float)tot;
+				BLI_heap_node_value_update(heap, nodes[i], values[i]);
+			}
+		}
+	}
+
+	{
+		float value_prev = -1.0f;
+
+		for (i = 0; i < tot; i++) {
+			const float value = BLI_heap_node_value(BLI_heap_top(heap));
+			const int index = GET_INT_FROM_POINTER(BLI_heap_popmin(heap));
+
+			EXPECT_EQ(values[index], value);
+			EXPECT_LT(value_prev, value);
+			value_prev = value;
+		}
+	}
+	EXPECT_EQ(BLI_heap_is_empty(heap), true);
+	BLI_heap_free(heap, NULL);
+}
@@ -0,0 +1,131 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+#include "dualcon.h"
+
+extern "C" {
+#include "PIL_time.h"
+};
+
+#define RINGS 64
+#define SEGMENTS 128
+
+struct RemeshOutput {
+	std::vector<float> co;
+	std::vector<int> quads;
+};
+
+static void *output_alloc(int totvert, int totquad)
+{
+	RemeshOutput *output = new RemeshOutput;
+	output->co.reserve(3 * totvert);
+	output->quads.reserve(4 * totquad);
+	return output;
+}
+
+static void output_add_vert(void *output, const float co[3])
+{
+	std::vector<float>& v = ((RemeshOutput *)output)->co;
+	v.insert(v.end(), co, co + 3);
+}
+
+static void output_add_quad(void *output, const int vert_indices[4])
+{
+	std::vector<int>& q = ((RemeshOutput *)output)->quads;
+	q.insert(q.end(), vert_indices, vert_indices + 4);
+}
+
+/* Bumpy sphere, closed apart from the poles. */
+static void sphere_create(std::vector<float>& co, std::vector<unsigned int>& faces)
+{
+	for (int i = 0; i <= RINGS; i++) {
+		for (int j = 0; j < SEGMENTS; j++) {
+			float theta = (float)M_PI * i / RINGS, phi = 2.0f * (float)M_PI * j / SEGMENTS;
+			float r = 1.0f + 0.2f * sinf(5.0f * phi) * sinf(3.0f * theta);
+			co.push_back(r * sinf(theta) * cosf(phi));
+			co.push_back(r * sinf(theta) * sinf(phi));
+			co.push_back(r * cosf(theta));
+		}
+	}
+
+	for (int i = 0; i < RINGS; i++) {
+		for (int j = 0; j < SEGMENTS; j++) {
+			faces.push_back(i * SEGMENTS + j);
+			faces.push_back(i * SEGMENTS + (j + 1) % SEGMENTS);
+			faces.push_back((i + 1) * SEGMENTS + (j + 1) % SEGMENTS);
+			faces.push_back((i + 1) * SEGMENTS + j);
+		}
+	}
+}
+
+static RemeshOutput *remesh(int depth, DualConMode mode, double *r_time)
+{
+	std::vector<float> co;
+	std::vector<unsigned int> faces;
+	DualConInput input;
+
+	sphere_create(co, faces);
+
+	input.co = (DualConCo)&co[0];
+	input.co_stride = 3 * sizeof(float);
+	input.totco = co.size() / 3;
+	input.faces = (DualConFaces)&faces[0];
+	input.face_stride = 4 * sizeof(unsigned int);
+	input.totface = faces.size() / 4;
+	for (int i = 0; i < 3; i++) {
+		input.min[i] = -1.3f;
+		input.max[i] = 1.3f;
+	}
+
+	double start = PIL_check_seconds_timer();
+	RemeshOutput *output = (RemeshOutput *)dualcon(&input, output_alloc, output_add_vert, output_add_quad,
+	                                               (DualConFlags)0, mode, 0.5f, 1.0f, 0.9f, depth);
+	if (r_time)
+		*r_time = PIL_check_seconds_timer() - start;
+
+	return output;
+}
+
+TEST(dualcon, OutputIndependentOfThreads)
+{
+#ifdef _OPENMP
+	int num_threads = omp_get_max_threads();
+	omp_set_num_threads(1);
+#endif
+	RemeshOutput *serial = remesh(7, DUALCON_SHARP_FEATURES, NULL);
+#ifdef _OPENMP
+	omp_set_num_threads(num_threads > 4 ? num_threads : 4);
+#endif
+	RemeshOutput *threaded = remesh(7, DUALCON_SHARP_FEATURES, NULL);
+#ifdef _OPENMP
+	omp_set_num_threads(num_threads);
+#endif
+
+	EXPECT_FALSE(serial->quads.empty());
+	EXPECT_TRUE(serial->co == threaded->co);
+	EXPECT_TRUE(serial->quads == threaded->quads);
+
+	delete serial;
+	delete threaded;
+}
+
+TEST(dualcon, DepthTiming)
+{
+	for (int depth = 6; depth <= 9; depth++) {
+		double time;
+		RemeshOutput *output = remesh(depth, DUALCON_SHARP_FEATURES, &time);
+
+		printf("depth %d: %d verts, %d quads, %.3f s\n", depth,
+		       (int)output->co.size() / 3, (int)output->quads.size() / 4, time);
+
+		delete output;
+	}
+}